@@ -0,0 +1,298 @@
+#include "BindlessTextures.h"
+#include "Descriptors.h"
+#include "Pipeline.h"
+#include "Images.h"
+#include "ImageManager.h"
+#include "ShaderManager.h"
+#include "StaticCommandCache.h"
+#include "CleanupManager.h"
+#include "RetireQueue.h"
+#include "Samplers.h"
+#include "consoleoutput.h"
+#include "importantConstants.h"
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+//sets per descriptor pool; a new set is written each time images are added
+static const unsigned SETS_PER_POOL = 2;
+
+//left for the other images in a pipeline layout
+static const unsigned RESERVED_IMAGES = 16;
+
+static VulkanContext* ctx;
+static bool enabled_ = false;
+static unsigned capacity;
+static DescriptorSetLayout* layout_;
+static std::map<Image*,unsigned> indices;
+static std::vector<Image*> images;           //by index
+static std::map<VkSampler,unsigned> samplerIndices;
+static std::vector<VkSampler> samplers;      //by index
+static bool newSamplers = false;             //added since the set was written
+static VkDescriptorSet current = VK_NULL_HANDLE;
+static RetireQueue<VkDescriptorSet> retired;
+static std::vector<VkDescriptorPool> pools;
+static unsigned numLeftInPool = 0;
+
+//only these can go in a texture2DArray[]
+static bool usable(Image* img)
+{
+    return img->viewType == VK_IMAGE_VIEW_TYPE_2D_ARRAY &&
+        img->finalLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL &&
+        img->aspect == VK_IMAGE_ASPECT_COLOR_BIT &&
+        img->pushedToGPU();
+}
+
+static VkDescriptorSet acquireSet()
+{
+    VkDescriptorSet s;
+    if( retired.pop(s) )
+        return s;
+
+    if( numLeftInPool == 0 ){
+        VkDescriptorPoolSize ps[2]{
+            {
+                .type=VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                .descriptorCount=capacity*SETS_PER_POOL
+            },
+            {
+                .type=VK_DESCRIPTOR_TYPE_SAMPLER,
+                .descriptorCount=BINDLESS_SAMPLER_COUNT*SETS_PER_POOL
+            }
+        };
+        VkDescriptorPool pool;
+        check(vkCreateDescriptorPool(
+            ctx->dev,
+            VkDescriptorPoolCreateInfo{
+                .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+                .pNext=nullptr,
+                .flags=0,
+                .maxSets=SETS_PER_POOL,
+                .poolSizeCount=2,
+                .pPoolSizes=ps
+            },
+            nullptr,
+            &pool
+        ));
+        ctx->setObjectName(pool,"bindless textures["+std::to_string(pools.size())+"]");
+        pools.push_back(pool);
+        numLeftInPool = SETS_PER_POOL;
+    }
+
+    check(vkAllocateDescriptorSets(
+        ctx->dev,
+        VkDescriptorSetAllocateInfo{
+            .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .pNext=nullptr,
+            .descriptorPool=pools.back(),
+            .descriptorSetCount=1,
+            .pSetLayouts=&(layout_->layout)
+        },
+        &s
+    ));
+    numLeftInPool--;
+    ctx->setObjectName(s,"bindless textures");
+    return s;
+}
+
+//called when ImageManager::pushToGPU() transfers images
+static void addNewImages()
+{
+    bool added=false;
+    for(Image* img : ImageManager::allImages() ){
+        if( indices.contains(img) || !usable(img) )
+            continue;
+        if( images.size() == capacity ){
+            warn("Too many images for the bindless texture array (capacity",capacity,"); "
+                "increase bindlessTextureCount in config.ini");
+            break;
+        }
+        indices[img] = (unsigned)images.size();
+        images.push_back(img);
+        added=true;
+    }
+    if(!added && !newSamplers)
+        return;
+    newSamplers=false;
+
+    //frames in flight may be using the current set, so write
+    //a new one. Existing indices don't change.
+    std::vector<VkDescriptorImageInfo> infos;
+    infos.reserve(images.size());
+    for(Image* img : images){
+        infos.push_back(VkDescriptorImageInfo{
+            .sampler=VK_NULL_HANDLE,
+            .imageView=img->view(),
+            .imageLayout=VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+        });
+    }
+    std::vector<VkDescriptorImageInfo> samplerInfos;
+    samplerInfos.reserve(samplers.size());
+    for(VkSampler samp : samplers){
+        samplerInfos.push_back(VkDescriptorImageInfo{
+            .sampler=samp,
+            .imageView=VK_NULL_HANDLE,
+            .imageLayout=VK_IMAGE_LAYOUT_UNDEFINED
+        });
+    }
+
+    VkDescriptorSet s = acquireSet();
+    std::vector<VkWriteDescriptorSet> writes;
+    if( !infos.empty() ){
+        writes.push_back(VkWriteDescriptorSet{
+            .sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext=nullptr,
+            .dstSet=s,
+            .dstBinding=0,
+            .dstArrayElement=0,
+            .descriptorCount=(unsigned)infos.size(),
+            .descriptorType=VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+            .pImageInfo=infos.data(),
+            .pBufferInfo=nullptr,
+            .pTexelBufferView=nullptr
+        });
+    }
+    writes.push_back(VkWriteDescriptorSet{
+        .sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .pNext=nullptr,
+        .dstSet=s,
+        .dstBinding=1,
+        .dstArrayElement=0,
+        .descriptorCount=(unsigned)samplerInfos.size(),
+        .descriptorType=VK_DESCRIPTOR_TYPE_SAMPLER,
+        .pImageInfo=samplerInfos.data(),
+        .pBufferInfo=nullptr,
+        .pTexelBufferView=nullptr
+    });
+    vkUpdateDescriptorSets( ctx->dev,
+        (unsigned)writes.size(), writes.data(),
+        0, nullptr      //ones to copy
+    );
+
+    if( current != VK_NULL_HANDLE )
+        retired.push(current);
+    current = s;
+
+    //cached commands bind the old set
+    StaticCommandCache::invalidate();
+    verbose("Bindless texture array has",images.size(),"images and",samplers.size(),"samplers");
+}
+
+namespace BindlessTextures{
+
+bool initialized()
+{
+    return ctx != nullptr;
+}
+
+void initialize(VulkanContext* ctx_)
+{
+    if(initialized())
+        return;
+    ctx=ctx_;
+
+    //this also covers bindlessTextures=no in config.ini
+    enabled_ = ctx->haveDescriptorIndexing;
+    if( !enabled_ )
+        return;
+
+    int n = std::stoi(ctx->config.get("bindlessTextureCount","4096"));
+    if( n <= 0 )
+        throw std::runtime_error("bindlessTextureCount must be positive");
+    const VkPhysicalDeviceLimits& limits = ctx->physdevProperties.limits;
+    if( limits.maxPerStageDescriptorSampledImages <= RESERVED_IMAGES ||
+        limits.maxDescriptorSetSampledImages <= RESERVED_IMAGES ){
+        //no room for the array next to the ordinary texture slots
+        warn("Device allows too few sampled images; bindless textures are off");
+        enabled_ = false;
+        return;
+    }
+    capacity = std::min( {
+        (unsigned)n,
+        limits.maxPerStageDescriptorSampledImages - RESERVED_IMAGES,
+        limits.maxDescriptorSetSampledImages - RESERVED_IMAGES
+    });
+
+    layout_ = new DescriptorSetLayout(
+        ctx,
+        {
+            { .type=VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, .slot=0, .count=capacity, .partiallyBound=true },
+            { .type=VK_DESCRIPTOR_TYPE_SAMPLER, .slot=1, .count=BINDLESS_SAMPLER_COUNT, .partiallyBound=true }
+        }
+    );
+
+    //index 0: what samplers that don't fit fall back to
+    addSampler(Samplers::mipSampler);
+
+    ShaderManager::define("BINDLESS_TEXTURES","1");
+    ImageManager::addCallback(addNewImages);
+
+    CleanupManager::registerCleanupFunction([](){
+        for(VkDescriptorPool p : pools){
+            vkDestroyDescriptorPool(ctx->dev,p,nullptr);
+        }
+        pools.clear();
+        samplerIndices.clear();
+        samplers.clear();
+        retired.drain([](VkDescriptorSet){});
+        current = VK_NULL_HANDLE;
+    });
+}
+
+bool enabled()
+{
+    return enabled_;
+}
+
+DescriptorSetLayout* layout()
+{
+    return layout_;
+}
+
+unsigned index(Image* img)
+{
+    auto it = indices.find(img);
+    if( it == indices.end() )
+        throw std::runtime_error("Image "+img->name+" is not in the bindless texture array");
+    return it->second;
+}
+
+void addSampler(VkSampler sampler)
+{
+    if( samplerIndices.contains(sampler) )
+        return;
+    if( samplers.size() == BINDLESS_SAMPLER_COUNT ){
+        warn("Too many samplers for the bindless sampler array (capacity",BINDLESS_SAMPLER_COUNT,"); "
+            "using the default sampler instead");
+        samplerIndices[sampler] = 0;
+        return;
+    }
+    samplerIndices[sampler] = (unsigned)samplers.size();
+    samplers.push_back(sampler);
+    newSamplers=true;
+}
+
+unsigned samplerIndex(VkSampler sampler)
+{
+    auto it = samplerIndices.find(sampler);
+    if( it == samplerIndices.end() )
+        throw std::runtime_error("Sampler is not in the bindless sampler array");
+    return it->second;
+}
+
+void bind(VkCommandBuffer cmd, PipelineLayout* pipelineLayout)
+{
+    if( current == VK_NULL_HANDLE )
+        throw std::runtime_error("BindlessTextures::bind(): No images have been pushed to the GPU");
+    vkCmdBindDescriptorSets(
+        cmd,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        pipelineLayout->pipelineLayout,
+        BINDLESS_TEXTURE_SET_BINDING_POINT,
+        1, &current,
+        0, nullptr
+    );
+}
+
+};  //namespace
@@ -0,0 +1,63 @@
+#pragma once
+#include "vkhelpers.h"
+
+class Image;
+class DescriptorSetLayout;
+class PipelineLayout;
+
+/// Puts every 2D texture from ImageManager into one large array of
+/// images so draws can select their textures with indices (in push
+/// constants) instead of writing and binding a descriptor set per draw.
+/// Next to it is a small array of the samplers that materials use,
+/// selected the same way.
+/// The arrays are written only when ImageManager::pushToGPU() adds images.
+/// Shaders see them at set BINDLESS_TEXTURE_SET_BINDING_POINT, bindings
+/// 0 (images) and 1 (samplers), and are compiled with BINDLESS_TEXTURES defined.
+/// This needs VK_EXT_descriptor_indexing (VulkanContext::haveDescriptorIndexing);
+/// without it, or with bindlessTextures=no in config.ini, enabled()
+/// is false and textures are bound per draw as before.
+namespace BindlessTextures{
+
+/// Initialize the subsystem. This must be called before
+/// any shaders that use the texture array are loaded.
+/// @param ctx The context
+void initialize(VulkanContext* ctx);
+
+/// Return true if subsystem was initialized
+/// @return True if initialized; false if not
+bool initialized();
+
+/// True if the texture array is in use.
+/// @return True if enabled
+bool enabled();
+
+/// Layout of the texture array's descriptor set, for the PipelineLayout.
+/// @return The layout, or null if not enabled()
+DescriptorSetLayout* layout();
+
+/// Get an image's position in the texture array. If the image isn't
+/// in the array (it isn't a 2D array texture, or pushToGPU() hasn't been
+/// called since it was loaded), an exception is thrown.
+/// @param img The image
+/// @return The index
+unsigned index(Image* img);
+
+/// Put a sampler in the sampler array, if it isn't there yet. It
+/// is written with the images at the next ImageManager::pushToGPU().
+/// If the array is full, a warning is printed and the sampler's
+/// index is that of Samplers::mipSampler, which is always there.
+/// @param sampler The sampler
+void addSampler(VkSampler sampler);
+
+/// Get a sampler's position in the sampler array. If addSampler()
+/// hasn't been called for it, an exception is thrown.
+/// @param sampler The sampler
+/// @return The index
+unsigned samplerIndex(VkSampler sampler);
+
+/// Bind the texture array.
+/// @param cmd The command buffer
+/// @param pipelineLayout Layout of the pipelines that will use it
+void bind(VkCommandBuffer cmd, PipelineLayout* pipelineLayout);
+
+};  //namespace
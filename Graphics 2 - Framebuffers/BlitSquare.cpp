@@ -1,6 +1,5 @@
 #include "BlitSquare.h"
 #include "math2801.h"
-#include "Samplers.h"
 #include "Descriptors.h"
 #include "Images.h"
 #include "importantConstants.h"
@@ -39,16 +38,9 @@ void BlitSquare::draw(VkCommandBuffer cmd,
     DescriptorSet* descriptorSet, Image* img)
 {
     if (img != nullptr) {
-        descriptorSet->setSlot(BASE_TEXTURE_SAMPLER_SLOT,
-            Samplers::clampingMipSampler);
-        descriptorSet->setSlot(BASE_TEXTURE_SLOT, img->view());
-
-        //these three are dummy
-        descriptorSet->setSlot(EMISSIVE_TEXTURE_SLOT, img->view());
-        descriptorSet->setSlot(NORMAL_TEXTURE_SLOT, img->view());
-        descriptorSet->setSlot(METALLICROUGHNESS_TEXTURE_SLOT, img->view());
-
-        descriptorSet->bind(cmd);
+        //BLIT_SAMPLER_SLOT is immutable (see descriptorSets.h)
+        descriptorSet->setSlot(BLIT_TEXTURE_SLOT, img->view());
+        descriptorSet->bind(cmd,{VK_PIPELINE_BIND_POINT_GRAPHICS});
     }
     vkCmdDrawIndexed(
         cmd,
@@ -10,6 +10,12 @@ class BlitSquare {
 public:
     VertexManager::Info drawinfo;
     BlitSquare(VertexManager* vertexManager);
+
+    /// Draw the square, sampling img.
+    /// @param cmd The command buffer
+    /// @param descriptorSet A per-draw descriptor set (set PER_DRAW_SET);
+    ///        img is put in it and it is bound. If img is null, this is skipped.
+    /// @param img The image to draw
     void draw(VkCommandBuffer cmd, DescriptorSet* descriptorSet, Image* img);
 
     BlitSquare(const BlitSquare&) = delete;
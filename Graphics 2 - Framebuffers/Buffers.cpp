@@ -1,5 +1,6 @@
 #include "Buffers.h"
 #include "CommandBuffer.h"
+#include "Uploader.h"
 #include <cstring>
 #include <assert.h>
 #include <stdexcept>
@@ -175,10 +176,8 @@ DeviceLocalBuffer::DeviceLocalBuffer( VulkanContext* ctx_, const void* initialDa
     this->bindMemory(this->memory,0,true);
 
     if(initialData != nullptr ){
-        StagingBuffer* staging = new StagingBuffer(ctx, initialData, size, "temporary staging buffer for "+name );
-        staging->copyTo(this);
-        staging->cleanup();
-        delete staging;
+        //batched; runs at the next Uploader::flush()
+        Uploader::uploadBuffer(this, initialData, size);
     }
 
 }
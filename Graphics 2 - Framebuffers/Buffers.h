@@ -93,6 +93,8 @@ class DeviceLocalBuffer: public Buffer{
   
   
     /// Create a device-local buffer from some optional initial data.
+    /// The initial data is copied by the Uploader; it is on the GPU
+    /// once the next Uploader::flush() has executed.
     /// @param ctx The owning context
     /// @param initialData The data to use for initializing the buffer (may be null).
     /// @param size Size in bytes of the buffer
@@ -0,0 +1,281 @@
+#include "CPUProfiler.h"
+
+#if ENABLE_CPU_PROFILER
+
+#include "consoleoutput.h"
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <cstring>
+
+//events each thread can hold between frameBoundary() calls
+static const unsigned RING_SIZE = 1<<16;
+
+//number of recent frames kept per zone for the percentiles
+static const unsigned HISTORY_FRAMES = 512;
+
+struct ZoneEvent{
+    const char* name;
+    const char* parent;     //enclosing zone or nullptr
+    unsigned depth;         //0 = outermost
+    std::int64_t duration;  //nsec
+};
+
+//Single producer (the owning thread), single consumer (frameBoundary)
+struct ZoneRing{
+    ZoneEvent events[RING_SIZE];
+    std::atomic<unsigned> head{0};      //written by the owner
+    std::atomic<unsigned> tail{0};      //written by the consumer
+    std::atomic<unsigned> dropped{0};
+};
+
+static VulkanContext* ctx;
+static unsigned reportInterval=0;
+static std::string csvFile;
+static unsigned frameNumber=0;
+static unsigned framesSinceReport=0;
+
+static std::mutex ringsMutex;
+static std::vector< std::shared_ptr<ZoneRing> > rings;
+
+//per thread state
+static thread_local std::shared_ptr<ZoneRing> myRing;
+static thread_local const char* currentZone = nullptr;
+static thread_local unsigned currentDepth = 0;
+
+//names are compared by text: the same literal in two translation
+//units need not have the same address
+static int compareNames(const char* a, const char* b)
+{
+    if( a == b )
+        return 0;
+    if( !a )
+        return -1;
+    if( !b )
+        return 1;
+    return std::strcmp(a,b);
+}
+
+struct ZoneKey{
+    const char* parent;
+    const char* name;
+    unsigned depth;
+    bool operator<(const ZoneKey& k) const {
+        if( depth != k.depth )
+            return depth < k.depth;
+        int c = compareNames(parent,k.parent);
+        if( c != 0 )
+            return c < 0;
+        return compareNames(name,k.name) < 0;
+    }
+};
+
+struct ZoneHistory{
+    std::vector<float> msec;        //per-frame totals; ring of HISTORY_FRAMES
+    std::vector<unsigned> calls;
+    unsigned next=0;
+    double thisFrameMsec=0.0;
+    unsigned thisFrameCalls=0;
+};
+static std::map<ZoneKey,ZoneHistory> zones;
+
+static std::int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ZoneRing* getRing()
+{
+    if( !myRing ){
+        myRing = std::make_shared<ZoneRing>();
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.push_back(myRing);
+    }
+    return myRing.get();
+}
+
+//full name of a zone, for output (ex: "draw/Mesh::draw")
+static std::string zoneLabel(const ZoneKey& k)
+{
+    if( k.parent )
+        return std::string(k.parent) + "/" + k.name;
+    return k.name;
+}
+
+struct Percentiles{
+    float p50,p95,p99,max;
+    double avgCalls;
+};
+
+static Percentiles computePercentiles(const ZoneHistory& h)
+{
+    std::vector<float> S = h.msec;
+    std::sort(S.begin(),S.end());
+    auto pct = [&S](double p){
+        std::size_t i = (std::size_t)std::ceil(p*S.size());
+        if( i > 0 )
+            i--;
+        return S[std::min(i,S.size()-1)];
+    };
+    double calls=0;
+    for(unsigned c : h.calls)
+        calls += c;
+    return Percentiles{
+        .p50 = pct(0.50),
+        .p95 = pct(0.95),
+        .p99 = pct(0.99),
+        .max = S.back(),
+        .avgCalls = calls/h.calls.size()
+    };
+}
+
+namespace CPUProfiler{
+
+bool initialized()
+{
+    return ctx != nullptr;
+}
+
+void initialize(VulkanContext* ctx_)
+{
+    if(initialized())
+        return;
+    ctx=ctx_;
+    reportInterval = (unsigned) std::stoi(ctx->config.get("cpuProfilerReportInterval","0"));
+    csvFile = ctx->config.get("cpuProfilerCSV","");
+    if( !csvFile.empty() ){
+        std::ofstream out(csvFile);
+        if( !out.good() )
+            throw std::runtime_error("Cannot write "+csvFile);
+        out << "frame,zone,depth,calls,p50_ms,p95_ms,p99_ms,max_ms\n";
+    }
+}
+
+Zone::Zone(const char* name_)
+{
+    this->name = name_;
+    this->parent = currentZone;
+    this->depth = currentDepth++;
+    currentZone = name_;
+    this->start = now();
+}
+
+Zone::~Zone()
+{
+    std::int64_t end = now();
+    currentZone = this->parent;
+    currentDepth = this->depth;
+    ZoneRing* R = getRing();
+    unsigned h = R->head.load(std::memory_order_relaxed);
+    if( h - R->tail.load(std::memory_order_acquire) >= RING_SIZE ){
+        R->dropped.fetch_add(1,std::memory_order_relaxed);
+        return;
+    }
+    R->events[h % RING_SIZE] = ZoneEvent{
+        .name = this->name,
+        .parent = this->parent,
+        .depth = this->depth,
+        .duration = end - this->start
+    };
+    R->head.store(h+1,std::memory_order_release);
+}
+
+void frameBoundary()
+{
+    if( !initialized() )
+        return;
+
+    //gather everything recorded since the last boundary
+    unsigned dropped=0;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for(auto& R : rings){
+            unsigned t = R->tail.load(std::memory_order_relaxed);
+            unsigned h = R->head.load(std::memory_order_acquire);
+            for( ; t != h ; ++t ){
+                ZoneEvent& e = R->events[t % RING_SIZE];
+                ZoneHistory& Z = zones[ZoneKey{e.parent,e.name,e.depth}];
+                Z.thisFrameMsec += double(e.duration) * 1.0e-6;
+                Z.thisFrameCalls++;
+            }
+            R->tail.store(t,std::memory_order_release);
+            dropped += R->dropped.exchange(0);
+        }
+    }
+    if( dropped )
+        warn("CPUProfiler: Dropped",dropped,"zone events; ring buffer is full");
+
+    for(auto& it : zones){
+        ZoneHistory& Z = it.second;
+        if( Z.msec.size() < HISTORY_FRAMES ){
+            Z.msec.push_back(float(Z.thisFrameMsec));
+            Z.calls.push_back(Z.thisFrameCalls);
+        } else {
+            Z.msec[Z.next] = float(Z.thisFrameMsec);
+            Z.calls[Z.next] = Z.thisFrameCalls;
+            Z.next = (Z.next+1) % HISTORY_FRAMES;
+        }
+        Z.thisFrameMsec=0.0;
+        Z.thisFrameCalls=0;
+    }
+
+    frameNumber++;
+    framesSinceReport++;
+    if( reportInterval != 0 && framesSinceReport >= reportInterval ){
+        framesSinceReport=0;
+        report();
+        if( !csvFile.empty() )
+            writeCSV(csvFile);
+    }
+}
+
+void report()
+{
+    print("CPU time per frame (msec) over the last",HISTORY_FRAMES,"frames:");
+    for(auto& it : zones){
+        if( it.second.msec.empty() )
+            continue;
+        Percentiles P = computePercentiles(it.second);
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(3)
+            << "    p50=" << P.p50
+            << " p95=" << P.p95
+            << " p99=" << P.p99
+            << " max=" << P.max
+            << " calls=" << std::setprecision(1) << P.avgCalls
+            << "  " << zoneLabel(it.first);
+        print(oss.str());
+    }
+}
+
+void writeCSV(const std::string& filename)
+{
+    std::ofstream out(filename, std::ios::app);
+    if( !out.good() )
+        throw std::runtime_error("Cannot write "+filename);
+    out << std::fixed << std::setprecision(4);
+    for(auto& it : zones){
+        if( it.second.msec.empty() )
+            continue;
+        Percentiles P = computePercentiles(it.second);
+        out << frameNumber << ","
+            << zoneLabel(it.first) << ","
+            << it.first.depth << ","
+            << P.avgCalls << ","
+            << P.p50 << "," << P.p95 << "," << P.p99 << "," << P.max << "\n";
+    }
+}
+
+};  //namespace
+
+#endif
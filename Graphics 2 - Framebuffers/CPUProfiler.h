@@ -0,0 +1,79 @@
+#pragma once
+#include "vkhelpers.h"
+#include <cstdint>
+
+//Build with ENABLE_CPU_PROFILER=0 to remove all profiling code.
+#ifndef ENABLE_CPU_PROFILER
+#define ENABLE_CPU_PROFILER 1
+#endif
+
+/// Hierarchical CPU timing. Put CPU_ZONE("name") at the top of
+/// a block to time it; zones nested inside it (on the same thread) are
+/// reported as its children. Each thread records into its own ring
+/// buffer, so recording takes no locks. Zones are gathered once per
+/// frame by frameBoundary(), and percentiles of each zone's per-frame
+/// total are printed and/or written to CSV (see config.ini:
+/// cpuProfilerReportInterval and cpuProfilerCSV).
+namespace CPUProfiler{
+
+#if ENABLE_CPU_PROFILER
+
+/// Initialize the subsystem.
+/// @param ctx The context (used only for configuration)
+void initialize(VulkanContext* ctx);
+
+/// Return true if subsystem was initialized
+/// @return True if initialized; false if not
+bool initialized();
+
+/// Mark the end of one frame and the start of the next. Call this
+/// once per frame, always from the same thread.
+void frameBoundary();
+
+/// Print percentiles of per-frame time for each zone.
+void report();
+
+/// Append percentiles of per-frame time for each zone to a CSV file.
+/// @param filename The file to append to
+void writeCSV(const std::string& filename);
+
+/// Times a scope. Use the CPU_ZONE macro instead of creating these directly.
+class Zone{
+  public:
+    /// Begin timing.
+    /// @param name Zone name. This must be a string literal (or otherwise
+    ///             outlive the profiler), since only the pointer is stored.
+    ///             Zones are matched by the text of the name, so the same
+    ///             name used in two places is one zone.
+    Zone(const char* name);
+
+    /// End timing and record the zone
+    ~Zone();
+  private:
+    Zone(const Zone&) = delete;
+    void operator=(const Zone&) = delete;
+    const char* name;
+    const char* parent;
+    unsigned depth;
+    std::int64_t start;
+};
+
+#define CPU_ZONE_CONCAT2(a,b) a##b
+#define CPU_ZONE_CONCAT(a,b) CPU_ZONE_CONCAT2(a,b)
+
+/// Time the enclosing scope
+#define CPU_ZONE(name) CPUProfiler::Zone CPU_ZONE_CONCAT(_cpuZone,__LINE__)(name)
+
+#else
+
+inline void initialize(VulkanContext*){}
+inline bool initialized(){ return false; }
+inline void frameBoundary(){}
+inline void report(){}
+inline void writeCSV(const std::string&){}
+
+#define CPU_ZONE(name) ((void)0)
+
+#endif
+
+};  //namespace
@@ -54,12 +54,20 @@ void Camera::updateViewMatrix()
     this->viewProjMatrix = this->viewMatrix*this->projMatrix;
 }
 
-void Camera::setUniforms(Uniforms* uniforms)
+Camera::UniformHandles::UniformHandles(Uniforms* uniforms) :
+    viewMatrix(uniforms->handle<math2801::mat4>("viewMatrix")),
+    viewProjMatrix(uniforms->handle<math2801::mat4>("viewProjMatrix")),
+    projMatrix(uniforms->handle<math2801::mat4>("projMatrix")),
+    eyePos(uniforms->handle<math2801::vec3>("eyePos"))
 {
-    uniforms->set("viewMatrix",this->viewMatrix);
-    uniforms->set("viewProjMatrix",this->viewProjMatrix);
-    uniforms->set("projMatrix",this->projMatrix);
-    uniforms->set("eyePos",this->eye);
+}
+
+void Camera::setUniforms(Uniforms* uniforms, const UniformHandles& handles) const
+{
+    uniforms->set(handles.viewMatrix,this->viewMatrix);
+    uniforms->set(handles.viewProjMatrix,this->viewProjMatrix);
+    uniforms->set(handles.projMatrix,this->projMatrix);
+    uniforms->set(handles.eyePos,this->eye);
 }
 
 void Camera::strafe(float deltaRight, float deltaUp, float deltaLook)
@@ -1,5 +1,6 @@
 #pragma once
 #include "math2801.h"
+#include "UniformHandle.h"
 
 class Uniforms;
 
@@ -64,9 +65,25 @@ class Camera{
     /// Recompute the view matrix and viewProjMatrix.
     void updateViewMatrix();
     
+    /// Handles for the uniforms that setUniforms() sets
+    struct UniformHandles{
+        /// Handles that don't refer to anything
+        UniformHandles() = default;
+
+        /// Look up the camera's uniforms.
+        /// @param uniforms The Uniforms object they are in
+        UniformHandles(Uniforms* uniforms);
+
+        UniformHandle<math2801::mat4> viewMatrix;       ///< viewMatrix
+        UniformHandle<math2801::mat4> viewProjMatrix;   ///< viewProjMatrix
+        UniformHandle<math2801::mat4> projMatrix;       ///< projMatrix
+        UniformHandle<math2801::vec3> eyePos;           ///< eyePos
+    };
+
     /// Set the uniforms associated with the camera.
     /// @param uniforms The Uniforms object to use
-    void setUniforms(Uniforms* uniforms);
+    /// @param handles Handles from the same Uniforms object
+    void setUniforms(Uniforms* uniforms, const UniformHandles& handles) const;
     
     /// Set the camera parameters to look at a given location and call updateViewMatrix.
     /// @param eye The eye location
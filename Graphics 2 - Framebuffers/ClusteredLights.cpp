@@ -0,0 +1,332 @@
+#include "ClusteredLights.h"
+#include "Buffers.h"
+#include "Camera.h"
+#include "Descriptors.h"
+#include "Light.h"
+#include "ShaderManager.h"
+#include "CleanupManager.h"
+#include "CPUProfiler.h"
+#include "consoleoutput.h"
+#include "importantConstants.h"
+#include "utils.h"
+#include "math2801.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace math2801;
+
+//vec4's per light in the light buffer (see shaders/lighting.txt)
+static const unsigned LIGHT_VEC4S = 4;
+
+static VulkanContext* ctx;
+static bool enabled_ = false;
+static unsigned maxLights_;
+static unsigned maxIndices;             //room for light indices in the cluster buffer
+static VkDeviceSize lightBytes;         //size of the light buffer
+static VkDeviceSize clusterBytes;       //size of the cluster buffer
+static VkDeviceSize frameBytes;         //staging for one frame: lights, then clusters
+static Buffer* staging;                 //one region per frame in flight
+static char* stagingMapped;
+static DeviceLocalBuffer* lightBuffer;
+static DeviceLocalBuffer* clusterBuffer;
+static bool warnedFull = false;
+
+//view space bounding box of one cluster
+struct ClusterBounds{
+    vec3 lo,hi;
+};
+
+//these only change with the projection (see computeBounds())
+static std::vector<ClusterBounds> bounds;
+static float boundsP00, boundsP11, boundsNear, boundsFar;
+static float sliceScale, sliceBias;
+
+//(cluster,light) pairs for this frame; kept to reuse their memory
+static std::vector< std::pair<std::uint32_t,std::uint32_t> > hits;
+static std::vector<std::uint32_t> counts;
+
+static unsigned clusterIndex(int x, int y, int z)
+{
+    return unsigned( (z*CLUSTER_GRID_Y + y)*CLUSTER_GRID_X + x );
+}
+
+//depth slice containing view space depth d (=-z). Slices are
+//logarithmic, so the clusters are roughly cubes at every distance.
+static int depthSlice(float d)
+{
+    int z = (int)std::floor( std::log(d)*sliceScale + sliceBias );
+    return std::clamp(z, 0, CLUSTER_GRID_Z-1);
+}
+
+//tile containing a normalized device coordinate
+static int tile(float ndc, int gridSize)
+{
+    int t = (int)std::floor( (ndc*0.5f+0.5f) * gridSize );
+    return std::clamp(t, 0, gridSize-1);
+}
+
+static void computeBounds(const Camera& camera)
+{
+    float n = camera.hither;
+    float f = camera.yon;
+    float P00 = camera.projMatrix[0][0];
+    float P11 = camera.projMatrix[1][1];
+    if( !bounds.empty() && P00 == boundsP00 && P11 == boundsP11 &&
+            n == boundsNear && f == boundsFar )
+        return;
+    boundsP00=P00; boundsP11=P11; boundsNear=n; boundsFar=f;
+
+    //slice z starts at depth n*(f/n)^(z/CLUSTER_GRID_Z); the shader
+    //uses the same scale and bias (from the cluster buffer header)
+    sliceScale = CLUSTER_GRID_Z / std::log(f/n);
+    sliceBias = -std::log(n) * sliceScale;
+
+    bounds.resize(CLUSTER_COUNT);
+    for(int z=0;z<CLUSTER_GRID_Z;++z){
+        float d0 = n * std::pow(f/n, float(z)/CLUSTER_GRID_Z);
+        float d1 = n * std::pow(f/n, float(z+1)/CLUSTER_GRID_Z);
+        for(int y=0;y<CLUSTER_GRID_Y;++y){
+            float ny0 = -1.0f + 2.0f*y/CLUSTER_GRID_Y;
+            float ny1 = -1.0f + 2.0f*(y+1)/CLUSTER_GRID_Y;
+            for(int x=0;x<CLUSTER_GRID_X;++x){
+                float nx0 = -1.0f + 2.0f*x/CLUSTER_GRID_X;
+                float nx1 = -1.0f + 2.0f*(x+1)/CLUSTER_GRID_X;
+                //view x = ndc*d/P00 (and y likewise), so
+                //the extremes are at the corners
+                ClusterBounds& b = bounds[clusterIndex(x,y,z)];
+                b.lo.x = std::min({ nx0*d0, nx0*d1, nx1*d0, nx1*d1 }) / P00;
+                b.hi.x = std::max({ nx0*d0, nx0*d1, nx1*d0, nx1*d1 }) / P00;
+                b.lo.y = std::min({ ny0*d0/P11, ny0*d1/P11, ny1*d0/P11, ny1*d1/P11 });
+                b.hi.y = std::max({ ny0*d0/P11, ny0*d1/P11, ny1*d0/P11, ny1*d1/P11 });
+                b.lo.z = -d1;
+                b.hi.z = -d0;
+            }
+        }
+    }
+}
+
+//find the clusters that light i's range touches
+static void assignLight(const Camera& camera, const LightCollection& lights, unsigned i)
+{
+    const vec4& p = lights.lightPositionAndDirectionalFlag[i];
+    if( p.w == 0.0f ){
+        hits.push_back(std::make_pair((std::uint32_t)CLUSTER_COUNT,i));
+        return;
+    }
+    float r = lights.radius((int)i);
+    if( r <= 0.0f )
+        return;
+    if( !std::isfinite(r) ){
+        hits.push_back(std::make_pair((std::uint32_t)CLUSTER_COUNT,i));
+        return;
+    }
+
+    vec4 v = vec4(p.x,p.y,p.z,1.0f) * camera.viewMatrix;
+    float d = -v.z;
+    float dmin = std::max(d-r, boundsNear);
+    float dmax = std::min(d+r, boundsFar);
+    if( dmin > dmax )
+        return;         //entirely in front of or behind the frustum
+
+    //the part of the sphere between dmin and dmax is inside this box,
+    //and x/d and y/d are largest and smallest at its corners
+    float x0 = boundsP00 * std::min( (v.x-r)/dmin, (v.x-r)/dmax );
+    float x1 = boundsP00 * std::max( (v.x+r)/dmin, (v.x+r)/dmax );
+    float ya = boundsP11 * std::min( (v.y-r)/dmin, (v.y-r)/dmax );
+    float yb = boundsP11 * std::max( (v.y+r)/dmin, (v.y+r)/dmax );
+    float y0 = std::min(ya,yb);
+    float y1 = std::max(ya,yb);
+    if( x1 < -1.0f || x0 > 1.0f || y1 < -1.0f || y0 > 1.0f )
+        return;
+
+    int tx0 = tile(x0,CLUSTER_GRID_X), tx1 = tile(x1,CLUSTER_GRID_X);
+    int ty0 = tile(y0,CLUSTER_GRID_Y), ty1 = tile(y1,CLUSTER_GRID_Y);
+    int tz0 = depthSlice(dmin), tz1 = depthSlice(dmax);
+    float r2 = r*r;
+    for(int z=tz0;z<=tz1;++z){
+        for(int y=ty0;y<=ty1;++y){
+            for(int x=tx0;x<=tx1;++x){
+                unsigned c = clusterIndex(x,y,z);
+                const ClusterBounds& b = bounds[c];
+                float dx = std::max({ b.lo.x-v.x, 0.0f, v.x-b.hi.x });
+                float dy = std::max({ b.lo.y-v.y, 0.0f, v.y-b.hi.y });
+                float dz = std::max({ b.lo.z-v.z, 0.0f, v.z-b.hi.z });
+                if( dx*dx + dy*dy + dz*dz <= r2 )
+                    hits.push_back(std::make_pair(c,i));
+            }
+        }
+    }
+}
+
+static std::uint32_t floatBits(float f)
+{
+    std::uint32_t u;
+    std::memcpy(&u,&f,sizeof(u));
+    return u;
+}
+
+namespace ClusteredLights{
+
+bool initialized()
+{
+    return ctx != nullptr;
+}
+
+void initialize(VulkanContext* ctx_)
+{
+    if(initialized())
+        return;
+    ctx=ctx_;
+
+    enabled_ = (ctx->config.get("clusteredLights","yes") == "yes");
+    if( !enabled_ )
+        return;
+
+    int n = std::stoi(ctx->config.get("clusteredMaxLights","4096"));
+    if( n <= 0 )
+        throw std::runtime_error("clusteredMaxLights must be positive");
+    int ni = std::stoi(ctx->config.get("clusteredLightIndices","262144"));
+    if( ni <= 0 )
+        throw std::runtime_error("clusteredLightIndices must be positive");
+    maxLights_ = (unsigned)n;
+    maxIndices = (unsigned)ni;
+
+    lightBytes = maxLights_ * LIGHT_VEC4S * sizeof(vec4);
+    clusterBytes = (CLUSTER_INDEX_START + maxIndices) * sizeof(std::uint32_t);
+    frameBytes = lightBytes + clusterBytes;
+
+    staging = new Buffer(ctx, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        frameBytes * ctx->framesInFlight, "clustered lights staging");
+    VkDeviceMemory mem = Buffers::allocateMemory(
+        ctx,
+        staging->memoryRequirements.memoryTypeBits,
+        staging->memoryRequirements.size,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "memory for clustered lights staging");
+    staging->bindMemory(mem,0,true);
+    //host coherent, and vkQueueSubmit makes host writes
+    //visible to the device, so it stays mapped
+    check(vkMapMemory(ctx->dev, mem, 0, VK_WHOLE_SIZE, 0, (void**)&stagingMapped));
+
+    lightBuffer = new DeviceLocalBuffer(ctx, nullptr, lightBytes,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, "light buffer");
+    clusterBuffer = new DeviceLocalBuffer(ctx, nullptr, clusterBytes,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, "cluster buffer");
+
+    ShaderManager::define("CLUSTERED_LIGHTS","1");
+
+    CleanupManager::registerCleanupFunction([](){
+        vkUnmapMemory(ctx->dev,staging->memory);
+        staging->cleanup();
+        lightBuffer->cleanup();
+        clusterBuffer->cleanup();
+    });
+
+    verbose("ClusteredLights:",CLUSTER_GRID_X,"x",CLUSTER_GRID_Y,"x",CLUSTER_GRID_Z,
+        "clusters, up to",maxLights_,"lights and",maxIndices,"light indices");
+}
+
+bool enabled()
+{
+    return enabled_;
+}
+
+int maxLights()
+{
+    return (int)maxLights_;
+}
+
+void update(VkCommandBuffer cmd, DescriptorSet* descriptorSet,
+            const Camera& camera, const LightCollection& lights)
+{
+    CPU_ZONE("ClusteredLights::update");
+    if( !enabled_ )
+        throw std::runtime_error("ClusteredLights::update(): Not enabled");
+
+    unsigned numLights = (unsigned)std::min(lights.numLights, (int)maxLights_);
+    computeBounds(camera);
+
+    hits.clear();
+    for(unsigned i=0;i<numLights;++i){
+        assignLight(camera,lights,i);
+    }
+    if( hits.size() > maxIndices ){
+        //the last lights lose some of their clusters
+        if( !warnedFull ){
+            warn("ClusteredLights: Too many light/cluster pairs (",hits.size(),
+                "); increase clusteredLightIndices in config.ini");
+            warnedFull=true;
+        }
+        hits.resize(maxIndices);
+    }
+
+    //this frame slot's region was last read by the frame that
+    //had the slot before, which utils::beginFrame() has waited for
+    char* region = stagingMapped + utils::getFrameSlot() * frameBytes;
+
+    float* L = (float*) region;
+    for(unsigned i=0;i<numLights;++i){
+        std::memcpy(L+0,  &lights.lightPositionAndDirectionalFlag[i], sizeof(vec4));
+        std::memcpy(L+4,  &lights.lightColorAndIntensity[i], sizeof(vec4));
+        std::memcpy(L+8,  &lights.cosSpotAngles[i], sizeof(vec4));
+        std::memcpy(L+12, &lights.spotDirection[i], sizeof(vec4));
+        L += LIGHT_VEC4S*4;
+    }
+
+    //counting sort by cluster
+    std::uint32_t* C = (std::uint32_t*)(region + lightBytes);
+    C[0] = numLights;
+    C[1] = floatBits(sliceScale);
+    C[2] = floatBits(sliceBias);
+    C[3] = 0;
+    counts.assign(CLUSTER_COUNT+1, 0);
+    for(auto& h : hits)
+        counts[h.first]++;
+    std::uint32_t* ranges = C + CLUSTER_HEADER_SIZE;
+    std::uint32_t total=0;
+    for(unsigned c=0;c<=CLUSTER_COUNT;++c){
+        ranges[2*c] = total;
+        ranges[2*c+1] = counts[c];
+        counts[c] = total;
+        total += ranges[2*c+1];
+    }
+    std::uint32_t* indices = C + CLUSTER_INDEX_START;
+    for(auto& h : hits)
+        indices[counts[h.first]++] = h.second;
+
+    //only copy what's used. The barriers order this after
+    //earlier frames' reads (same queue) and before this frame's.
+    VkDeviceSize srcOffset = region - stagingMapped;
+    VkDeviceSize usedLights = numLights * LIGHT_VEC4S * sizeof(vec4);
+    VkDeviceSize usedClusters = (CLUSTER_INDEX_START + total) * sizeof(std::uint32_t);
+    Buffers::memoryBarrier(cmd,lightBuffer->buffer);
+    Buffers::memoryBarrier(cmd,clusterBuffer->buffer);
+    if( usedLights > 0 ){
+        vkCmdCopyBuffer(cmd, staging->buffer, lightBuffer->buffer, 1,
+            VkBufferCopy{
+                .srcOffset=srcOffset,
+                .dstOffset=0,
+                .size=usedLights
+            }
+        );
+    }
+    vkCmdCopyBuffer(cmd, staging->buffer, clusterBuffer->buffer, 1,
+        VkBufferCopy{
+            .srcOffset=srcOffset+lightBytes,
+            .dstOffset=0,
+            .size=usedClusters
+        }
+    );
+    Buffers::memoryBarrier(cmd,lightBuffer->buffer);
+    Buffers::memoryBarrier(cmd,clusterBuffer->buffer);
+
+    descriptorSet->setSlot(LIGHT_BUFFER_SLOT, lightBuffer->buffer);
+    descriptorSet->setSlot(CLUSTER_BUFFER_SLOT, clusterBuffer->buffer);
+}
+
+};  //namespace
@@ -0,0 +1,52 @@
+#pragma once
+#include "vkhelpers.h"
+
+class Camera;
+class DescriptorSet;
+class LightCollection;
+
+/// Clustered forward lighting: Lights are read from a storage buffer
+/// instead of the uniform arrays, so there can be many more of them
+/// than MAX_LIGHTS. The view frustum is divided into
+/// CLUSTER_GRID_X*CLUSTER_GRID_Y*CLUSTER_GRID_Z clusters (screen tiles,
+/// sliced logarithmically in depth); each frame, the lights whose
+/// range touches a cluster are listed for it, and a fragment only
+/// shades the lights in its own cluster.
+/// Lights that never fade out (or are directional) are in
+/// every cluster. The lists are built on the CPU and copied
+/// to device local buffers before the frame's render passes.
+/// Shaders are compiled with CLUSTERED_LIGHTS defined; see
+/// importantConstants.h for the buffer layout. If clusteredLights=no
+/// in config.ini, enabled() is false and the uniform arrays are used.
+namespace ClusteredLights{
+
+/// Initialize the subsystem. This must be called before
+/// any shaders that use the light buffers are loaded.
+/// @param ctx The context
+void initialize(VulkanContext* ctx);
+
+/// Return true if subsystem was initialized
+/// @return True if initialized; false if not
+bool initialized();
+
+/// True if the lights come from the light buffer.
+/// @return True if enabled
+bool enabled();
+
+/// Most lights the light buffer can hold (clusteredMaxLights
+/// in config.ini). Only meaningful if enabled().
+/// @return The count
+int maxLights();
+
+/// Assign the lights to clusters and record the copies of the
+/// light and cluster buffers. This must be called once per frame,
+/// outside of any render pass, before the draws that use them.
+/// @param cmd The frame's command buffer
+/// @param descriptorSet The per-frame set; receives the buffers
+///         at LIGHT_BUFFER_SLOT and CLUSTER_BUFFER_SLOT
+/// @param camera The camera the frame is drawn with
+/// @param lights The lights
+void update(VkCommandBuffer cmd, DescriptorSet* descriptorSet,
+            const Camera& camera, const LightCollection& lights);
+
+};  //namespace
@@ -1,9 +1,50 @@
 #include "CommandBuffer.h"
 #include "CleanupManager.h"
+#include "Uploader.h"
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <atomic>
 
 static VulkanContext* ctx;
 static VkCommandPool pool;
 
+//one of these for each frame slot
+struct FramePool{
+    VkCommandPool pool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> primaries;
+    std::vector<VkCommandBuffer> secondaries;
+    unsigned numPrimariesUsed = 0;
+    unsigned numSecondariesUsed = 0;
+};
+
+static std::vector<FramePool> framePools;
+
+//secondary command buffer pools for recording threads: [slot][worker]
+static std::vector< std::vector<FramePool> > workerFramePools;
+static int currentFramePool = -1;
+
+//workers allocate concurrently, so these are atomic
+static std::atomic<unsigned> totalFrameAllocations{0};
+static std::atomic<unsigned> frameAllocationsThisFrame{0};
+
+static VkCommandPool makeFramePool()
+{
+    VkCommandPool p;
+    check(vkCreateCommandPool(
+        ctx->dev,
+        VkCommandPoolCreateInfo{
+            .sType=VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .pNext=nullptr,
+            .flags=VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = ctx->graphicsQueueIndex
+        },
+        nullptr,
+        &(p)
+    ));
+    return p;
+}
+
 namespace CommandBuffer{
 
 bool initialized()
@@ -29,12 +70,28 @@ void initialize(VulkanContext* ctx_)
         &(pool)
     ));
 
+    framePools.resize(ctx->framesInFlight);
+    for(auto& fp : framePools ){
+        fp.pool = makeFramePool();
+    }
+    workerFramePools.resize(ctx->framesInFlight);
+
     CleanupManager::registerCleanupFunction([](){
         vkDestroyCommandPool(
             ctx->dev,
             pool,
             nullptr
         );
+        //destroying a pool frees its command buffers too
+        for(auto& fp : framePools ){
+            vkDestroyCommandPool(ctx->dev, fp.pool, nullptr);
+        }
+        framePools.clear();
+        for(auto& W : workerFramePools ){
+            for(auto& fp : W )
+                vkDestroyCommandPool(ctx->dev, fp.pool, nullptr);
+        }
+        workerFramePools.clear();
     });
 }
 
@@ -68,6 +125,8 @@ void dispose(VkCommandBuffer cmd)
 
 VkCommandBuffer beginImmediateCommands()
 {
+    //immediate commands must see the results of pending uploads
+    Uploader::flush();
     vkQueueWaitIdle(ctx->graphicsQueue);
     auto cmd = allocate();
     check( vkBeginCommandBuffer(
@@ -105,6 +164,99 @@ void endImmediateCommands(VkCommandBuffer cmd)
     dispose(cmd);
 }
 
+namespace FrameAllocator{
+
+static VkCommandBuffer getBuffer(FramePool& fp, VkCommandBufferLevel level)
+{
+    bool primary = (level == VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+    std::vector<VkCommandBuffer>& L = (primary ? fp.primaries : fp.secondaries);
+    unsigned& numUsed = (primary ? fp.numPrimariesUsed : fp.numSecondariesUsed);
+
+    if( numUsed == L.size() ){
+        VkCommandBuffer cmd;
+        check(vkAllocateCommandBuffers(
+            ctx->dev,
+            VkCommandBufferAllocateInfo{
+                .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .pNext=nullptr,
+                .commandPool=fp.pool,
+                .level=level,
+                .commandBufferCount=1
+            },
+            &(cmd)
+        ));
+        L.push_back(cmd);
+        totalFrameAllocations++;
+        frameAllocationsThisFrame++;
+    }
+    return L[numUsed++];
+}
+
+void beginSlot(int slot)
+{
+    if( slot < 0 || slot >= (int)framePools.size() )
+        throw std::runtime_error("Bad frame slot "+std::to_string(slot));
+    FramePool& fp = framePools[slot];
+    //all of the pool's buffers go back to the initial state
+    check(vkResetCommandPool(ctx->dev, fp.pool, 0));
+    fp.numPrimariesUsed = 0;
+    fp.numSecondariesUsed = 0;
+    for(FramePool& wp : workerFramePools[slot] ){
+        check(vkResetCommandPool(ctx->dev, wp.pool, 0));
+        wp.numSecondariesUsed = 0;
+    }
+    currentFramePool = slot;
+    frameAllocationsThisFrame = 0;
+}
+
+static FramePool& currentPool()
+{
+    if( currentFramePool == -1 )
+        throw std::runtime_error("FrameAllocator used outside of a frame");
+    return framePools[currentFramePool];
+}
+
+VkCommandBuffer allocate()
+{
+    return getBuffer(currentPool(), VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+}
+
+VkCommandBuffer allocateSecondary()
+{
+    return getBuffer(currentPool(), VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+}
+
+void reserveWorkers(unsigned numWorkers)
+{
+    for(auto& W : workerFramePools ){
+        while( W.size() < numWorkers ){
+            W.push_back(FramePool{});
+            W.back().pool = makeFramePool();
+        }
+    }
+}
+
+VkCommandBuffer allocateSecondary(unsigned worker)
+{
+    if( currentFramePool == -1 )
+        throw std::runtime_error("FrameAllocator used outside of a frame");
+    if( worker >= workerFramePools[currentFramePool].size() )
+        throw std::runtime_error("Bad worker "+std::to_string(worker)+" for FrameAllocator; call reserveWorkers() first");
+    return getBuffer(workerFramePools[currentFramePool][worker], VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+}
+
+unsigned numAllocations()
+{
+    return totalFrameAllocations;
+}
+
+unsigned numAllocationsThisFrame()
+{
+    return frameAllocationsThisFrame;
+}
+
+};  //namespace FrameAllocator
+
 }; //namespace
 
 
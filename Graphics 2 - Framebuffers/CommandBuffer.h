@@ -21,7 +21,8 @@ VkCommandBuffer allocate();
 void dispose(VkCommandBuffer cmd);
 
 /// Create a command buffer and prepare it to record commands.
-/// This waits until the queue is idle, allocates a command buffer,
+/// This flushes pending uploads (see Uploader),
+/// waits until the queue is idle, allocates a command buffer,
 /// and begins recording into the buffer.
 /// @return The command buffer.
 VkCommandBuffer beginImmediateCommands();
@@ -31,6 +32,56 @@ VkCommandBuffer beginImmediateCommands();
 /// @param cmd The command buffer.
 void endImmediateCommands(VkCommandBuffer cmd);
 
+/// Per-frame command buffers. There is one command pool for each
+/// of the ctx->framesInFlight frame slots. When a slot's previous
+/// frame has finished on the GPU, the whole pool is reset with
+/// vkResetCommandPool and its command buffers are handed out again,
+/// so steady-state frames do not allocate or free anything.
+/// Buffers obtained here must not be passed to dispose().
+namespace FrameAllocator{
+
+/// Called by utils::beginFrame() once the GPU is done with the slot.
+/// Resets the slot's pool and makes it the current one.
+/// @param slot The frame slot, in the range [0...ctx->framesInFlight)
+void beginSlot(int slot);
+
+/// Get a primary command buffer from the current slot's pool.
+/// It is valid until the slot is reused.
+/// @return The command buffer (in the initial state)
+VkCommandBuffer allocate();
+
+/// Get a secondary command buffer from the current slot's pool.
+/// It is valid until the slot is reused.
+/// @return The command buffer (in the initial state)
+VkCommandBuffer allocateSecondary();
+
+/// Make sure every frame slot has at least numWorkers extra command
+/// pools, one for each recording thread. Call this before the first
+/// frame, from the thread that calls beginSlot().
+/// @param numWorkers Number of recording threads
+void reserveWorkers(unsigned numWorkers);
+
+/// Get a secondary command buffer from a recording thread's own pool
+/// for the current slot. Different workers may call this at the same
+/// time, but each worker number must be used by only one thread at a time.
+/// It is valid until the slot is reused.
+/// @param worker The worker, in the range [0...numWorkers) (see reserveWorkers())
+/// @return The command buffer (in the initial state)
+VkCommandBuffer allocateSecondary(unsigned worker);
+
+/// Total number of vkAllocateCommandBuffers calls made
+/// by the frame allocator since startup.
+/// @return The count
+unsigned numAllocations();
+
+/// Number of vkAllocateCommandBuffers calls made by the frame
+/// allocator since the last beginSlot(). This should be zero
+/// once every slot has been through a frame.
+/// @return The count
+unsigned numAllocationsThisFrame();
+
+};  //namespace FrameAllocator
+
 
 };  //namespace
 
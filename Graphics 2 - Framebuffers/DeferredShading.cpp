@@ -0,0 +1,160 @@
+#include "DeferredShading.h"
+#include "BlitSquare.h"
+#include "Descriptors.h"
+#include "Framebuffer.h"
+#include "GraphicsPipeline.h"
+#include "Images.h"
+#include "ShaderManager.h"
+#include "VertexManager.h"
+#include "CPUProfiler.h"
+#include "consoleoutput.h"
+#include "importantConstants.h"
+#include <stdexcept>
+
+//every layer has the same format, so the normals decide it:
+//8 bits per channel isn't enough for them
+static const VkFormat GBUFFER_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+static VulkanContext* ctx;
+static bool enabled_ = false;
+static bool active_ = false;
+
+static Framebuffer* gbuffer_;
+static Framebuffer* target;
+static GraphicsPipeline* geometryPipeline_;
+static GraphicsPipeline* lightingPipeline;
+static VertexManager* vertexManager;
+static DescriptorSet* descriptorSet;       //per-draw; holds the G-buffer
+static BlitSquare* square;
+
+namespace DeferredShading{
+
+bool initialized()
+{
+    return ctx != nullptr;
+}
+
+void initialize(VulkanContext* ctx_)
+{
+    if(initialized())
+        return;
+    ctx=ctx_;
+
+    enabled_ = (ctx->config.get("deferredShading","yes") == "yes");
+    std::string path = ctx->config.get("renderPath","forward");
+    if( path != "forward" && path != "deferred" )
+        throw std::runtime_error("renderPath must be 'forward' or 'deferred'");
+    if( path == "deferred" && !enabled_ )
+        throw std::runtime_error("renderPath=deferred needs deferredShading=yes");
+    active_ = (path == "deferred");
+}
+
+bool enabled()
+{
+    return enabled_;
+}
+
+bool active()
+{
+    return active_;
+}
+
+void setActive(bool deferred)
+{
+    if( deferred && !enabled_ )
+        throw std::runtime_error("DeferredShading::setActive(): Not enabled");
+    active_ = deferred;
+}
+
+void createResources(unsigned width, unsigned height,
+                     PipelineLayout* pipelineLayout, VertexManager* vertexManager_,
+                     Framebuffer* target_, DescriptorSetFactory* drawDescriptorSetFactory,
+                     BlitSquare* square_)
+{
+    if( !enabled_ )
+        throw std::runtime_error("DeferredShading::createResources(): Not enabled");
+    if( gbuffer_ )
+        throw std::runtime_error("DeferredShading::createResources(): Already called");
+
+    vertexManager = vertexManager_;
+    target = target_;
+    square = square_;
+
+    gbuffer_ = new Framebuffer(width, height, GBUFFER_LAYERS, GBUFFER_FORMAT, "gbuffer");
+
+    //the alpha channels hold data too, so nothing is blended;
+    //the one pipeline state is used for every layer
+    geometryPipeline_ = (new GraphicsPipeline(
+        ctx,
+        pipelineLayout,
+        vertexManager->layout,
+        gbuffer_,
+        "gbuffer pipeline"
+    ))
+    ->set(ShaderManager::load("shaders/main.vert"))
+    ->set(ShaderManager::load("shaders/gbuffer.frag"))
+    ->set(VkPipelineColorBlendAttachmentState{
+        .blendEnable=VK_FALSE,
+        .srcColorBlendFactor=VK_BLEND_FACTOR_ONE,
+        .dstColorBlendFactor=VK_BLEND_FACTOR_ZERO,
+        .colorBlendOp=VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor=VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor=VK_BLEND_FACTOR_ZERO,
+        .alphaBlendOp=VK_BLEND_OP_ADD,
+        .colorWriteMask=VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
+    });
+
+    //one square over the whole screen; the depth buffer isn't used
+    lightingPipeline = (new GraphicsPipeline(
+        ctx,
+        pipelineLayout,
+        vertexManager->layout,
+        target,
+        "deferred lighting pipeline"
+    ))
+    ->set(ShaderManager::load("shaders/deferred.vert"))
+    ->set(ShaderManager::load("shaders/deferred.frag"))
+    ->set(false, false, false, VK_COMPARE_OP_ALWAYS, 0,
+        VK_STENCIL_OP_KEEP, VK_STENCIL_OP_KEEP, VK_STENCIL_OP_KEEP);
+
+    descriptorSet = drawDescriptorSetFactory->make();
+
+    verbose("DeferredShading:",GBUFFER_LAYERS,"layers of",width,"x",height,
+        "; starting with the", (active_ ? "deferred" : "forward"), "path");
+}
+
+Framebuffer* gbuffer()
+{
+    if( !gbuffer_ )
+        throw std::runtime_error("DeferredShading::gbuffer(): createResources() hasn't been called");
+    return gbuffer_;
+}
+
+GraphicsPipeline* geometryPipeline()
+{
+    if( !geometryPipeline_ )
+        throw std::runtime_error("DeferredShading::geometryPipeline(): createResources() hasn't been called");
+    return geometryPipeline_;
+}
+
+void light(VkCommandBuffer cmd, float r, float g, float b, float a)
+{
+    CPU_ZONE("DeferredShading::light");
+    if( !gbuffer_ )
+        throw std::runtime_error("DeferredShading::light(): createResources() hasn't been called");
+
+    target->beginRenderPassClearContents(cmd, r, g, b, a);
+    lightingPipeline->use(cmd);
+    vertexManager->bindBuffers(cmd);
+
+    //BLIT_SAMPLER_SLOT is immutable (see descriptorSets.h)
+    descriptorSet->setSlot(GBUFFER_TEXTURE_SLOT, gbuffer_->currentImage()->view());
+    descriptorSet->setSlot(GBUFFER_DEPTH_SLOT, gbuffer_->currentDepthBufferView());
+    descriptorSet->bind(cmd);
+    square->draw(cmd, descriptorSet, nullptr);
+
+    target->endRenderPass(cmd);
+}
+
+};  //namespace
@@ -0,0 +1,78 @@
+#pragma once
+#include "vkhelpers.h"
+
+class BlitSquare;
+class DescriptorSetFactory;
+class Framebuffer;
+class GraphicsPipeline;
+class PipelineLayout;
+class VertexManager;
+
+/// Deferred shading: instead of lighting every fragment that is
+/// rasterized (including the ones that are drawn over later), the
+/// meshes are drawn into a G-buffer, a Framebuffer with one layer
+/// per surface property (see GBUFFER_*_LAYER in importantConstants.h),
+/// and then one full-screen pass lights each pixel once. Both paths
+/// use the same lighting code (shaders/lighting.txt), so they give the
+/// same picture, except that translucent surfaces are drawn opaque.
+/// The path can be switched while running (F3) to compare their
+/// cost. If deferredShading=no in config.ini, enabled() is false and
+/// only forward shading is used.
+namespace DeferredShading{
+
+/// Initialize the subsystem.
+/// @param ctx The context
+void initialize(VulkanContext* ctx);
+
+/// Return true if subsystem was initialized
+/// @return True if initialized; false if not
+bool initialized();
+
+/// True if the deferred path is available.
+/// @return True if enabled
+bool enabled();
+
+/// True if frames are drawn with the deferred path. It starts out
+/// as renderPath in config.ini says.
+/// @return True if the deferred path is in use
+bool active();
+
+/// Choose the path that frames are drawn with. This
+/// must not be called while a frame is being recorded.
+/// @param deferred True for the deferred path; false for forward.
+///        If enabled() is false, this must be false.
+void setActive(bool deferred);
+
+/// Make the G-buffer and the pipelines for the two passes.
+/// This must be called once, after initialize(), if enabled().
+/// @param width Width of the G-buffer; the same as target's
+/// @param height Height of the G-buffer; the same as target's
+/// @param pipelineLayout The layout the meshes are drawn with
+/// @param vertexManager The meshes' vertex manager; square must be in it
+/// @param target The Framebuffer the lighting pass draws into
+/// @param drawDescriptorSetFactory Makes per-draw descriptor sets
+///         (PER_DRAW_SET); the lighting pass gets its own
+/// @param square The square that covers the screen
+void createResources(unsigned width, unsigned height,
+                     PipelineLayout* pipelineLayout, VertexManager* vertexManager,
+                     Framebuffer* target, DescriptorSetFactory* drawDescriptorSetFactory,
+                     BlitSquare* square);
+
+/// The G-buffer: the geometry pass's target
+/// @return The G-buffer
+Framebuffer* gbuffer();
+
+/// The pipeline that draws the meshes into the G-buffer
+/// (shaders/gbuffer.frag). It's used like the forward pipeline.
+/// @return The pipeline
+GraphicsPipeline* geometryPipeline();
+
+/// Record the lighting pass: clear the target and light every pixel
+/// that the geometry pass drew. The geometry pass must have ended, and
+/// the per-frame descriptor set must be bound. This changes the bound
+/// pipeline, vertex buffers and per-draw descriptor set.
+/// @param cmd The frame's command buffer
+/// @param r,g,b,a The color where nothing was drawn
+void light(VkCommandBuffer cmd, float r, float g, float b, float a);
+
+};  //namespace
@@ -4,25 +4,41 @@
 #include "CleanupManager.h"
 #include "consoleoutput.h"
 #include "utils.h"
+#include "CPUProfiler.h"
 #include <list>
 #include <cassert>
 #include <iostream>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <algorithm>
 
-static std::map<int, VkDescriptorSet> currentBindings;
+static thread_local std::map<int, VkDescriptorSet> currentBindings;
 
-static VkDescriptorPool _makePool(VulkanContext* ctx, unsigned num)
+//DescriptorSets on different threads update these
+static std::atomic<unsigned long long> cacheHits{0};
+static std::atomic<unsigned long long> cacheMisses{0};
+static std::atomic<unsigned long long> descriptorWrites{0};
+
+//sets in a factory's first pool; each new pool in a group
+//holds twice as many as the one before, up to the maximum
+static const unsigned FIRST_POOL_SETS = 16;
+static const unsigned MAX_POOL_SETS = 1024;
+
+//every factory, for DescriptorSetFactory::report()
+static std::mutex factoriesMutex;
+static std::vector<DescriptorSetFactory*> allFactories;
+
+static VkDescriptorPool _makePool(VulkanContext* ctx, const std::vector<VkDescriptorPoolSize>& setSizes, unsigned numSets)
 {
-    std::vector<VkDescriptorPoolSize> PPS {
-        VkDescriptorPoolSize{ .type=VK_DESCRIPTOR_TYPE_SAMPLER                  , .descriptorCount=num },
-        VkDescriptorPoolSize{ .type=VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE            , .descriptorCount=num },
-        VkDescriptorPoolSize{ .type=VK_DESCRIPTOR_TYPE_STORAGE_IMAGE            , .descriptorCount=num },
-        VkDescriptorPoolSize{ .type=VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER     , .descriptorCount=num },
-        VkDescriptorPoolSize{ .type=VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER     , .descriptorCount=num },
-        VkDescriptorPoolSize{ .type=VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER           , .descriptorCount=num },
-        VkDescriptorPoolSize{ .type=VK_DESCRIPTOR_TYPE_STORAGE_BUFFER           , .descriptorCount=num },
-        VkDescriptorPoolSize{ .type=VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT         , .descriptorCount=num }
-        //~ VkDescriptorPoolSize{ .descriptorCount=_POOLSIZE,   .type=VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER  },
-    };
+    std::vector<VkDescriptorPoolSize> PPS;
+    for(const VkDescriptorPoolSize& ps : setSizes ){
+        PPS.push_back( VkDescriptorPoolSize{ .type=ps.type, .descriptorCount=ps.descriptorCount*numSets } );
+    }
+    if( PPS.empty() ){
+        //the layout has no descriptors, but a pool must have a size
+        PPS.push_back( VkDescriptorPoolSize{ .type=VK_DESCRIPTOR_TYPE_SAMPLER, .descriptorCount=1 } );
+    }
 
     VkDescriptorPool pool;
     check(vkCreateDescriptorPool(
@@ -31,7 +47,7 @@ static VkDescriptorPool _makePool(VulkanContext* ctx, unsigned num)
             .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
             .pNext=nullptr,
             .flags=0,
-            .maxSets=num,
+            .maxSets=numSets,
             .poolSizeCount=unsigned(PPS.size()),
             .pPoolSizes=PPS.data()
         },
@@ -48,6 +64,8 @@ DescriptorSetLayout::DescriptorSetLayout( VulkanContext* ctx_,
     this->ctx=ctx_;
     this->entries = entries_;
     std::vector<VkDescriptorSetLayoutBinding> L;
+    std::vector<VkDescriptorBindingFlagsEXT> bindingFlags;
+    bool anyPartiallyBound=false;
     int maxSlot=-1;
     for(const DescriptorSetEntry& e : entries ){
         maxSlot = std::max(e.slot,maxSlot);
@@ -55,16 +73,36 @@ DescriptorSetLayout::DescriptorSetLayout( VulkanContext* ctx_,
             VkDescriptorSetLayoutBinding{
                 .binding=(unsigned)e.slot,
                 .descriptorType=e.type,
-                .descriptorCount=1,
+                .descriptorCount=e.count,
                 .stageFlags=VK_SHADER_STAGE_ALL,
-                .pImmutableSamplers=nullptr
+                .pImmutableSamplers=( e.immutableSampler != VK_NULL_HANDLE ? &(e.immutableSampler) : nullptr )
             }
         );
+        if( e.immutableSampler != VK_NULL_HANDLE && (e.type != VK_DESCRIPTOR_TYPE_SAMPLER || e.count != 1) )
+            throw std::runtime_error("Immutable samplers must be in a SAMPLER slot with count 1 (slot "+std::to_string(e.slot)+")");
+        bindingFlags.push_back( e.partiallyBound ? VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT : 0 );
+        if( e.partiallyBound )
+            anyPartiallyBound=true;
     }
+    if( anyPartiallyBound && !ctx->haveDescriptorIndexing )
+        throw std::runtime_error("Partially bound descriptors need VK_EXT_descriptor_indexing");
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagInfo{
+        .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+        .pNext=nullptr,
+        .bindingCount=(unsigned)bindingFlags.size(),
+        .pBindingFlags=bindingFlags.data()
+    };
     this->types.resize(maxSlot+1, VK_DESCRIPTOR_TYPE_MAX_ENUM );
+    this->immutableSamplers.resize(maxSlot+1, VK_NULL_HANDLE );
     //~ this->typeNames.resize(this->types.size());
     for(const DescriptorSetEntry& e : entries ){
         this->types[e.slot] = e.type;
+        this->immutableSamplers[e.slot] = e.immutableSampler;
+        if( e.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || e.type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC ){
+            if( e.count != 1 )
+                throw std::runtime_error("Dynamic buffers must have count 1 (slot "+std::to_string(e.slot)+")");
+            this->dynamicSlots.push_back(e.slot);
+        }
         //~ switch(e.type){
             //~ case VK_DESCRIPTOR_TYPE_SAMPLER:  this->typeNames[e.slot]="VkSampler"; break;
             //~ case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:  this->typeNames[e.slot]="VkImageView (for sampled image)"; break;
@@ -85,7 +123,7 @@ DescriptorSetLayout::DescriptorSetLayout( VulkanContext* ctx_,
         ctx->dev,
         VkDescriptorSetLayoutCreateInfo{
             .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-            .pNext=nullptr,
+            .pNext=(anyPartiallyBound ? &flagInfo : nullptr),
             .flags=0,
             .bindingCount=(unsigned)L.size(),
             .pBindings=L.data()
@@ -95,16 +133,75 @@ DescriptorSetLayout::DescriptorSetLayout( VulkanContext* ctx_,
     ));
 
     CleanupManager::registerCleanupFunction( [this](){
+        for(auto& it : this->templates ){
+            vkDestroyDescriptorUpdateTemplateKHR(this->ctx->dev, it.second, nullptr);
+        }
+        this->templates.clear();
         vkDestroyDescriptorSetLayout(this->ctx->dev, this->layout, nullptr);
     });
 
 }
 
-void DescriptorSetFactory::cleanup()
+VkDescriptorUpdateTemplate DescriptorSetLayout::updateTemplate(std::uint64_t slots)
 {
-    for(VkDescriptorPool& p : this->pools ){
-        vkDestroyDescriptorPool(this->ctx->dev,p,nullptr);
+    if( !this->ctx->haveDescriptorUpdateTemplates )
+        return VK_NULL_HANDLE;
+
+    std::lock_guard<std::mutex> lock(this->templateMutex);
+    auto it = this->templates.find(slots);
+    if( it != this->templates.end() )
+        return it->second;
+
+    std::vector<VkDescriptorUpdateTemplateEntry> E;
+    for(unsigned i=0;i<64 && i<this->types.size();++i){
+        if( !(slots & (std::uint64_t(1)<<i)) )
+            continue;
+        E.push_back( VkDescriptorUpdateTemplateEntry{
+            .dstBinding=i,
+            .dstArrayElement=0,
+            .descriptorCount=1,
+            .descriptorType=this->types[i],
+            .offset=i*sizeof(DescriptorData),
+            .stride=sizeof(DescriptorData)
+        });
     }
+
+    VkDescriptorUpdateTemplate tmpl;
+    check(vkCreateDescriptorUpdateTemplateKHR(
+        this->ctx->dev,
+        VkDescriptorUpdateTemplateCreateInfo{
+            .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+            .pNext=nullptr,
+            .flags=0,
+            .descriptorUpdateEntryCount=(unsigned)E.size(),
+            .pDescriptorUpdateEntries=E.data(),
+            .templateType=VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET,
+            .descriptorSetLayout=this->layout,
+            .pipelineBindPoint=VK_PIPELINE_BIND_POINT_GRAPHICS,     //ignored
+            .pipelineLayout=VK_NULL_HANDLE,                         //ignored
+            .set=0                                                  //ignored
+        },
+        nullptr,
+        &tmpl
+    ));
+    this->templates[slots]=tmpl;
+    return tmpl;
+}
+
+void DescriptorSetFactory::cleanup()
+{
+    auto destroy = [this](PoolGroup& g){
+        for(VkDescriptorPool p : g.pools ){
+            vkDestroyDescriptorPool(this->ctx->dev,p,nullptr);
+        }
+        g = PoolGroup();
+    };
+    destroy(this->persistent);
+    destroy(this->transient);
+    this->retiredTransient.drain(destroy);
+    for(PoolGroup& g : this->freeTransient)
+        destroy(g);
+    this->freeTransient.clear();
 }
     
 DescriptorSetFactory::DescriptorSetFactory(VulkanContext* ctx_, 
@@ -120,14 +217,25 @@ DescriptorSetFactory::DescriptorSetFactory(VulkanContext* ctx_,
     assert(bindingPoint >= 0 );
     assert(bindingPoint < (int)pipelineLayout->descriptorSetLayouts.size());
     this->layout=pipelineLayout->descriptorSetLayouts[bindingPoint];
+
+    //pools are sized for exactly the descriptors in the layout
+    std::map<VkDescriptorType,unsigned> histogram;
+    this->descriptorsPerSet = 0;
+    for(const DescriptorSetEntry& e : this->layout->entries ){
+        histogram[e.type] += e.count;
+        this->descriptorsPerSet += e.count;
+    }
+    for(auto& it : histogram ){
+        this->setSizes.push_back( VkDescriptorPoolSize{ .type=it.first, .descriptorCount=it.second } );
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(factoriesMutex);
+        allFactories.push_back(this);
+    }
+
     CleanupManager::registerCleanupFunction( [this](){
-        for( VkDescriptorPool p : this->pools ){
-            vkDestroyDescriptorPool(
-                this->ctx->dev,
-                p,
-                nullptr
-            );
-        }
+        this->cleanup();
     });
             
 }
@@ -139,6 +247,7 @@ DescriptorSetFactory::DescriptorSetFactory(VulkanContext* ctx_,
 
 DescriptorSet* DescriptorSetFactory::make()
 {
+    std::lock_guard<std::mutex> lock(this->mutex);
     DescriptorSet* ds = new DescriptorSet(
         this->ctx,
         this->bindingPoint,
@@ -154,11 +263,55 @@ DescriptorSet* DescriptorSetFactory::make()
 //called by DescriptorSet 
 VkDescriptorSet DescriptorSetFactory::allocate()
 {
-    if( this->numLeft < (int)this->layout->entries.size() ){
-        unsigned num = unsigned(this->layout->entries.size()*16);
-        this->pools.push_back( _makePool(this->ctx, (unsigned)num ) );
-        ctx->setObjectName(this->pools.back(),"factory{"+this->name+"}["+std::to_string(this->pools.size()-1)+"]");
-        this->numLeft = num;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->allocateFrom(this->persistent);
+}
+
+//called by DescriptorSet
+VkDescriptorSet DescriptorSetFactory::allocateTransient()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    unsigned frame = utils::getCurrentFrameIdentifier();
+    if( !this->haveTransientFrame || frame != this->transientFrame ){
+        //recycle the pools of frames that have finished
+        PoolGroup g;
+        while( this->retiredTransient.pop(g) ){
+            this->resetGroup(g);
+            this->freeTransient.push_back(std::move(g));
+        }
+        //the previous frame's pools are retired along with the
+        //current frame, which can't finish before it does
+        if( !this->transient.pools.empty() )
+            this->retiredTransient.push(this->transient);
+        if( this->freeTransient.empty() ){
+            this->transient = PoolGroup();
+        } else {
+            this->transient = std::move(this->freeTransient.back());
+            this->freeTransient.pop_back();
+        }
+        this->transientFrame = frame;
+        this->haveTransientFrame = true;
+    }
+    return this->allocateFrom(this->transient);
+}
+
+//mutex must be held
+VkDescriptorSet DescriptorSetFactory::allocateFrom(PoolGroup& group)
+{
+    while( group.current < group.pools.size() && group.used[group.current] == group.capacity[group.current] )
+        group.current++;
+
+    if( group.current == group.pools.size() ){
+        unsigned num = FIRST_POOL_SETS;
+        if( !group.capacity.empty() )
+            num = std::min(group.capacity.back()*2, MAX_POOL_SETS);
+        group.pools.push_back( _makePool(this->ctx, this->setSizes, num) );
+        group.capacity.push_back(num);
+        group.used.push_back(0);
+        ctx->setObjectName(group.pools.back(),"factory{"+this->name+"}["+std::to_string(this->stats.pools)+"]");
+        this->stats.pools++;
+        this->stats.setCapacity += num;
+        this->stats.descriptorCapacity += num*this->descriptorsPerSet;
     }
     
     VkDescriptorSet dset;
@@ -167,19 +320,53 @@ VkDescriptorSet DescriptorSetFactory::allocate()
         VkDescriptorSetAllocateInfo{
             .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
             .pNext=nullptr,
-            .descriptorPool=this->pools.back(),
+            .descriptorPool=group.pools[group.current],
             .descriptorSetCount=1,
             .pSetLayouts=&(layout->layout)
         },
         &dset
     ));
-    this->numLeft -= (int)this->layout->entries.size();
+    group.used[group.current]++;
+    this->stats.setsAllocated++;
+    this->stats.descriptorsAllocated += this->descriptorsPerSet;
 
     assert(this->pipelineLayout != VK_NULL_HANDLE );
    
     return dset;
 }
 
+//mutex must be held
+void DescriptorSetFactory::resetGroup(PoolGroup& group)
+{
+    for(std::size_t i=0;i<group.pools.size();++i){
+        if( group.used[i] == 0 )
+            continue;
+        check(vkResetDescriptorPool(this->ctx->dev, group.pools[i], 0));
+        this->stats.setsAllocated -= group.used[i];
+        this->stats.descriptorsAllocated -= group.used[i]*this->descriptorsPerSet;
+        group.used[i] = 0;
+    }
+    group.current = 0;
+}
+
+DescriptorPoolStats DescriptorSetFactory::poolStats()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->stats;
+}
+
+void DescriptorSetFactory::report()
+{
+    std::lock_guard<std::mutex> lock(factoriesMutex);
+    for(DescriptorSetFactory* f : allFactories ){
+        DescriptorPoolStats st = f->poolStats();
+        print("Descriptor pools for",f->name+":",
+            st.pools,"pools,",
+            st.setsAllocated,"of",st.setCapacity,"sets,",
+            st.descriptorsAllocated,"of",st.descriptorCapacity,"descriptors");
+    }
+}
+
 DescriptorSet::DescriptorSet(
         VulkanContext* ctx_, int bindingPoint_,
         DescriptorSetLayout* descriptorSetLayout_,
@@ -193,22 +380,21 @@ DescriptorSet::DescriptorSet(
     this->bindingPoint = bindingPoint_;
     this->factory=factory_;
     this->name=name_;
-    utils::registerFrameCompleteCallback( [this](unsigned frameNumber){
-        if( this->activeDescriptorSets.contains(frameNumber) ){
-            this->availableDescriptorSets.insert(
-                this->availableDescriptorSets.end(),
-                this->activeDescriptorSets[frameNumber].begin(),
-                this->activeDescriptorSets[frameNumber].end()
-            );
-            this->activeDescriptorSets.erase(frameNumber);
-        }
-    });
     
     int largestSlot = 0;
     for(DescriptorSetEntry& e : this->descriptorSetLayout->entries ){
         largestSlot = std::max(largestSlot,e.slot);
     }
     this->needsBind.resize(largestSlot+1,false);
+    this->currentResources.resize(this->descriptorSetLayout->types.size(), Empty() );
+    this->currentData.resize(this->descriptorSetLayout->types.size(), DescriptorData{} );
+    this->dynamicOffsets.resize(this->descriptorSetLayout->types.size(), 0 );
+    this->boundOffsets.resize(this->descriptorSetLayout->dynamicSlots.size(), 0 );
+
+    int capacity = std::stoi(ctx->config.get("descriptorCacheSize","1024"));
+    if( capacity < 0 )
+        throw std::runtime_error("descriptorCacheSize must be zero or positive");
+    this->cacheCapacity = (unsigned)capacity;
 }
   
     
@@ -372,15 +558,58 @@ void DescriptorSet::bind(VkCommandBuffer cmd)
 
 void DescriptorSet::bind(VkCommandBuffer cmd, std::initializer_list<VkPipelineBindPoint> bindPoints)
 {
-    if( this->currentDescriptorSet == VK_NULL_HANDLE ){
-        //make a new set and initialize it with the most recently
-        //used options
-        this->ensureCurrentIsValid();
+    CPU_ZONE("DescriptorSet::bind");
+
+    VkDescriptorSet set = this->frozenSet;
+    std::size_t hash = 0;
+
+    if( set == VK_NULL_HANDLE && this->cacheCapacity > 0 ){
+        hash = this->hashResources();
+        auto range = this->cacheIndex.equal_range(hash);
+        for(auto it=range.first; it != range.second; ++it ){
+            CacheIterator e = it->second;
+            if( e->resources == this->currentResources ){
+                //move to the front of the LRU list
+                this->cache.splice(this->cache.begin(), this->cache, e);
+                if( this->pinning )
+                    e->pins++;
+                set = e->set;
+                cacheHits++;
+                break;
+            }
+        }
+    }
+
+    if( set == VK_NULL_HANDLE ){
+        cacheMisses++;
+        //FIXME: Check for partially initialized set?
+        if( this->cacheCapacity == 0 && !this->pinning ){
+            //only this frame uses it; the factory resets its pool later
+            set = this->factory->allocateTransient();
+        } else {
+            set = this->acquireSet();
+        }
+        this->writeSet(set, this->cacheCapacity == 0 && !this->pinning);
+        if( this->cacheCapacity > 0 ){
+            this->cache.push_front( CacheEntry{
+                .set=set,
+                .hash=hash,
+                .resources=this->currentResources,
+                .pins=(this->pinning ? 1u : 0u)
+            });
+            this->cacheIndex.insert( std::make_pair(hash, this->cache.begin()) );
+            this->cacheBySet[set] = this->cache.begin();
+            this->evict();
+        }
     }
 
-    //FIXME: Check for partially initialized set?
-    this->activeDescriptorSets[utils::getCurrentFrameIdentifier()].push_back(
-        this->currentDescriptorSet);
+    if( this->pinning && set != this->frozenSet )
+        this->pinnedDescriptorSets.push_back(set);
+  
+    const std::vector<int>& dynamicSlots = this->descriptorSetLayout->dynamicSlots;
+    for(std::size_t i=0;i<dynamicSlots.size();++i){
+        this->boundOffsets[i] = this->dynamicOffsets[dynamicSlots[i]];
+    }
   
     for(VkPipelineBindPoint p : bindPoints ){
         vkCmdBindDescriptorSets( 
@@ -389,21 +618,81 @@ void DescriptorSet::bind(VkCommandBuffer cmd, std::initializer_list<VkPipelineBi
             this->pipelineLayout->pipelineLayout,
             this->bindingPoint,             //first descriptor set
             1,                              //number of sets
-            &this->currentDescriptorSet,    //things to bind
-            0,                              //number of dynamic descriptors
-            nullptr                         //dynamic offsets
+            &set,                           //things to bind
+            (unsigned)this->boundOffsets.size(),    //number of dynamic descriptors
+            this->boundOffsets.data()               //dynamic offsets
         );
     }
-      
-    this->currentDescriptorSet = VK_NULL_HANDLE;
     
-    currentBindings[this->bindingPoint] = this->currentDescriptorSet;
+    currentBindings[this->bindingPoint] = set;
     
     for(int i=0;i<(int)this->needsBind.size();++i){
         this->needsBind[i]=false;
     }
 }
 
+void DescriptorSet::copyContents(const DescriptorSet* src)
+{
+    if( src->descriptorSetLayout != this->descriptorSetLayout )
+        throw std::runtime_error("Cannot copy descriptor set "+src->name+" to "+this->name+": Layouts differ");
+
+    this->currentResources = src->currentResources;
+    this->currentData = src->currentData;
+    this->dynamicOffsets = src->dynamicOffsets;
+    for(int i=0;i<(int)this->needsBind.size();++i){
+        this->needsBind[i]=false;
+    }
+}
+
+void DescriptorSet::freeze()
+{
+    if( this->frozenSet != VK_NULL_HANDLE )
+        throw std::runtime_error("Descriptor set "+this->name+" is already frozen");
+    this->frozenSet = this->acquireSet();
+    this->writeSet(this->frozenSet,false);
+    for(int i=0;i<(int)this->needsBind.size();++i){
+        this->needsBind[i]=false;
+    }
+}
+
+void DescriptorSet::beginPinning()
+{
+    this->pinning = true;
+    this->pinnedDescriptorSets.clear();
+}
+
+std::vector<VkDescriptorSet> DescriptorSet::endPinning()
+{
+    this->pinning = false;
+    std::vector<VkDescriptorSet> tmp;
+    tmp.swap(this->pinnedDescriptorSets);
+    return tmp;
+}
+
+void DescriptorSet::releasePinned(const std::vector<VkDescriptorSet>& sets)
+{
+    for(VkDescriptorSet s : sets){
+        auto it = this->cacheBySet.find(s);
+        if( it != this->cacheBySet.end() ){
+            //the current frame may still use it, but it
+            //can't be evicted before that frame finishes
+            it->second->pins--;
+        } else {
+            this->activeDescriptorSets.push(s);
+        }
+    }
+    this->evict();
+}
+
+DescriptorCacheStats DescriptorSet::cacheStats()
+{
+    return DescriptorCacheStats{
+        .hits=cacheHits.load(),
+        .misses=cacheMisses.load(),
+        .writes=descriptorWrites.load()
+    };
+}
+
 class DescriptorTypeError : public std::runtime_error
 {
   public:
@@ -416,31 +705,48 @@ class DescriptorTypeError : public std::runtime_error
 
 
 static
-void setWriteInfo( VkDescriptorImageInfo& ii, VkDescriptorBufferInfo& , VkBufferView& , VkSampler item)
+void setData( DescriptorData& d, VkSampler item)
 {
-    ii.sampler = item; 
+    d.image = VkDescriptorImageInfo{
+        .sampler=item,
+        .imageView=VK_NULL_HANDLE,
+        .imageLayout=VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL   //ignored
+    };
 }
 
 static
-void setWriteInfo( VkDescriptorImageInfo& ii, VkDescriptorBufferInfo& , VkBufferView& , VkImageView item)
+void setData( DescriptorData& d, VkImageView item)
 {
-    ii.imageView = item; 
-    ii.imageLayout=VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    d.image = VkDescriptorImageInfo{
+        .sampler=VK_NULL_HANDLE,
+        .imageView=item,
+        .imageLayout=VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
 }
 
 static
-void setWriteInfo( VkDescriptorImageInfo& , VkDescriptorBufferInfo& bi, VkBufferView& , VkBuffer item)
+void setData( DescriptorData& d, VkBuffer item)
 {
-    bi.buffer = item;
-    bi.offset = 0;
-    bi.range = VK_WHOLE_SIZE;
+    d.buffer = VkDescriptorBufferInfo{
+        .buffer=item,
+        .offset=0,
+        .range=VK_WHOLE_SIZE
+    };
 }
 
+void setData( DescriptorData& d, const DescriptorSet::BufferRange& item)
+{
+    d.buffer = VkDescriptorBufferInfo{
+        .buffer=item.buffer,
+        .offset=0,
+        .range=item.range
+    };
+}
 
 static
-void setWriteInfo( VkDescriptorImageInfo& , VkDescriptorBufferInfo& , VkBufferView& bv, VkBufferView item)
+void setData( DescriptorData& d, VkBufferView item)
 {
-    bv=item;
+    d.texelBuffer=item;
 }
 
 template<typename T>
@@ -449,14 +755,24 @@ void DescriptorSet::setSlotDoIt(int slot, const T& item)
     if(slot<0){
         throw std::runtime_error("Bad slot: Must be non-negative");
     }
+
+    if( this->frozenSet != VK_NULL_HANDLE ){
+        throw std::runtime_error("Cannot change descriptor set "+this->name+": It was frozen");
+    }
     
     if( slot >= (int)this->descriptorSetLayout->types.size() ){
         throw std::runtime_error("Bad slot: Too large (must be less than "+
             std::to_string(this->descriptorSetLayout->types.size())+ ")" );
     }
 
+    if( this->descriptorSetLayout->immutableSamplers[slot] != VK_NULL_HANDLE ){
+        throw std::runtime_error("Cannot set slot "+std::to_string(slot)+" of descriptor set "+
+            this->name+": It has an immutable sampler");
+    }
+
     if( (int)this->currentResources.size() <= slot ){
         this->currentResources.resize( slot+1, Empty() );
+        this->currentData.resize( slot+1, DescriptorData{} );
     }
     
     if( this->needsBind[slot] ){
@@ -464,10 +780,6 @@ void DescriptorSet::setSlotDoIt(int slot, const T& item)
         "Did you forget to call bind()?");
     }
     
-    this->ensureCurrentIsValid();
-    
-    assert( this->currentDescriptorSet != VK_NULL_HANDLE);
-    
     auto expected =  this->descriptorSetLayout->types[slot];  //expected type
     switch(expected){
         case VK_DESCRIPTOR_TYPE_SAMPLER:    
@@ -491,11 +803,11 @@ void DescriptorSet::setSlotDoIt(int slot, const T& item)
                 throw DescriptorTypeError(slot,typeid(T).name(),"VkBufferView (for storage texel buffer)");
             break;
         case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
-            if( !std::is_same<VkBuffer,T>::value ) 
+            if( !std::is_same<VkBuffer,T>::value && !std::is_same<BufferRange,T>::value )
                 throw DescriptorTypeError(slot,typeid(T).name(),"VkBuffer (for uniform buffer)");
             break;
         case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
-            if( !std::is_same<VkBuffer,T>::value ) 
+            if( !std::is_same<VkBuffer,T>::value && !std::is_same<BufferRange,T>::value )
                 throw DescriptorTypeError(slot,typeid(T).name(),"VkBuffer (for storage buffer)");
             break;
         case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
@@ -508,42 +820,21 @@ void DescriptorSet::setSlotDoIt(int slot, const T& item)
             assert(0);  //the setWriteInfo function needs to write both sampler and image info
             break;
         case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
-            if( !std::is_same<VkBuffer,T>::value ) 
+            if( !std::is_same<VkBuffer,T>::value && !std::is_same<BufferRange,T>::value )
                 throw DescriptorTypeError(slot,typeid(T).name(),"VkBuffer (for uniform buffer dynamic)");
             break;
         case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
-            if( !std::is_same<VkBuffer,T>::value ) 
+            if( !std::is_same<VkBuffer,T>::value && !std::is_same<BufferRange,T>::value )
                 throw DescriptorTypeError(slot,typeid(T).name(),"VkBuffer (for storage buffer dynamic)");
             break;
         default:
             assert(0);
     }
     
-    VkDescriptorImageInfo ii{};
-    VkDescriptorBufferInfo bi{};
-    VkBufferView bv{};
-
-    setWriteInfo( ii,bi,bv, item);
-        
-    VkWriteDescriptorSet wr{
-        .sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .pNext=nullptr,
-        .dstSet=this->currentDescriptorSet, 
-        .dstBinding=(unsigned)slot,
-        .dstArrayElement=0,
-        .descriptorCount=1,
-        .descriptorType=expected,
-        .pImageInfo=&ii,
-        .pBufferInfo=&bi,
-        .pTexelBufferView=&bv
-    };
-    
-    vkUpdateDescriptorSets( ctx->dev, 
-        1, &wr,
-        0, nullptr      //ones to copy
-    );
-    
+    //the descriptors are written when bind() finds that
+    //there's no cached set with the same contents
     this->currentResources[slot] = item;
+    setData(this->currentData[slot], item);
     this->needsBind[slot] = true;
 }
 
@@ -561,43 +852,146 @@ void DescriptorSet::setSlot( int slot, VkBufferView item ){
 
 void DescriptorSet::setSlot( int slot, VkBuffer item ){
     this->setSlotDoIt(slot,item);
+    this->dynamicOffsets[slot] = 0;
 }
- 
 
-void DescriptorSet::ensureCurrentIsValid(){
-    if( this->currentDescriptorSet != VK_NULL_HANDLE )
-        return;
-    if( this->availableDescriptorSets.empty()){
-        verbose("Allocating a descriptor set for",this->name);
-        this->currentDescriptorSet = this->factory->allocate();
-        this->ctx->setObjectName(this->currentDescriptorSet,this->name);
-    } else {
-        this->currentDescriptorSet = this->availableDescriptorSets.back();
-        this->availableDescriptorSets.pop_back();
+void DescriptorSet::setSlot( int slot, VkBuffer item, VkDeviceSize range, std::uint32_t dynamicOffset ){
+    auto type = ( slot >= 0 && slot < (int)this->descriptorSetLayout->types.size() ?
+        this->descriptorSetLayout->types[slot] : VK_DESCRIPTOR_TYPE_MAX_ENUM );
+    if( dynamicOffset != 0 && type != VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC &&
+            type != VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC ){
+        throw std::runtime_error("Slot "+std::to_string(slot)+" of descriptor set "+this->name+
+            " isn't dynamic, so it can't have a dynamic offset");
     }
-    
-    for(int i=0;i<(int)this->currentResources.size();++i){
-        Resource r = this->currentResources[i];
+    this->setSlotDoIt(slot,BufferRange{item,range});
+    this->dynamicOffsets[slot] = dynamicOffset;
+}
+ 
+
+std::size_t DescriptorSet::hashResources() const
+{
+    std::size_t h = std::hash<const void*>()(this->descriptorSetLayout);
+    for(const Resource& r : this->currentResources ){
+        std::size_t v = r.index();
         if( std::holds_alternative<VkImageView>(r) )
-            this->setSlot(i, std::get<VkImageView>(r) );
+            v ^= std::hash<VkImageView>()( std::get<VkImageView>(r) );
         else if( std::holds_alternative<VkSampler>(r) )
-            this->setSlot(i, std::get<VkSampler>(r) );
+            v ^= std::hash<VkSampler>()( std::get<VkSampler>(r) );
         else if( std::holds_alternative<VkBufferView>(r) )
-            this->setSlot(i, std::get<VkBufferView>(r) );
+            v ^= std::hash<VkBufferView>()( std::get<VkBufferView>(r) );
         else if( std::holds_alternative<VkBuffer>(r) )
-            this->setSlot(i, std::get<VkBuffer>(r) );
-        else if( std::holds_alternative<Empty>(r) ){
-            //leave alone
-        } else {
-            assert(0);
-        }
+            v ^= std::hash<VkBuffer>()( std::get<VkBuffer>(r) );
+        else if( std::holds_alternative<BufferRange>(r) )
+            v ^= std::hash<VkBuffer>()( std::get<BufferRange>(r).buffer ) ^ std::get<BufferRange>(r).range;
+        //same mixing as boost::hash_combine
+        h ^= v + 0x9e3779b9 + (h<<6) + (h>>2);
+    }
+    return h;
+}
+
+//get a VkDescriptorSet that no pending frame is using
+VkDescriptorSet DescriptorSet::acquireSet()
+{
+    VkDescriptorSet set;
+    if( !this->availableDescriptorSets.empty() ){
+        set = this->availableDescriptorSets.back();
+        this->availableDescriptorSets.pop_back();
+    } else if( !this->activeDescriptorSets.pop(set) ){
+        verbose("Allocating a descriptor set for",this->name);
+        set = this->factory->allocate();
+        this->ctx->setObjectName(set,this->name);
     }
+    return set;
+}
 
-    for(int i=0;i<(int)this->needsBind.size();++i){
-        this->needsBind[i]=false;
+//write currentResources to set. Only the slots that differ from what
+//set already holds are written; a transient set's contents are unknown.
+void DescriptorSet::writeSet(VkDescriptorSet set, bool transient)
+{
+    std::vector<Resource>* previous = nullptr;
+    if( !transient ){
+        auto it = this->setContents.find(set);
+        if( it != this->setContents.end() )
+            previous = &(it->second);
     }
-    
 
+    std::size_t n = this->currentResources.size();
+    std::vector<unsigned> dirty;
+    dirty.reserve(n);
+    std::uint64_t mask = 0;
+    for(std::size_t i=0;i<n;++i){
+        const Resource& r = this->currentResources[i];
+        if( std::holds_alternative<Empty>(r) )
+            continue;       //leave alone
+        if( previous && i < previous->size() && (*previous)[i] == r )
+            continue;       //already there
+        dirty.push_back((unsigned)i);
+        if( i < 64 )
+            mask |= std::uint64_t(1)<<i;
+    }
+
+    if( !transient )
+        this->setContents[set] = this->currentResources;
+
+    if( dirty.empty() )
+        return;
+
+    //one template update writes all of the dirty slots
+    //straight from currentData
+    VkDescriptorUpdateTemplate tmpl = VK_NULL_HANDLE;
+    if( dirty.back() < 64 )
+        tmpl = this->descriptorSetLayout->updateTemplate(mask);
+    if( tmpl != VK_NULL_HANDLE ){
+        vkUpdateDescriptorSetWithTemplateKHR(ctx->dev, set, tmpl, this->currentData.data());
+        descriptorWrites += dirty.size();
+        return;
+    }
+
+    std::vector<VkWriteDescriptorSet> writes;
+    writes.reserve(dirty.size());
+    for(unsigned i : dirty){
+        writes.push_back( VkWriteDescriptorSet{
+            .sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext=nullptr,
+            .dstSet=set, 
+            .dstBinding=i,
+            .dstArrayElement=0,
+            .descriptorCount=1,
+            .descriptorType=this->descriptorSetLayout->types[i],
+            .pImageInfo=&(this->currentData[i].image),
+            .pBufferInfo=&(this->currentData[i].buffer),
+            .pTexelBufferView=&(this->currentData[i].texelBuffer)
+        });
+    }
+
+    vkUpdateDescriptorSets( ctx->dev, 
+        (unsigned)writes.size(), writes.data(),
+        0, nullptr      //ones to copy
+    );
+    descriptorWrites += writes.size();
+}
+
+//shrink the cache to its capacity, least recently used first.
+//Evicted sets may still be in use by frames that haven't finished,
+//so they go to activeDescriptorSets rather than being reused at once.
+void DescriptorSet::evict()
+{
+    auto it = this->cache.end();
+    while( this->cache.size() > this->cacheCapacity && it != this->cache.begin() ){
+        --it;
+        if( it->pins > 0 )
+            continue;       //a cached command buffer refers to it
+        auto range = this->cacheIndex.equal_range(it->hash);
+        for(auto j=range.first; j != range.second; ++j ){
+            if( j->second == it ){
+                this->cacheIndex.erase(j);
+                break;
+            }
+        }
+        this->cacheBySet.erase(it->set);
+        this->activeDescriptorSets.push(it->set);
+        it = this->cache.erase(it);
+    }
 }
 
 //~ std::map<int, VkDescriptorSet> Descriptors::getCurrentBindings()
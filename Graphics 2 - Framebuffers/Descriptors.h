@@ -1,6 +1,12 @@
 #pragma once
 #include "vkhelpers.h"
+#include "RetireQueue.h"
 #include <variant>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <map>
+#include <cstdint>
 
 class DescriptorSetFactory;
 class PipelineLayout;
@@ -9,9 +15,21 @@ class PipelineLayout;
 struct DescriptorSetEntry{
     VkDescriptorType type;          /// Resource type (ex: VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE).
     int slot;                       /// Slot in the descriptor set; must be nonnegative.
+    unsigned count = 1;             /// Array size. DescriptorSet can only fill in slots where this is 1.
+    bool partiallyBound = false;    /// If true, array elements that the shader doesn't use may be left unwritten. Requires VulkanContext::haveDescriptorIndexing.
+    VkSampler immutableSampler = VK_NULL_HANDLE;   /// For a SAMPLER slot: If not null, the layout holds this sampler and DescriptorSet never writes the slot. count must be 1.
 };
 
 
+/// One descriptor's information, laid out the way
+/// vkUpdateDescriptorSetWithTemplateKHR reads it. DescriptorSet
+/// keeps an array of these indexed by slot (see DescriptorSetLayout::updateTemplate()).
+union DescriptorData{
+    VkDescriptorImageInfo image;        /// For samplers and images
+    VkDescriptorBufferInfo buffer;      /// For uniform and storage buffers
+    VkBufferView texelBuffer;           /// For texel buffers
+};
+
 /// Describes the layout of a descriptor set.
 class DescriptorSetLayout{
   public:
@@ -29,19 +47,57 @@ class DescriptorSetLayout{
     /// by slot (so types[i] tells the type of item in slot i).
     /// Empty slots hold VK_DESCRIPTOR_TYPE_MAX_ENUM.
     std::vector< VkDescriptorType > types;
+
+    /// The immutable samplers, organized by slot. Slots without
+    /// one hold VK_NULL_HANDLE. See DescriptorSetEntry::immutableSampler.
+    std::vector< VkSampler > immutableSamplers;
+
+    /// Slots that hold UNIFORM_BUFFER_DYNAMIC or STORAGE_BUFFER_DYNAMIC
+    /// descriptors, in increasing order. This is the order that
+    /// vkCmdBindDescriptorSets takes their dynamic offsets in.
+    std::vector< int > dynamicSlots;
     
     /// Copy of the entries parameter passed to the constructor. Not
     /// organized by slot number (so entries[i].slot is not necessarily
     /// equal to i). See the types field.
     std::vector< DescriptorSetEntry > entries;
 
+    /// Get an update template that writes some of the slots. Slot i's
+    /// information is the i'th item of a DescriptorData array, so the
+    /// same array works with any of the templates. Templates are made the
+    /// first time they're asked for. This may be called from any thread.
+    /// @param slots Bit i is set to write slot i
+    /// @return The template, or VK_NULL_HANDLE if templates can't be used
+    ///     (see VulkanContext::haveDescriptorUpdateTemplates) or a slot is 64 or more
+    VkDescriptorUpdateTemplate updateTemplate(std::uint64_t slots);
+
   private:
     DescriptorSetLayout(const DescriptorSetLayout&) = delete;
     void operator=(const DescriptorSetLayout& ) = delete;
     VulkanContext* ctx;
+    std::map<std::uint64_t, VkDescriptorUpdateTemplate> templates;
+    std::mutex templateMutex;
 };
  
  
+/// Counts for the DescriptorSet caches, summed over all
+/// DescriptorSets since the program started. See DescriptorSet::cacheStats().
+struct DescriptorCacheStats{
+    unsigned long long hits;        /// bind() calls that reused a VkDescriptorSet with the same contents
+    unsigned long long misses;      /// bind() calls that had to write a VkDescriptorSet
+    unsigned long long writes;      /// descriptors written with vkUpdateDescriptorSets
+};
+
+/// Descriptor pool usage of one DescriptorSetFactory.
+/// See DescriptorSetFactory::poolStats().
+struct DescriptorPoolStats{
+    unsigned pools;                 /// VkDescriptorPools the factory has made
+    unsigned setCapacity;           /// Number of sets those pools can hold
+    unsigned setsAllocated;         /// Sets allocated from them that haven't been reset
+    unsigned descriptorCapacity;    /// Descriptors those pools were made with
+    unsigned descriptorsAllocated;  /// Descriptors in the allocated sets
+};
+
 /// Wrapper for a Vulkan VkDescriptorSet object.
 /// The constructor for this class is not public; use the DescriptorSetFactory
 /// to manufacture DescriptorSet objects.
@@ -49,7 +105,16 @@ class DescriptorSet{
   public:
   
     /// Placeholder structure for an empty slot.
-    struct Empty{};
+    struct Empty{
+        bool operator==(const Empty&) const { return true; }
+    };
+
+    /// A buffer with an explicit range (see setSlot(int,VkBuffer,VkDeviceSize,std::uint32_t)).
+    struct BufferRange{
+        VkBuffer buffer;        /// The buffer
+        VkDeviceSize range;     /// Number of bytes the shader can see
+        bool operator==(const BufferRange& b) const { return buffer == b.buffer && range == b.range; }
+    };
     
     /// Set slot of the descriptor set to  the given item.
     /// @param slot Slot number; must be valid according to the DescriptorSetLayout
@@ -71,6 +136,17 @@ class DescriptorSet{
     /// @param item The item to store to that slot; must match type declared in DescriptorSetLayout
     void setSlot( int slot, VkBuffer item );
 
+    /// Set slot of the descriptor set to part of a buffer. For a dynamic
+    /// slot (UNIFORM_BUFFER_DYNAMIC or STORAGE_BUFFER_DYNAMIC), the part
+    /// can move without writing any descriptors: Only the offset changes,
+    /// and bind() passes it to vkCmdBindDescriptorSets. Setting a dynamic
+    /// slot with setSlot(int,VkBuffer) makes its offset 0.
+    /// @param slot Slot number; must be valid according to the DescriptorSetLayout
+    /// @param item The buffer
+    /// @param range Number of bytes the shader can see
+    /// @param dynamicOffset Where the range begins; must be 0 if the slot isn't dynamic
+    void setSlot( int slot, VkBuffer item, VkDeviceSize range, std::uint32_t dynamicOffset );
+
     /// Bind this descriptor set to the graphics and compute pipelines.
     /// This makes any setSlot() operations visible to the GPU. It is 
     /// permissible to set a DescriptorSet's contents with setSlot,
@@ -78,6 +154,13 @@ class DescriptorSet{
     /// bind it again, and draw additional geometry. Internally, the DescriptorSet
     /// manages one or more VkDescriptorSet handles and ensures that handles are not changed or
     /// re-used while they are part of an active command buffer.
+    /// The VkDescriptorSet handles are cached by their contents: if a handle
+    /// holding the same resources was bound recently, it is bound again
+    /// without writing any descriptors. The cache size comes from
+    /// config.ini (descriptorCacheSize); the least recently used handles
+    /// are recycled once the frames that used them have finished.
+    /// If descriptorCacheSize is 0, each bind() that isn't pinned writes
+    /// a set that belongs to the current frame (see DescriptorSetFactory).
     /// @param cmd The command buffer in which to record the bind operation.
     void bind(VkCommandBuffer cmd);
     
@@ -85,12 +168,56 @@ class DescriptorSet{
     /// See documentation for bind(VkCommandBuffer).
     /// @param bindPoints The binding points: VK_PIPELINE_BIND_POINT_GRAPHICS and/or VK_PIPELINE_BIND_POINT_COMPUTE.
     void bind(VkCommandBuffer cmd, std::initializer_list<VkPipelineBindPoint> bindPoints);
+
+    /// Make this descriptor set hold the same resources as src, as of
+    /// src's most recent setSlot() calls. This is how a recording thread
+    /// gets its own copy of a shared DescriptorSet: a DescriptorSet may
+    /// only be used by one thread at a time, but different DescriptorSets
+    /// from the same factory can be used on different threads.
+    /// @param src The set to copy; it must have the same layout as this one.
+    void copyContents(const DescriptorSet* src);
+
+    /// Write the current contents to a VkDescriptorSet that is kept
+    /// until the program ends. From then on, bind() only records the
+    /// bind command, and setSlot() may not be called. This is for sets
+    /// whose contents never change, such as a material's textures.
+    void freeze();
+
+    /// Start pinning: the VkDescriptorSets that bind() uses from now
+    /// on are not recycled when their frame finishes. Use this while
+    /// recording a command buffer that is replayed for many frames.
+    void beginPinning();
+
+    /// Stop pinning.
+    /// @return The descriptor sets that were bound since beginPinning().
+    ///     Pass these to releasePinned() when the commands that use
+    ///     them will no longer be executed.
+    std::vector<VkDescriptorSet> endPinning();
+
+    /// Give back descriptor sets that endPinning() returned. They are
+    /// recycled once the current frame has finished on the GPU.
+    /// This may only be called between utils::beginFrame() and utils::endFrame().
+    /// @param sets The descriptor sets
+    void releasePinned(const std::vector<VkDescriptorSet>& sets);
+
+    /// Get the cache counters. These may be read from any thread.
+    /// @return The counts
+    static DescriptorCacheStats cacheStats();
     
     /// Name, for debugging purposes
     std::string name;
     
   private:
-    typedef std::variant<Empty,VkImageView, VkSampler, VkBufferView, VkBuffer > Resource;
+    typedef std::variant<Empty,VkImageView, VkSampler, VkBufferView, VkBuffer, BufferRange > Resource;
+
+    ///a VkDescriptorSet in the cache and the resources that were written to it
+    struct CacheEntry{
+        VkDescriptorSet set;
+        std::size_t hash;
+        std::vector<Resource> resources;
+        unsigned pins;          //binds since beginPinning() that haven't been released
+    };
+    typedef std::list<CacheEntry>::iterator CacheIterator;
 
     DescriptorSet(const DescriptorSet&) = delete;
     void operator=(const DescriptorSet&) = delete;
@@ -101,6 +228,22 @@ class DescriptorSet{
     VulkanContext* ctx;
     
     std::vector<Resource> currentResources;
+
+    ///currentResources, as they'll be passed to the update
+    ///template; indexed by slot
+    std::vector<DescriptorData> currentData;
+
+    ///dynamic offset of each slot; only used for dynamic slots.
+    ///These aren't part of the VkDescriptorSet, so they aren't hashed.
+    std::vector<std::uint32_t> dynamicOffsets;
+
+    ///dynamicOffsets for the layout's dynamicSlots, as bind() passes them
+    std::vector<std::uint32_t> boundOffsets;
+
+    ///what each of our VkDescriptorSets holds, so that only the slots
+    ///that differ are written when one is reused. Sets from
+    ///DescriptorSetFactory::allocateTransient() aren't in here.
+    std::unordered_map<VkDescriptorSet, std::vector<Resource> > setContents;
     
     ///set(i,...) marks needsBind[i] as true.
     ///bind() marks all entries as false
@@ -110,15 +253,38 @@ class DescriptorSet{
     ///are now available for re-use
     std::vector<VkDescriptorSet> availableDescriptorSets;
     
-    ///descriptor sets that are in-use for one or more frames that are
-    ///being rendered. key=frame number, value=list of those descriptor sets
-    std::map<unsigned, std::vector<VkDescriptorSet> > activeDescriptorSets;
-    
-    ///the descriptor set we're currently updating.
-    ///it will be moved to activeDescriptorSets when we use() it
-    VkDescriptorSet currentDescriptorSet = VK_NULL_HANDLE;
+    ///descriptor sets that are in-use for frames that are being
+    ///rendered and that aren't in the cache (because they were evicted,
+    ///or they were pinned while caching is off); they become available
+    ///when their frame finishes. Sets that were bound while caching is
+    ///off aren't kept at all (see DescriptorSetFactory::allocateTransient()).
+    RetireQueue<VkDescriptorSet> activeDescriptorSets;
+
+    ///cached descriptor sets, most recently used first
+    std::list<CacheEntry> cache;
+
+    ///cache entries, by the hash of their resources
+    std::unordered_multimap<std::size_t, CacheIterator> cacheIndex;
+
+    ///cache entries, by handle
+    std::unordered_map<VkDescriptorSet, CacheIterator> cacheBySet;
+
+    ///maximum size of cache; 0 means that nothing is cached
+    unsigned cacheCapacity;
+
+    ///true between beginPinning() and endPinning()
+    bool pinning = false;
+
+    ///descriptor sets bound since beginPinning()
+    std::vector<VkDescriptorSet> pinnedDescriptorSets;
+
+    ///set by freeze()
+    VkDescriptorSet frozenSet = VK_NULL_HANDLE;
     
-    void ensureCurrentIsValid();
+    std::size_t hashResources() const;
+    VkDescriptorSet acquireSet();
+    void writeSet(VkDescriptorSet set, bool transient);
+    void evict();
     template<typename T>
     void setSlotDoIt(int slot, const T& item);
 
@@ -136,6 +302,12 @@ class DescriptorSet{
 };
     
 /// A DescriptorSetFactory is used to manufacture DescriptorSet objects.
+/// Its descriptor pools hold exactly the descriptor types that the
+/// layout uses. Sets that DescriptorSets keep (cached, frozen, or pinned)
+/// come from pools that are never reset. Sets that are only used for one
+/// frame (when descriptorCacheSize=0) come from pools that belong to that
+/// frame; they're reset all at once with vkResetDescriptorPool when the
+/// frame has finished on the GPU, so they don't need to be tracked one by one.
 class DescriptorSetFactory{
   public:
   
@@ -156,22 +328,64 @@ class DescriptorSetFactory{
     
     /// Clean up any allocated resources and DescriptorSet's.
     void cleanup();
+
+    /// Get this factory's pool usage.
+    /// @return The counts
+    DescriptorPoolStats poolStats();
+
+    /// Print the pool usage of every factory.
+    static void report();
     
   private:
+
+    //some descriptor pools, used in order
+    struct PoolGroup{
+        std::vector<VkDescriptorPool> pools;
+        std::vector<unsigned> capacity;     //sets that each pool can hold
+        std::vector<unsigned> used;         //sets allocated from each pool
+        std::size_t current=0;              //first pool that might have room
+    };
   
     //binding point for the created Descriptors
     int bindingPoint;
 
-    //used by DescriptorSet to actually allocate a set
+    //used by DescriptorSet to actually allocate a set that it keeps
     VkDescriptorSet allocate();
+
+    //used by DescriptorSet to allocate a set that is only used
+    //for the current frame. The caller doesn't free it.
+    VkDescriptorSet allocateTransient();
+
+    VkDescriptorSet allocateFrom(PoolGroup& group);
+    void resetGroup(PoolGroup& group);
     
     std::string name;
     DescriptorSetLayout* layout;
     PipelineLayout* pipelineLayout;
     std::vector<DescriptorSet*> sets;
-    std::vector<VkDescriptorPool> pools;
-    int numLeft=0;
+
+    //number of each type of descriptor in one set
+    std::vector<VkDescriptorPoolSize> setSizes;
+    unsigned descriptorsPerSet;
+
+    //pools for sets that DescriptorSets keep
+    PoolGroup persistent;
+
+    //pools for the current frame's transient sets; the frame's
+    //identifier is transientFrame
+    PoolGroup transient;
+    unsigned transientFrame;
+    bool haveTransientFrame=false;
+
+    //pools from earlier frames that may still be in use
+    RetireQueue<PoolGroup> retiredTransient;
+
+    //pools that have been reset and can be used for a new frame
+    std::vector<PoolGroup> freeTransient;
+
+    DescriptorPoolStats stats{};
     VulkanContext* ctx;
+    std::mutex mutex;       //make() and allocate() may be called from several threads
     DescriptorSetFactory(const DescriptorSetFactory&) = delete;
     void operator=(const DescriptorSetFactory&) = delete;
     friend class DescriptorSet;
@@ -0,0 +1,37 @@
+#include "FrameState.h"
+#include "Globals.h"
+#include "Uniforms.h"
+#include <stdexcept>
+
+FrameState::FrameState(const Globals& globs) :
+    camera(globs.camera),
+    lights(*globs.allLights),
+    cullLights(globs.ctx->config.get("lightCulling","yes") == "yes"),
+    uniforms(globs.uniforms),
+    cameraHandles(globs.uniforms),
+    lightHandles(globs.uniforms)
+{
+    this->capture(globs);
+}
+
+void FrameState::capture(const Globals& globs)
+{
+    this->camera = globs.camera;
+    if( this->cullLights )
+        globs.allLights->cull(this->camera, this->lights);
+    else
+        this->lights = *globs.allLights;
+    this->worldMatrices.resize(globs.allMeshes.size());
+    for(std::size_t i=0;i<globs.allMeshes.size();++i){
+        this->worldMatrices[i] = globs.allMeshes[i]->worldMatrix;
+    }
+    this->tick = globs.tick;
+}
+
+void FrameState::setUniforms(Uniforms* uniforms_) const
+{
+    if( uniforms_ != this->uniforms )
+        throw std::runtime_error("FrameState::setUniforms: The handles are for a different Uniforms object");
+    this->camera.setUniforms(uniforms_,this->cameraHandles);
+    this->lights.setUniforms(uniforms_,this->lightHandles);
+}
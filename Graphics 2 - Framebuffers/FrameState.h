@@ -0,0 +1,121 @@
+#pragma once
+#include "Camera.h"
+#include "Light.h"
+#include "math2801.h"
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+struct Globals;
+class Uniforms;
+
+/// A copy of everything draw() needs from the simulation.
+/// The simulation fills one of these in after each tick;
+/// the renderer reads only from the copy, so the simulation can
+/// keep changing Globals while the frame is being recorded.
+class FrameState{
+  public:
+
+    /// The camera as of the end of the tick
+    Camera camera;
+
+    /// Lights as of the end of the tick
+    LightCollection lights;
+
+    /// World matrix of each mesh; parallel to Globals::allMeshes
+    std::vector<math2801::mat4> worldMatrices;
+
+    /// Number of the simulation tick this state came from
+    unsigned tick = 0;
+
+    /// Capture the current state. This also looks up the
+    /// uniforms that setUniforms() sets, so globs.uniforms must exist.
+    /// @param globs The globals
+    FrameState(const Globals& globs);
+
+    /// Overwrite this state with the current state. This doesn't
+    /// allocate memory unless the number of meshes or lights changed.
+    /// @param globs The globals
+    void capture(const Globals& globs);
+
+    /// Set the camera and light uniforms
+    /// @param uniforms The uniforms to set; this must be
+    ///     the globs.uniforms that was passed to the constructor
+    void setUniforms(Uniforms* uniforms) const;
+
+  private:
+    bool cullLights;        //lightCulling in config.ini
+    Uniforms* uniforms;
+    Camera::UniformHandles cameraHandles;
+    LightCollection::UniformHandles lightHandles;
+};
+
+/// Passes values from one writer thread to one reader thread
+/// without locking either of them. There are three copies: one
+/// the writer is filling in, one the reader is using, and the
+/// most recently published one. The reader always gets the newest
+/// published value; values that are published faster than the reader
+/// consumes them are skipped.
+template<typename T>
+class TripleBuffer{
+  public:
+
+    /// Create the buffer.
+    /// @param initial Initial value for all three copies
+    TripleBuffer(const T& initial) : slots{initial,initial,initial} {}
+
+    /// Writer: Get the copy to fill in. This stays the same until publish() is called.
+    /// @return The copy
+    T& writeSlot(){
+        return slots[this->back];
+    }
+
+    /// Writer: Make writeSlot() available to the reader and get a new writeSlot().
+    void publish(){
+        unsigned old = this->middle.exchange(this->back | NEW_DATA, std::memory_order_acq_rel);
+        this->back = old & INDEX_MASK;
+        {
+            //taking the lock keeps the wakeup from being lost
+            //if the reader is about to wait
+            std::lock_guard<std::mutex> lock(this->mutex);
+        }
+        this->cond.notify_one();
+    }
+
+    /// Reader: Wait until the writer has published a value that
+    /// hasn't been read yet.
+    /// @param timeout Maximum time to wait, in seconds
+    /// @return True if there is a new value; false if the timeout expired
+    bool waitForNew(double timeout){
+        if( this->middle.load(std::memory_order_acquire) & NEW_DATA )
+            return true;
+        std::unique_lock<std::mutex> lock(this->mutex);
+        return this->cond.wait_for(lock, std::chrono::duration<double>(timeout), [this](){
+            return (this->middle.load(std::memory_order_acquire) & NEW_DATA) != 0;
+        });
+    }
+
+    /// Reader: Get the newest published value. It stays valid until the next call.
+    /// @return The value
+    const T& read(){
+        if( this->middle.load(std::memory_order_acquire) & NEW_DATA ){
+            unsigned old = this->middle.exchange(this->front, std::memory_order_acq_rel);
+            this->front = old & INDEX_MASK;
+        }
+        return slots[this->front];
+    }
+
+  private:
+    static const unsigned NEW_DATA = 4;
+    static const unsigned INDEX_MASK = 3;
+    T slots[3];
+    unsigned back=0;                        //owned by the writer
+    unsigned front=1;                       //owned by the reader
+    std::atomic<unsigned> middle{2};        //exchanged between them
+    std::mutex mutex;
+    std::condition_variable cond;
+    TripleBuffer(const TripleBuffer&) = delete;
+    void operator=(const TripleBuffer&) = delete;
+};
@@ -201,6 +201,7 @@ void Framebuffer::initialize(VulkanContext* ctx_)
 
     ctx = ctx_;
     ShaderManager::initialize(ctx);
+    Samplers::initialize(ctx);
     fbVertexManager = new VertexManager(
         ctx,
         {
@@ -218,9 +219,9 @@ void Framebuffer::initialize(VulkanContext* ctx_)
 
     fbBlurDescriptorSetLayout = new DescriptorSetLayout(ctx,
         {
-            {.type = VK_DESCRIPTOR_TYPE_SAMPLER,         .slot = 0   },
+            {.type = VK_DESCRIPTOR_TYPE_SAMPLER,         .slot = 0, .immutableSampler = Samplers::clampingMipSampler },
             {.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,   .slot = 1   },
-            {.type = VK_DESCRIPTOR_TYPE_SAMPLER,         .slot = 2   },
+            {.type = VK_DESCRIPTOR_TYPE_SAMPLER,         .slot = 2, .immutableSampler = Samplers::nearestSampler },
             {.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,   .slot = 3   }
         }
     );
@@ -250,6 +251,8 @@ void Framebuffer::initialize(VulkanContext* ctx_)
 Framebuffer::Framebuffer()
 {
     assert(ctx);
+    if (ctx->headless)
+        throw std::runtime_error("There is no window framebuffer in headless mode; use an offscreen Framebuffer instead");
 
     //using default framebuffer
     this->width = ctx->width;
@@ -274,7 +277,12 @@ Framebuffer::Framebuffer(unsigned w, unsigned h, unsigned layers, VkFormat forma
     : Framebuffer(true, w, h, layers, format_, name_)
 {}
 
-Framebuffer::Framebuffer(bool blurrable, unsigned w, unsigned h, unsigned layers, VkFormat format_, std::string name_)
+Framebuffer* Framebuffer::makePersistent(unsigned w, unsigned h, unsigned layers, VkFormat format_, std::string name_)
+{
+    return new Framebuffer(false, w, h, layers, format_, name_, true);
+}
+
+Framebuffer::Framebuffer(bool blurrable, unsigned w, unsigned h, unsigned layers, VkFormat format_, std::string name_, bool persistent)
 {
     assert(ctx);
     this->width = w;
@@ -287,6 +295,12 @@ Framebuffer::Framebuffer(bool blurrable, unsigned w, unsigned h, unsigned layers
     this->colorBuffers.reserve(ctx->numSwapchainImages);
     this->depthBuffers.reserve(ctx->numSwapchainImages);
     for (int i = 0; i < ctx->numSwapchainImages; ++i) {
+        if (persistent && i > 0) {
+            //every swapchain index uses the first one's images
+            this->colorBuffers.push_back(this->colorBuffers[0]);
+            this->depthBuffers.push_back(this->depthBuffers[0]);
+            continue;
+        }
         this->colorBuffers.push_back(
             ImageManager::createUninitializedImage(
                 w, h, layers,
@@ -603,6 +617,30 @@ void Framebuffer::beginRenderPassClearContents(VkCommandBuffer cmd, float r, flo
     this->beginRenderPassHelper(imageIndex, -1, cmd, VK_ATTACHMENT_LOAD_OP_CLEAR, r, g, b, a);
 }
 
+void Framebuffer::beginRenderPassClearContents(VkCommandBuffer cmd, float r, float g, float b, float a,
+    VkSubpassContents contents)
+{
+    int imageIndex = currentSwapchainIndex();
+    this->beginRenderPassHelper(imageIndex, -1, cmd, VK_ATTACHMENT_LOAD_OP_CLEAR, r, g, b, a, contents);
+}
+
+VkCommandBufferInheritanceInfo Framebuffer::inheritanceInfo()
+{
+    if (!this->insideRenderpass) {
+        throw std::runtime_error("inheritanceInfo() called while not in a renderpass");
+    }
+    return VkCommandBufferInheritanceInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = nullptr,
+        .renderPass = this->currentRenderPass,
+        .subpass = 0,
+        .framebuffer = this->currentFramebuffer,
+        .occlusionQueryEnable = VK_FALSE,
+        .queryFlags = 0,
+        .pipelineStatistics = 0
+    };
+}
+
 void Framebuffer::beginOneLayerRenderPassDiscardContents(int layerIndex, VkCommandBuffer cmd) {
     int imageIndex = currentSwapchainIndex();
     this->beginRenderPassHelper(imageIndex, layerIndex, cmd, VK_ATTACHMENT_LOAD_OP_DONT_CARE, 0.0f, 0.0f, 0.0f, 0.0f);
@@ -632,7 +670,8 @@ void Framebuffer::beginOneLayerRenderPassClearContents(int layerIndex, VkCommand
 
 void Framebuffer::beginRenderPassHelper(int imageIndex, int layerIndex,
     VkCommandBuffer cmd, VkAttachmentLoadOp loadOp,
-    float clearR, float clearG, float clearB, float clearA
+    float clearR, float clearG, float clearB, float clearA,
+    VkSubpassContents contents
 ) {
 
     std::string s = (
@@ -719,13 +758,16 @@ void Framebuffer::beginRenderPassHelper(int imageIndex, int layerIndex,
         }
     }
 
+    this->currentRenderPass = rp->renderPass;
+    this->currentFramebuffer = ((layerIndex == -1) ? this->allLayersFramebuffers[imageIndex] : this->singleLayerFramebuffers[imageIndex][layerIndex]);
+
     vkCmdBeginRenderPass(
         cmd,
         VkRenderPassBeginInfo{
             .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
             .pNext = nullptr,
-            .renderPass = rp->renderPass,
-            .framebuffer = ((layerIndex == -1) ? this->allLayersFramebuffers[imageIndex] : this->singleLayerFramebuffers[imageIndex][layerIndex]),
+            .renderPass = this->currentRenderPass,
+            .framebuffer = this->currentFramebuffer,
             .renderArea = VkRect2D{
                 .offset = VkOffset2D{
                     .x = 0,
@@ -739,7 +781,7 @@ void Framebuffer::beginRenderPassHelper(int imageIndex, int layerIndex,
             .clearValueCount = (unsigned)clearValues.size(),
             .pClearValues = (clearValues.empty() ? nullptr : clearValues.data())
         },
-        VK_SUBPASS_CONTENTS_INLINE
+        contents
     );
 
 }
@@ -749,11 +791,13 @@ void Framebuffer::endRenderPassNoMipmaps(VkCommandBuffer cmd)
         throw std::runtime_error("endRenderPass() called while not in a renderpass");
     }
 
-    ctx->endCmdRegion(cmd);
-
     vkCmdEndRenderPass(cmd);
     this->insideRenderpass = false;
 
+    //outside the renderpass, since one with secondary command
+    //buffers can't contain anything but vkCmdExecuteCommands
+    ctx->endCmdRegion(cmd);
+
     this->completedRenderIndex = this->currentRenderIndex;
     this->currentRenderIndex = -1;
 
@@ -779,11 +823,13 @@ void Framebuffer::endRenderPass(VkCommandBuffer cmd)
         throw std::runtime_error("endRenderPass() called while not in a renderpass");
     }
 
-    ctx->endCmdRegion(cmd);
-
     vkCmdEndRenderPass(cmd);
     this->insideRenderpass = false;
 
+    //outside the renderpass, since one with secondary command
+    //buffers can't contain anything but vkCmdExecuteCommands
+    ctx->endCmdRegion(cmd);
+
     this->completedRenderIndex = this->currentRenderIndex;
     this->currentRenderIndex = -1;
 
@@ -1067,10 +1113,8 @@ void Framebuffer::blur(unsigned radius, unsigned layer,
     fbBlurPushConstants->set(cmd, "blurDelta", vec2(1.0f, 0.0f));
 
 
-    //read from this FBO
-    this->blurDescriptorSet->setSlot(0, Samplers::clampingMipSampler);
+    //read from this FBO. Slots 0 and 2 are immutable samplers.
     this->blurDescriptorSet->setSlot(1, this->colorBuffers[this->completedRenderIndex]->view());
-    this->blurDescriptorSet->setSlot(2, Samplers::nearestSampler);
     this->blurDescriptorSet->setSlot(3, this->depthBufferViews[this->completedRenderIndex]);
     this->blurDescriptorSet->bind(cmd);
 
@@ -1099,9 +1143,7 @@ void Framebuffer::blur(unsigned radius, unsigned layer,
         this->blurPipeline->use(cmd);
     }
 
-    //~ this->blurDescriptorSet->setSlot(0,Samplers::clampingMipSampler);
     this->blurDescriptorSet->setSlot(1, this->blurHelper->colorBuffers[this->completedRenderIndex]->view());
-    //~ this->blurDescriptorSet->setSlot(2,Samplers::nearestSampler);
     this->blurDescriptorSet->setSlot(3, this->blurHelper->depthBufferViews[this->completedRenderIndex]);
     this->blurDescriptorSet->bind(cmd);
 
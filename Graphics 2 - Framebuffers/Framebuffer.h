@@ -64,6 +64,7 @@ public:
     RenderPass* singleLayerRenderPassClear;
 
     /// Create a Framebuffer associated with the onscreen window.
+    /// This throws if the context is headless.
     Framebuffer();
 
     /// Create offscreen Framebuffer
@@ -76,6 +77,21 @@ public:
         unsigned w, unsigned h, unsigned layers, VkFormat format, std::string name
     );
 
+    /// Create offscreen Framebuffer whose contents are kept from one frame
+    /// to the next. Normally there is an image for each swapchain image, so
+    /// what was drawn in an earlier frame is not necessarily there; this
+    /// one has a single color image and depth buffer that every frame
+    /// draws into. It can't be blurred.
+    /// @param w Width
+    /// @param h Height
+    /// @param layers Number of layers; must be positive
+    /// @param VkFormat Format of image
+    /// @param name For debugging
+    /// @return The new Framebuffer
+    static Framebuffer* makePersistent(
+        unsigned w, unsigned h, unsigned layers, VkFormat format, std::string name
+    );
+
     /// Destructor to release resources.
     ~Framebuffer();
 
@@ -97,6 +113,24 @@ public:
     /// @param r,g,b,a The clear color
     void beginRenderPassClearContents(VkCommandBuffer cmd, float r, float g, float b, float a);
 
+    /// Begin a renderpass that draws into all layers of this framebuffer.
+    /// The framebuffer is cleared before rendering starts.
+    /// The depth buffer is cleared to 1.0 and the stencil buffer is cleared to 0.
+    /// @param cmd Command buffer
+    /// @param r,g,b,a The clear color
+    /// @param contents VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS if the
+    ///        renderpass's commands will come from secondary command buffers
+    ///        (see inheritanceInfo()); in that case, cmd may only
+    ///        use vkCmdExecuteCommands until endRenderPass().
+    void beginRenderPassClearContents(VkCommandBuffer cmd, float r, float g, float b, float a,
+        VkSubpassContents contents);
+
+    /// Describe the renderpass that is in progress, for
+    /// beginning secondary command buffers that continue it. This
+    /// must be called between beginning and ending a renderpass.
+    /// @return The inheritance info
+    VkCommandBufferInheritanceInfo inheritanceInfo();
+
     /// Begin a renderpass that draws into one layer of this framebuffer.
     /// The initial contents of the framebuffer are undefined.
     /// @param layerIndex The layer to draw to
@@ -192,7 +226,8 @@ private:
     void beginOneLayerRenderPassDiscardContentsWithIndex(int imageIndex, int layerIndex, VkCommandBuffer cmd);
     void beginOneLayerRenderPassKeepContentsWithIndex(int imageIndex, int layerIndex, VkCommandBuffer cmd);
     void beginRenderPassHelper(int imageIndex, int layerIndex, VkCommandBuffer cmd,
-        VkAttachmentLoadOp loadOp, float r, float g, float b, float a);
+        VkAttachmentLoadOp loadOp, float r, float g, float b, float a,
+        VkSubpassContents contents=VK_SUBPASS_CONTENTS_INLINE);
     std::vector<VkFramebuffer> allLayersFramebuffers;   //one per swapchain image
     std::vector< std::vector<VkFramebuffer> > singleLayerFramebuffers;  //outer=swapchain index, inner=layer index
 
@@ -200,6 +235,8 @@ private:
     int currentRenderIndex = -1;              // frame that we are currently rendering into; -1 if none
 
     bool insideRenderpass = false;            //true if we're in a renderpass
+    VkRenderPass currentRenderPass = VK_NULL_HANDLE;      //renderpass in progress, if any
+    VkFramebuffer currentFramebuffer = VK_NULL_HANDLE;    //framebuffer for the renderpass in progress
     std::vector<Image*> colorBuffers;       //one per swapchain image
     std::vector<Image*> depthBuffers;       //one per swapchain image
     std::vector<VkImageView> depthBufferViews;  // one per swapchain image; view only includes depth aspect so we can use for fbo's
@@ -212,7 +249,8 @@ private:
     void pushToGPU();
 
     Framebuffer(
-        bool blurrable, unsigned w, unsigned h, unsigned layers, VkFormat format, std::string name
+        bool blurrable, unsigned w, unsigned h, unsigned layers, VkFormat format, std::string name,
+        bool persistent=false
     );
 
     Framebuffer* blurHelper = nullptr;    //pointer into map, not a private FB
@@ -0,0 +1,345 @@
+#include "GPUProfiler.h"
+#include "CleanupManager.h"
+#include "utils.h"
+#include "RetireQueue.h"
+#include "consoleoutput.h"
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <climits>
+#include <cctype>
+
+//queries available to each frame; each region uses two
+static const unsigned MAX_QUERIES = 1024;
+
+//number of recent samples kept per region for the statistics
+static const unsigned STATS_WINDOW = 256;
+
+//number of recent frames kept for the chrome trace
+static const unsigned TRACE_FRAMES = 120;
+
+static VulkanContext* ctx;
+static bool active=false;
+static double nsPerTick;
+static std::uint64_t timestampMask;
+static unsigned reportInterval;
+static unsigned framesSinceReport=0;
+
+struct RegionRecord{
+    std::string name;
+    unsigned beginQuery;
+    unsigned endQuery;
+};
+
+//one of these for each frame slot
+struct SlotPool{
+    VkQueryPool pool = VK_NULL_HANDLE;
+    unsigned numQueries = 0;
+    std::vector<RegionRecord> regions;
+    unsigned frameNumber = 0;
+    bool pending = false;       //recorded, but results not read yet
+};
+
+static std::vector<SlotPool> pools;
+static int currentPool=-1;
+static VkCommandBuffer frameCmd=VK_NULL_HANDLE;
+static std::vector<int> openRegions;     //indices into pools[currentPool].regions
+
+//pools whose results can be read once their frame finishes
+static RetireQueue<int> retiredPools;
+
+struct RegionStats{
+    std::vector<float> samples;         //msec; ring buffer of size STATS_WINDOW
+    unsigned next=0;
+};
+static std::map<std::string,RegionStats> stats;
+
+struct TraceEvent{
+    std::string name;
+    double startUs;
+    double durationUs;
+};
+static std::deque< std::vector<TraceEvent> > traceFrames;
+static std::uint64_t firstTimestamp;
+static bool haveFirstTimestamp=false;
+
+//Region names sometimes include indices
+//(ex: "Computing mipmaps index=2"); drop those so
+//all instances are counted together
+static std::string statsKey(const std::string& name)
+{
+    std::string s;
+    for(std::size_t i=0;i<name.size();++i){
+        s.push_back(name[i]);
+        if( name[i] == '=' ){
+            s.pop_back();
+            while( i+1 < name.size() && std::isdigit((unsigned char)name[i+1]) )
+                ++i;
+        }
+    }
+    return s;
+}
+
+static std::string jsonEscape(const std::string& s)
+{
+    std::string r;
+    for(char c : s){
+        if( c == '"' || c == '\\' )
+            r.push_back('\\');
+        if( (unsigned char)c < 32 )
+            continue;
+        r.push_back(c);
+    }
+    return r;
+}
+
+static void readResults(SlotPool& p);
+
+static void frameBegin(int, VkCommandBuffer cmd)
+{
+    int retired;
+    while( retiredPools.pop(retired) )
+        readResults(pools[retired]);
+
+    currentPool = utils::getFrameSlot();
+    SlotPool& p = pools[currentPool];
+    //if the previous results were never read, they're lost now
+    p.pending=false;
+    vkCmdResetQueryPool(cmd, p.pool, 0, MAX_QUERIES);
+    p.numQueries=0;
+    p.regions.clear();
+    p.frameNumber = utils::getCurrentFrameIdentifier();
+    frameCmd = cmd;
+    openRegions.clear();
+    GPUProfiler::beginRegion(cmd,"Frame");
+}
+
+static void frameEnd(int, VkCommandBuffer cmd)
+{
+    if( openRegions.size() > 1 ){
+        warn("GPUProfiler:",openRegions.size()-1,"command regions were not closed before endFrame()");
+    }
+    while( !openRegions.empty() )
+        GPUProfiler::endRegion(cmd);
+    pools[currentPool].pending=true;
+    retiredPools.push(currentPool);
+    frameCmd=VK_NULL_HANDLE;
+    currentPool=-1;
+}
+
+//read the timestamps of a frame that has finished
+static void readResults(SlotPool& p)
+{
+    if( !p.pending )
+        return;
+    p.pending=false;
+    if( p.numQueries == 0 )
+        return;
+
+    std::vector<std::uint64_t> results(p.numQueries);
+    //the frame has finished, so this does not wait
+    VkResult res = vkGetQueryPoolResults(
+        ctx->dev, p.pool,
+        0, p.numQueries,
+        results.size()*sizeof(results[0]), results.data(),
+        sizeof(results[0]),
+        VK_QUERY_RESULT_64_BIT
+    );
+    if( res == VK_NOT_READY )
+        return;
+    check(res);
+
+    std::vector<TraceEvent> events;
+    for(RegionRecord& r : p.regions){
+        if( r.beginQuery == UINT_MAX )
+            continue;       //ran out of queries
+        std::uint64_t t0 = results[r.beginQuery] & timestampMask;
+        std::uint64_t t1 = results[r.endQuery] & timestampMask;
+        double ms = double( (t1-t0) & timestampMask ) * nsPerTick / 1.0e6;
+
+        RegionStats& st = stats[statsKey(r.name)];
+        if( st.samples.size() < STATS_WINDOW ){
+            st.samples.push_back(float(ms));
+        } else {
+            st.samples[st.next] = float(ms);
+            st.next = (st.next+1) % STATS_WINDOW;
+        }
+
+        if( !haveFirstTimestamp ){
+            firstTimestamp = t0;
+            haveFirstTimestamp = true;
+        }
+        events.push_back( TraceEvent{
+            .name = r.name,
+            .startUs = double(t0-firstTimestamp) * nsPerTick / 1000.0,
+            .durationUs = ms * 1000.0
+        });
+    }
+    traceFrames.push_back(events);
+    if( traceFrames.size() > TRACE_FRAMES )
+        traceFrames.pop_front();
+
+    framesSinceReport++;
+    if( reportInterval != 0 && framesSinceReport >= reportInterval ){
+        GPUProfiler::report();
+        framesSinceReport=0;
+    }
+}
+
+namespace GPUProfiler{
+
+bool initialized()
+{
+    return ctx != nullptr;
+}
+
+bool enabled()
+{
+    return active;
+}
+
+void initialize(VulkanContext* ctx_)
+{
+    if(initialized())
+        return;
+
+    ctx=ctx_;
+
+    if( ctx->config.get("gpuProfiler","no") == "no" )
+        return;
+
+    reportInterval = (unsigned) std::stoi(ctx->config.get("gpuProfilerReportInterval","300"));
+
+    std::uint32_t count;
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx->physdev,&(count),nullptr);
+    std::vector<VkQueueFamilyProperties> qfamilies(count);
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx->physdev,&(count),qfamilies.data());
+    unsigned validBits = qfamilies[ctx->graphicsQueueIndex].timestampValidBits;
+    if( validBits == 0 ){
+        warn("GPUProfiler: The graphics queue does not support timestamps; profiling disabled");
+        return;
+    }
+    timestampMask = (validBits >= 64) ? ~std::uint64_t(0) : ( (std::uint64_t(1) << validBits) - 1 );
+    nsPerTick = ctx->physdevProperties.limits.timestampPeriod;
+
+    pools.resize(ctx->framesInFlight);
+    for(int i=0;i<(int)pools.size();++i){
+        check(vkCreateQueryPool(
+            ctx->dev,
+            VkQueryPoolCreateInfo{
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = MAX_QUERIES,
+                .pipelineStatistics = 0
+            },
+            nullptr,
+            &(pools[i].pool)
+        ));
+        ctx->setObjectName(pools[i].pool,"GPUProfiler pool["+std::to_string(i)+"]");
+    }
+
+    CleanupManager::registerCleanupFunction([](){
+        for(SlotPool& p : pools){
+            vkDestroyQueryPool(ctx->dev, p.pool, nullptr);
+        }
+        pools.clear();
+        active=false;
+    });
+
+    utils::registerFrameBeginCallback(frameBegin);
+    utils::registerFrameEndCallback(frameEnd);
+
+    active=true;
+    info("GPUProfiler enabled");
+}
+
+void beginRegion(VkCommandBuffer cmd, const std::string& name)
+{
+    if( !active || cmd != frameCmd )
+        return;
+    SlotPool& p = pools[currentPool];
+    RegionRecord r{
+        .name = name,
+        .beginQuery = UINT_MAX,
+        .endQuery = UINT_MAX
+    };
+    //both queries are reserved now so every begin has a matching end
+    if( p.numQueries + 2 <= MAX_QUERIES ){
+        r.beginQuery = p.numQueries;
+        r.endQuery = p.numQueries+1;
+        p.numQueries += 2;
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, p.pool, r.beginQuery);
+    }
+    openRegions.push_back((int)p.regions.size());
+    p.regions.push_back(r);
+}
+
+void endRegion(VkCommandBuffer cmd)
+{
+    if( !active || cmd != frameCmd || openRegions.empty() )
+        return;
+    SlotPool& p = pools[currentPool];
+    RegionRecord& r = p.regions[openRegions.back()];
+    openRegions.pop_back();
+    if( r.endQuery != UINT_MAX )
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, p.pool, r.endQuery);
+}
+
+void report()
+{
+    if( !active )
+        return;
+    print("GPU times (msec) over the last",STATS_WINDOW,"samples:");
+    for(auto& it : stats){
+        std::vector<float> S = it.second.samples;
+        if( S.empty() )
+            continue;
+        std::sort(S.begin(),S.end());
+        double total=0.0;
+        for(float f : S)
+            total += f;
+        std::size_t p99 = std::min( S.size()-1, (std::size_t)std::ceil(0.99*S.size())-1 );
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(3)
+            << "    min=" << S.front()
+            << " avg=" << total/S.size()
+            << " p99=" << S[p99]
+            << "  " << it.first;
+        print(oss.str());
+    }
+}
+
+void dumpChromeTrace(const std::string& filename)
+{
+    if( !active ){
+        warn("GPUProfiler is not enabled; set gpuProfiler=yes in config.ini");
+        return;
+    }
+    std::ofstream out(filename);
+    if( !out.good() )
+        throw std::runtime_error("Cannot write "+filename);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\":[\n";
+    bool first=true;
+    for(auto& F : traceFrames){
+        for(TraceEvent& e : F){
+            if(!first)
+                out << ",\n";
+            first=false;
+            out << "{\"name\":\"" << jsonEscape(e.name) << "\",\"cat\":\"gpu\",\"ph\":\"X\""
+                << ",\"ts\":" << e.startUs << ",\"dur\":" << e.durationUs
+                << ",\"pid\":1,\"tid\":1}";
+        }
+    }
+    out << "\n]}\n";
+    info("Wrote GPU trace to",filename);
+}
+
+};  //namespace
@@ -0,0 +1,48 @@
+#pragma once
+#include "vkhelpers.h"
+#include <string>
+
+/// GPU timing of command regions using timestamp queries.
+/// Every VulkanContext::beginCmdRegion()/endCmdRegion() pair that is
+/// recorded into the frame's command buffer gets a timestamp at each
+/// end, as does the frame as a whole. Each frame slot has its own
+/// query pool; results are read when the slot's frame has completed,
+/// so reading them never stalls.
+/// Enable with gpuProfiler=yes in config.ini.
+namespace GPUProfiler{
+
+/// Initialize the subsystem. If profiling is disabled in the
+/// config file or timestamps are not supported, all other
+/// functions do nothing.
+/// @param ctx The context
+void initialize(VulkanContext* ctx);
+
+/// Return true if subsystem was initialized
+/// @return True if initialized; false if not
+bool initialized();
+
+/// Return true if timestamps are being recorded
+/// @return True if profiling is active
+bool enabled();
+
+/// Start timing a region. Called by VulkanContext::beginCmdRegion().
+/// @param cmd The command buffer. Regions in command buffers other than
+///            the current frame's are ignored.
+/// @param name The region name
+void beginRegion(VkCommandBuffer cmd, const std::string& name);
+
+/// Finish timing the most recently begun region. Called by
+/// VulkanContext::endCmdRegion().
+/// @param cmd The command buffer
+void endRegion(VkCommandBuffer cmd);
+
+/// Print min/avg/p99 GPU time (in msec) for each region,
+/// computed over the most recent frames.
+void report();
+
+/// Write the most recent frames' regions as a Chrome trace
+/// (load it in chrome://tracing or https://ui.perfetto.dev).
+/// @param filename The output file
+void dumpChromeTrace(const std::string& filename);
+
+};  //namespace
@@ -9,7 +9,9 @@
 #include "Meshes.h"
 #include "Light.h"
 #include <vector>
+#include <array>
 #include <set>
+#include <atomic>
 
 struct Globals{
     
@@ -23,20 +25,41 @@ struct Globals{
     VulkanContext* ctx;
     
     /// the framebuffer associated with the window
+    /// (an offscreen Framebuffer if the context is headless)
     Framebuffer* framebuffer;
     Framebuffer* offscreen;
     
     /// default vertex manager
     VertexManager* vertexManager;
     
-    /// true as long as the program should keep running
-    bool keepLooping;
+    /// true as long as the program should keep running.
+    /// Written by the simulation thread and read by the render thread.
+    std::atomic<bool> keepLooping;
+
+    /// number of simulation ticks (calls to update()) so far
+    unsigned tick;
+
+    /// set by handleEvents(); the render thread takes the
+    /// screenshot after the next frame it draws
+    std::atomic<bool> screenshotRequested;
+
+    /// set by handleEvents(); the render thread writes the
+    /// GPU profiler trace after the next frame it draws
+    std::atomic<bool> gpuTraceRequested;
+
+    /// set by handleEvents(); the render thread switches between
+    /// forward and deferred shading (see DeferredShading) before
+    /// the next frame it draws
+    std::atomic<bool> renderPathToggleRequested;
     
     /// set of keys that are currently pressed
     std::set<int> keys;
     
     /// push constants
     PushConstants* pushConstants;
+
+    /// the push constants that the meshes set, looked up in pushConstants
+    MeshPushConstantHandles meshPushConstantHandles;
     
     /// the default graphics pipeline
     GraphicsPipeline* pipeline;
@@ -53,15 +76,35 @@ struct Globals{
     /// the pipeline layout
     PipelineLayout* pipelineLayout;
     
-    /// layout of the descriptor set
-    DescriptorSetLayout* descriptorSetLayout;
+    /// layouts of the per-frame, per-material and per-draw
+    /// descriptor sets, made from descriptorSets.h. The per-material
+    /// one is BindlessTextures::layout() if that's enabled.
+    std::array<DescriptorSetLayout*,3> descriptorSetLayouts;
     
-    /// factory for making descriptor sets
+    /// factory for making per-frame descriptor sets
     DescriptorSetFactory* descriptorSetFactory;
+
+    /// factory for making per-material descriptor sets (see
+    /// Meshes::getFromGLTF()); null if BindlessTextures is enabled
+    DescriptorSetFactory* materialDescriptorSetFactory;
+
+    /// factory for making per-draw descriptor sets
+    DescriptorSetFactory* drawDescriptorSetFactory;
     
-    /// the active descriptor set
+    /// the active per-frame descriptor set
     DescriptorSet* descriptorSet;
 
+    /// per-draw descriptor set for the blit
+    DescriptorSet* drawDescriptorSet;
+
+    /// per-frame descriptor sets for the mesh recording threads; indexed by
+    /// worker number (see ParallelRecorder). Each one is refreshed
+    /// from descriptorSet with copyContents() before it's used.
+    std::vector<DescriptorSet*> workerDescriptorSets;
+
+    /// descriptor set for the cached mesh commands (see StaticCommandCache)
+    DescriptorSet* staticDescriptorSet;
+
     /// manager for uniforms
     Uniforms* uniforms;
 
@@ -95,4 +138,7 @@ struct Globals{
     
     /// true if program is in mouselook mode
     bool mouseLook;
+
+    /// the scene to load
+    std::string sceneFile = "assets/room.glb";
 };
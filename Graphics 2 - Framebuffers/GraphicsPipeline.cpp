@@ -50,6 +50,7 @@ GraphicsPipeline::GraphicsPipeline(
     if( parent->pipelineTessellationStateCreateInfo.has_value() )
         this->set(parent->pipelineTessellationStateCreateInfo.value()   );
     this->set(parent->pipelineVertexInputStateCreateInfo    );
+    this->set(parent->pipelineDynamicStateCreateInfo        );
 }
 
 GraphicsPipeline::GraphicsPipeline(
@@ -197,6 +198,14 @@ void GraphicsPipeline::setDefaults()
     }
     
     this->pipelineTessellationStateCreateInfo=std::optional<VkPipelineTessellationStateCreateInfo>();
+
+    this->set(VkPipelineDynamicStateCreateInfo{
+        .sType=VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .pNext=nullptr,
+        .flags=0,
+        .dynamicStateCount=0,
+        .pDynamicStates=nullptr
+    });
     
 }
     
@@ -246,6 +255,17 @@ GraphicsPipeline* GraphicsPipeline::set( VkPipelineViewportStateCreateInfo opt)
     return this;
 }
 
+GraphicsPipeline* GraphicsPipeline::set( VkPipelineDynamicStateCreateInfo opt)
+{
+    checkSettable();
+    this->pipelineDynamicStateCreateInfo = opt;
+
+    //make private copy that won't have external pointer dependencies
+    this->dynamicStates.assign( opt.pDynamicStates, opt.pDynamicStates + opt.dynamicStateCount );
+    this->pipelineDynamicStateCreateInfo.pDynamicStates = this->dynamicStates.data();
+    return this;
+}
+
 GraphicsPipeline* GraphicsPipeline::set( VkPipelineRasterizationStateCreateInfo opt)
 {
     checkSettable();
@@ -484,7 +504,7 @@ void GraphicsPipeline::finishInit()
         .pMultisampleState = &this->pipelineMultisampleStateCreateInfo,
         .pDepthStencilState = &this->pipelineDepthStencilStateCreateInfo,
         .pColorBlendState = &this->pipelineColorBlendStateCreateInfo,
-        .pDynamicState = nullptr,
+        .pDynamicState = (this->dynamicStates.empty() ? nullptr : &this->pipelineDynamicStateCreateInfo),
         .layout = this->pipelineLayout->pipelineLayout,
         //any compatible renderpass may be used with this pipeline
         //compatible means:
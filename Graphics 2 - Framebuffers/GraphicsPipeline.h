@@ -109,6 +109,13 @@ class GraphicsPipeline : public Pipeline{
     /// @return A pointer to this GraphicsPipeline, to facilitate call chaining.
     GraphicsPipeline* set(VkPipelineShaderStageCreateInfo op);
 
+    /// Set the state for the pipeline. This cannot be called after use() has been called.
+    /// The states listed in op must be set with vkCmdSet* after the pipeline is bound
+    /// (ex: VK_DYNAMIC_STATE_VIEWPORT, to draw to part of a framebuffer).
+    /// @param op The option to set
+    /// @return A pointer to this GraphicsPipeline, to facilitate call chaining.
+    GraphicsPipeline* set(VkPipelineDynamicStateCreateInfo op);
+
     /// Set the state for the pipeline. This cannot be called after use() has been called.
     /// @param op The framebuffer to use (only width & height are relevant)
     /// @return A pointer to this GraphicsPipeline, to facilitate call chaining.
@@ -178,6 +185,10 @@ class GraphicsPipeline : public Pipeline{
     
     //no pointers in here
     std::optional<VkPipelineTessellationStateCreateInfo> pipelineTessellationStateCreateInfo;
+
+    //these go together
+    VkPipelineDynamicStateCreateInfo pipelineDynamicStateCreateInfo;
+    std::vector<VkDynamicState> dynamicStates;
     
     //these go together
     VkPipelineVertexInputStateCreateInfo pipelineVertexInputStateCreateInfo;
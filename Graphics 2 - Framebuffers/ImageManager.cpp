@@ -3,6 +3,7 @@
 #include "Images.h"
 #include "utils.h"
 #include "CleanupManager.h"
+#include "Uploader.h"
 #include <cassert>
 #include <fstream>
 #include <sstream>
@@ -252,7 +253,6 @@ void pushToGPU()
     offsets.reserve(_imgmap.size());
 
     VkDeviceSize offset=0;
-    VkDeviceSize largestImageSize=0;
 
     Image* img=nullptr;
 
@@ -272,7 +272,6 @@ void pushToGPU()
         sizes.push_back(img->memoryRequirements.size);
 
         offset += sizes.back();
-        largestImageSize = std::max( sizes.back(), largestImageSize );
     }
 
     if( img == nullptr ){
@@ -292,22 +291,20 @@ void pushToGPU()
         vkFreeMemory( ctx->dev, memory, nullptr );
     });
 
-    StagingBuffer* stagingBuffer = new StagingBuffer(ctx,nullptr,largestImageSize,"ImageManager staging");
+    //the copies are batched by the Uploader and all
+    //submitted together
     int idx=0;
     for(auto& it : _imgmap){
         img = it.second;
         if(img->pushedToGPU())
             continue;
         img->copyDataToGPU(
-            stagingBuffer,
             memory,
             offsets[idx]
         );
         idx++;
     }
-
-    stagingBuffer->cleanup();
-    delete stagingBuffer;
+    Uploader::flush();
 
     for(auto& f : callbacks){
         f();
@@ -319,5 +316,15 @@ void addCallback( std::function<void(void)> f)
     callbacks.push_back(f);
 }
 
+std::vector<Image*> allImages()
+{
+    std::vector<Image*> v;
+    v.reserve(_imgmap.size());
+    for(auto& it : _imgmap){
+        v.push_back(it.second);
+    }
+    return v;
+}
+
 
 }; //namespace
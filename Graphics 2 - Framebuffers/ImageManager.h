@@ -83,6 +83,10 @@ void pushToGPU();
 /// @param f The callback.
 void addCallback( std::function<void(void)> f);
 
+/// Get every image that has been loaded or created with the functions above.
+/// @return The images, in no particular order
+std::vector<Image*> allImages();
+
 }
   
 
@@ -8,6 +8,7 @@
 #include <fstream>
 #include <cassert>
 #include "Buffers.h"
+#include "Uploader.h"
 #include "CleanupManager.h"
 #include <iostream>
 #include <array>
@@ -248,7 +249,7 @@ VkImageView Image::createView(VkImageViewType viewType_, VkFormat format_,
 }
 
 
-void Image::copyDataToGPU(StagingBuffer* stagingBuffer, VkDeviceMemory memory, VkDeviceSize startingOffset)
+void Image::copyDataToGPU(VkDeviceMemory memory, VkDeviceSize startingOffset)
 {
     assert(ctx);
 
@@ -263,61 +264,8 @@ void Image::copyDataToGPU(StagingBuffer* stagingBuffer, VkDeviceMemory memory, V
         startingOffset
     ));
 
-
-    this->layoutTransition(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-
-    if (this->layers[0].mips[0].pixels.empty()) {
-        //no initial data, so nothing to copy
-    }
-    else if (this->aspect & VK_IMAGE_ASPECT_DEPTH_BIT) {
-        throw std::runtime_error("Unimplemented: Depth texture with initial data...");
-    }
-    else {
-        for (int layernumber = 0; layernumber < (int)this->layers.size(); ++layernumber) {
-            Layer& layerdata = this->layers[layernumber];
-            for (int miplevel = 0; miplevel < (int)layerdata.mips.size(); ++miplevel) {
-                Mip& mipdata = layerdata.mips[miplevel];
-
-                void* p = stagingBuffer->map();
-                std::memcpy(p, mipdata.pixels.data(), mipdata.pixels.size() * sizeof(mipdata.pixels[0]));
-                stagingBuffer->unmap();
-
-                auto cmd = CommandBuffer::beginImmediateCommands();
-                vkCmdCopyBufferToImage(
-                    cmd,
-                    stagingBuffer->buffer,
-                    this->image,
-                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    1,
-                    VkBufferImageCopy{
-                        .bufferOffset = 0,
-                        .bufferRowLength = 0,      //0=no padding
-                        .bufferImageHeight = 0,    //0=no padding
-                        .imageSubresource = VkImageSubresourceLayers{
-                            .aspectMask = this->aspect, //VK_IMAGE_ASPECT_COLOR_BIT,
-                            .mipLevel = (unsigned)miplevel,
-                            .baseArrayLayer = (unsigned)layernumber,
-                            .layerCount = 1
-                        },
-                        .imageOffset = VkOffset3D{
-                            .x = 0,
-                            .y = 0,
-                            .z = 0,
-                        },
-                        .imageExtent = VkExtent3D{
-                            .width = (unsigned)mipdata.width,
-                            .height = (unsigned)mipdata.height,
-                            .depth = 1
-                        }
-                    }
-                );
-                CommandBuffer::endImmediateCommands(cmd);
-            }
-        }
-    }
-
-    this->layoutTransition(this->finalLayout);
+    //copies every layer and mip and transitions to finalLayout
+    Uploader::uploadImage(this);
 
     this->view_ = this->createView(
         this->viewType,
@@ -355,11 +303,9 @@ void Image::addCallback(std::function<void(Image*)> f) {
 
 void Image::layoutTransition(VkImageLayout newLayout_)
 {
-    auto cmd = CommandBuffer::beginImmediateCommands();
     this->layoutTransition(0, (unsigned)this->layers.size(),
         0, (unsigned)this->layers[0].mips.size(),
-        newLayout_, cmd);
-    CommandBuffer::endImmediateCommands(cmd);
+        newLayout_, Uploader::graphicsCommands());
 }
 
 void Image::layoutTransition(VkImageLayout newLayout_, VkCommandBuffer cmd)
@@ -371,9 +317,7 @@ void Image::layoutTransition(VkImageLayout newLayout_, VkCommandBuffer cmd)
 
 void Image::layoutTransition(unsigned layer, unsigned mipLevel, VkImageLayout newLayout_)
 {
-    auto cmd = CommandBuffer::beginImmediateCommands();
-    this->layoutTransition(layer, 1, mipLevel, 1, newLayout_, cmd);
-    CommandBuffer::endImmediateCommands(cmd);
+    this->layoutTransition(layer, 1, mipLevel, 1, newLayout_, Uploader::graphicsCommands());
 }
 
 void Image::layoutTransition(
@@ -448,6 +392,69 @@ static void doBarrier(VkCommandBuffer cmd, VkImageAspectFlags aspect,
     );
 }
 
+void Image::queueFamilyTransfer(VkImageLayout newLayout,
+    std::uint32_t srcQueueFamily, std::uint32_t dstQueueFamily,
+    VkCommandBuffer releaseCmd, VkCommandBuffer acquireCmd)
+{
+    unsigned numMips = (unsigned)this->layers[0].mips.size();
+    if (!this->allLayoutsMatch(0, this->numLayers, 0, numMips)) {
+        throw std::runtime_error("Image " + this->name + ": queueFamilyTransfer requires all mips to have the same layout");
+    }
+    VkImageLayout oldLayout = this->layers[0].mips[0].layout;
+
+    ctx->insertCmdLabel(releaseCmd, this->name + ": release to queue family " + std::to_string(dstQueueFamily));
+    ctx->insertCmdLabel(acquireCmd, this->name + ": acquire from queue family " + std::to_string(srcQueueFamily));
+
+    //the release and acquire barriers must describe the same
+    //transition; only the access masks differ
+    VkImageMemoryBarrier B{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+        .dstAccessMask = 0,
+        .oldLayout = oldLayout,
+        .newLayout = newLayout,
+        .srcQueueFamilyIndex = srcQueueFamily,
+        .dstQueueFamilyIndex = dstQueueFamily,
+        .image = this->image,
+        .subresourceRange = VkImageSubresourceRange{
+            .aspectMask = this->aspect,
+            .baseMipLevel = 0,
+            .levelCount = numMips,
+            .baseArrayLayer = 0,
+            .layerCount = this->numLayers
+        }
+    };
+
+    vkCmdPipelineBarrier(
+        releaseCmd,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &B
+    );
+
+    B.srcAccessMask = 0;
+    B.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(
+        acquireCmd,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &B
+    );
+
+    for (auto& L : this->layers) {
+        for (auto& M : L.mips) {
+            M.layout = newLayout;
+        }
+    }
+}
+
 void Image::layoutTransition(unsigned firstLayer, unsigned numLayersToTransition,
     unsigned firstMip, unsigned numMips,
     VkImageLayout newLayout, VkCommandBuffer cmd)
@@ -141,12 +141,11 @@ public:
     /// Clean up image resources
     void cleanup();
 
-    /// Copy image data to GPU and allocate its view.
-    /// @param stagingBuffer Staging buffer to use for temporary storage.
-    ///                      This must be large enough for the Image's data
+    /// Copy image data to GPU and allocate its view. The copy is
+    /// queued with the Uploader; it runs at the next Uploader::flush().
     /// @param memory The memory destination for the copy
     /// @param startingOffset Offset within the memory for this image's data
-    void copyDataToGPU(StagingBuffer* stagingBuffer, VkDeviceMemory memory, VkDeviceSize startingOffset);
+    void copyDataToGPU(VkDeviceMemory memory, VkDeviceSize startingOffset);
 
     /// Add callback to be called when this Image is copied to the GPU and gets its view.
     /// If the Image has already been copied to the GPU when addCallback is executed,
@@ -155,7 +154,8 @@ public:
     void addCallback(std::function<void(Image*)> f);
 
     /// Perform a layout transition on this image: Transition all mips of all layers.
-    /// Do the operation immediately using a temporary command buffer.
+    /// The operation is batched with pending uploads (see Uploader::graphicsCommands())
+    /// and runs at the next Uploader::flush().
     /// @param newLayout the new layout
     void layoutTransition(VkImageLayout newLayout);
 
@@ -166,7 +166,8 @@ public:
     void layoutTransition(VkImageLayout newLayout_, VkCommandBuffer cmd);
 
     /// Perform a layout transition on this image: Transition a single layer and mip level
-    /// Do the operation immediately using a temporary command buffer.
+    /// The operation is batched with pending uploads (see Uploader::graphicsCommands())
+    /// and runs at the next Uploader::flush().
     /// @param layer The layer to process
     /// @param mipLevel The mip level to process
     /// @param newLayout the new layout
@@ -208,6 +209,19 @@ public:
     void layoutTransition(VkImageAspectFlags aspect, unsigned firstLayer, unsigned numLayers,
         unsigned firstMip, unsigned numMips, VkImageLayout newLayout, VkCommandBuffer cmd);
 
+    /// Transfer ownership of all layers and mips from one queue family
+    /// to another while transitioning them to a new layout. All mips
+    /// must currently have the same layout.
+    /// @param newLayout The new layout
+    /// @param srcQueueFamily The queue family that currently owns the image
+    /// @param dstQueueFamily The queue family that will own the image
+    /// @param releaseCmd Command buffer for srcQueueFamily; gets the release barrier
+    /// @param acquireCmd Command buffer for dstQueueFamily; gets the acquire barrier.
+    ///                   It must execute after releaseCmd (ex: wait on a semaphore).
+    void queueFamilyTransfer(VkImageLayout newLayout,
+        std::uint32_t srcQueueFamily, std::uint32_t dstQueueFamily,
+        VkCommandBuffer releaseCmd, VkCommandBuffer acquireCmd);
+
     /// Check if image has been copied to GPU.
     /// @return True if image has been copied to GPU and has a view.
     bool pushedToGPU();
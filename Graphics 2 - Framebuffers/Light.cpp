@@ -3,10 +3,61 @@
 #include <sstream>
 #include "consoleoutput.h"
 #include "Uniforms.h"
+#include "Camera.h"
 #include "math2801.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <span>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define LIGHT_CULL_SSE 1
+#else
+#define LIGHT_CULL_SSE 0
+#endif
 
 using namespace math2801;
 
+//LightCollection::radius(): Light below this is ignored (one step of an 8 bit color)
+static const float LIGHT_CUTOFF = 1.0f/256.0f;
+
+//lights tested at once by LightCollection::cull()
+static const std::size_t CULL_BATCH = 4;
+
+//bit i is set if sphere i of the CULL_BATCH starting at
+//x,y,z,r is on the inner side of all six planes (xyz=normal, w=distance)
+static unsigned insideFrustum(const vec4* planes,
+        const float* x, const float* y, const float* z, const float* r)
+{
+#if LIGHT_CULL_SSE
+    __m128 X = _mm_loadu_ps(x);
+    __m128 Y = _mm_loadu_ps(y);
+    __m128 Z = _mm_loadu_ps(z);
+    __m128 negR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r));
+    unsigned mask = 0xf;
+    for(int p=0;p<6;++p){
+        __m128 d = _mm_add_ps(
+            _mm_add_ps( _mm_mul_ps(X,_mm_set1_ps(planes[p].x)), _mm_mul_ps(Y,_mm_set1_ps(planes[p].y)) ),
+            _mm_add_ps( _mm_mul_ps(Z,_mm_set1_ps(planes[p].z)), _mm_set1_ps(planes[p].w) )
+        );
+        mask &= (unsigned)_mm_movemask_ps(_mm_cmpge_ps(d,negR));
+    }
+    return mask;
+#else
+    unsigned mask=0;
+    for(std::size_t i=0;i<CULL_BATCH;++i){
+        bool inside=true;
+        for(int p=0;p<6;++p){
+            float d = x[i]*planes[p].x + y[i]*planes[p].y + z[i]*planes[p].z + planes[p].w;
+            inside = inside && (d >= -r[i]);
+        }
+        mask |= (inside ? 1u : 0u) << i;
+    }
+    return mask;
+#endif
+}
+
 Light::Light(std::string name_, vec3 position_, bool positional_,
             vec3 direction_, float cosInnerSpotAngle_,
             float cosOuterSpotAngle_, vec3 color_,
@@ -36,7 +87,7 @@ Light::operator std::string()
     return oss.str();
 }
 
-LightCollection::LightCollection(const gltf::GLTFScene& scene, int maxLights)
+LightCollection::LightCollection(const gltf::GLTFScene& scene, int maxLights, int arraySize)
 {
     for(const auto& L : scene.lights){
         this->lightPositionAndDirectionalFlag.push_back(
@@ -59,22 +110,185 @@ LightCollection::LightCollection(const gltf::GLTFScene& scene, int maxLights)
         this->lightColorAndIntensity.resize(maxLights);
         this->cosSpotAngles.resize(maxLights);
         this->spotDirection.resize(maxLights);
-    } else {
-        while((int)lightPositionAndDirectionalFlag.size() < maxLights ){
-            this->lightPositionAndDirectionalFlag.push_back(vec4(0,0,0,1));
-            this->lightColorAndIntensity.push_back(vec4(0,0,0,0));
-            this->cosSpotAngles.push_back(vec4(0,0,0,0));
-            this->spotDirection.push_back(vec4(0,0,1,0));
-        }
+    }
+    this->numLights = (int)this->lightPositionAndDirectionalFlag.size();
+    this->arraySize = arraySize;
+    while((int)lightPositionAndDirectionalFlag.size() < arraySize ){
+        this->lightPositionAndDirectionalFlag.push_back(vec4(0,0,0,1));
+        this->lightColorAndIntensity.push_back(vec4(0,0,0,0));
+        this->cosSpotAngles.push_back(vec4(0,0,0,0));
+        this->spotDirection.push_back(vec4(0,0,1,0));
     }
 }
  
-void LightCollection::setUniforms(Uniforms* uniforms)
+LightCollection::UniformHandles::UniformHandles(Uniforms* uniforms) :
+    lightPositionAndDirectionalFlag(uniforms->handle<std::vector<vec4>>("lightPositionAndDirectionalFlag")),
+    lightColorAndIntensity(uniforms->handle<std::vector<vec4>>("lightColorAndIntensity")),
+    cosSpotAngles(uniforms->handle<std::vector<vec4>>("cosSpotAngles")),
+    spotDirection(uniforms->handle<std::vector<vec4>>("spotDirection")),
+    attenuation(uniforms->handle<vec3>("attenuation")),
+    activeLightCount(uniforms->handle<std::int32_t>("activeLightCount"))
+{
+}
+
+void LightCollection::setUniforms(Uniforms* uniforms, const UniformHandles& handles) const
+{
+    //the arrays are padded to at least arraySize. If there are more
+    //lights than fit (the shaders read them from somewhere else; see
+    //ClusteredLights), the uniforms get the first ones.
+    std::size_t n = (std::size_t)this->arraySize;
+    uniforms->set(handles.lightPositionAndDirectionalFlag, std::span(this->lightPositionAndDirectionalFlag).first(n));
+    uniforms->set(handles.lightColorAndIntensity, std::span(this->lightColorAndIntensity).first(n));
+    uniforms->set(handles.cosSpotAngles, std::span(this->cosSpotAngles).first(n));
+    uniforms->set(handles.spotDirection, std::span(this->spotDirection).first(n));
+    uniforms->set(handles.attenuation, this->attenuation);
+    uniforms->set(handles.activeLightCount, (std::int32_t)std::min(this->numLights,this->arraySize));
+}
+
+float LightCollection::radius(int i) const
+{
+    const vec4& ci = this->lightColorAndIntensity[i];
+    float brightest = std::max({ci.x,ci.y,ci.z}) * ci.w;
+
+    //solve brightest/(a0 + a1*D + a2*D*D) = LIGHT_CUTOFF for D
+    float a0 = this->attenuation.x;
+    float a1 = this->attenuation.y;
+    float a2 = this->attenuation.z;
+    float k = a0 - brightest/LIGHT_CUTOFF;
+    if( k >= 0.0f )
+        return 0.0f;        //never bright enough to see
+    if( a2 > 0.0f )
+        return (-a1 + std::sqrt(a1*a1 - 4.0f*a2*k)) / (2.0f*a2);
+    if( a1 > 0.0f )
+        return -k/a1;
+    return std::numeric_limits<float>::infinity();
+}
+
+
+void LightCollection::updateCullSpheres()
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    std::size_t n = (std::size_t)this->numLights;
+    std::size_t padded = (n + CULL_BATCH-1) / CULL_BATCH * CULL_BATCH;
+    this->cullX.assign(padded,0.0f);
+    this->cullY.assign(padded,0.0f);
+    this->cullZ.assign(padded,0.0f);
+    this->cullRadius.assign(padded,-inf);     //-inf: never inside
+
+    for(std::size_t i=0;i<n;++i){
+        const vec4& p = this->lightPositionAndDirectionalFlag[i];
+        if( p.w == 0.0f ){
+            this->cullRadius[i] = inf;        //directional: always inside
+            continue;
+        }
+        float r = this->radius((int)i);
+        if( r <= 0.0f )
+            continue;
+        vec3 c(p.x,p.y,p.z);
+
+        //a spotlight only lights a cone, so use the
+        //smallest sphere around the cone instead
+        float cosOuter = this->cosSpotAngles[i].y;
+        vec3 dir(this->spotDirection[i].x, this->spotDirection[i].y, this->spotDirection[i].z);
+        float dirLen = length(dir);
+        if( std::isfinite(r) && cosOuter > 0.0f && dirLen > 0.0f ){
+            dir = dir * (1.0f/dirLen);
+            if( cosOuter >= std::sqrt(0.5f) ){
+                //narrow: the sphere through the apex and the rim of the end cap
+                float t = r / (2.0f*cosOuter);
+                c = c + dir*t;
+                r = t;
+            } else {
+                //wide: the sphere around the rim of the end cap
+                c = c + dir*(r*cosOuter);
+                r = r*std::sqrt(1.0f-cosOuter*cosOuter);
+            }
+        }
+        this->cullX[i] = c.x;
+        this->cullY[i] = c.y;
+        this->cullZ[i] = c.z;
+        this->cullRadius[i] = r;
+    }
+    this->cullAttenuation = this->attenuation;
+    this->cullSpheresStale = false;
+}
+
+void LightCollection::setPosition(int i, vec4 position)
 {
-    uniforms->set("lightPositionAndDirectionalFlag",this->lightPositionAndDirectionalFlag);
-    uniforms->set("lightColorAndIntensity", this->lightColorAndIntensity);
-    uniforms->set("cosSpotAngles", this->cosSpotAngles);
-    uniforms->set("spotDirection", this->spotDirection);
-    uniforms->set("attenuation", vec3(150,0.0,0.15));
+    this->lightPositionAndDirectionalFlag[i] = position;
+    this->changed();
 }
 
+void LightCollection::setSpotDirection(int i, vec3 direction)
+{
+    this->spotDirection[i] = vec4(direction.x, direction.y, direction.z, 0.0f);
+    this->changed();
+}
+
+void LightCollection::changed()
+{
+    this->cullSpheresStale = true;
+}
+
+void LightCollection::cull(const Camera& camera, LightCollection& active)
+{
+    std::size_t n = (std::size_t)this->numLights;
+    if( this->cullSpheresStale ||
+            this->cullRadius.size() < n || this->cullRadius.size() >= n+CULL_BATCH ||
+            this->attenuation.x != this->cullAttenuation.x ||
+            this->attenuation.y != this->cullAttenuation.y ||
+            this->attenuation.z != this->cullAttenuation.z )
+        this->updateCullSpheres();
+
+    //clip = p*viewProjMatrix, so each frustum plane is a combination of
+    //its columns. Vulkan clips to -w<=x<=w, -w<=y<=w, 0<=z<=w.
+    const mat4& M = camera.viewProjMatrix;
+    vec4 col[4];
+    for(int j=0;j<4;++j)
+        col[j] = vec4(M[0][j],M[1][j],M[2][j],M[3][j]);
+    vec4 planes[6] = {
+        col[3]+col[0], col[3]-col[0],
+        col[3]+col[1], col[3]-col[1],
+        col[2], col[3]-col[2]
+    };
+    for(vec4& pl : planes){
+        pl = pl * (1.0f/length(vec3(pl.x,pl.y,pl.z)));
+    }
+
+    active.lightPositionAndDirectionalFlag.clear();
+    active.lightColorAndIntensity.clear();
+    active.cosSpotAngles.clear();
+    active.spotDirection.clear();
+    for(std::size_t b=0;b<this->cullRadius.size();b+=CULL_BATCH){
+        unsigned mask = insideFrustum(planes,
+            &this->cullX[b], &this->cullY[b], &this->cullZ[b], &this->cullRadius[b]);
+        for(std::size_t k=0;k<CULL_BATCH;++k){
+            if( !(mask & (1u<<k)) )
+                continue;
+            std::size_t i = b+k;
+            active.lightPositionAndDirectionalFlag.push_back(this->lightPositionAndDirectionalFlag[i]);
+            active.lightColorAndIntensity.push_back(this->lightColorAndIntensity[i]);
+            active.cosSpotAngles.push_back(this->cosSpotAngles[i]);
+            active.spotDirection.push_back(this->spotDirection[i]);
+        }
+    }
+
+    active.numLights = (int)active.lightPositionAndDirectionalFlag.size();
+    active.numCulled = this->numLights - active.numLights;
+    active.arraySize = this->arraySize;
+    active.attenuation = this->attenuation;
+    while( (int)active.lightPositionAndDirectionalFlag.size() < this->arraySize ){
+        active.lightPositionAndDirectionalFlag.push_back(vec4(0,0,0,1));
+        active.lightColorAndIntensity.push_back(vec4(0,0,0,0));
+        active.cosSpotAngles.push_back(vec4(0,0,0,0));
+        active.spotDirection.push_back(vec4(0,0,1,0));
+    }
+
+    this->stats.active += active.numLights;
+    this->stats.culled += active.numCulled;
+}
+
+LightCullStats LightCollection::cullStats() const
+{
+    return this->stats;
+}
@@ -1,8 +1,12 @@
 #pragma once
 #include "math2801.h"
+#include "UniformHandle.h"
 #include <string>
+#include <cstdint>
+#include <vector>
 
 class Uniforms;
+class Camera;
 
 namespace gltf{
     class GLTFScene;
@@ -55,6 +59,12 @@ class Light{
     
 };
 
+/// Light culling counts; see LightCollection::cullStats()
+struct LightCullStats{
+    unsigned long long active=0;    ///< Lights that could affect the view
+    unsigned long long culled=0;    ///< Lights that were left out
+};
+
 /// A collection of several lights
 class LightCollection{
   public:
@@ -64,15 +74,91 @@ class LightCollection{
     /// @param maxLights Maximum number of lights. If the scene
     ///         has more than this number of lights, the excess
     ///         will be discarded and a warning is printed.
+    /// @param arraySize Size of the light arrays in the uniforms.
     ///         If the scene has fewer than this number of lights,
     ///         additional lights with a color of (0,0,0) and
-    ///         an intensity of 0 are created.
-    LightCollection(const gltf::GLTFScene& scene, int maxLights);
+    ///         an intensity of 0 are created. It's the same as
+    ///         maxLights unless the shaders get the lights from somewhere
+    ///         else (see ClusteredLights).
+    LightCollection(const gltf::GLTFScene& scene, int maxLights, int arraySize);
     
-    /// Set the light uniforms
-    void setUniforms(Uniforms* uniforms);
+    /// Handles for the uniforms that setUniforms() sets
+    struct UniformHandles{
+        /// Handles that don't refer to anything
+        UniformHandles() = default;
+
+        /// Look up the light uniforms.
+        /// @param uniforms The Uniforms object they are in
+        UniformHandles(Uniforms* uniforms);
+
+        UniformHandle<std::vector<math2801::vec4>> lightPositionAndDirectionalFlag;  ///< lightPositionAndDirectionalFlag
+        UniformHandle<std::vector<math2801::vec4>> lightColorAndIntensity;           ///< lightColorAndIntensity
+        UniformHandle<std::vector<math2801::vec4>> cosSpotAngles;                    ///< cosSpotAngles
+        UniformHandle<std::vector<math2801::vec4>> spotDirection;                    ///< spotDirection
+        UniformHandle<math2801::vec3> attenuation;                                   ///< attenuation
+        UniformHandle<std::int32_t> activeLightCount;                                ///< activeLightCount
+    };
+
+    /// Set the light uniforms. If there are more than arraySize
+    /// lights (see the constructor), the arrays get the first
+    /// arraySize of them, and activeLightCount is arraySize.
+    /// @param uniforms The Uniforms object to use
+    /// @param handles Handles from the same Uniforms object
+    void setUniforms(Uniforms* uniforms, const UniformHandles& handles) const;
+
+    /// Distance from light i beyond which it adds less than
+    /// LIGHT_CUTOFF to any color channel, given attenuation.
+    /// @param i The light; must be positional
+    /// @return The distance; 0 if the light is black, or
+    ///     infinity if the light never fades out
+    float radius(int i) const;
+
+    /// Copy the lights that can affect what the camera sees to
+    /// active, in order; the others are culled. A light is kept if
+    /// its bounding sphere (from radius() and, for spotlights, the
+    /// cone) intersects the view frustum. Directional lights are
+    /// always kept. active's arrays are padded to arraySize if
+    /// the survivors fit. The tests are done four lights at a time.
+    /// @param camera The camera
+    /// @param active Receives the lights; its memory is reused, so
+    ///     it should be the same object from frame to frame
+    void cull(const Camera& camera, LightCollection& active);
+
+    /// Totals for every call to cull() so far
+    /// @return The totals
+    LightCullStats cullStats() const;
+
+    /// Move light i, so cull() rebuilds the bounding spheres.
+    /// @param i The light
+    /// @param position xyz = position; w=1 for positional, 0 for directional
+    void setPosition(int i, math2801::vec4 position);
+
+    /// Aim spotlight i, so cull() rebuilds the bounding spheres.
+    /// @param i The light
+    /// @param direction The spotlight direction
+    void setSpotDirection(int i, math2801::vec3 direction);
+
+    /// Say that the light arrays were changed directly; cull()
+    /// rebuilds the bounding spheres the next time it's called.
+    /// setPosition() and setSpotDirection() call this.
+    void changed();
+
+    /// Number of lights from the scene; the arrays may be
+    /// longer than this, but the rest of their entries are black.
+    int numLights;
+
+    /// Size of the light arrays in the uniforms
+    int arraySize;
+
+    /// Number of lights that cull() left out of this collection
+    int numCulled = 0;
+
+    /// Attenuation: Light at distance D is scaled by
+    /// 1/(x + y*D + z*D*D), clamped to 0...1
+    math2801::vec3 attenuation{150,0.0,0.15};
     
-    /// xyz = light position; w=1 for positional, 0 for directional
+    /// xyz = light position; w=1 for positional, 0 for directional.
+    /// If these arrays are written directly, call changed() afterwards.
     std::vector<math2801::vec4> lightPositionAndDirectionalFlag;
     
     /// xyz = light color (0...1); w=intensity
@@ -83,5 +169,16 @@ class LightCollection{
     
     /// xyz= spotlight direction
     std::vector<math2801::vec4> spotDirection;
+
+  private:
+    void updateCullSpheres();
+
+    //bounding spheres for cull(), as structure of arrays so they
+    //can be loaded four at a time. Padded to a multiple of four
+    //with spheres that are always culled.
+    std::vector<float> cullX, cullY, cullZ, cullRadius;
+    math2801::vec3 cullAttenuation;     //attenuation the spheres are for
+    bool cullSpheresStale = true;       //lights changed since they were made
+    LightCullStats stats;
 };
 
@@ -0,0 +1,970 @@
+#include "Lightmaps.h"
+#include "Buffers.h"
+#include "Descriptors.h"
+#include "ImageManager.h"
+#include "Images.h"
+#include "Light.h"
+#include "Meshes.h"
+#include "ShaderManager.h"
+#include "CleanupManager.h"
+#include "consoleoutput.h"
+#include "importantConstants.h"
+#include "gltf.h"
+#include "imagedecode.h"
+#include "imageencode.h"
+#include "timeutil.h"
+#include "utils.h"
+#include "math2801.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <random>
+#include <set>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace math2801;
+
+//change this when the bake changes, so old cache files aren't used
+static const std::uint32_t BAKE_VERSION = 1;
+
+//texels around the edge of each tile that only get copies of the
+//texels next to them, so filtering never reaches another tile
+static const unsigned TILE_PADDING = 2;
+
+//rays start this far (in world units) off the surface,
+//so they don't hit the triangle they start on
+static const float RAY_OFFSET = 0.001f;
+
+//texels a bake thread takes at a time
+static const std::size_t TEXELS_PER_JOB = 64;
+
+//most triangles in a leaf of the bounding volume hierarchy
+static const unsigned LEAF_SIZE = 4;
+
+//a texel that is this far inside (in barycentric coordinates) two
+//triangles of a primitive means the texture coordinates overlap
+static const float OVERLAP_MARGIN = 0.05f;
+
+static const float INFINITE_DISTANCE = std::numeric_limits<float>::infinity();
+
+//only used in this file; other files have types with the same names
+namespace{
+
+//what a surface does with the light that reaches it
+struct BakeMaterial{
+    vec3 reflectance;       //outgoing light per unit of incoming, as shade() computes it
+    vec3 emissive;          //emitted color
+};
+
+struct Triangle{
+    vec3 p0,e1,e2;          //world space: a corner and the edges from it
+    vec3 normal;            //unit length
+    unsigned material;
+};
+
+//a node of the bounding volume hierarchy. A leaf has count triangles,
+//starting at first; otherwise, its children are the next node and right.
+struct BVHNode{
+    vec3 lo,hi;
+    unsigned first=0, count=0, right=0;
+};
+
+struct BakeLight{
+    vec3 position;          //the direction to the light, if it's directional
+    float positional;       //1 or 0
+    vec3 color;             //times the intensity
+    float cosInner,cosOuter;
+    vec3 spotDirection;
+    float range;            //how far it reaches (see LightCollection::radius())
+};
+
+//everything the rays can hit and the lights that shine on it
+struct BakeScene{
+    std::vector<Triangle> triangles;
+    std::vector<BVHNode> nodes;
+    std::vector<BakeMaterial> materials;
+    std::vector<BakeLight> lights;
+    vec3 attenuation;
+};
+
+struct Ray{
+    vec3 origin, direction, inverseDirection;
+};
+
+//where one primitive's lightmap goes
+struct Tile{
+    unsigned mesh, primitive;
+    unsigned size;          //in texels, including the padding
+    unsigned x=0, y=0;
+    vec2 uvMin, uvMax;      //bounding box of its second texture coordinates
+    bool placed=false;
+};
+
+//a texel of the atlas that is on a surface
+struct Texel{
+    unsigned x,y;
+    vec3 position, normal;
+    float inside;           //smallest barycentric coordinate; negative if outside
+};
+
+//64 bit FNV-1a, over everything the bake depends on
+class BakeHash{
+  public:
+    std::uint64_t value = 14695981039346656037ull;
+
+    void add(const void* data, std::size_t size){
+        const unsigned char* p = (const unsigned char*)data;
+        for(std::size_t i=0;i<size;++i){
+            value ^= p[i];
+            value *= 1099511628211ull;
+        }
+    }
+
+    template<typename T>
+    void add(const T& x){
+        this->add(&x,sizeof(x));
+    }
+
+    template<typename T>
+    void add(const std::vector<T>& v){
+        this->add(v.size());
+        this->add(v.data(),v.size()*sizeof(T));
+    }
+
+    void add(std::span<const char> bytes){
+        this->add(bytes.size());
+        this->add(bytes.data(),bytes.size());
+    }
+
+    void add(const std::string& s){
+        this->add(s.size());
+        this->add(s.data(),s.size());
+    }
+
+    //images are named like ImageManager names them, so each
+    //one's data only has to be hashed the first time it's used
+    void add(const gltf::GLTFImage& img){
+        this->add(img.name);
+        if( this->images.insert(img.name).second )
+            this->add(img.bytes);
+    }
+
+  private:
+    std::set<std::string> images;
+};
+
+};  //namespace
+
+static VulkanContext* ctx;
+static bool enabled_ = false;
+static unsigned atlasSize;
+static unsigned minTileSize;
+static unsigned maxTileSize;
+static float texelsPerUnit;
+static unsigned samples;
+static unsigned bounces;
+static unsigned numThreads;
+static std::string cacheDirectory;
+
+static Image* atlas;
+static DeviceLocalBuffer* tileBuffer;
+
+static bool isPowerOfTwo(unsigned x)
+{
+    return x != 0 && (x & (x-1)) == 0;
+}
+
+static unsigned nextPowerOfTwo(float x)
+{
+    unsigned p = 1;
+    while( (float)p < x && p < (1u<<30) )
+        p *= 2;
+    return p;
+}
+
+//every other bit of v, packed together: one coordinate of a Morton code
+static unsigned compactBits(unsigned v)
+{
+    v &= 0x55555555u;
+    v = (v | (v >> 1)) & 0x33333333u;
+    v = (v | (v >> 2)) & 0x0f0f0f0fu;
+    v = (v | (v >> 4)) & 0x00ff00ffu;
+    v = (v | (v >> 8)) & 0x0000ffffu;
+    return v;
+}
+
+//GLSL's smoothstep. Lights that aren't spotlights have both
+//edges at -1; then the shaders get 1 everywhere past the edge.
+static float smoothstep(float edge0, float edge1, float x)
+{
+    if( edge0 >= edge1 )
+        return x < edge0 ? 0.0f : 1.0f;
+    float t = std::clamp( (x-edge0)/(edge1-edge0), 0.0f, 1.0f );
+    return t*t*(3.0f-2.0f*t);
+}
+
+static vec3 transformPoint(const vec3& p, const mat4& M)
+{
+    return (vec4(p.x,p.y,p.z,1.0f) * M).xyz();
+}
+
+//like main.frag, normals are transformed by the world matrix itself
+static vec3 transformNormal(const vec3& n, const mat4& M)
+{
+    return (vec4(n.x,n.y,n.z,0.0f) * M).xyz();
+}
+
+//average color of an encoded image; they're cached by name
+//because many materials share textures
+static vec4 averageColor(const gltf::GLTFImage& img, std::map<std::string,vec4>& averages)
+{
+    if( img.bytes.empty() )
+        return vec4(1,1,1,1);
+    auto it = averages.find(img.name);
+    if( it != averages.end() )
+        return it->second;
+
+    auto tmp = imagedecode::decode(img.bytes);
+    const std::vector<char>& pix = std::get<3>(tmp);
+    double sum[4] = {0,0,0,0};
+    std::size_t numPixels = pix.size()/4;
+    for(std::size_t i=0;i<numPixels;++i){
+        for(int j=0;j<4;++j)
+            sum[j] += (unsigned char)pix[i*4+j];
+    }
+    vec4 avg(1,1,1,1);
+    if( numPixels > 0 ){
+        avg = vec4( float(sum[0]/numPixels), float(sum[1]/numPixels),
+                    float(sum[2]/numPixels), float(sum[3]/numPixels) ) / 255.0f;
+    }
+    averages[img.name] = avg;
+    return avg;
+}
+
+//the material's textures are averaged: the rays
+//don't know where in the textures they hit
+static BakeMaterial makeMaterial(const gltf::GLTFMaterial& mtl, std::map<std::string,vec4>& averages)
+{
+    const gltf::GLTFPBRMetallicRoughness& pbr = mtl.pbrMetallicRoughness;
+    vec3 c = pbr.baseColorFactor.xyz() * averageColor(pbr.baseColorTexture.texture.source,averages).xyz();
+    float MF = pbr.metallicFactor * averageColor(pbr.metallicRoughnessTexture.texture.source,averages).z;
+    vec3 e = mtl.emissiveFactor * averageColor(mtl.emissiveTexture.texture.source,averages).xyz();
+
+    //shade()'s diffuse term for a lightmap (see shaders/lighting.txt),
+    //so bounced light is as bright as the surface looks
+    vec3 Fzero = vec3(0.04f,0.04f,0.04f)*(1.0f-MF) + c*MF;
+    vec3 d = 0.96f*c*(1.0f-MF)/pi;
+    BakeMaterial m;
+    m.reflectance = (vec3(1,1,1)-Fzero) * d * c * c;
+    m.emissive = e;
+    return m;
+}
+
+static unsigned buildNode(BakeScene& s, std::vector<unsigned>& order,
+                          const std::vector<vec3>& centroids, unsigned first, unsigned count)
+{
+    unsigned index = (unsigned)s.nodes.size();
+    s.nodes.push_back(BVHNode{});
+
+    vec3 lo( INFINITE_DISTANCE, INFINITE_DISTANCE, INFINITE_DISTANCE);
+    vec3 hi(-INFINITE_DISTANCE,-INFINITE_DISTANCE,-INFINITE_DISTANCE);
+    vec3 clo = lo;
+    vec3 chi = hi;
+    for(unsigned i=first;i<first+count;++i){
+        const Triangle& t = s.triangles[order[i]];
+        vec3 p1 = t.p0 + t.e1;
+        vec3 p2 = t.p0 + t.e2;
+        lo = min(lo,min(t.p0,min(p1,p2)));
+        hi = max(hi,max(t.p0,max(p1,p2)));
+        clo = min(clo,centroids[order[i]]);
+        chi = max(chi,centroids[order[i]]);
+    }
+    s.nodes[index].lo = lo;
+    s.nodes[index].hi = hi;
+
+    if( count <= LEAF_SIZE ){
+        s.nodes[index].first = first;
+        s.nodes[index].count = count;
+        return index;
+    }
+
+    //split at the median along the axis the centroids spread the most
+    vec3 extent = chi-clo;
+    int axis = 0;
+    if( extent.y > extent.x )
+        axis = 1;
+    if( extent.z > extent[axis] )
+        axis = 2;
+    unsigned half = count/2;
+    std::nth_element( order.begin()+first, order.begin()+first+half, order.begin()+first+count,
+        [&centroids,axis](unsigned a, unsigned b){
+            return centroids[a][axis] < centroids[b][axis];
+        }
+    );
+    buildNode(s,order,centroids,first,half);
+    unsigned right = buildNode(s,order,centroids,first+half,count-half);
+    s.nodes[index].right = right;
+    return index;
+}
+
+static void buildHierarchy(BakeScene& s)
+{
+    if( s.triangles.empty() )
+        return;
+    std::vector<vec3> centroids;
+    std::vector<unsigned> order;
+    for(unsigned i=0;i<(unsigned)s.triangles.size();++i){
+        const Triangle& t = s.triangles[i];
+        centroids.push_back( t.p0 + (t.e1+t.e2)/3.0f );
+        order.push_back(i);
+    }
+    buildNode(s,order,centroids,0,(unsigned)order.size());
+
+    //put the triangles in leaf order
+    std::vector<Triangle> sorted;
+    sorted.reserve(order.size());
+    for(unsigned i : order)
+        sorted.push_back(s.triangles[i]);
+    s.triangles.swap(sorted);
+}
+
+static Ray makeRay(const vec3& origin, const vec3& direction)
+{
+    Ray r;
+    r.origin = origin;
+    r.direction = direction;
+    //IEEE division gives infinity for zero components, which the slab test handles
+    r.inverseDirection = vec3(1.0f/direction.x, 1.0f/direction.y, 1.0f/direction.z);
+    return r;
+}
+
+static bool hitBox(const BVHNode& n, const Ray& r, float tmax)
+{
+    float t0 = 0.0f;
+    float t1 = tmax;
+    for(int i=0;i<3;++i){
+        float a = (n.lo[i] - r.origin[i]) * r.inverseDirection[i];
+        float b = (n.hi[i] - r.origin[i]) * r.inverseDirection[i];
+        if( a > b )
+            std::swap(a,b);
+        t0 = std::max(t0,a);
+        t1 = std::min(t1,b);
+        if( t0 > t1 )
+            return false;
+    }
+    return true;
+}
+
+//Moller-Trumbore
+static bool hitTriangle(const Triangle& t, const Ray& r, float tmax, float& tHit)
+{
+    vec3 p = cross(r.direction,t.e2);
+    float det = dot(t.e1,p);
+    if( std::fabs(det) < 1e-12f )
+        return false;
+    float inv = 1.0f/det;
+    vec3 s = r.origin - t.p0;
+    float u = dot(s,p) * inv;
+    if( u < 0.0f || u > 1.0f )
+        return false;
+    vec3 q = cross(s,t.e1);
+    float v = dot(r.direction,q) * inv;
+    if( v < 0.0f || u+v > 1.0f )
+        return false;
+    float d = dot(t.e2,q) * inv;
+    if( d <= 0.0f || d >= tmax )
+        return false;
+    tHit = d;
+    return true;
+}
+
+//the nearest triangle the ray hits closer than tmax, or -1 if none.
+//If anyHit is true, stop at the first one found.
+static int trace(const BakeScene& s, const Ray& r, float tmax, bool anyHit, float& tHit)
+{
+    int hit = -1;
+    tHit = tmax;
+    if( s.nodes.empty() )
+        return hit;
+    unsigned stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while( top > 0 ){
+        unsigned ni = stack[--top];
+        const BVHNode& n = s.nodes[ni];
+        if( !hitBox(n,r,tHit) )
+            continue;
+        if( n.count > 0 ){
+            for(unsigned i=n.first;i<n.first+n.count;++i){
+                float t;
+                if( hitTriangle(s.triangles[i],r,tHit,t) ){
+                    tHit = t;
+                    hit = (int)i;
+                    if( anyHit )
+                        return hit;
+                }
+            }
+        } else {
+            stack[top++] = n.right;
+            stack[top++] = ni+1;
+        }
+    }
+    return hit;
+}
+
+//the light that reaches a point straight from the lights: the part of
+//computeLightContribution() (shaders/lighting.txt) that doesn't depend
+//on the viewer or the material, with shadows from every triangle
+static vec3 directLight(const BakeScene& s, const vec3& P, const vec3& N)
+{
+    vec3 total(0,0,0);
+    vec3 origin = P + N*RAY_OFFSET;
+    for(const BakeLight& L : s.lights){
+        vec3 toLight = L.position - P*L.positional;
+        float D = length(toLight);
+        if( D == 0.0f || D > L.range )
+            continue;
+        toLight = toLight / D;
+        float cosNL = dot(N,toLight);
+        if( cosNL <= 0.0f )
+            continue;
+        float SA = smoothstep(L.cosOuter, L.cosInner, dot(-toLight,L.spotDirection));
+        if( SA <= 0.0f )
+            continue;
+        float A = 1.0f/(s.attenuation.x + D*(s.attenuation.y + D*s.attenuation.z));
+        A = std::clamp(A,0.0f,1.0f);
+        float tHit;
+        float tmax = (L.positional != 0.0f ? D : INFINITE_DISTANCE);
+        if( trace(s, makeRay(origin,toLight), tmax, true, tHit) >= 0 )
+            continue;
+        total += cosNL * A * SA * L.color;
+    }
+    return total;
+}
+
+//a direction above N, more likely the closer it is to N
+static vec3 cosineDirection(const vec3& N, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> uniform01(0.0f,1.0f);
+    float u1 = uniform01(rng);
+    float u2 = uniform01(rng);
+    float r = std::sqrt(u1);
+    float phi = 2.0f*pi*u2;
+    vec3 T = normalize( cross( std::fabs(N.x) > 0.5f ? vec3(0,1,0) : vec3(1,0,0), N ) );
+    vec3 B = cross(N,T);
+    return normalize( T*(r*std::cos(phi)) + B*(r*std::sin(phi)) + N*std::sqrt(std::max(0.0f,1.0f-u1)) );
+}
+
+//the light arriving at P from a random direction above N that
+//bounced off another surface at most 'depth' times.
+//Nothing arrives from the sky: the ambient term isn't baked.
+static vec3 bouncedLight(const BakeScene& s, const vec3& P, const vec3& N,
+                         unsigned depth, std::mt19937& rng)
+{
+    Ray r = makeRay(P + N*RAY_OFFSET, cosineDirection(N,rng));
+    float t;
+    int hit = trace(s, r, INFINITE_DISTANCE, false, t);
+    if( hit < 0 )
+        return vec3(0,0,0);
+
+    const Triangle& tri = s.triangles[hit];
+    vec3 Q = r.origin + r.direction*t;
+    vec3 M = tri.normal;
+    if( dot(M,r.direction) > 0.0f )
+        M = -M;                         //the side the ray hit
+    vec3 E = directLight(s,Q,M);
+    if( depth > 1 )
+        E += pi * bouncedLight(s,Q,M,depth-1,rng);
+
+    //like shade(), the reflected light is clamped before the emitted light is added
+    const BakeMaterial& m = s.materials[tri.material];
+    return min( m.reflectance*E, vec3(1,1,1) ) + m.emissive;
+}
+
+static vec3 bakeTexel(const BakeScene& s, const Texel& tx, std::mt19937& rng)
+{
+    vec3 E = directLight(s,tx.position,tx.normal);
+    if( samples == 0 || bounces == 0 )
+        return E;
+    //the directions are cosine weighted, so the
+    //cosine and the 1/pi of the integral cancel
+    vec3 indirect(0,0,0);
+    for(unsigned i=0;i<samples;++i)
+        indirect += bouncedLight(s,tx.position,tx.normal,bounces,rng);
+    return E + indirect * (pi/samples);
+}
+
+//the tiles' sizes: a power of two, from the primitive's area. If
+//they don't all fit in the atlas, they're all halved until they do
+//(or are as small as they can be); then they're packed largest
+//first. A run of squares whose sizes are powers of two, largest
+//first, fills the atlas in Morton order without gaps.
+static void placeTiles(std::vector<Tile>& tiles, const std::vector<float>& areas)
+{
+    unsigned long long total = 0;
+    for(std::size_t i=0;i<tiles.size();++i){
+        float side = std::sqrt(areas[i]) * texelsPerUnit + 2*TILE_PADDING;
+        tiles[i].size = std::clamp(nextPowerOfTwo(side), minTileSize, maxTileSize);
+        total += (unsigned long long)tiles[i].size * tiles[i].size;
+    }
+    unsigned long long capacity = (unsigned long long)atlasSize * atlasSize;
+    bool shrunk = false;
+    while( total > capacity ){
+        total = 0;
+        bool smaller = false;
+        for(Tile& t : tiles){
+            if( t.size > minTileSize ){
+                t.size /= 2;
+                smaller = true;
+            }
+            total += (unsigned long long)t.size * t.size;
+        }
+        if( !smaller )
+            break;
+        shrunk = true;
+    }
+    if( shrunk )
+        warn("Lightmaps: The tiles don't fit in the atlas at lightmapTexelsPerUnit; they were made smaller");
+
+    std::vector<Tile*> sorted;
+    for(Tile& t : tiles)
+        sorted.push_back(&t);
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Tile* a, const Tile* b){
+        return a->size > b->size;
+    });
+    unsigned long long used = 0;
+    unsigned dropped = 0;
+    for(Tile* t : sorted){
+        unsigned long long area = (unsigned long long)t->size * t->size;
+        if( used + area > capacity ){
+            ++dropped;
+            continue;
+        }
+        unsigned k = (unsigned)(used / area);
+        t->x = compactBits(k) * t->size;
+        t->y = compactBits(k >> 1) * t->size;
+        t->placed = true;
+        used += area;
+    }
+    if( dropped > 0 )
+        warn("Lightmaps:",dropped,"primitives don't fit in the atlas; they have no lightmap");
+}
+
+//the atlas texels that the primitive's triangles cover, found
+//by rasterizing them in its second texture coordinates
+static unsigned rasterizeTile(const Tile& tile, const gltf::GLTFPrimitive& p, const mat4& M,
+                              std::vector<int>& owner, std::vector<Texel>& texels)
+{
+    unsigned inner = tile.size - 2*TILE_PADDING;
+    vec2 range = tile.uvMax - tile.uvMin;
+    unsigned overlaps = 0;
+    for(std::size_t i=0;i+2<p.indices.size();i+=3){
+        std::uint32_t v[3] = { p.indices[i], p.indices[i+1], p.indices[i+2] };
+        vec2 q[3];
+        for(int j=0;j<3;++j)
+            q[j] = (p.textureCoordinates2[v[j]] - tile.uvMin) / range * (float)inner;
+        float area = (q[1].x-q[0].x)*(q[2].y-q[0].y) - (q[2].x-q[0].x)*(q[1].y-q[0].y);
+        if( std::fabs(area) < 1e-12f )
+            continue;
+
+        vec3 P[3], N[3];
+        for(int j=0;j<3;++j)
+            P[j] = transformPoint(p.positions[v[j]],M);
+        vec3 faceNormal = normalize(cross(P[1]-P[0],P[2]-P[0]));
+        for(int j=0;j<3;++j)
+            N[j] = p.normals.size() != p.positions.size() ? faceNormal : transformNormal(p.normals[v[j]],M);
+
+        float xmin = std::min({q[0].x,q[1].x,q[2].x});
+        float xmax = std::max({q[0].x,q[1].x,q[2].x});
+        float ymin = std::min({q[0].y,q[1].y,q[2].y});
+        float ymax = std::max({q[0].y,q[1].y,q[2].y});
+        int x0 = std::max(0, (int)std::floor(xmin));
+        int x1 = std::min((int)inner-1, (int)std::ceil(xmax));
+        int y0 = std::max(0, (int)std::floor(ymin));
+        int y1 = std::min((int)inner-1, (int)std::ceil(ymax));
+        for(int y=y0;y<=y1;++y){
+            for(int x=x0;x<=x1;++x){
+                vec2 c(x+0.5f, y+0.5f);
+                float w0 = ((q[1].x-c.x)*(q[2].y-c.y) - (q[2].x-c.x)*(q[1].y-c.y)) / area;
+                float w1 = ((q[2].x-c.x)*(q[0].y-c.y) - (q[0].x-c.x)*(q[2].y-c.y)) / area;
+                float w2 = 1.0f-w0-w1;
+                float inside = std::min({w0,w1,w2});
+                if( inside < 0.0f )
+                    continue;
+                unsigned ax = tile.x + TILE_PADDING + (unsigned)x;
+                unsigned ay = tile.y + TILE_PADDING + (unsigned)y;
+                int& o = owner[(std::size_t)ay*atlasSize+ax];
+                if( o >= 0 ){
+                    if( inside > OVERLAP_MARGIN && texels[o].inside > OVERLAP_MARGIN )
+                        ++overlaps;
+                    continue;
+                }
+                o = (int)texels.size();
+                Texel t;
+                t.x = ax;
+                t.y = ay;
+                t.position = w0*P[0] + w1*P[1] + w2*P[2];
+                t.normal = normalize(w0*N[0] + w1*N[1] + w2*N[2]);
+                t.inside = inside;
+                texels.push_back(t);
+            }
+        }
+    }
+    return overlaps;
+}
+
+//give the texels of a tile that no triangle covers the average
+//of their covered neighbors, a ring at a time, so filtering at
+//the edges of the triangles doesn't pick up black
+static void dilate(const Tile& tile, std::vector<vec3>& light, std::vector<char>& covered)
+{
+    std::vector< std::pair<std::size_t,vec3> > added;
+    for(unsigned ring=0;ring<=TILE_PADDING;++ring){
+        added.clear();
+        for(unsigned y=tile.y;y<tile.y+tile.size;++y){
+            for(unsigned x=tile.x;x<tile.x+tile.size;++x){
+                std::size_t i = (std::size_t)y*atlasSize+x;
+                if( covered[i] )
+                    continue;
+                vec3 sum(0,0,0);
+                int n = 0;
+                for(int dy=-1;dy<=1;++dy){
+                    for(int dx=-1;dx<=1;++dx){
+                        int nx = (int)x+dx;
+                        int ny = (int)y+dy;
+                        if( nx < (int)tile.x || ny < (int)tile.y ||
+                            nx >= (int)(tile.x+tile.size) || ny >= (int)(tile.y+tile.size) )
+                            continue;
+                        std::size_t j = (std::size_t)ny*atlasSize+(std::size_t)nx;
+                        if( covered[j] ){
+                            sum += light[j];
+                            ++n;
+                        }
+                    }
+                }
+                if( n > 0 )
+                    added.push_back(std::make_pair(i,sum/(float)n));
+            }
+        }
+        for(auto& a : added){
+            light[a.first] = a.second;
+            covered[a.first] = 1;
+        }
+    }
+}
+
+static void encodeRGBM(const vec3& c, char* out)
+{
+    float range = (float)LIGHTMAP_RGBM_RANGE;
+    float m = std::max({c.x,c.y,c.z,0.0f}) / range;
+    m = std::ceil( std::min(m,1.0f) * 255.0f ) / 255.0f;
+    if( m == 0.0f ){
+        out[0] = out[1] = out[2] = out[3] = 0;
+        return;
+    }
+    for(int i=0;i<3;++i){
+        float v = std::clamp( c[i]/(m*range), 0.0f, 1.0f );
+        out[i] = (char)(unsigned char)std::lround(v*255.0f);
+    }
+    out[3] = (char)(unsigned char)std::lround(m*255.0f);
+}
+
+//path trace every texel, several at a time; returns the atlas as RGBM
+static std::vector<char> bake(const BakeScene& s, const std::vector<Tile>& tiles,
+                              const std::vector<Texel>& texels)
+{
+    std::size_t numTexels = (std::size_t)atlasSize*atlasSize;
+    std::vector<vec3> light(numTexels, vec3(0,0,0));
+    std::vector<char> covered(numTexels, 0);
+
+    std::size_t numJobs = (texels.size() + TEXELS_PER_JOB-1) / TEXELS_PER_JOB;
+    std::atomic<std::size_t> nextJob(0);
+    auto work = [&](){
+        for(;;){
+            std::size_t job = nextJob.fetch_add(1);
+            if( job >= numJobs )
+                return;
+            //seeded by the job, so the result doesn't depend on the threads
+            std::mt19937 rng( (std::uint32_t)(job*2654435761u + BAKE_VERSION) );
+            std::size_t end = std::min(texels.size(), (job+1)*TEXELS_PER_JOB);
+            for(std::size_t i=job*TEXELS_PER_JOB;i<end;++i){
+                const Texel& t = texels[i];
+                std::size_t j = (std::size_t)t.y*atlasSize+t.x;
+                light[j] = bakeTexel(s,t,rng);
+                covered[j] = 1;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for(unsigned i=1;i<numThreads;++i)
+        threads.emplace_back(work);
+    work();
+    for(std::thread& t : threads)
+        t.join();
+
+    for(const Tile& t : tiles){
+        if( t.placed )
+            dilate(t,light,covered);
+    }
+
+    std::vector<char> pix(numTexels*4);
+    for(std::size_t i=0;i<numTexels;++i)
+        encodeRGBM(light[i], pix.data()+i*4);
+    return pix;
+}
+
+namespace Lightmaps{
+
+bool initialized()
+{
+    return ctx != nullptr;
+}
+
+void initialize(VulkanContext* ctx_)
+{
+    if(initialized())
+        return;
+    ctx=ctx_;
+
+    enabled_ = (ctx->config.get("lightmaps","no") == "yes");
+    if( !enabled_ )
+        return;
+
+    int size = std::stoi(ctx->config.get("lightmapAtlasSize","2048"));
+    int minTile = std::stoi(ctx->config.get("lightmapMinTileSize","16"));
+    int maxTile = std::stoi(ctx->config.get("lightmapMaxTileSize","512"));
+    int numSamples = std::stoi(ctx->config.get("lightmapSamples","64"));
+    int numBounces = std::stoi(ctx->config.get("lightmapBounces","2"));
+    int n = std::stoi(ctx->config.get("lightmapThreads","0"));
+    texelsPerUnit = std::stof(ctx->config.get("lightmapTexelsPerUnit","16"));
+    cacheDirectory = ctx->config.get("lightmapCache","lightmaps");
+    if( size <= 0 || !isPowerOfTwo((unsigned)size) )
+        throw std::runtime_error("lightmapAtlasSize must be a power of two");
+    if( minTile <= (int)(2*TILE_PADDING) || !isPowerOfTwo((unsigned)minTile) ||
+            maxTile <= 0 || !isPowerOfTwo((unsigned)maxTile) ||
+            minTile > maxTile || maxTile > size )
+        throw std::runtime_error("lightmapMinTileSize and lightmapMaxTileSize must be powers of two, "
+            "with "+std::to_string(2*TILE_PADDING)+" < lightmapMinTileSize <= "
+            "lightmapMaxTileSize <= lightmapAtlasSize");
+    if( numSamples < 0 || numBounces < 0 )
+        throw std::runtime_error("lightmapSamples and lightmapBounces must be zero or positive");
+    if( n < 0 )
+        throw std::runtime_error("lightmapThreads must be zero or positive");
+    if( !(texelsPerUnit > 0.0f) )
+        throw std::runtime_error("lightmapTexelsPerUnit must be positive");
+    atlasSize = (unsigned)size;
+    minTileSize = (unsigned)minTile;
+    maxTileSize = (unsigned)maxTile;
+    samples = (unsigned)numSamples;
+    bounces = (unsigned)numBounces;
+    if( n == 0 )
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    else
+        numThreads = (unsigned)n;
+
+    ShaderManager::define("LIGHTMAPS","1");
+
+    verbose("Lightmaps:",atlasSize,"x",atlasSize,"atlas; tiles from",minTileSize,"to",
+        maxTileSize,"texels;",samples,"samples and",bounces,"bounces per texel");
+}
+
+bool enabled()
+{
+    return enabled_;
+}
+
+void createResources(const gltf::GLTFScene& scene, const std::vector<Mesh*>& meshes)
+{
+    if( !enabled_ )
+        throw std::runtime_error("Lightmaps::createResources(): Not enabled");
+    if( atlas )
+        throw std::runtime_error("Lightmaps::createResources(): Already called");
+    if( meshes.size() != scene.meshes.size() )
+        throw std::runtime_error("Lightmaps::createResources(): The meshes don't match the scene");
+
+    //every light, even if there are more than the shaders' arrays hold
+    int numLights = (int)scene.lights.size();
+    LightCollection lights(scene, numLights, numLights);
+
+    BakeHash hash;
+    hash.add(BAKE_VERSION);
+    hash.add(atlasSize);
+    hash.add(minTileSize);
+    hash.add(maxTileSize);
+    hash.add(texelsPerUnit);
+    hash.add(samples);
+    hash.add(bounces);
+    hash.add(lights.attenuation);
+    hash.add(lights.lightPositionAndDirectionalFlag);
+    hash.add(lights.lightColorAndIntensity);
+    hash.add(lights.cosSpotAngles);
+    hash.add(lights.spotDirection);
+
+    //the tiles, from the primitives' areas
+    std::vector<Tile> tiles;
+    std::vector<float> areas;
+    for(unsigned mi=0;mi<(unsigned)scene.meshes.size();++mi){
+        const gltf::GLTFMesh& gm = scene.meshes[mi];
+        hash.add(gm.matrix);
+        if( meshes[mi]->primitives.size() != gm.primitives.size() )
+            throw std::runtime_error("Lightmaps::createResources(): The meshes don't match the scene");
+        for(unsigned pi=0;pi<(unsigned)gm.primitives.size();++pi){
+            const gltf::GLTFPrimitive& p = gm.primitives[pi];
+            const gltf::GLTFMaterial& mtl = p.material;
+            hash.add(p.indices);
+            hash.add(p.positions);
+            hash.add(p.normals);
+            hash.add(p.textureCoordinates2);
+            hash.add(mtl.pbrMetallicRoughness.baseColorFactor);
+            hash.add(mtl.pbrMetallicRoughness.metallicFactor);
+            hash.add(mtl.emissiveFactor);
+            hash.add(mtl.pbrMetallicRoughness.baseColorTexture.texture.source);
+            hash.add(mtl.pbrMetallicRoughness.metallicRoughnessTexture.texture.source);
+            hash.add(mtl.emissiveTexture.texture.source);
+
+            if( p.indices.empty() || p.textureCoordinates2.size() != p.positions.size() )
+                continue;
+            Tile t;
+            t.mesh = mi;
+            t.primitive = pi;
+            t.uvMin = p.textureCoordinates2[0];
+            t.uvMax = p.textureCoordinates2[0];
+            for(const vec2& uv : p.textureCoordinates2){
+                t.uvMin = vec2( std::min(t.uvMin.x,uv.x), std::min(t.uvMin.y,uv.y) );
+                t.uvMax = vec2( std::max(t.uvMax.x,uv.x), std::max(t.uvMax.y,uv.y) );
+            }
+            if( t.uvMax.x - t.uvMin.x < 1e-6f || t.uvMax.y - t.uvMin.y < 1e-6f )
+                continue;
+            float area = 0.0f;
+            for(std::size_t i=0;i+2<p.indices.size();i+=3){
+                vec3 a = transformPoint(p.positions[p.indices[i]],gm.matrix);
+                vec3 b = transformPoint(p.positions[p.indices[i+1]],gm.matrix);
+                vec3 c = transformPoint(p.positions[p.indices[i+2]],gm.matrix);
+                area += 0.5f * length(cross(b-a,c-a));
+            }
+            tiles.push_back(t);
+            areas.push_back(area);
+        }
+    }
+    placeTiles(tiles,areas);
+
+    //entry 0 is for primitives without a lightmap
+    std::vector<vec4> tileData(1, vec4(0,0,0,0));
+    for(const Tile& t : tiles){
+        if( !t.placed )
+            continue;
+        float inner = float(t.size - 2*TILE_PADDING);
+        vec2 scale = vec2(inner,inner) / ((t.uvMax - t.uvMin) * (float)atlasSize);
+        vec2 offset = vec2( float(t.x+TILE_PADDING), float(t.y+TILE_PADDING) ) / (float)atlasSize
+                      - t.uvMin*scale;
+        meshes[t.mesh]->primitives[t.primitive]->lightmapIndex = (std::uint32_t)tileData.size();
+        tileData.push_back(vec4(scale.x, scale.y, offset.x, offset.y));
+    }
+
+    std::ostringstream oss;
+    oss << "lightmap-" << std::hex << std::setw(16) << std::setfill('0') << hash.value << ".png";
+    std::string filename = (std::filesystem::path(cacheDirectory) / oss.str()).string();
+
+    if( std::filesystem::exists(filename) ){
+        atlas = ImageManager::load(filename);
+        if( atlas->width != atlasSize || atlas->height != atlasSize )
+            throw std::runtime_error("Lightmap "+filename+" is the wrong size; delete it to bake it again");
+        verbose("Lightmaps: Loaded",filename);
+    } else {
+        double start = timeutil::time_sec();
+
+        //the triangles the rays can hit, with the materials averaged
+        BakeScene s;
+        s.attenuation = lights.attenuation;
+        std::map<std::string,vec4> averages;
+        for(const gltf::GLTFMesh& gm : scene.meshes){
+            for(const gltf::GLTFPrimitive& p : gm.primitives){
+                unsigned material = (unsigned)s.materials.size();
+                s.materials.push_back(makeMaterial(p.material,averages));
+                for(std::size_t i=0;i+2<p.indices.size();i+=3){
+                    vec3 a = transformPoint(p.positions[p.indices[i]],gm.matrix);
+                    vec3 b = transformPoint(p.positions[p.indices[i+1]],gm.matrix);
+                    vec3 c = transformPoint(p.positions[p.indices[i+2]],gm.matrix);
+                    vec3 n = cross(b-a,c-a);
+                    if( length(n) == 0.0f )
+                        continue;
+                    s.triangles.push_back(Triangle{a, b-a, c-a, normalize(n), material});
+                }
+            }
+        }
+        buildHierarchy(s);
+
+        for(int i=0;i<lights.numLights;++i){
+            const vec4& pos = lights.lightPositionAndDirectionalFlag[i];
+            const vec4& col = lights.lightColorAndIntensity[i];
+            BakeLight L;
+            L.position = pos.xyz();
+            L.positional = pos.w;
+            L.color = col.xyz() * col.w;
+            L.cosInner = lights.cosSpotAngles[i].x;
+            L.cosOuter = lights.cosSpotAngles[i].y;
+            L.spotDirection = lights.spotDirection[i].xyz();
+            L.range = (pos.w != 0.0f ? lights.radius(i) : INFINITE_DISTANCE);
+            s.lights.push_back(L);
+        }
+
+        //the texels to bake
+        std::vector<int> owner((std::size_t)atlasSize*atlasSize, -1);
+        std::vector<Texel> texels;
+        unsigned overlaps = 0;
+        for(const Tile& t : tiles){
+            if( t.placed ){
+                overlaps += rasterizeTile(t, scene.meshes[t.mesh].primitives[t.primitive],
+                    scene.meshes[t.mesh].matrix, owner, texels);
+            }
+        }
+        if( overlaps > 0 )
+            warn("Lightmaps:",overlaps,"texels are covered by more than one triangle of a primitive;"
+                " its second texture coordinates overlap");
+
+        print("Lightmaps: Baking",texels.size(),"texels,",s.triangles.size(),"triangles and",
+            s.lights.size(),"lights on",numThreads,"threads");
+        std::vector<char> pix = bake(s,tiles,texels);
+        print("Lightmaps: Baked in",timeutil::time_sec()-start,"seconds");
+
+        std::vector<char> png = imageencode::encodePNG(atlasSize, atlasSize, "RGBA8", pix);
+        std::filesystem::create_directories(cacheDirectory);
+        std::ofstream out(filename,std::ios::binary);
+        if( out.good() ){
+            out.write( png.data(), png.size() );
+            out.close();
+        }
+        if( !out.good() )
+            warn("Lightmaps: Cannot write",filename,"; it will be baked again next time");
+        atlas = ImageManager::loadFromData(png,filename);
+    }
+
+    tileBuffer = new DeviceLocalBuffer(ctx, tileData,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, "lightmap tiles");
+
+    CleanupManager::registerCleanupFunction([](){
+        tileBuffer->cleanup();
+    });
+
+    verbose("Lightmaps:",tileData.size()-1,"primitives have lightmaps");
+}
+
+void setSlots(DescriptorSet* descriptorSet)
+{
+    if( !atlas )
+        throw std::runtime_error("Lightmaps::setSlots(): createResources() hasn't been called");
+    descriptorSet->setSlot(LIGHTMAP_TEXTURE_SLOT, atlas->view());
+    descriptorSet->setSlot(LIGHTMAP_BUFFER_SLOT, tileBuffer->buffer);
+}
+
+};  //namespace
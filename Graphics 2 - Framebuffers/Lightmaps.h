@@ -0,0 +1,55 @@
+#pragma once
+#include "vkhelpers.h"
+#include <vector>
+
+class DescriptorSet;
+class Mesh;
+
+namespace gltf{
+    class GLTFScene;
+};
+
+/// Lightmaps: the diffuse light that the scene's lights (which never
+/// move) put on its meshes, baked ahead of time into one RGBM atlas,
+/// so surfaces with a lightmap don't loop over the lights at all.
+/// Each primitive with second texture coordinates gets a square,
+/// padded tile of the atlas; its size is a power of two that grows
+/// with the primitive's surface area. The bake is a path tracer
+/// that runs on the CPU, on several threads: each texel gets the
+/// light that reaches it directly (with shadows), plus the light
+/// bounced off other surfaces. The atlas is written to a PNG in
+/// the cache directory, named by a hash of everything the bake
+/// depends on, so a scene is only baked once.
+/// The light is diffuse only: the static lights' highlights are lost.
+/// Shaders are compiled with LIGHTMAPS defined; see importantConstants.h
+/// for the tile buffer layout. If lightmaps=no in config.ini,
+/// enabled() is false and every surface loops over the lights.
+namespace Lightmaps{
+
+/// Initialize the subsystem. This must be called before
+/// any shaders that use the lightmaps are loaded.
+/// @param ctx The context
+void initialize(VulkanContext* ctx);
+
+/// Return true if subsystem was initialized
+/// @return True if initialized; false if not
+bool initialized();
+
+/// True if the meshes have lightmaps.
+/// @return True if enabled
+bool enabled();
+
+/// Lay out the atlas, set each primitive's lightmapIndex, and load
+/// the atlas from the cache, baking it first if it isn't there.
+/// This must be called once, after initialize() and before
+/// ImageManager::pushToGPU(), if enabled().
+/// @param scene The scene, with its lights
+/// @param meshes The meshes Meshes::getFromGLTF() made from scene
+void createResources(const gltf::GLTFScene& scene, const std::vector<Mesh*>& meshes);
+
+/// Put the atlas and the tile buffer in a per-frame descriptor set,
+/// at LIGHTMAP_TEXTURE_SLOT and LIGHTMAP_BUFFER_SLOT.
+/// @param descriptorSet The set
+void setSlots(DescriptorSet* descriptorSet);
+
+};  //namespace
@@ -1,12 +1,18 @@
 #include "Meshes.h"
 #include "Descriptors.h"
 #include "VertexManager.h"
-#include "Samplers.h"
 #include "PushConstants.h"
 #include "gltf.h"
 #include "ImageManager.h"
 #include "Pipeline.h"
 #include "importantConstants.h"
+#include "CPUProfiler.h"
+#include "BindlessTextures.h"
+#include "Samplers.h"
+#include <array>
+#include <map>
+#include <set>
+#include <memory>
 
 
 Primitive::Primitive(
@@ -27,7 +33,9 @@ Primitive::Primitive(
     float normalFactor_,
     Image* metallicRoughnessTexture_,
     float metallicFactor_,
-    float roughnessFactor_
+    float roughnessFactor_,
+    const std::array<VkSampler,4>& samplers_,
+    DescriptorSet* materialDescriptorSet_
 ){
     this->drawinfo = vertexManager->addIndexedData( 
             indices,
@@ -47,21 +55,62 @@ Primitive::Primitive(
     this->metallicRoughnessTexture = metallicRoughnessTexture_;
     this->metallicFactor = metallicFactor_;
     this->roughnessFactor = roughnessFactor_;
+    this->samplers = samplers_;
+    this->materialDescriptorSet = materialDescriptorSet_;
+
+    this->boundsMin = math2801::vec3(0,0,0);
+    this->boundsMax = math2801::vec3(0,0,0);
+    if( !positions.empty() ){
+        this->boundsMin = this->boundsMax = positions[0];
+        for(const math2801::vec3& p : positions ){
+            this->boundsMin = math2801::min(this->boundsMin,p);
+            this->boundsMax = math2801::max(this->boundsMax,p);
+        }
+    }
 }
 
-void Primitive::draw(VkCommandBuffer cmd, DescriptorSet* descriptorSet, PushConstants* pushConstants)
+MeshPushConstantHandles::MeshPushConstantHandles(PushConstants* pushConstants)
 {
-    descriptorSet->setSlot(BASE_TEXTURE_SAMPLER_SLOT, Samplers::mipSampler );
-    descriptorSet->setSlot(BASE_TEXTURE_SLOT, baseColorTexture->view() );
-    descriptorSet->setSlot(EMISSIVE_TEXTURE_SLOT, emissiveTexture->view() );
-    descriptorSet->setSlot(NORMAL_TEXTURE_SLOT, normalTexture->view());
-    descriptorSet->setSlot(METALLICROUGHNESS_TEXTURE_SLOT, metallicRoughnessTexture->view());
-    descriptorSet->bind(cmd);
-    pushConstants->set(cmd,"baseColorFactor",this->baseColorFactor);
-    pushConstants->set(cmd,"emissiveFactor",this->emissiveColorFactor);
-    pushConstants->set(cmd, "normalFactor", this->normalFactor);
-    pushConstants->set(cmd, "metallicFactor", this->metallicFactor);
-    pushConstants->set(cmd, "roughnessFactor", this->roughnessFactor);
+    this->worldMatrix = pushConstants->handle<math2801::mat4>("worldMatrix");
+    this->baseColorFactor = pushConstants->handle<math2801::vec4>("baseColorFactor");
+    this->emissiveFactor = pushConstants->handle<math2801::vec3>("emissiveFactor");
+    this->normalFactor = pushConstants->handle<float>("normalFactor");
+    this->metallicFactor = pushConstants->handle<float>("metallicFactor");
+    this->roughnessFactor = pushConstants->handle<float>("roughnessFactor");
+    this->textureIndices = pushConstants->handle<math2801::ivec2>("textureIndices");
+    this->textureSamplers = pushConstants->handle<std::int32_t>("textureSamplers");
+    this->lightmapIndex = pushConstants->handle<std::int32_t>("lightmapIndex");
+}
+
+void Primitive::draw(VkCommandBuffer cmd, PushConstantBlock& pushConstants,
+        const MeshPushConstantHandles& handles)
+{
+    if( BindlessTextures::enabled() ){
+        if( !this->haveTextureIndices ){
+            this->textureIndices = math2801::ivec2(
+                int( BindlessTextures::index(baseColorTexture) |
+                    (BindlessTextures::index(emissiveTexture) << 16) ),
+                int( BindlessTextures::index(normalTexture) |
+                    (BindlessTextures::index(metallicRoughnessTexture) << 16) )
+            );
+            unsigned packed=0;
+            for(unsigned i=0;i<4;++i)
+                packed |= BindlessTextures::samplerIndex(this->samplers[i]) << (8*i);
+            this->textureSamplers = std::int32_t(packed);
+            this->haveTextureIndices = true;
+        }
+        pushConstants.set(handles.textureIndices,this->textureIndices);
+        pushConstants.set(handles.textureSamplers,this->textureSamplers);
+    } else {
+        this->materialDescriptorSet->bind(cmd,{VK_PIPELINE_BIND_POINT_GRAPHICS});
+    }
+    pushConstants.set(handles.baseColorFactor,this->baseColorFactor);
+    pushConstants.set(handles.emissiveFactor,this->emissiveColorFactor);
+    pushConstants.set(handles.normalFactor, this->normalFactor);
+    pushConstants.set(handles.metallicFactor, this->metallicFactor);
+    pushConstants.set(handles.roughnessFactor, this->roughnessFactor);
+    pushConstants.set(handles.lightmapIndex, std::int32_t(this->lightmapIndex));
+    pushConstants.flush(cmd);
     vkCmdDrawIndexed(
         cmd,
         this->drawinfo.numIndices,
@@ -86,25 +135,80 @@ Mesh::Mesh()
 }
 
 
-void Mesh::draw(VkCommandBuffer cmd, DescriptorSet* descriptorSet, PushConstants* pushConstants)
+void Mesh::draw(VkCommandBuffer cmd, PushConstantBlock& pushConstants,
+        const MeshPushConstantHandles& handles)
 {
-    pushConstants->set(cmd,"worldMatrix", this->worldMatrix);
+    this->draw(cmd,pushConstants,handles,this->worldMatrix);
+}
+
+void Mesh::draw(VkCommandBuffer cmd, PushConstantBlock& pushConstants,
+        const MeshPushConstantHandles& handles,
+        const math2801::mat4& worldMatrix_)
+{
+    CPU_ZONE("Mesh::draw");
+    //pushed with the first primitive's values
+    pushConstants.set(handles.worldMatrix, worldMatrix_);
     for(auto& p : this->primitives ){
-        p->draw(cmd,descriptorSet,pushConstants);
+        p->draw(cmd,pushConstants,handles);
     }
 }
  
 void Mesh::addPrimitive(Primitive* m)
 {
     this->primitives.push_back(m);
+    this->boundsMin = math2801::min(this->boundsMin,m->boundsMin);
+    this->boundsMax = math2801::max(this->boundsMax,m->boundsMax);
 }
 
 
 namespace Meshes {
 
-std::vector<Mesh*> getFromGLTF(VertexManager* vertexManager, const gltf::GLTFScene& scene)
+//textures and samplers of a material
+typedef std::pair< std::array<Image*,4>, std::array<VkSampler,4> > MaterialKey;
+
+//make (or reuse) the per-material descriptor set for these textures.
+//The images don't have views until ImageManager::pushToGPU(), so
+//the set is written and frozen when the last of them gets one.
+static DescriptorSet* getMaterialDescriptorSet(
+    DescriptorSetFactory* materialFactory,
+    std::map< MaterialKey, DescriptorSet*>& materials,
+    Image* baseColorTexture, Image* emissiveTexture,
+    Image* normalTexture, Image* metallicRoughnessTexture,
+    const std::array<VkSampler,4>& samplers)
+{
+    if( !materialFactory )
+        return nullptr;
+    std::array<Image*,4> key{baseColorTexture, emissiveTexture, normalTexture, metallicRoughnessTexture};
+    auto it = materials.find(MaterialKey(key,samplers));
+    if( it != materials.end() )
+        return it->second;
+    DescriptorSet* ds = materialFactory->make();
+    std::set<Image*> distinct(key.begin(),key.end());
+    auto remaining = std::make_shared<std::size_t>(distinct.size());
+    for(Image* img : distinct){
+        img->addCallback( [ds,key,samplers,remaining](Image*){
+            if( --(*remaining) != 0 )
+                return;
+            ds->setSlot(BASE_SAMPLER_SLOT, samplers[0]);
+            ds->setSlot(BASE_TEXTURE_SLOT, key[0]->view() );
+            ds->setSlot(EMISSIVE_SAMPLER_SLOT, samplers[1]);
+            ds->setSlot(EMISSIVE_TEXTURE_SLOT, key[1]->view() );
+            ds->setSlot(NORMAL_SAMPLER_SLOT, samplers[2]);
+            ds->setSlot(NORMAL_TEXTURE_SLOT, key[2]->view());
+            ds->setSlot(METALLICROUGHNESS_SAMPLER_SLOT, samplers[3]);
+            ds->setSlot(METALLICROUGHNESS_TEXTURE_SLOT, key[3]->view());
+            ds->freeze();
+        });
+    }
+    materials[MaterialKey(key,samplers)] = ds;
+    return ds;
+}
+
+std::vector<Mesh*> getFromGLTF(VertexManager* vertexManager, const gltf::GLTFScene& scene,
+        DescriptorSetFactory* materialFactory)
 {
     std::vector<Mesh*> meshes;
+    std::map< MaterialKey, DescriptorSet*> materials;
     
     for(const gltf::GLTFMesh& gmesh : scene.meshes){
         meshes.push_back(new Mesh(gmesh.name));
@@ -142,6 +246,17 @@ std::vector<Mesh*> getFromGLTF(VertexManager* vertexManager, const gltf::GLTFSce
                 .source
                 .bytes;
             metallicRoughnessTexture = ImageManager::loadFromData(tmp, imagename);
+
+            std::array<VkSampler,4> samplers{
+                Samplers::get(p.material.pbrMetallicRoughness.baseColorTexture.texture.sampler),
+                Samplers::get(p.material.emissiveTexture.texture.sampler),
+                Samplers::get(p.material.normalTexture.texture.sampler),
+                Samplers::get(p.material.pbrMetallicRoughness.metallicRoughnessTexture.texture.sampler)
+            };
+            if( BindlessTextures::enabled() ){
+                for(VkSampler s : samplers)
+                    BindlessTextures::addSampler(s);
+            }
             
             meshes.back()->addPrimitive(new Primitive(
                 vertexManager,
@@ -159,7 +274,12 @@ std::vector<Mesh*> getFromGLTF(VertexManager* vertexManager, const gltf::GLTFSce
                 p.material.normalTexture.scale,
                 metallicRoughnessTexture,
                 p.material.pbrMetallicRoughness.metallicFactor,
-                p.material.pbrMetallicRoughness.roughnessFactor
+                p.material.pbrMetallicRoughness.roughnessFactor,
+                samplers,
+                getMaterialDescriptorSet(materialFactory, materials,
+                    baseColorTexture, emissiveTexture,
+                    normalTexture, metallicRoughnessTexture,
+                    samplers)
             ));
         }
     }
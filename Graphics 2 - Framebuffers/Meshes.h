@@ -3,9 +3,11 @@
 #include "VertexManager.h"
 #include "Images.h"
 #include "math2801.h"
+#include "PushConstants.h"
 #include <span>
+#include <array>
+#include <cmath>
 
-class PushConstants;
 class Pipeline;
 class DescriptorSetFactory;
 class DescriptorSet;
@@ -14,6 +16,27 @@ namespace gltf{
     class GLTFScene;
 };
 
+/// The push constants that Mesh::draw() and Primitive::draw()
+/// set (see shaders/pushconstants.txt), looked up once.
+struct MeshPushConstantHandles{
+    /// Handles that don't refer to anything
+    MeshPushConstantHandles() = default;
+
+    /// Look up the push constants.
+    /// @param pushConstants The push constants they are in
+    MeshPushConstantHandles(PushConstants* pushConstants);
+
+    PushConstantHandle<math2801::mat4> worldMatrix;         ///< worldMatrix
+    PushConstantHandle<math2801::vec4> baseColorFactor;     ///< baseColorFactor
+    PushConstantHandle<math2801::vec3> emissiveFactor;      ///< emissiveFactor
+    PushConstantHandle<float> normalFactor;                 ///< normalFactor
+    PushConstantHandle<float> metallicFactor;               ///< metallicFactor
+    PushConstantHandle<float> roughnessFactor;              ///< roughnessFactor
+    PushConstantHandle<math2801::ivec2> textureIndices;     ///< textureIndices
+    PushConstantHandle<std::int32_t> textureSamplers;       ///< textureSamplers
+    PushConstantHandle<std::int32_t> lightmapIndex;         ///< lightmapIndex
+};
+
 /// A Primitive is a collection of geometry with the same material properties.
 class Primitive{
   public:
@@ -43,6 +66,26 @@ class Primitive{
     float metallicFactor;
     float roughnessFactor;
 
+    /// Samplers for baseColorTexture, emissiveTexture, normalTexture
+    /// and metallicRoughnessTexture, in that order (see Samplers::get())
+    std::array<VkSampler,4> samplers;
+
+    /// Object space bounding box of the vertices: Smallest corner
+    math2801::vec3 boundsMin;
+
+    /// Object space bounding box of the vertices: Largest corner
+    math2801::vec3 boundsMax;
+
+    /// Per-material descriptor set holding the four textures; it
+    /// may be shared with other Primitives that use the same textures.
+    /// Null if BindlessTextures is enabled.
+    DescriptorSet* materialDescriptorSet;
+
+    /// Entry in the lightmap tile buffer (see Lightmaps); 0 if the
+    /// primitive has no lightmap. draw() passes it to the shaders
+    /// in the lightmapIndex push constant.
+    std::uint32_t lightmapIndex = 0;
+
     /// Initialize the primitive.
     /// @param vertexManager VertexManager that will hold this 
     ///        Primitive's data
@@ -58,6 +101,12 @@ class Primitive{
     /// @param emissiveTexture Emissive texture.
     /// @param emissiveColorFactor Multiplied by color in
     ///        emissiveTexture to get final emissive color.
+    /// @param samplers_ Samplers for the four textures; see samplers.
+    ///        If BindlessTextures is enabled, they must have been
+    ///        given to BindlessTextures::addSampler().
+    /// @param materialDescriptorSet_ Frozen per-material descriptor
+    ///        set with the textures (see DescriptorSet::freeze()),
+    ///        or null if BindlessTextures is enabled.
     Primitive(
         VertexManager* vertexManager,
         const std::vector<math2801::vec3>& positions,
@@ -74,23 +123,36 @@ class Primitive{
         float normalFactor_,
         Image* metallicRoughnessTexture_,
         float metallicFactor_,
-        float roughnessFactor_
+        float roughnessFactor_,
+        const std::array<VkSampler,4>& samplers_,
+        DescriptorSet* materialDescriptorSet_
     );
     
-    /// Draw the Primitive
+    /// Draw the Primitive. The caller must have bound the
+    /// per-frame descriptor set; this binds materialDescriptorSet.
+    /// If BindlessTextures is enabled, the textures are selected
+    /// by index instead, and the caller must have bound the
+    /// texture array too.
+    /// The material's push constants are staged in pushConstants,
+    /// which is flushed once just before the draw.
     /// @param cmd The command buffer
-    /// @param descriptorSet Descriptor set; will be updated
-    ///        to hold references to Primitive's textures and
-    ///        then bound for the draw operation
     /// @param pushConstants Push constants to hold baseColorFactor
     ///        and emissiveColorFactor
-    void draw(VkCommandBuffer cmd, DescriptorSet* descriptorSet,
-                PushConstants* pushConstants);
+    /// @param handles Handles from the same PushConstants as pushConstants
+    void draw(VkCommandBuffer cmd, PushConstantBlock& pushConstants,
+              const MeshPushConstantHandles& handles);
 
   private:
     Primitive(const Primitive&) = delete;
     void operator=(const Primitive&) = delete;
 
+    //positions of the textures in the bindless texture array,
+    //two 16 bit indices per component, and of their samplers in
+    //the sampler array, four 8 bit indices (see pushconstants.txt)
+    math2801::ivec2 textureIndices;
+    std::int32_t textureSamplers;
+    bool haveTextureIndices = false;
+
 };
 
 class Mesh{
@@ -104,6 +166,13 @@ class Mesh{
     
     /// world matrix for the mesh
     math2801::mat4 worldMatrix;
+
+    /// Object space bounding box of all the primitives: Smallest corner.
+    /// If there are no primitives, it's larger than boundsMax.
+    math2801::vec3 boundsMin{ HUGE_VALF, HUGE_VALF, HUGE_VALF };
+
+    /// Object space bounding box of all the primitives: Largest corner
+    math2801::vec3 boundsMax{ -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
     
     /// Create empty mesh
     Mesh();
@@ -112,13 +181,23 @@ class Mesh{
     /// @param name Name of the mesh
     Mesh(std::string name);
     
-    /// Draw all Primitives in this Mesh.
+    /// Draw all Primitives in this Mesh. See Primitive::draw()
+    /// for the descriptor sets that must be bound first.
+    /// @param cmd The command buffer
+    /// @param pushConstants Push constants to hold baseColorFact
+    /// @param handles Handles from the same PushConstants as pushConstants
+    void draw(VkCommandBuffer cmd, PushConstantBlock& pushConstants,
+              const MeshPushConstantHandles& handles);
+
+    /// Draw all Primitives in this Mesh with a given world matrix
+    /// instead of this->worldMatrix (ex: from a FrameState).
     /// @param cmd The command buffer
-    /// @param descriptorSet Descriptor set; will be updated
-    ///        to hold references to Primitive's textures and
-    ///        then bound for the draw operation
     /// @param pushConstants Push constants to hold baseColorFact
-    void draw(VkCommandBuffer cmd, DescriptorSet* descriptorSet, PushConstants* pushConstants);
+    /// @param handles Handles from the same PushConstants as pushConstants
+    /// @param worldMatrix The world matrix
+    void draw(VkCommandBuffer cmd, PushConstantBlock& pushConstants,
+              const MeshPushConstantHandles& handles,
+              const math2801::mat4& worldMatrix);
     
     /// Add a Primitive to the Mesh
     /// @param m The primitive
@@ -132,12 +211,17 @@ class Mesh{
 
 namespace Meshes{
 
-/// Extract all GLTFMeshes from a scene and return list of them
+/// Extract all GLTFMeshes from a scene and return list of them.
+/// Each distinct combination of textures gets one frozen
+/// per-material descriptor set, made here.
 /// @param vertexManager Vertex manager for meshes
 /// @param scene The GLTF scene to extract from
+/// @param materialFactory Factory for the per-material descriptor
+///        sets (set PER_MATERIAL_SET); null if BindlessTextures is enabled
 /// @return List of meshes
 std::vector<Mesh*> getFromGLTF(VertexManager* vertexManager, 
-        const gltf::GLTFScene& scene);
+        const gltf::GLTFScene& scene,
+        DescriptorSetFactory* materialFactory);
 
 };
 
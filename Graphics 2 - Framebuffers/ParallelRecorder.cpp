@@ -0,0 +1,182 @@
+#include "ParallelRecorder.h"
+#include "CommandBuffer.h"
+#include "CleanupManager.h"
+#include "Framebuffer.h"
+#include "CPUProfiler.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+//upper limit when recordThreads=0 (one per core)
+static const unsigned MAX_AUTO_WORKERS = 16;
+
+//what the workers are doing for the current record() call
+struct Job{
+    const ParallelRecorder::RecordFunction* func = nullptr;
+    VkCommandBufferInheritanceInfo inheritance{};
+    std::size_t numItems = 0;
+    std::vector<VkCommandBuffer> buffers;           //one per worker; null if the chunk was empty
+    std::vector<std::exception_ptr> errors;         //one per worker
+};
+
+static VulkanContext* ctx;
+static unsigned workerCount = 1;
+static std::vector<std::thread> threads;          //workers 1...workerCount-1
+static Job job;
+
+//protects everything below
+static std::mutex mutex;
+static std::condition_variable startCondition;
+static std::condition_variable doneCondition;
+static unsigned generation = 0;       //incremented for each record() call
+static unsigned numRunning = 0;       //threads that haven't finished the current job
+static bool quitting = false;
+
+static void recordChunk(unsigned worker)
+{
+    CPU_ZONE("ParallelRecorder::recordChunk");
+    std::size_t begin = job.numItems * worker / workerCount;
+    std::size_t end = job.numItems * (worker+1) / workerCount;
+    job.buffers[worker] = VK_NULL_HANDLE;
+    if( begin == end )
+        return;
+    try{
+        VkCommandBuffer cmd = CommandBuffer::FrameAllocator::allocateSecondary(worker);
+        check(vkBeginCommandBuffer(
+            cmd,
+            VkCommandBufferBeginInfo{
+                .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                .pNext=nullptr,
+                .flags=VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                       VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+                .pInheritanceInfo=&job.inheritance
+            }
+        ));
+        (*job.func)(cmd, worker, begin, end);
+        check(vkEndCommandBuffer(cmd));
+        job.buffers[worker] = cmd;
+    } catch(...){
+        job.errors[worker] = std::current_exception();
+    }
+}
+
+static void workerMain(unsigned worker)
+{
+    unsigned lastGeneration = 0;
+    while(true){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            startCondition.wait(lock, [&lastGeneration](){
+                return quitting || generation != lastGeneration;
+            });
+            if( quitting )
+                return;
+            lastGeneration = generation;
+        }
+        recordChunk(worker);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            numRunning--;
+        }
+        doneCondition.notify_one();
+    }
+}
+
+namespace ParallelRecorder{
+
+bool initialized()
+{
+    return ctx != nullptr;
+}
+
+void initialize(VulkanContext* ctx_)
+{
+    if(initialized())
+        return;
+    ctx=ctx_;
+
+    int n = std::stoi(ctx->config.get("recordThreads","0"));
+    if( n < 0 )
+        throw std::runtime_error("recordThreads must be zero or positive");
+    if( n == 0 )
+        workerCount = std::clamp(std::thread::hardware_concurrency(), 1u, MAX_AUTO_WORKERS);
+    else
+        workerCount = (unsigned)n;
+
+    CommandBuffer::FrameAllocator::reserveWorkers(workerCount);
+    job.buffers.resize(workerCount);
+    job.errors.resize(workerCount);
+    for(unsigned i=1;i<workerCount;++i){
+        threads.push_back(std::thread(workerMain,i));
+    }
+
+    CleanupManager::registerCleanupFunction([](){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quitting=true;
+        }
+        startCondition.notify_all();
+        for(auto& t : threads)
+            t.join();
+        threads.clear();
+    });
+}
+
+bool enabled()
+{
+    return workerCount > 1;
+}
+
+unsigned numWorkers()
+{
+    return workerCount;
+}
+
+void record(VkCommandBuffer cmd, Framebuffer* fb, std::size_t numItems, const RecordFunction& func)
+{
+    if( !initialized() )
+        throw std::runtime_error("ParallelRecorder::record() called before initialize()");
+
+    CPU_ZONE("ParallelRecorder::record");
+
+    job.func = &func;
+    job.inheritance = fb->inheritanceInfo();
+    job.numItems = numItems;
+    for(auto& e : job.errors)
+        e = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        numRunning = workerCount-1;
+        generation++;
+    }
+    startCondition.notify_all();
+
+    //this thread is worker 0
+    recordChunk(0);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [](){ return numRunning == 0; });
+    }
+    job.func = nullptr;
+
+    for(auto& e : job.errors){
+        if( e )
+            std::rethrow_exception(e);
+    }
+
+    std::vector<VkCommandBuffer> toExecute;
+    for(VkCommandBuffer b : job.buffers){
+        if( b != VK_NULL_HANDLE )
+            toExecute.push_back(b);
+    }
+    if( !toExecute.empty() )
+        vkCmdExecuteCommands(cmd, (unsigned)toExecute.size(), toExecute.data());
+}
+
+};  //namespace
@@ -0,0 +1,55 @@
+#pragma once
+#include "vkhelpers.h"
+#include <functional>
+#include <cstddef>
+
+class Framebuffer;
+
+/// Records one renderpass's draw commands on several threads at once.
+/// The items to draw (ex: meshes) are split into contiguous chunks;
+/// each chunk is recorded into a secondary command buffer that comes
+/// from its worker's own command pool (see CommandBuffer::FrameAllocator),
+/// and the primary command buffer runs the secondaries in chunk order with
+/// vkCmdExecuteCommands. The number of workers comes from config.ini (recordThreads).
+namespace ParallelRecorder{
+
+/// Function that records items [begin...end) into a secondary command buffer.
+/// The command buffer has already been begun; the function must bind
+/// whatever it needs (pipeline, vertex buffers, descriptor sets) itself,
+/// since secondary command buffers don't inherit those from the primary.
+/// @param cmd The secondary command buffer
+/// @param worker Which worker is calling, in the range [0...numWorkers());
+///        use this to select per-thread objects such as a DescriptorSet
+/// @param begin First item to record
+/// @param end One past the last item to record
+typedef std::function<void(VkCommandBuffer cmd, unsigned worker, std::size_t begin, std::size_t end)> RecordFunction;
+
+/// Initialize the subsystem.
+/// @param ctx The context
+void initialize(VulkanContext* ctx);
+
+/// Return true if subsystem was initialized
+/// @return True if initialized; false if not
+bool initialized();
+
+/// True if draws should be recorded with record(); false if
+/// recordThreads=1, in which case the caller should record inline.
+/// @return True if there are multiple workers
+bool enabled();
+
+/// Number of workers, including the calling thread.
+/// @return The count (at least 1)
+unsigned numWorkers();
+
+/// Record numItems items with the workers and execute the results
+/// in cmd. The calling thread records the first chunk itself and
+/// waits for the others. If any worker throws, the exception is
+/// rethrown here after all of the workers have finished.
+/// @param cmd The primary command buffer. fb's renderpass must be in
+///        progress in cmd, begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+/// @param fb The Framebuffer being drawn to
+/// @param numItems Number of items to record
+/// @param func Function that records a chunk of items
+void record(VkCommandBuffer cmd, Framebuffer* fb, std::size_t numItems, const RecordFunction& func);
+
+};  //namespace
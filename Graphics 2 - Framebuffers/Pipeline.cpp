@@ -14,7 +14,9 @@
 
 
 static bool initialized=false;
-static Pipeline* current_;
+
+//each thread that records commands has its own current pipeline
+static thread_local Pipeline* current_;
 
 
 static void frameBeginCallback(int /*imageIndex*/, VkCommandBuffer )
@@ -106,7 +108,6 @@ void Pipeline::use(VkCommandBuffer cmd)
 }
 
 
-//FIXME: This assumes we only build one command list at a time
 Pipeline* Pipeline::current(){
     if(!current_)
         throw std::runtime_error("There is no active pipeline");
@@ -60,7 +60,8 @@ class Pipeline{
     /// @param cmd The command buffer
     void use(VkCommandBuffer cmd);
 
-    /// Returns the most recently used pipeline (see use()).
+    /// Returns the pipeline most recently used (see use()) by the
+    /// calling thread; each thread that records commands has its own.
     /// If no pipeline has been used for the current frame,
     /// an exception is thrown.
     /// @return The pipeline
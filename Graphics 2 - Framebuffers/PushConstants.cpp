@@ -6,24 +6,30 @@
 #include "consoleoutput.h"
 #include <assert.h>
 #include <array>
-
-//Vk standard specifies this
-#define PUSHCONSTANT_MAX 128
+#include <atomic>
+#include <algorithm>
 
 //~ static PushConstants::PushConstants* _default;
 
+//for pushCount()
+static std::atomic<unsigned long long> numPushes{0};
+
+[[noreturn]] static void noSuchPushConstant(PushConstants* pushc, const std::string& name)
+{
+    error("No such push constant '"+name+"'");
+    error("Known push constants:");
+    for(auto it : pushc->items ){
+        error("    ",it.second.name,"("+it.second.typeAsString+it.second.arraySizeAsString+")");
+    }
+    throw std::runtime_error("No such push constant '"+name+"'");
+}
+
 template<typename T>
 static void doSet(PushConstants* pushc, VkCommandBuffer cmd, const std::string& name, const T& value)
 {
     
-    if( pushc->items.find(name) == pushc->items.end() ){
-        error("No such push constant '"+name+"'");
-        error("Known push constants:");
-        for(auto it : pushc->items ){
-            error("    ",it.second.name,"("+it.second.typeAsString+it.second.arraySizeAsString+")");
-        }
-        throw std::runtime_error("No such push constant '"+name+"'");
-    }
+    if( pushc->items.find(name) == pushc->items.end() )
+        noSuchPushConstant(pushc,name);
     auto& tmp = pushc->items[name];
     auto converted = tmp.convert(value);
     vkCmdPushConstants(
@@ -34,8 +40,20 @@ static void doSet(PushConstants* pushc, VkCommandBuffer cmd, const std::string&
         tmp.byteSize,
         converted.data()
     );
+    numPushes.fetch_add(1,std::memory_order_relaxed);
 }
 
+//the type a push constant must have for handle<T>()
+template<typename T> static parseMembers::ItemType handleType();
+template<> parseMembers::ItemType handleType<std::int32_t>(){       return parseMembers::ItemType::INT_ITEM; }
+template<> parseMembers::ItemType handleType<std::uint32_t>(){      return parseMembers::ItemType::UINT_ITEM; }
+template<> parseMembers::ItemType handleType<float>(){              return parseMembers::ItemType::FLOAT_ITEM; }
+template<> parseMembers::ItemType handleType<math2801::ivec2>(){    return parseMembers::ItemType::IVEC2_ITEM; }
+template<> parseMembers::ItemType handleType<math2801::vec2>(){     return parseMembers::ItemType::VEC2_ITEM; }
+template<> parseMembers::ItemType handleType<math2801::vec3>(){     return parseMembers::ItemType::VEC3_ITEM; }
+template<> parseMembers::ItemType handleType<math2801::vec4>(){     return parseMembers::ItemType::VEC4_ITEM; }
+template<> parseMembers::ItemType handleType<math2801::mat4>(){     return parseMembers::ItemType::MAT4_ITEM; }
+
 
 //~ namespace PushConstants{
 
@@ -133,6 +151,80 @@ void PushConstants::set(VkCommandBuffer cmd, std::string name, const std::vector
 {
     doSet(this,cmd,name,value);
 }
+
+template<typename T>
+PushConstantHandle<T> PushConstants::handle(const std::string& name)
+{
+    auto it = this->items.find(name);
+    if( it == this->items.end() )
+        noSuchPushConstant(this,name);
+    const parseMembers::Item& info = it->second;
+    if( info.type != handleType<T>() ){
+        throw std::runtime_error("Bad type for handle to push constant "+name+": It is "+
+            info.typeAsString+info.arraySizeAsString);
+    }
+    PushConstantHandle<T> h;
+    h.offset = info.offset;
+    h.byteSize = info.byteSize;
+    return h;
+}
+
+template PushConstantHandle<std::int32_t> PushConstants::handle(const std::string&);
+template PushConstantHandle<std::uint32_t> PushConstants::handle(const std::string&);
+template PushConstantHandle<float> PushConstants::handle(const std::string&);
+template PushConstantHandle<math2801::ivec2> PushConstants::handle(const std::string&);
+template PushConstantHandle<math2801::vec2> PushConstants::handle(const std::string&);
+template PushConstantHandle<math2801::vec3> PushConstants::handle(const std::string&);
+template PushConstantHandle<math2801::vec4> PushConstants::handle(const std::string&);
+template PushConstantHandle<math2801::mat4> PushConstants::handle(const std::string&);
+
+unsigned long long PushConstants::pushCount()
+{
+    return numPushes.load(std::memory_order_relaxed);
+}
+
+PushConstantBlock::PushConstantBlock(PushConstants* pushConstants_)
+{
+    this->pushConstants = pushConstants_;
+}
+
+void PushConstantBlock::flush(VkCommandBuffer cmd)
+{
+    if( cmd != this->lastCmd ){
+        //a new command buffer doesn't have any of the values yet
+        this->lastCmd = cmd;
+        this->dirtyBegin = this->setBegin;
+        this->dirtyEnd = this->setEnd;
+        this->pushedBegin = PUSHCONSTANT_MAX;
+        this->pushedEnd = 0;
+    }
+    if( this->dirtyBegin >= this->dirtyEnd )
+        return;
+
+    //fill any gap between these bytes and the ones already pushed,
+    //so write() can tell what lastCmd has from one range
+    if( this->pushedBegin < this->pushedEnd ){
+        this->dirtyBegin = std::min(this->dirtyBegin,this->pushedEnd);
+        this->dirtyEnd = std::max(this->dirtyEnd,this->pushedBegin);
+    }
+
+    PipelineLayout* layout = Pipeline::current()->pipelineLayout;
+    if( layout->pushConstants != this->pushConstants )
+        throw std::runtime_error("PushConstantBlock::flush(): The current pipeline has different push constants");
+    vkCmdPushConstants(
+        cmd,
+        layout->pipelineLayout,
+        VK_SHADER_STAGE_ALL,
+        this->dirtyBegin,
+        this->dirtyEnd - this->dirtyBegin,
+        this->data.data() + this->dirtyBegin
+    );
+    numPushes.fetch_add(1,std::memory_order_relaxed);
+    this->pushedBegin = std::min(this->pushedBegin,this->dirtyBegin);
+    this->pushedEnd = std::max(this->pushedEnd,this->dirtyEnd);
+    this->dirtyBegin = PUSHCONSTANT_MAX;
+    this->dirtyEnd = 0;
+}
 //~ void initialize(VulkanContext* )
 //~ {
     //~ if( !initialized() ){
@@ -2,9 +2,44 @@
 #include "vkhelpers.h"
 #include "parseMembers.h"
 #include "math2801.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <type_traits>
 
 //FIXME: Do uvec{2,3,4}  
 
+//Vk standard specifies this
+#define PUSHCONSTANT_MAX 128
+
+class PushConstants;
+class PushConstantBlock;
+
+/// A push constant that has already been looked up; see
+/// PushConstants::handle(). It is used with PushConstantBlock::set().
+/// @tparam T The C++ type of the push constant (ex: math2801::mat4)
+template<typename T>
+class PushConstantHandle{
+  public:
+
+    /// Make a handle that doesn't refer to anything. It must
+    /// be replaced with one from PushConstants::handle() before use.
+    PushConstantHandle() = default;
+
+    /// Return true if this handle came from PushConstants::handle()
+    /// @return True if the handle can be used
+    bool valid() const {
+        return this->offset >= 0;
+    }
+
+  private:
+    friend class PushConstants;
+    friend class PushConstantBlock;
+    int offset = -1;        //byte offset in the push constants
+    int byteSize = 0;       //size of the data
+};
+
 /// Class to manage push constants
 class PushConstants{
   public:
@@ -102,4 +137,83 @@ class PushConstants{
     /// @param name Variable name
     /// @param value Value to set
     void set(VkCommandBuffer cmd, std::string name, const std::vector<math2801::ivec4>& value);
+
+    /// Look up a push constant so it can be set with
+    /// PushConstantBlock::set(). If the name does not specify a valid
+    /// push constant or T is not exactly its type, an exception is thrown.
+    /// @tparam T std::int32_t, std::uint32_t, float, math2801::ivec2,
+    ///     vec2, vec3, vec4, or mat4
+    /// @param name Variable name
+    /// @return The handle
+    template<typename T>
+    PushConstantHandle<T> handle(const std::string& name);
+
+    /// Number of vkCmdPushConstants calls made by set() and
+    /// PushConstantBlock::flush() since the program started, on all threads.
+    /// @return The count
+    static unsigned long long pushCount();
+};
+
+/// A CPU copy of the push constants in one command buffer.
+/// set() only changes the copy; flush() sends everything that
+/// changed since the last flush() with one vkCmdPushConstants, so
+/// a draw that sets several push constants pushes them once, and
+/// one that sets them to the values they already have doesn't push at all.
+/// Push constants stay set across draws, and across pipelines
+/// with the same layout. A PushConstantBlock may only be used by
+/// one thread at a time; threads that record in parallel each need one.
+class PushConstantBlock{
+  public:
+
+    /// Make an empty block.
+    /// @param pushConstants The push constants that the handles come from
+    PushConstantBlock(PushConstants* pushConstants);
+
+    /// Set a push constant in the CPU copy.
+    /// @param h The handle; it must be valid()
+    /// @param value The value to set
+    template<typename T>
+    void set(const PushConstantHandle<T>& h, const std::type_identity_t<T>& value){
+        static_assert(sizeof(T) % 4 == 0);
+        assert(h.valid());
+        this->write(h.offset, &value, sizeof(T));
+    }
+
+    /// Push the values that changed since the last flush() into cmd. If cmd
+    /// isn't the command buffer from the last flush(), every value that has
+    /// been set is pushed. This uses the layout of the current Pipeline.
+    /// @param cmd The command buffer
+    void flush(VkCommandBuffer cmd);
+
+  private:
+    PushConstants* pushConstants;
+    std::array<char,PUSHCONSTANT_MAX> data{};
+
+    //bytes [dirtyBegin,dirtyEnd) changed since the last flush()
+    std::uint32_t dirtyBegin = PUSHCONSTANT_MAX;
+    std::uint32_t dirtyEnd = 0;
+
+    //bytes [setBegin,setEnd) have been set at some point
+    std::uint32_t setBegin = PUSHCONSTANT_MAX;
+    std::uint32_t setEnd = 0;
+
+    //bytes [pushedBegin,pushedEnd) have been pushed to lastCmd
+    std::uint32_t pushedBegin = PUSHCONSTANT_MAX;
+    std::uint32_t pushedEnd = 0;
+
+    VkCommandBuffer lastCmd = VK_NULL_HANDLE;
+
+    void write(int offset, const void* value, std::uint32_t size){
+        std::uint32_t first = (std::uint32_t)offset;
+        std::uint32_t last = first+size;
+        if( first < this->setBegin ) this->setBegin = first;
+        if( last > this->setEnd ) this->setEnd = last;
+        char* p = this->data.data()+offset;
+        if( first >= this->pushedBegin && last <= this->pushedEnd &&
+                std::memcmp(p,value,size) == 0 )
+            return;
+        std::memcpy(p,value,size);
+        if( first < this->dirtyBegin ) this->dirtyBegin = first;
+        if( last > this->dirtyEnd ) this->dirtyEnd = last;
+    }
 };
@@ -0,0 +1,54 @@
+#pragma once
+#include "utils.h"
+#include <deque>
+#include <utility>
+
+/// Holds resources that are in use by frames the GPU hasn't
+/// finished yet. push() tags an item with the current frame;
+/// pop() hands back the oldest item whose frame has completed (see
+/// utils::isFrameComplete()). Frames are pushed in order, so only
+/// the front of the queue ever needs to be checked: the cost of
+/// reclaiming is proportional to the number of items reclaimed,
+/// and nothing happens for subsystems that aren't asking for anything.
+/// A RetireQueue may only be used by one thread at a time.
+template<typename T>
+class RetireQueue{
+  public:
+
+    /// Add an item that is used by the current frame. This may only
+    /// be called between utils::beginFrame() and utils::endFrame().
+    /// @param item The item
+    void push(const T& item){
+        this->items.push_back(std::make_pair(utils::getCurrentFrameIdentifier(),item));
+    }
+
+    /// Get the oldest item whose frame has finished on the GPU.
+    /// @param item Receives the item
+    /// @return True if there was one; false if not (item is unchanged)
+    bool pop(T& item){
+        if( this->items.empty() || !utils::isFrameComplete(this->items.front().first) )
+            return false;
+        item = this->items.front().second;
+        this->items.pop_front();
+        return true;
+    }
+
+    /// Call f on every item, whether or not its frame has
+    /// finished, and empty the queue. This is for cleanup.
+    /// @param f Function taking a T
+    template<typename F>
+    void drain(F f){
+        for(auto& it : this->items)
+            f(it.second);
+        this->items.clear();
+    }
+
+    /// Number of items in the queue
+    /// @return The count
+    std::size_t size() const {
+        return this->items.size();
+    }
+
+  private:
+    std::deque< std::pair<unsigned,T> > items;     //(frame identifier, item), oldest first
+};
@@ -1,11 +1,20 @@
 #include "Samplers.h"
 #include "CleanupManager.h"
+#include "gltf.h"
+#include <map>
+#include <tuple>
+#include <stdexcept>
 
 
 static VulkanContext* ctx;
 
+//samplers made by Samplers::get(); key = GLTF
+//(magFilter, minFilter, wrapS, wrapT)
+static std::map< std::tuple<int,int,int,int>, VkSampler > gltfSamplers;
 
-static VkSampler _make(VkFilter minMagFilter, VkSamplerAddressMode repeatMode, bool useMipmap)
+
+static VkSampler _make(VkFilter magFilter, VkFilter minFilter, VkSamplerMipmapMode mipmapMode,
+    VkSamplerAddressMode repeatModeU, VkSamplerAddressMode repeatModeV, bool useMipmap)
 {
     VkSampler samp;
     check(
@@ -15,12 +24,12 @@ static VkSampler _make(VkFilter minMagFilter, VkSamplerAddressMode repeatMode, b
                 .sType=VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
                 .pNext=nullptr,
                 .flags=0,
-                .magFilter=minMagFilter,
-                .minFilter=minMagFilter,
-                .mipmapMode=VK_SAMPLER_MIPMAP_MODE_LINEAR,
-                .addressModeU = repeatMode,
-                .addressModeV = repeatMode,
-                .addressModeW = repeatMode,
+                .magFilter=magFilter,
+                .minFilter=minFilter,
+                .mipmapMode=mipmapMode,
+                .addressModeU = repeatModeU,
+                .addressModeV = repeatModeV,
+                .addressModeW = repeatModeU,
                 .mipLodBias=0,
                 .anisotropyEnable=(useMipmap ? VK_TRUE : VK_FALSE),
                 .maxAnisotropy=4,
@@ -37,6 +46,21 @@ static VkSampler _make(VkFilter minMagFilter, VkSamplerAddressMode repeatMode, b
     return samp;
 }
 
+static VkSampler _make(VkFilter minMagFilter, VkSamplerAddressMode repeatMode, bool useMipmap)
+{
+    return _make(minMagFilter, minMagFilter, VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        repeatMode, repeatMode, useMipmap);
+}
+
+static VkSamplerAddressMode _wrapMode(int gltfWrap)
+{
+    switch(gltfWrap){
+        case gltf::CLAMP_TO_EDGE:   return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        case gltf::MIRRORED_REPEAT: return VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+        default:                    return VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    }
+}
+
 
 
 namespace Samplers{
@@ -104,8 +128,58 @@ void initialize(VulkanContext* ctx_){
             Samplers::clampingMipSampler,
             nullptr
         );
+
+        for(auto& it : gltfSamplers){
+            vkDestroySampler(ctx->dev, it.second, nullptr);
+        }
+        gltfSamplers.clear();
     });
 }
 
+VkSampler get(const gltf::GLTFSampler& s)
+{
+    if(!initialized())
+        throw std::runtime_error("Samplers::get() called before initialize()");
+
+    auto key = std::make_tuple(s.magFilter, s.minFilter, s.wrapS, s.wrapT);
+    auto it = gltfSamplers.find(key);
+    if( it != gltfSamplers.end() )
+        return it->second;
+
+    VkFilter minFilter = VK_FILTER_LINEAR;
+    VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    bool useMipmap = true;
+    switch(s.minFilter){
+        case gltf::NEAREST:
+            minFilter = VK_FILTER_NEAREST;
+            useMipmap = false;
+            break;
+        case gltf::LINEAR:
+            useMipmap = false;
+            break;
+        case gltf::NEAREST_MIPMAP_NEAREST:
+            minFilter = VK_FILTER_NEAREST;
+            mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+            break;
+        case gltf::LINEAR_MIPMAP_NEAREST:
+            mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+            break;
+        case gltf::NEAREST_MIPMAP_LINEAR:
+            minFilter = VK_FILTER_NEAREST;
+            break;
+        default:
+            break;
+    }
+
+    VkSampler samp = _make(
+        (s.magFilter == gltf::NEAREST ? VK_FILTER_NEAREST : VK_FILTER_LINEAR),
+        minFilter, mipmapMode,
+        _wrapMode(s.wrapS), _wrapMode(s.wrapT),
+        useMipmap
+    );
+    gltfSamplers[key] = samp;
+    return samp;
+}
+
 
 }; //namespace
@@ -1,5 +1,9 @@
 #include "vkhelpers.h"
 
+namespace gltf {
+    class GLTFSampler;
+};
+
 namespace Samplers {
 
 /// Initialize the subsystem.
@@ -22,4 +26,10 @@ extern VkSampler mipSampler             ;
 /// Sampler using linear filtering + mipmaps + claping 
 extern VkSampler clampingMipSampler     ;
 
+/// Get a sampler with a GLTF sampler's filter and wrap modes. Samplers
+/// are cached, so materials with the same modes share one.
+/// @param s The GLTF sampler
+/// @return The sampler. It's destroyed at cleanup.
+VkSampler get(const gltf::GLTFSampler& s);
+
 };
@@ -22,6 +22,9 @@ static VulkanContext* ctx;
 static std::vector<VkPipelineShaderStageCreateInfo> _shaders;
 static std::list<std::vector<unsigned> > codes;
 
+//#define's from define(); glslang puts this after the #version line
+static std::string preamble;
+
 
 
 
@@ -289,6 +292,7 @@ VkPipelineShaderStageCreateInfo doCompile( const std::string& src,
     const int L[1] = { (int)src.length() };
     const char* N[1] = { filename.c_str() };
     shader.setStringsWithLengthsAndNames(S,L,N,1);
+    shader.setPreamble(preamble.c_str());
 
     shader.setEnvInput( glslang::EShSourceGlsl, lang, glslang::EShClientVulkan, 100 );
     shader.setEnvClient( glslang::EShClientVulkan, glslang::EShTargetVulkan_1_0 );
@@ -436,4 +440,9 @@ VkPipelineShaderStageCreateInfo loadFromString(std::string src, std::string type
     return doCompile(src, "internal source", type );
 }
 
+void define(std::string name, std::string value)
+{
+    preamble += "#define "+name+" "+value+"\n";
+}
+
 }; //namespace
@@ -32,4 +32,9 @@ VkPipelineShaderStageCreateInfo load(std::string filename, std::string type);
 /// @return Shader information.
 VkPipelineShaderStageCreateInfo loadFromString(std::string data, std::string type);
 
+/// #define a symbol in every shader that is compiled after this call.
+/// @param name Symbol name
+/// @param value Value of the symbol
+void define(std::string name, std::string value);
+
 };
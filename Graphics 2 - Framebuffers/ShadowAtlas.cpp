@@ -0,0 +1,738 @@
+#include "ShadowAtlas.h"
+#include "Buffers.h"
+#include "Camera.h"
+#include "Descriptors.h"
+#include "Framebuffer.h"
+#include "GraphicsPipeline.h"
+#include "Images.h"
+#include "Light.h"
+#include "Meshes.h"
+#include "PushConstants.h"
+#include "ShaderManager.h"
+#include "VertexManager.h"
+#include "CleanupManager.h"
+#include "CPUProfiler.h"
+#include "consoleoutput.h"
+#include "importantConstants.h"
+#include "utils.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+using namespace math2801;
+
+//what a tile holds where nothing was drawn: farther than anything
+static const float FAR_DISTANCE = std::numeric_limits<float>::max();
+
+//spotlights wider than this (cosine of the half angle) get
+//six views, like a point light
+static const float WIDEST_SPOT = 0.2f;
+
+//added to a spotlight's half angle (degrees) so the
+//edge of the cone isn't at the edge of the tile
+static const float SPOT_MARGIN = 2.0f;
+
+//only used in this file; other files have types with the same names
+namespace{
+
+//a square part of one layer of the atlas
+struct Tile{
+    unsigned x,y,size,layer;
+};
+
+struct Sphere{
+    vec3 center;
+    float radius;       //negative if there's nothing in it
+};
+
+//what a light's views are for; a light that changes any of
+//these is a different light as far as the cache is concerned
+typedef std::array<float,8> LightKey;
+
+struct CachedLight{
+    std::vector<mat4> viewProj;     //one per view: the spotlight, or the cube faces
+    std::vector<Tile> tiles;        //parallel to viewProj; empty if they have no room
+    Sphere bounds;                  //the light's range
+    unsigned requested=0;           //tile size the tiles were allocated for; 0 if none
+    unsigned wantedSize=0;          //tile size for this frame
+    bool drawn=false;               //the tiles have been drawn
+    bool upToDate=false;            //nothing has moved since then
+    float coverage=0.0f;            //fraction of the screen's height the range covers
+    int lightIndex=-1;              //in this frame's LightCollection
+    unsigned lastUsed=0;            //frame number
+};
+
+};  //namespace
+
+static VulkanContext* ctx;
+static bool enabled_ = false;
+static unsigned atlasSize;
+static unsigned numLayers;
+static unsigned minTileSize;
+static unsigned maxTileSize;
+static unsigned updatesPerFrame;
+static unsigned maxShadowedLights;
+static float shadowDistance;
+static Framebuffer* atlas;
+static bool atlasCleared = false;
+
+static GraphicsPipeline* pipeline;
+static VertexManager* vertexManager;
+static PushConstants* pushConstants;
+static MeshPushConstantHandles pushConstantHandles;
+
+static unsigned maxLights_;
+static VkDeviceSize frameBytes;         //shadow buffer contents for one frame
+static Buffer* staging;                 //one region per frame in flight
+static char* stagingMapped;
+static DeviceLocalBuffer* shadowBuffer;
+
+//free tiles, by level: a tile at level L is atlasSize>>L texels across
+static std::vector< std::vector<Tile> > freeTiles;
+static unsigned long long usedTexels = 0;
+static bool warnedFull = false;
+
+static std::map<LightKey,CachedLight> cache;
+static unsigned frameNumber = 0;
+static ShadowAtlasStats stats_;
+
+//kept from frame to frame to reuse their memory
+static std::vector<CachedLight*> shadowed;     //this frame's lights, most coverage first
+static std::vector<CachedLight*> toDraw;
+static std::vector<Sphere> casterBounds;
+static std::vector<Sphere> previousCasterBounds;
+static std::vector<mat4> previousWorldMatrices;
+static std::vector<unsigned> moved;
+
+static bool isPowerOfTwo(unsigned x)
+{
+    return x != 0 && (x & (x-1)) == 0;
+}
+
+static bool overlap(const Sphere& a, const Sphere& b)
+{
+    if( a.radius < 0.0f || b.radius < 0.0f )
+        return false;
+    vec3 d = a.center - b.center;
+    float r = a.radius + b.radius;
+    return dot(d,d) <= r*r;
+}
+
+static unsigned level(unsigned size)
+{
+    unsigned L=0;
+    while( (atlasSize>>L) > size )
+        ++L;
+    return L;
+}
+
+static bool allocateTile(unsigned L, Tile& t)
+{
+    if( !freeTiles[L].empty() ){
+        t = freeTiles[L].back();
+        freeTiles[L].pop_back();
+        return true;
+    }
+    if( L == 0 )
+        return false;
+    Tile parent;
+    if( !allocateTile(L-1,parent) )
+        return false;
+    //use one quarter of the parent and keep the other three
+    unsigned s = parent.size/2;
+    freeTiles[L].push_back(Tile{parent.x+s, parent.y,   s, parent.layer});
+    freeTiles[L].push_back(Tile{parent.x,   parent.y+s, s, parent.layer});
+    freeTiles[L].push_back(Tile{parent.x+s, parent.y+s, s, parent.layer});
+    t = Tile{parent.x, parent.y, s, parent.layer};
+    return true;
+}
+
+static void releaseTile(Tile t)
+{
+    unsigned L = level(t.size);
+    while( L > 0 ){
+        //if the other three quarters of the parent
+        //are free, free the parent instead
+        unsigned ps = t.size*2;
+        unsigned px = t.x - t.x%ps;
+        unsigned py = t.y - t.y%ps;
+        auto sibling = [&](const Tile& f){
+            return f.layer == t.layer && f.x - f.x%ps == px && f.y - f.y%ps == py;
+        };
+        std::vector<Tile>& F = freeTiles[L];
+        if( std::count_if(F.begin(),F.end(),sibling) != 3 )
+            break;
+        F.erase( std::remove_if(F.begin(),F.end(),sibling), F.end() );
+        t = Tile{px,py,ps,t.layer};
+        --L;
+    }
+    freeTiles[L].push_back(t);
+}
+
+static void releaseTiles(CachedLight& c)
+{
+    for(const Tile& t : c.tiles){
+        releaseTile(t);
+        usedTexels -= (unsigned long long)t.size * t.size;
+    }
+    c.tiles.clear();
+    c.requested = 0;
+    c.drawn = false;
+    c.upToDate = false;
+}
+
+//get tiles for all of c's views, as close to c.wantedSize as there's room for
+static bool allocateTiles(CachedLight& c)
+{
+    releaseTiles(c);
+    for(unsigned size=c.wantedSize; size >= minTileSize; size /= 2){
+        unsigned L = level(size);
+        Tile t;
+        while( c.tiles.size() < c.viewProj.size() && allocateTile(L,t) ){
+            c.tiles.push_back(t);
+            usedTexels += (unsigned long long)size * size;
+        }
+        if( c.tiles.size() == c.viewProj.size() ){
+            c.requested = c.wantedSize;
+            return true;
+        }
+        releaseTiles(c);
+    }
+    return false;
+}
+
+//tile size for a light whose range covers this much of the screen
+static unsigned tileSize(float coverage, std::size_t numViews)
+{
+    float s = coverage * maxTileSize;
+    if( numViews > 1 )
+        s *= 0.5f;          //each cube face sees a quarter of the space a spotlight might
+    unsigned size = minTileSize;
+    while( size < s && size < maxTileSize )
+        size *= 2;
+    return size;
+}
+
+//fraction of the screen's height that the sphere covers, at most 1
+static float screenCoverage(const Camera& camera, vec3 center, float radius)
+{
+    vec3 d = center - camera.eye;
+    float dist2 = dot(d,d);
+    float r2 = radius*radius;
+    if( dist2 <= r2 )
+        return 1.0f;
+    float P = std::max( std::fabs(camera.projMatrix[0][0]), std::fabs(camera.projMatrix[1][1]) );
+    return std::min(1.0f, radius * P / std::sqrt(dist2-r2) );
+}
+
+static Sphere worldBounds(const Mesh* m, const mat4& M)
+{
+    if( m->boundsMin.x > m->boundsMax.x )
+        return Sphere{ vec3(0,0,0), -1.0f };
+    vec3 lo(HUGE_VALF,HUGE_VALF,HUGE_VALF);
+    vec3 hi(-HUGE_VALF,-HUGE_VALF,-HUGE_VALF);
+    for(int i=0;i<8;++i){
+        vec3 p(
+            (i&1) ? m->boundsMax.x : m->boundsMin.x,
+            (i&2) ? m->boundsMax.y : m->boundsMin.y,
+            (i&4) ? m->boundsMax.z : m->boundsMin.z
+        );
+        vec3 w = (vec4(p,1.0f) * M).xyz();
+        lo = min(lo,w);
+        hi = max(hi,w);
+    }
+    return Sphere{ 0.5f*(lo+hi), 0.5f*length(hi-lo) };
+}
+
+//the light's views: one for a spotlight, else
+//one for each cube face (+x,-x,+y,-y,+z,-z)
+static void lightViews(const LightCollection& lights, int i, float range, std::vector<mat4>& viewProj)
+{
+    vec3 p = lights.lightPositionAndDirectionalFlag[i].xyz();
+    float cosOuter = lights.cosSpotAngles[i].y;
+    float yon = range;
+    float hither = std::min(0.05f, 0.01f*range);
+    viewProj.clear();
+    if( cosOuter > WIDEST_SPOT ){
+        vec3 dir = normalize(lights.spotDirection[i].xyz());
+        vec3 up = ( std::fabs(dir.y) < 0.99f ? vec3(0,1,0) : vec3(1,0,0) );
+        //Camera takes the half angle
+        float halfAngle = std::acos(cosOuter) * 180.0f / 3.14159265358979f + SPOT_MARGIN;
+        Camera cam(p, p+dir, up, halfAngle, 1.0f, hither, yon);
+        viewProj.push_back(cam.viewProjMatrix);
+    } else {
+        static const vec3 axes[6] = {
+            vec3(1,0,0), vec3(-1,0,0), vec3(0,1,0), vec3(0,-1,0), vec3(0,0,1), vec3(0,0,-1)
+        };
+        static const vec3 ups[6] = {
+            vec3(0,1,0), vec3(0,1,0), vec3(0,0,1), vec3(0,0,1), vec3(0,1,0), vec3(0,1,0)
+        };
+        for(int f=0;f<6;++f){
+            //a half angle of 45 degrees makes each face a quarter of the sphere
+            Camera cam(p, p+axes[f], ups[f], 45.0f, 1.0f, hither, yon);
+            viewProj.push_back(cam.viewProjMatrix);
+        }
+    }
+}
+
+//find the meshes that moved since the last frame
+static void findMovedCasters(const std::vector<Mesh*>& meshes, const std::vector<mat4>& worldMatrices)
+{
+    bool sameMeshes = (previousWorldMatrices.size() == meshes.size());
+    casterBounds.resize(meshes.size());
+    moved.clear();
+    for(unsigned i=0;i<meshes.size();++i){
+        casterBounds[i] = worldBounds(meshes[i],worldMatrices[i]);
+        if( !sameMeshes || std::memcmp(&previousWorldMatrices[i], &worldMatrices[i], sizeof(mat4)) != 0 )
+            moved.push_back(i);
+    }
+
+    for(auto& it : cache ){
+        CachedLight& c = it.second;
+        if( !c.upToDate )
+            continue;
+        if( !sameMeshes ){
+            c.upToDate = false;
+            continue;
+        }
+        //both where it was and where it is now
+        for(unsigned i : moved){
+            if( overlap(c.bounds,casterBounds[i]) || overlap(c.bounds,previousCasterBounds[i]) ){
+                c.upToDate = false;
+                break;
+            }
+        }
+    }
+
+    previousWorldMatrices = worldMatrices;
+    previousCasterBounds = casterBounds;
+}
+
+//pick the lights to shadow, most screen coverage first, and
+//forget the ones that weren't picked
+static void chooseLights(const Camera& camera, const LightCollection& lights)
+{
+    struct Candidate{
+        int index;
+        float range;
+        float coverage;
+    };
+    static std::vector<Candidate> candidates;
+    candidates.clear();
+    int numLights = std::min(lights.numLights, (int)maxLights_);
+    for(int i=0;i<numLights;++i){
+        const vec4& p = lights.lightPositionAndDirectionalFlag[i];
+        if( p.w == 0.0f )
+            continue;
+        float r = lights.radius(i);
+        if( r <= 0.0f )
+            continue;
+        //casters farther away than this don't cast shadows
+        r = std::min(r, shadowDistance);
+        candidates.push_back(Candidate{ i, r, screenCoverage(camera,p.xyz(),r) });
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+        [](const Candidate& a, const Candidate& b){ return a.coverage > b.coverage; });
+    if( candidates.size() > maxShadowedLights )
+        candidates.resize(maxShadowedLights);
+
+    shadowed.clear();
+    for(const Candidate& cand : candidates){
+        int i = cand.index;
+        const vec4& p = lights.lightPositionAndDirectionalFlag[i];
+        const vec4& d = lights.spotDirection[i];
+        LightKey key{ p.x, p.y, p.z, d.x, d.y, d.z, lights.cosSpotAngles[i].y, cand.range };
+        CachedLight& c = cache[key];
+        if( c.lastUsed == frameNumber )
+            continue;       //another light with the same parameters
+        if( c.viewProj.empty() ){
+            c.bounds = Sphere{ p.xyz(), cand.range };
+            lightViews(lights, i, cand.range, c.viewProj);
+        }
+        c.lightIndex = i;
+        c.lastUsed = frameNumber;
+        c.coverage = cand.coverage;
+
+        //grow right away, but only shrink once it's two sizes
+        //too big, so a light near a boundary isn't redrawn every frame
+        unsigned want = tileSize(cand.coverage, c.viewProj.size());
+        if( c.requested == 0 || want > c.requested || want*4 <= c.requested )
+            c.wantedSize = want;
+        else
+            c.wantedSize = c.requested;
+        shadowed.push_back(&c);
+    }
+
+    for(auto it = cache.begin(); it != cache.end(); ){
+        if( it->second.lastUsed != frameNumber ){
+            releaseTiles(it->second);
+            it = cache.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+static void drawTile(VkCommandBuffer cmd, PushConstantBlock& block, const CachedLight& c, unsigned v,
+    const std::vector<Mesh*>& meshes, const std::vector<mat4>& worldMatrices)
+{
+    const Tile& t = c.tiles[v];
+    VkRect2D rect{
+        .offset = VkOffset2D{ .x = (int)t.x, .y = (int)t.y },
+        .extent = VkExtent2D{ .width = t.size, .height = t.size }
+    };
+    vkCmdSetViewport(cmd, 0, 1,
+        VkViewport{
+            .x = (float)t.x,
+            .y = (float)t.y,
+            .width = (float)t.size,
+            .height = (float)t.size,
+            .minDepth = 0.0f,
+            .maxDepth = 1.0f
+        }
+    );
+    vkCmdSetScissor(cmd, 0, 1, rect);
+
+    //the depth buffer is shared by all of the layers, so
+    //what's there could be from another layer's tile
+    VkClearAttachment clears[2];
+    clears[0].aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    clears[0].colorAttachment = 0;
+    clears[0].clearValue.color.float32[0] = FAR_DISTANCE;
+    clears[0].clearValue.color.float32[1] = FAR_DISTANCE;
+    clears[0].clearValue.color.float32[2] = FAR_DISTANCE;
+    clears[0].clearValue.color.float32[3] = FAR_DISTANCE;
+    clears[1].aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    clears[1].colorAttachment = 0;    //ignored
+    clears[1].clearValue.depthStencil = VkClearDepthStencilValue{ .depth = 1.0f, .stencil = 0 };
+    VkClearRect clearRect{
+        .rect = rect,
+        .baseArrayLayer = 0,
+        .layerCount = 1
+    };
+    vkCmdClearAttachments(cmd, 2, clears, 1, &clearRect);
+
+    for(unsigned i=0;i<meshes.size();++i){
+        if( !overlap(c.bounds,casterBounds[i]) )
+            continue;
+        //shadow.vert doesn't use the materials, so the
+        //primitives are drawn without Primitive::draw()
+        block.set(pushConstantHandles.worldMatrix, worldMatrices[i] * c.viewProj[v]);
+        block.flush(cmd);
+        for(const Primitive* p : meshes[i]->primitives){
+            vkCmdDrawIndexed(
+                cmd,
+                p->drawinfo.numIndices,
+                1,              //instance count
+                p->drawinfo.indexOffset,
+                p->drawinfo.vertexOffset,
+                0               //first instance
+            );
+        }
+    }
+}
+
+//draw the tiles that are out of date, up to the budget
+static void drawTiles(VkCommandBuffer cmd, const std::vector<Mesh*>& meshes,
+    const std::vector<mat4>& worldMatrices)
+{
+    //lights that have never been drawn first; then the ones that cover
+    //the most screen (shadowed is already in that order)
+    toDraw.clear();
+    for(CachedLight* c : shadowed){
+        bool reallocate = c->tiles.empty() || c->wantedSize != c->requested;
+        if( !c->drawn || !c->upToDate || reallocate )
+            toDraw.push_back(c);
+        else
+            stats_.tilesCached += c->tiles.size();
+    }
+    std::stable_sort(toDraw.begin(), toDraw.end(),
+        [](const CachedLight* a, const CachedLight* b){ return !a->drawn && b->drawn; });
+
+    //a point light's tiles are drawn together, so the first
+    //light is drawn even if it has more tiles than the budget
+    unsigned budget = updatesPerFrame;
+    bool any = false;
+    auto last = toDraw.begin();
+    for(CachedLight* c : toDraw){
+        unsigned n = (unsigned)c->viewProj.size();
+        if( n > budget && any ){
+            stats_.tilesDeferred += n;
+            continue;
+        }
+        if( c->tiles.empty() || c->wantedSize != c->requested ){
+            if( !allocateTiles(*c) ){
+                if( !warnedFull ){
+                    warn("ShadowAtlas: The atlas is full; some lights won't have shadows."
+                        " Increase shadowAtlasLayers in config.ini");
+                    warnedFull=true;
+                }
+                continue;
+            }
+        }
+        budget -= std::min(n,budget);
+        any = true;
+        *last++ = c;
+    }
+    toDraw.erase(last,toDraw.end());
+    if( toDraw.empty() )
+        return;
+
+    for(unsigned layer=0;layer<numLayers;++layer){
+        bool began = false;
+        PushConstantBlock block(pushConstants);
+        for(CachedLight* c : toDraw){
+            for(unsigned v=0;v<c->tiles.size();++v){
+                if( c->tiles[v].layer != layer )
+                    continue;
+                if( !began ){
+                    atlas->beginOneLayerRenderPassKeepContents((int)layer, cmd);
+                    pipeline->use(cmd);
+                    vertexManager->bindBuffers(cmd);
+                    began = true;
+                }
+                drawTile(cmd, block, *c, v, meshes, worldMatrices);
+                stats_.tilesRendered++;
+            }
+        }
+        if( began )
+            atlas->endRenderPassNoMipmaps(cmd);
+    }
+    for(CachedLight* c : toDraw){
+        c->drawn = true;
+        c->upToDate = true;
+    }
+}
+
+//fill in this frame's part of the staging buffer and copy it
+static void writeShadowBuffer(VkCommandBuffer cmd, DescriptorSet* descriptorSet, const LightCollection& lights)
+{
+    unsigned numLights = (unsigned)std::min(lights.numLights, (int)maxLights_);
+
+    //this frame slot's region was last read by the frame that
+    //had the slot before, which utils::beginFrame() has waited for
+    char* region = stagingMapped + utils::getFrameSlot() * frameBytes;
+    float* F = (float*) region;
+    F[0] = (float)numLights;
+    F[1] = F[2] = F[3] = 0.0f;
+    float* entries = F + 4*SHADOW_HEADER_SIZE;
+    std::memset(entries, 0, numLights*4*sizeof(float));
+    float* views = entries + 4*numLights;
+
+    unsigned numViews=0;
+    for(const CachedLight* c : shadowed){
+        if( !c->drawn )
+            continue;
+        stats_.shadowedLights++;
+        entries[4*c->lightIndex] = (float)numViews;
+        entries[4*c->lightIndex+1] = (float)c->tiles.size();
+        for(unsigned v=0;v<c->tiles.size();++v){
+            //columns, so the shader can use dot()
+            float* V = views + 4*SHADOW_VIEW_SIZE*numViews;
+            const mat4& M = c->viewProj[v];
+            for(int j=0;j<4;++j){
+                for(int k=0;k<4;++k)
+                    V[4*j+k] = M[k][j];
+            }
+            const Tile& t = c->tiles[v];
+            V[16] = (float)t.x;
+            V[17] = (float)t.y;
+            V[18] = (float)t.size;
+            V[19] = (float)t.layer;
+            numViews++;
+        }
+    }
+
+    VkDeviceSize used = (SHADOW_HEADER_SIZE + numLights + SHADOW_VIEW_SIZE*numViews) * 4*sizeof(float);
+    Buffers::memoryBarrier(cmd,shadowBuffer->buffer);
+    vkCmdCopyBuffer(cmd, staging->buffer, shadowBuffer->buffer, 1,
+        VkBufferCopy{
+            .srcOffset=(VkDeviceSize)(region - stagingMapped),
+            .dstOffset=0,
+            .size=used
+        }
+    );
+    Buffers::memoryBarrier(cmd,shadowBuffer->buffer);
+
+    descriptorSet->setSlot(SHADOW_BUFFER_SLOT, shadowBuffer->buffer);
+    descriptorSet->setSlot(SHADOW_ATLAS_SLOT, atlas->currentImage()->view());
+}
+
+namespace ShadowAtlas{
+
+bool initialized()
+{
+    return ctx != nullptr;
+}
+
+void initialize(VulkanContext* ctx_)
+{
+    if(initialized())
+        return;
+    ctx=ctx_;
+
+    enabled_ = (ctx->config.get("shadows","yes") == "yes");
+    if( !enabled_ )
+        return;
+
+    int size = std::stoi(ctx->config.get("shadowAtlasSize","2048"));
+    int layers = std::stoi(ctx->config.get("shadowAtlasLayers","2"));
+    int minTile = std::stoi(ctx->config.get("shadowMinTileSize","64"));
+    int maxTile = std::stoi(ctx->config.get("shadowMaxTileSize","1024"));
+    int updates = std::stoi(ctx->config.get("shadowUpdatesPerFrame","6"));
+    int maxShadowed = std::stoi(ctx->config.get("shadowMaxLights","16"));
+    if( size <= 0 || !isPowerOfTwo((unsigned)size) )
+        throw std::runtime_error("shadowAtlasSize must be a power of two");
+    if( layers <= 0 )
+        throw std::runtime_error("shadowAtlasLayers must be positive");
+    if( minTile <= 0 || !isPowerOfTwo((unsigned)minTile) ||
+            maxTile <= 0 || !isPowerOfTwo((unsigned)maxTile) ||
+            minTile > maxTile || maxTile > size )
+        throw std::runtime_error("shadowMinTileSize and shadowMaxTileSize must be powers of two, "
+            "with shadowMinTileSize <= shadowMaxTileSize <= shadowAtlasSize");
+    if( updates <= 0 )
+        throw std::runtime_error("shadowUpdatesPerFrame must be positive");
+    if( maxShadowed <= 0 )
+        throw std::runtime_error("shadowMaxLights must be positive");
+    atlasSize = (unsigned)size;
+    numLayers = (unsigned)layers;
+    minTileSize = (unsigned)minTile;
+    maxTileSize = (unsigned)maxTile;
+    updatesPerFrame = (unsigned)updates;
+    maxShadowedLights = (unsigned)maxShadowed;
+    shadowDistance = std::stof(ctx->config.get("shadowDistance","50"));
+    if( !(shadowDistance > 0.0f) )
+        throw std::runtime_error("shadowDistance must be positive");
+
+    freeTiles.resize(level(minTileSize)+1);
+    for(unsigned i=0;i<numLayers;++i)
+        freeTiles[0].push_back(Tile{0,0,atlasSize,i});
+
+    atlas = Framebuffer::makePersistent(atlasSize, atlasSize, numLayers,
+        VK_FORMAT_R32_SFLOAT, "shadow atlas");
+
+    ShaderManager::define("SHADOW_ATLAS","1");
+
+    verbose("ShadowAtlas:",numLayers,"layers of",atlasSize,"x",atlasSize,
+        "; tiles from",minTileSize,"to",maxTileSize,"texels");
+}
+
+bool enabled()
+{
+    return enabled_;
+}
+
+void createResources(PipelineLayout* pipelineLayout, VertexManager* vertexManager_,
+                     PushConstants* pushConstants_, int maxLights)
+{
+    if( !enabled_ )
+        throw std::runtime_error("ShadowAtlas::createResources(): Not enabled");
+    if( pipeline )
+        throw std::runtime_error("ShadowAtlas::createResources(): Already called");
+
+    vertexManager = vertexManager_;
+    pushConstants = pushConstants_;
+    pushConstantHandles = MeshPushConstantHandles(pushConstants);
+
+    static const VkDynamicState dynamicStates[] = {
+        VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR
+    };
+    pipeline = (new GraphicsPipeline(
+        ctx,
+        pipelineLayout,
+        vertexManager->layout,
+        atlas,
+        "shadow pipeline"
+    ))
+    ->set(ShaderManager::load("shaders/shadow.vert"))
+    ->set(ShaderManager::load("shaders/shadow.frag"))
+    ->set(atlas->singleLayerRenderPassKeep)
+    //R32_SFLOAT isn't necessarily blendable
+    ->set(VkPipelineColorBlendAttachmentState{
+        .blendEnable=VK_FALSE,
+        .srcColorBlendFactor=VK_BLEND_FACTOR_ONE,
+        .dstColorBlendFactor=VK_BLEND_FACTOR_ZERO,
+        .colorBlendOp=VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor=VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor=VK_BLEND_FACTOR_ZERO,
+        .alphaBlendOp=VK_BLEND_OP_ADD,
+        .colorWriteMask=VK_COLOR_COMPONENT_R_BIT
+    })
+    //each tile sets its own
+    ->set(VkPipelineDynamicStateCreateInfo{
+        .sType=VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .pNext=nullptr,
+        .flags=0,
+        .dynamicStateCount=2,
+        .pDynamicStates=dynamicStates
+    });
+
+    maxLights_ = (unsigned)std::max(maxLights,1);
+    unsigned maxViews = maxShadowedLights*6;
+    frameBytes = (SHADOW_HEADER_SIZE + maxLights_ + SHADOW_VIEW_SIZE*maxViews) * 4*sizeof(float);
+
+    staging = new Buffer(ctx, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        frameBytes * ctx->framesInFlight, "shadow buffer staging");
+    VkDeviceMemory mem = Buffers::allocateMemory(
+        ctx,
+        staging->memoryRequirements.memoryTypeBits,
+        staging->memoryRequirements.size,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "memory for shadow buffer staging");
+    staging->bindMemory(mem,0,true);
+    check(vkMapMemory(ctx->dev, mem, 0, VK_WHOLE_SIZE, 0, (void**)&stagingMapped));
+
+    shadowBuffer = new DeviceLocalBuffer(ctx, nullptr, frameBytes,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, "shadow buffer");
+
+    CleanupManager::registerCleanupFunction([](){
+        vkUnmapMemory(ctx->dev,staging->memory);
+        staging->cleanup();
+        shadowBuffer->cleanup();
+    });
+}
+
+void update(VkCommandBuffer cmd, DescriptorSet* descriptorSet,
+            const Camera& camera, const LightCollection& lights,
+            const std::vector<Mesh*>& meshes,
+            const std::vector<mat4>& worldMatrices)
+{
+    CPU_ZONE("ShadowAtlas::update");
+    if( !enabled_ )
+        throw std::runtime_error("ShadowAtlas::update(): Not enabled");
+    if( !pipeline )
+        throw std::runtime_error("ShadowAtlas::update(): createResources() hasn't been called");
+
+    ++frameNumber;
+
+    //the atlas's initial contents are undefined; this
+    //also gives it a currentImage() for the descriptor
+    if( !atlasCleared ){
+        for(unsigned layer=0;layer<numLayers;++layer){
+            atlas->beginOneLayerRenderPassClearContents((int)layer, cmd,
+                FAR_DISTANCE, FAR_DISTANCE, FAR_DISTANCE, FAR_DISTANCE);
+            atlas->endRenderPassNoMipmaps(cmd);
+        }
+        atlasCleared = true;
+    }
+
+    findMovedCasters(meshes,worldMatrices);
+    chooseLights(camera,lights);
+    drawTiles(cmd,meshes,worldMatrices);
+    writeShadowBuffer(cmd,descriptorSet,lights);
+
+    stats_.frames++;
+    stats_.occupancy += double(usedTexels) / (double(atlasSize)*atlasSize*numLayers);
+}
+
+ShadowAtlasStats stats()
+{
+    return stats_;
+}
+
+};  //namespace
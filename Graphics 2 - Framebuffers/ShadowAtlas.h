@@ -0,0 +1,86 @@
+#pragma once
+#include "vkhelpers.h"
+#include "math2801.h"
+#include <vector>
+
+class Camera;
+class DescriptorSet;
+class LightCollection;
+class Mesh;
+class PipelineLayout;
+class PushConstants;
+class VertexManager;
+
+/// Shadow atlas counts; see ShadowAtlas::stats()
+struct ShadowAtlasStats{
+    unsigned long long frames=0;            ///< Calls to update()
+    unsigned long long shadowedLights=0;    ///< Lights that had a shadow map
+    unsigned long long tilesRendered=0;     ///< Tiles that were drawn
+    unsigned long long tilesCached=0;       ///< Up to date tiles that were reused
+    unsigned long long tilesDeferred=0;     ///< Out of date tiles left for a later frame
+    double occupancy=0.0;                   ///< Sum of the fraction of the atlas in use
+};
+
+/// Shadow maps for positional lights, packed into one atlas: a
+/// persistent, layered Framebuffer (see Framebuffer::makePersistent()).
+/// Each shadowed light gets a square tile (a spotlight)
+/// or six (a point light: one per cube face); the tile size is a power
+/// of two that grows with how much of the screen the light's range
+/// covers. A tile holds the distance along the light's view direction
+/// to the nearest caster, as a float.
+/// Tiles are cached: a light's tiles are drawn again only when
+/// the light changes or a mesh that moved (before or after) is within
+/// its range. At most shadowUpdatesPerFrame tiles are drawn each
+/// frame (see config.ini); the rest keep their old contents until a
+/// later frame. Lights that have never been drawn are first in line.
+/// Directional lights are not shadowed.
+/// Shaders are compiled with SHADOW_ATLAS defined; see
+/// importantConstants.h for the shadow buffer layout. If shadows=no
+/// in config.ini, enabled() is false and nothing is shadowed.
+namespace ShadowAtlas{
+
+/// Initialize the subsystem. This must be called before
+/// any shaders that use the atlas are loaded.
+/// @param ctx The context
+void initialize(VulkanContext* ctx);
+
+/// Return true if subsystem was initialized
+/// @return True if initialized; false if not
+bool initialized();
+
+/// True if lights are shadowed.
+/// @return True if enabled
+bool enabled();
+
+/// Make the pipeline that draws the shadow maps and the shadow
+/// buffer. This must be called once, after initialize() and
+/// before update(), if enabled().
+/// @param pipelineLayout The layout the meshes are drawn with
+/// @param vertexManager The meshes' vertex manager
+/// @param pushConstants The push constants in pipelineLayout
+/// @param maxLights Most lights a LightCollection passed to update() will have
+void createResources(PipelineLayout* pipelineLayout, VertexManager* vertexManager,
+                     PushConstants* pushConstants, int maxLights);
+
+/// Pick the shadowed lights, draw the tiles that are out of date
+/// (up to the budget), and record the copy of the shadow buffer.
+/// This must be called once per frame, outside of any render
+/// pass, before the draws that use them. It changes the bound
+/// pipeline and vertex buffers.
+/// @param cmd The frame's command buffer
+/// @param descriptorSet The per-frame set; receives the atlas at
+///         SHADOW_ATLAS_SLOT and the buffer at SHADOW_BUFFER_SLOT
+/// @param camera The camera the frame is drawn with
+/// @param lights The lights
+/// @param meshes The shadow casters
+/// @param worldMatrices World matrix of each mesh; parallel to meshes
+void update(VkCommandBuffer cmd, DescriptorSet* descriptorSet,
+            const Camera& camera, const LightCollection& lights,
+            const std::vector<Mesh*>& meshes,
+            const std::vector<math2801::mat4>& worldMatrices);
+
+/// Totals for every call to update() so far
+/// @return The totals
+ShadowAtlasStats stats();
+
+};  //namespace
@@ -0,0 +1,177 @@
+#include "StaticCommandCache.h"
+#include "Framebuffer.h"
+#include "Descriptors.h"
+#include "CleanupManager.h"
+#include "RetireQueue.h"
+#include "CPUProfiler.h"
+#include "utils.h"
+#include <map>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+
+//cached commands for one VkFramebuffer
+struct Entry{
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    unsigned generation = 0;
+    std::vector<char> key;
+    DescriptorSet* descriptorSet = nullptr;
+    std::vector<VkDescriptorSet> pinned;
+};
+
+static VulkanContext* ctx;
+static bool enabled_ = false;
+static VkCommandPool pool;
+static std::map<VkFramebuffer,Entry> entries;
+static unsigned generation = 1;        //entries with a different value are stale
+static unsigned recordings = 0;
+
+//command buffers that were replaced; they may still
+//be executing, so they're reset only after their frame is done
+static RetireQueue<VkCommandBuffer> retired;
+
+static VkCommandBuffer getCommandBuffer()
+{
+    VkCommandBuffer c;
+    if( retired.pop(c) ){
+        check(vkResetCommandBuffer(c,0));
+        return c;
+    }
+    check(vkAllocateCommandBuffers(
+        ctx->dev,
+        VkCommandBufferAllocateInfo{
+            .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .pNext=nullptr,
+            .commandPool=pool,
+            .level=VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+            .commandBufferCount=1
+        },
+        &c
+    ));
+    return c;
+}
+
+//give back the entry's command buffer and descriptor sets
+//once the current frame is done with them
+static void releaseEntry(Entry& e)
+{
+    if( e.cmd != VK_NULL_HANDLE ){
+        retired.push(e.cmd);
+        e.cmd = VK_NULL_HANDLE;
+    }
+    if( e.descriptorSet ){
+        e.descriptorSet->releasePinned(e.pinned);
+        e.pinned.clear();
+        e.descriptorSet = nullptr;
+    }
+}
+
+namespace StaticCommandCache{
+
+bool initialized()
+{
+    return ctx != nullptr;
+}
+
+void initialize(VulkanContext* ctx_)
+{
+    if(initialized())
+        return;
+    ctx=ctx_;
+
+    enabled_ = (ctx->config.get("staticCommandCache","no") == "yes");
+
+    check(vkCreateCommandPool(
+        ctx->dev,
+        VkCommandPoolCreateInfo{
+            .sType=VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .pNext=nullptr,
+            .flags=VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = ctx->graphicsQueueIndex
+        },
+        nullptr,
+        &(pool)
+    ));
+
+    CleanupManager::registerCleanupFunction([](){
+        //destroying the pool frees all of its command buffers
+        vkDestroyCommandPool(ctx->dev,pool,nullptr);
+        entries.clear();
+        retired.drain([](VkCommandBuffer){});
+    });
+}
+
+bool enabled()
+{
+    return enabled_;
+}
+
+void invalidate()
+{
+    generation++;
+}
+
+void execute(VkCommandBuffer cmd, Framebuffer* fb, DescriptorSet* descriptorSet,
+    const void* keyData, std::size_t keySize, const RecordFunction& record)
+{
+    if( !initialized() )
+        throw std::runtime_error("StaticCommandCache::execute() called before initialize()");
+
+    CPU_ZONE("StaticCommandCache::execute");
+
+    VkCommandBufferInheritanceInfo inheritance = fb->inheritanceInfo();
+    Entry& e = entries[inheritance.framebuffer];
+
+    bool stale = ( e.cmd == VK_NULL_HANDLE ||
+        e.generation != generation ||
+        e.renderPass != inheritance.renderPass ||
+        e.descriptorSet != descriptorSet ||
+        e.key.size() != keySize ||
+        std::memcmp(e.key.data(), keyData, keySize) != 0 );
+
+    if( stale ){
+        CPU_ZONE("StaticCommandCache::record");
+        releaseEntry(e);
+        e.cmd = getCommandBuffer();
+        //the same commands are executed by every frame slot, so
+        //they may be pending in several frames at once
+        check(vkBeginCommandBuffer(
+            e.cmd,
+            VkCommandBufferBeginInfo{
+                .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                .pNext=nullptr,
+                .flags=VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+                       VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
+                .pInheritanceInfo=&inheritance
+            }
+        ));
+        descriptorSet->beginPinning();
+        try{
+            record(e.cmd);
+        } catch(...){
+            e.pinned = descriptorSet->endPinning();
+            e.descriptorSet = descriptorSet;
+            vkEndCommandBuffer(e.cmd);
+            releaseEntry(e);
+            throw;
+        }
+        e.pinned = descriptorSet->endPinning();
+        e.descriptorSet = descriptorSet;
+        check(vkEndCommandBuffer(e.cmd));
+        e.renderPass = inheritance.renderPass;
+        e.generation = generation;
+        const char* k = (const char*)keyData;
+        e.key.assign(k, k+keySize);
+        recordings++;
+    }
+
+    vkCmdExecuteCommands(cmd, 1, &e.cmd);
+}
+
+unsigned numRecordings()
+{
+    return recordings;
+}
+
+};  //namespace
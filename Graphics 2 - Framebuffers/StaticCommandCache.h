@@ -0,0 +1,64 @@
+#pragma once
+#include "vkhelpers.h"
+#include <functional>
+#include <cstddef>
+
+class Framebuffer;
+class DescriptorSet;
+
+/// Keeps secondary command buffers for draws that don't change from
+/// frame to frame (ex: the static scene) and replays them with
+/// vkCmdExecuteCommands instead of recording them again every frame.
+/// A cached buffer is re-recorded only when its key data changes
+/// (ex: a world matrix moved), when the framebuffer it was recorded
+/// for is different, or after invalidate() is called (ex: meshes,
+/// materials, or pipelines were changed). Enabled with config.ini
+/// (staticCommandCache).
+namespace StaticCommandCache{
+
+/// Function that records the draws into a secondary command buffer.
+/// The command buffer has already been begun; the function must bind
+/// whatever it needs (pipeline, vertex buffers, descriptor sets) itself.
+/// Everything it refers to must stay valid until the next re-record,
+/// so uniforms must come from a buffer that is updated in place (see
+/// Uniforms::updateFixed()) rather than one that changes every frame.
+/// @param cmd The secondary command buffer
+typedef std::function<void(VkCommandBuffer cmd)> RecordFunction;
+
+/// Initialize the subsystem.
+/// @param ctx The context
+void initialize(VulkanContext* ctx);
+
+/// Return true if subsystem was initialized
+/// @return True if initialized; false if not
+bool initialized();
+
+/// True if the cache is turned on in config.ini.
+/// @return True if enabled
+bool enabled();
+
+/// Discard all cached commands; each one is re-recorded the next
+/// time it's executed. Call this when anything that the recorded
+/// commands refer to is changed or destroyed.
+void invalidate();
+
+/// Execute the cached commands for fb's current framebuffer, recording
+/// them first if there aren't any or if they're out of date.
+/// @param cmd The primary command buffer. fb's renderpass must be in
+///        progress in cmd, begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+/// @param fb The Framebuffer being drawn to
+/// @param descriptorSet The DescriptorSet that record uses. Its sets
+///        are pinned (see DescriptorSet::beginPinning()) while the
+///        commands are cached.
+/// @param keyData Data that the recorded commands depend on; if it's
+///        different from the last recording, the commands are re-recorded
+/// @param keySize Size of keyData, in bytes
+/// @param record Function that records the commands
+void execute(VkCommandBuffer cmd, Framebuffer* fb, DescriptorSet* descriptorSet,
+    const void* keyData, std::size_t keySize, const RecordFunction& record);
+
+/// Number of times commands have been recorded since the program started.
+/// @return The count
+unsigned numRecordings();
+
+};  //namespace
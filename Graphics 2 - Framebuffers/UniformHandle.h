@@ -0,0 +1,28 @@
+#pragma once
+
+class Uniforms;
+
+/// A uniform that has already been looked up; see Uniforms::handle().
+/// Setting a uniform through a handle copies the value straight into
+/// the uniform data, without looking up the name or allocating memory.
+/// A handle can only be used with the Uniforms object that made it.
+/// @tparam T The C++ type of the uniform (ex: math2801::mat4)
+template<typename T>
+class UniformHandle{
+  public:
+
+    /// Make a handle that doesn't refer to anything. It must
+    /// be replaced with one from Uniforms::handle() before use.
+    UniformHandle() = default;
+
+    /// Return true if this handle came from Uniforms::handle()
+    /// @return True if the handle can be used
+    bool valid() const {
+        return this->offset >= 0;
+    }
+
+  private:
+    friend class Uniforms;
+    int offset = -1;        //byte offset in the uniform data
+    int arraySize = -1;     //for arrays: Number of elements
+};
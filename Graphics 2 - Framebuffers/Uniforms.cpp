@@ -4,36 +4,81 @@
 #include "Buffers.h"
 #include "consoleoutput.h"
 #include "utils.h"
+#include "CPUProfiler.h"
 #include <cassert>
 #include <cstring>
 #include <array>
+#include <algorithm>
 
-template<typename T>
-static void _set(
-    std::map<std::string,parseMembers::Item>& items,
-    std::vector<char>& shadowBuffer,
-    const std::string& name, const T& value,
-    std::set<std::string>& uninitialized)
-{
-    auto tmp = items.find(name);
-    if( tmp == items.end() ){
-        error("No such uniform '"+name+"'");
-        error("Known uniforms:");
-        for(auto it : items ){
-            error(it.second.name,"(",
-                it.second.typeAsString+
-                it.second.arraySizeAsString,
-                ") "
-            );
-        }
-        throw std::runtime_error("No such uniform '"+name+"'");
+[[noreturn]] static void _noSuchUniform(
+    const std::map<std::string,parseMembers::Item>& items,
+    const std::string& name)
+{
+    error("No such uniform '"+name+"'");
+    error("Known uniforms:");
+    for(auto it : items ){
+        error(it.second.name,"(",
+            it.second.typeAsString+
+            it.second.arraySizeAsString,
+            ") "
+        );
     }
+    throw std::runtime_error("No such uniform '"+name+"'");
+}
+
+//updateFixed() copies two changed ranges with one vkCmdUpdateBuffer
+//if there are fewer than this many bytes between them
+static const std::uint32_t DIRTY_MERGE_GAP = 64;
+
+//if more ranges than this have changed since the last updateFixed(),
+//they're replaced with one range that covers all of them
+static const std::size_t MAX_DIRTY_RANGES = 64;
+
+template<typename T>
+void Uniforms::setByName(const std::string& name, const T& value)
+{
+    auto tmp = this->items.find(name);
+    if( tmp == this->items.end() )
+        _noSuchUniform(this->items,name);
     auto& info = tmp->second;
     std::vector<char> convertedValue = info.convert(value);
-    std::memcpy( shadowBuffer.data()+info.offset, convertedValue.data(), info.byteSize );
-    uninitialized.erase(name);
+    this->write( info.offset, convertedValue.data(), info.byteSize );
 }
 
+void Uniforms::markDirty(int offset, std::size_t size)
+{
+    std::uint32_t first = (std::uint32_t)offset;
+    std::uint32_t last = (std::uint32_t)(offset+size);
+    if( !this->fixedDirty.empty() ){
+        auto& back = this->fixedDirty.back();
+        if( first <= back.second && last >= back.first ){
+            back.first = std::min(back.first,first);
+            back.second = std::max(back.second,last);
+            return;
+        }
+    }
+    if( this->fixedDirty.size() == MAX_DIRTY_RANGES ){
+        for(auto& r : this->fixedDirty){
+            first = std::min(first,r.first);
+            last = std::max(last,r.second);
+        }
+        this->fixedDirty.clear();
+    }
+    this->fixedDirty.push_back(std::make_pair(first,last));
+}
+
+//the type a uniform must have for handle<T>()
+template<typename T> static parseMembers::ItemType _handleType();
+template<> parseMembers::ItemType _handleType<std::int32_t>(){           return parseMembers::ItemType::INT_ITEM; }
+template<> parseMembers::ItemType _handleType<std::uint32_t>(){          return parseMembers::ItemType::UINT_ITEM; }
+template<> parseMembers::ItemType _handleType<float>(){                  return parseMembers::ItemType::FLOAT_ITEM; }
+template<> parseMembers::ItemType _handleType<math2801::ivec2>(){        return parseMembers::ItemType::IVEC2_ITEM; }
+template<> parseMembers::ItemType _handleType<math2801::vec2>(){         return parseMembers::ItemType::VEC2_ITEM; }
+template<> parseMembers::ItemType _handleType<math2801::vec3>(){         return parseMembers::ItemType::VEC3_ITEM; }
+template<> parseMembers::ItemType _handleType<math2801::vec4>(){         return parseMembers::ItemType::VEC4_ITEM; }
+template<> parseMembers::ItemType _handleType<math2801::mat4>(){         return parseMembers::ItemType::MAT4_ITEM; }
+template<> parseMembers::ItemType _handleType<std::vector<math2801::vec4>>(){ return parseMembers::ItemType::VEC4ARRAY_ITEM; }
+
 //~ Uniforms::Uniforms(VulkanContext* ctx, PerFrameDescriptorSet* perFrameDescriptorSet, int slotNumber, std::string uniformFile) :
     //~ Uniforms(ctx,std::vector<PerFrameDescriptorSet*>{perFrameDescriptorSet},slotNumber,uniformFile)
 //~ {}
@@ -66,14 +111,15 @@ void Uniforms::init(VulkanContext* ctx_,
     this->items = std::get<1>(info);
     this->defines = std::get<2>(info);
 
+    this->shadowBuffer.resize(byteSize);
+    this->isSet.resize(byteSize/4+1,0);
+
     verbose("Uniforms: Discovered these uniforms in file",inputFile,":");
     for(auto it : this->items ){
-        this->uninitialized.insert(it.second.name);
+        this->numUnset++;
         verbose(it.second.typeAsString,it.second.arraySizeAsString,it.second.name);
     }
 
-    this->shadowBuffer.resize(byteSize);
-
     verbose("Uniforms: Original byteSize is",byteSize);
 
     //create a dummy so we can get the memory requirements
@@ -94,67 +140,66 @@ void Uniforms::init(VulkanContext* ctx_,
     buff->cleanup();
     buff=nullptr;
 
-    utils::registerFrameCompleteCallback( [this](unsigned frameNumber){
-        if( this->activeBuffers.contains(frameNumber) ){
-
-            this->availableBuffers.insert(
-                this->availableBuffers.end(),
-                this->activeBuffers[frameNumber].begin(),
-                this->activeBuffers[frameNumber].end()
-            );
-            this->activeBuffers.erase(frameNumber);
-        }
-    });
+    this->useRing = this->ctx->config.get("uniformRing","yes") == "yes";
+    this->ringFrameSize = std::stoull(this->ctx->config.get("uniformRingSize","262144"));
 
     CleanupManager::registerCleanupFunction( [this](){
         for(DeviceLocalBuffer* abuff : this->availableBuffers ){
             abuff->cleanup();
         }
-        for(auto it = this->activeBuffers.begin();it!=this->activeBuffers.end();++it){
-            for(DeviceLocalBuffer* b : it->second){
-                b->cleanup();
-            }
-        }
+        this->activeBuffers.drain([](DeviceLocalBuffer* b){
+            b->cleanup();
+        });
         if(this->currentBuffer)
             this->currentBuffer->cleanup();
+        if(this->fixed)
+            this->fixed->cleanup();
+        if(this->ring){
+            vkUnmapMemory(this->ctx->dev,this->ring->memory);
+            this->ring->cleanup();
+        }
         for(VkDeviceMemory mem : this->memories){
             vkFreeMemory(this->ctx->dev,mem,nullptr);
         }
     });
 }
 
-void Uniforms::ensureCurrentIsValid()
+//get a buffer that no frame in flight is using
+DeviceLocalBuffer* Uniforms::freeBuffer()
 {
-    if( this->currentBuffer == nullptr ){
-        if( this->availableBuffers.size() == 0 ){
-            VkDeviceSize numBuffers=(1<<20)/this->byteSize;
-            if( numBuffers == 0 ){
-                throw std::runtime_error("Size of uniforms is too large");
-            }
-            VkDeviceSize allBufferBytes = numBuffers * this->byteSize;
+    DeviceLocalBuffer* buff;
+    //reuse the oldest buffer whose frame has finished, if there is one
+    if( this->activeBuffers.pop(buff) )
+        return buff;
+    if( this->availableBuffers.size() == 0 ){
+        VkDeviceSize numBuffers=(1<<20)/this->byteSize;
+        if( numBuffers == 0 ){
+            throw std::runtime_error("Size of uniforms is too large");
+        }
+        VkDeviceSize allBufferBytes = numBuffers * this->byteSize;
 
-            verbose("Allocated memory for uniforms:",allBufferBytes,"; each uniform buffer is",this->byteSize,"bytes");
+        verbose("Allocated memory for uniforms:",allBufferBytes,"; each uniform buffer is",this->byteSize,"bytes");
 
-            VkDeviceMemory mem = DeviceLocalBuffer::allocateMemory(
+        VkDeviceMemory mem = DeviceLocalBuffer::allocateMemory(
+            this->ctx,
+            this->memoryTypeBits,
+            allBufferBytes,
+            "memory for uniforms");
+        this->memories.push_back(mem);
+        VkDeviceSize offset=0;
+        for(VkDeviceSize i=0;i<numBuffers;++i){
+            this->availableBuffers.push_back( new DeviceLocalBuffer(
                 this->ctx,
-                this->memoryTypeBits,
-                allBufferBytes,
-                "memory for uniforms");
-            this->memories.push_back(mem);
-            VkDeviceSize offset=0;
-            for(VkDeviceSize i=0;i<numBuffers;++i){
-                this->availableBuffers.push_back( new DeviceLocalBuffer(
-                    this->ctx,
-                    mem, offset, this->byteSize,
-                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                    "uniform buffer")
-                );
-                offset += this->byteSize;
-            }
+                mem, offset, this->byteSize,
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                "uniform buffer")
+            );
+            offset += this->byteSize;
         }
-        this->currentBuffer = this->availableBuffers.back();
-        this->availableBuffers.pop_back();
     }
+    buff = this->availableBuffers.back();
+    this->availableBuffers.pop_back();
+    return buff;
 }
 
 //~ void Uniforms::bind(VkCommandBuffer cmd, int index)
@@ -163,35 +208,168 @@ void Uniforms::ensureCurrentIsValid()
     //~ this->descriptorSets[index]->bind(cmd);
 //~ }
 
-void Uniforms::set(const std::string& name, std::int32_t value){    _set(this->items, this->shadowBuffer,name,value,this->uninitialized);}
-void Uniforms::set(const std::string& name, std::uint32_t value){   _set(this->items, this->shadowBuffer,name,value,this->uninitialized);}
-void Uniforms::set(const std::string& name, float value){           _set(this->items, this->shadowBuffer,name,value,this->uninitialized);}
-void Uniforms::set(const std::string& name, math2801::ivec2 value){ _set(this->items, this->shadowBuffer,name,value,this->uninitialized);}
-void Uniforms::set(const std::string& name, math2801::vec2 value){  _set(this->items, this->shadowBuffer,name,value,this->uninitialized);}
-void Uniforms::set(const std::string& name, math2801::vec3 value){  _set(this->items, this->shadowBuffer,name,value,this->uninitialized);}
-void Uniforms::set(const std::string& name, math2801::vec4 value){  _set(this->items, this->shadowBuffer,name,value,this->uninitialized);}
-void Uniforms::set(const std::string& name, math2801::mat4 value){  _set(this->items, this->shadowBuffer,name,value,this->uninitialized);}
-void Uniforms::set(const std::string& name, const std::vector<math2801::vec4>& value){ _set(this->items, this->shadowBuffer,name,value,this->uninitialized);}
+void Uniforms::set(const std::string& name, std::int32_t value){ this->setByName(name,value);}
+void Uniforms::set(const std::string& name, std::uint32_t value){ this->setByName(name,value);}
+void Uniforms::set(const std::string& name, float value){ this->setByName(name,value);}
+void Uniforms::set(const std::string& name, math2801::ivec2 value){ this->setByName(name,value);}
+void Uniforms::set(const std::string& name, math2801::vec2 value){ this->setByName(name,value);}
+void Uniforms::set(const std::string& name, math2801::vec3 value){ this->setByName(name,value);}
+void Uniforms::set(const std::string& name, math2801::vec4 value){ this->setByName(name,value);}
+void Uniforms::set(const std::string& name, math2801::mat4 value){ this->setByName(name,value);}
+void Uniforms::set(const std::string& name, const std::vector<math2801::vec4>& value){ this->setByName(name,value);}
 void Uniforms::set(const std::string& name, double value){ this->set(name,(float)value);}
 
+template<typename T>
+UniformHandle<T> Uniforms::handle(const std::string& name)
+{
+    auto it = this->items.find(name);
+    if( it == this->items.end() )
+        _noSuchUniform(this->items,name);
+    const parseMembers::Item& info = it->second;
+    if( info.type != _handleType<T>() ){
+        throw std::runtime_error("Bad type for handle to uniform "+name+": It is "+
+            info.typeAsString+info.arraySizeAsString);
+    }
+    UniformHandle<T> h;
+    h.offset = info.offset;
+    h.arraySize = info.arraySize;
+    return h;
+}
+
+template UniformHandle<std::int32_t> Uniforms::handle(const std::string&);
+template UniformHandle<std::uint32_t> Uniforms::handle(const std::string&);
+template UniformHandle<float> Uniforms::handle(const std::string&);
+template UniformHandle<math2801::ivec2> Uniforms::handle(const std::string&);
+template UniformHandle<math2801::vec2> Uniforms::handle(const std::string&);
+template UniformHandle<math2801::vec3> Uniforms::handle(const std::string&);
+template UniformHandle<math2801::vec4> Uniforms::handle(const std::string&);
+template UniformHandle<math2801::mat4> Uniforms::handle(const std::string&);
+template UniformHandle<std::vector<math2801::vec4>> Uniforms::handle(const std::string&);
+
+void Uniforms::set(const UniformHandle<std::vector<math2801::vec4>>& h, const std::vector<math2801::vec4>& value)
+{
+    this->set(h, std::span<const math2801::vec4>(value));
+}
+
+void Uniforms::set(const UniformHandle<std::vector<math2801::vec4>>& h, std::span<const math2801::vec4> value)
+{
+    assert(h.valid());
+    if( (int)value.size() != h.arraySize ){
+        throw std::runtime_error("Array size mismatch for uniform: Expected "+
+            std::to_string(h.arraySize)+" but got "+std::to_string(value.size()));
+    }
+    this->write( h.offset, value.data(), value.size()*sizeof(value[0]) );
+}
+
+void Uniforms::createRing()
+{
+    //dynamic offsets must be multiples of this
+    VkDeviceSize alignment = this->ctx->physdevProperties.limits.minUniformBufferOffsetAlignment;
+    this->ringStride = this->shadowBuffer.size();
+    this->ringStride += utils::computePadding(this->ringStride, alignment);
+    if( this->ringFrameSize < this->ringStride ){
+        throw std::runtime_error("uniformRingSize must be at least "+
+            std::to_string(this->ringStride)+" bytes");
+    }
+    this->ringFrameSize -= this->ringFrameSize % this->ringStride;
+
+    this->ring = new Buffer(this->ctx, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        this->ringFrameSize * this->ctx->framesInFlight, "uniform ring");
+    VkDeviceMemory mem = Buffers::allocateMemory(
+        this->ctx,
+        this->ring->memoryRequirements.memoryTypeBits,
+        this->ring->memoryRequirements.size,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "memory for uniform ring");
+    this->ring->bindMemory(mem,0,true);
+
+    //the memory is host coherent and vkQueueSubmit makes host
+    //writes visible to the device, so it stays mapped
+    check(vkMapMemory(this->ctx->dev, mem, 0, VK_WHOLE_SIZE, 0, (void**)&(this->ringMapped)));
+
+    verbose("Uniforms: Ring buffer has",this->ringFrameSize/this->ringStride,
+        "blocks of",this->ringStride,"bytes per frame");
+}
+
+void Uniforms::updateRing(DescriptorSet* descriptorSet, int slot)
+{
+    if( !this->ring )
+        this->createRing();
+
+    //this frame slot's part of the ring was last read by the frame that
+    //had the slot before, which utils::beginFrame() has waited for
+    unsigned frame = utils::getCurrentFrameIdentifier();
+    if( frame != this->ringFrame || this->ringFrameEnd == 0 ){
+        this->ringFrame = frame;
+        this->ringCursor = utils::getFrameSlot() * this->ringFrameSize;
+        this->ringFrameEnd = this->ringCursor + this->ringFrameSize;
+        //...except for the last block, which later frames may have
+        //reused because nothing changed; only that block is skipped
+        if( this->ringLast >= this->ringCursor && this->ringLast < this->ringFrameEnd )
+            this->ringSkip = this->ringLast;
+        else
+            this->ringSkip = this->ringFrameEnd;
+    }
+
+    if( !this->changed ){
+        descriptorSet->setSlot(slot, this->ring->buffer, this->shadowBuffer.size(),
+            (std::uint32_t)this->ringLast);
+        this->stats.skipped++;
+        return;
+    }
+
+    if( this->ringCursor == this->ringSkip )
+        this->ringCursor += this->ringStride;
+    if( this->ringCursor + this->ringStride > this->ringFrameEnd ){
+        throw std::runtime_error("Uniform ring is full: More than "+
+            std::to_string(this->ringFrameSize/this->ringStride)+
+            " uniform updates in one frame; increase uniformRingSize in config.ini");
+    }
+
+    //the block may still hold data from a few frames ago,
+    //so all of the uniforms are copied
+    std::memcpy( this->ringMapped + this->ringCursor,
+        this->shadowBuffer.data(), this->shadowBuffer.size() );
+    descriptorSet->setSlot(slot, this->ring->buffer, this->shadowBuffer.size(),
+        (std::uint32_t)this->ringCursor);
+    this->ringLast = this->ringCursor;
+    this->ringCursor += this->ringStride;
+    this->changed = false;
+    this->stats.bytes += this->shadowBuffer.size();
+    this->stats.uploads++;
+}
+
 void Uniforms::update(VkCommandBuffer cmd, DescriptorSet* descriptorSet, int slot)
 {
-    ensureCurrentIsValid();
-    Buffers::memoryBarrier(cmd,this->currentBuffer->buffer);
-    vkCmdUpdateBuffer( cmd, this->currentBuffer->buffer,
-        0, this->shadowBuffer.size(),
-        this->shadowBuffer.data() );
-    Buffers::memoryBarrier(cmd, this->currentBuffer->buffer);
-    unsigned f = utils::getCurrentFrameIdentifier();
-    this->activeBuffers[f].push_back(this->currentBuffer);
-
-    descriptorSet->setSlot(slot,this->currentBuffer->buffer);
-    //~ descriptorSet->bind(cmd);       //easy to forget this if we leave it to the caller
-    this->currentBuffer=nullptr;
-    if(!uninitialized.empty()){
+    CPU_ZONE("Uniforms::update");
+    if( this->useRing ){
+        this->updateRing(descriptorSet,slot);
+    } else if( !this->changed && this->currentBuffer ){
+        //the last buffer still has the right data
+        descriptorSet->setSlot(slot,this->currentBuffer->buffer);
+        this->stats.skipped++;
+    } else {
+        //the old buffer may be in use until the end of this frame
+        if( this->currentBuffer )
+            this->activeBuffers.push(this->currentBuffer);
+        this->currentBuffer = this->freeBuffer();
+        Buffers::memoryBarrier(cmd,this->currentBuffer->buffer);
+        vkCmdUpdateBuffer( cmd, this->currentBuffer->buffer,
+            0, this->shadowBuffer.size(),
+            this->shadowBuffer.data() );
+        Buffers::memoryBarrier(cmd, this->currentBuffer->buffer);
+
+        descriptorSet->setSlot(slot,this->currentBuffer->buffer);
+        //~ descriptorSet->bind(cmd);       //easy to forget this if we leave it to the caller
+        this->changed = false;
+        this->stats.bytes += this->shadowBuffer.size();
+        this->stats.uploads++;
+    }
+    if( this->numUnset != 0 ){
         std::vector<std::string> v;
-        for(const std::string& s : this->uninitialized){
-            v.push_back(s);
+        for(auto& it : this->items){
+            if( !this->isSet[it.second.offset/4] )
+                v.push_back(it.first);
         }
         std::string txt;
         if(v.size() == 1)
@@ -202,6 +380,60 @@ void Uniforms::update(VkCommandBuffer cmd, DescriptorSet* descriptorSet, int slo
     }
 }
 
+VkBuffer Uniforms::fixedBuffer()
+{
+    if( !this->fixed ){
+        this->fixed = new DeviceLocalBuffer(
+            this->ctx, nullptr, this->byteSize,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            "fixed uniform buffer"
+        );
+        //it doesn't have any of the data yet
+        this->fixedDirty.assign(1, std::make_pair(0u,(std::uint32_t)this->shadowBuffer.size()));
+    }
+    return this->fixed->buffer;
+}
+
+void Uniforms::updateFixed(VkCommandBuffer cmd)
+{
+    CPU_ZONE("Uniforms::updateFixed");
+    VkBuffer buff = this->fixedBuffer();
+    if( this->fixedDirty.empty() ){
+        this->stats.skipped++;
+        return;
+    }
+
+    //copy the changed ranges, joining ones that are close together
+    auto& D = this->fixedDirty;
+    std::sort(D.begin(),D.end());
+    std::size_t n=0;
+    for(std::size_t i=1;i<D.size();++i){
+        if( D[i].first <= D[n].second + DIRTY_MERGE_GAP )
+            D[n].second = std::max(D[n].second,D[i].second);
+        else
+            D[++n] = D[i];
+    }
+    D.resize(n+1);
+
+    //the barriers order this after earlier frames' reads
+    //(same queue) and before this frame's
+    Buffers::memoryBarrier(cmd,buff);
+    for(auto& r : D){
+        vkCmdUpdateBuffer( cmd, buff,
+            r.first, r.second-r.first,
+            this->shadowBuffer.data()+r.first );
+        this->stats.bytes += r.second-r.first;
+    }
+    Buffers::memoryBarrier(cmd,buff);
+    D.clear();
+    this->stats.uploads++;
+}
+
+UniformUploadStats Uniforms::uploadStats() const
+{
+    return this->stats;
+}
+
 int Uniforms::getDefine(const std::string& name)
 {
     if( this->defines.contains(name) )
@@ -8,13 +8,28 @@
 #include <cstdint>
 #include "math2801.h"
 #include "parseMembers.h"
+#include "RetireQueue.h"
+#include "UniformHandle.h"
 #include <array>
+#include <span>
+#include <cstring>
+#include <cassert>
+#include <type_traits>
 
 //FIXME: Do uvec{2,3,4} and array of ivec4/uvec4
 
+class Buffer;
 class DeviceLocalBuffer;
 class DescriptorSet;
 
+/// Counts of the uniform data sent to the GPU by one Uniforms
+/// object since it was created. See Uniforms::uploadStats().
+struct UniformUploadStats{
+    unsigned long long bytes;       /// bytes copied to GPU-visible memory by update() and updateFixed()
+    unsigned long long uploads;     /// update() and updateFixed() calls that copied something
+    unsigned long long skipped;     /// calls that copied nothing because no uniform had changed
+};
+
 /// Class to manage collection of uniforms
 class Uniforms{
     public:
@@ -100,16 +115,79 @@ class Uniforms{
     /// @param value The value to set
     void set(const std::string& name, const std::vector<math2801::vec4>& value);
 
-    /// Update the uniform data visible to the the GPU. This may not be called
-    /// within a renderpass. It may be called several times for
-    /// a single frame as long as no renderpass is active.
+    /// Look up a uniform so it can be set with set(handle,value),
+    /// which is much faster than setting it by name. If the name does
+    /// not specify a valid uniform or T is not exactly its type,
+    /// an exception is thrown.
+    /// @tparam T std::int32_t, std::uint32_t, float, math2801::ivec2,
+    ///     vec2, vec3, vec4, mat4, or std::vector<math2801::vec4> (for an array of vec4)
+    /// @param name The uniform name
+    /// @return The handle
+    template<typename T>
+    UniformHandle<T> handle(const std::string& name);
+
+    /// Set uniform value through a handle from handle(). This doesn't
+    /// allocate memory or look anything up. h must be valid().
+    /// @param h The handle
+    /// @param value The value to set
+    template<typename T>
+    void set(const UniformHandle<T>& h, const std::type_identity_t<T>& value){
+        assert(h.valid());
+        this->write(h.offset, &value, sizeof(T));
+    }
+
+    /// Set an array of vec4's through a handle from handle(). If the
+    /// array is the wrong size, an exception is thrown.
+    /// @param h The handle
+    /// @param value The value to set
+    void set(const UniformHandle<std::vector<math2801::vec4>>& h, const std::vector<math2801::vec4>& value);
+
+    /// Set an array of vec4's through a handle from handle(), from
+    /// memory that isn't a std::vector of exactly the right size (ex: the
+    /// first elements of a longer one). This doesn't allocate memory. If
+    /// the span is the wrong size, an exception is thrown.
+    /// @param h The handle
+    /// @param value The value to set
+    void set(const UniformHandle<std::vector<math2801::vec4>>& h, std::span<const math2801::vec4> value);
+
+    /// Update the uniform data visible to the the GPU.
     /// If this function is not called, any changes to the uniforms
     /// will not be visible to the GPU.
+    /// If the uniformRing config option is on, the data is copied into
+    /// the next free block of a persistently mapped ring buffer and the
+    /// slot gets that block's dynamic offset (the slot must be
+    /// UNIFORM_BUFFER_DYNAMIC). This records no commands, so it may be
+    /// called within a renderpass and any number of times per frame, up
+    /// to uniformRingSize bytes per frame; each bind() of the descriptor
+    /// set sees the data from the update() before it.
+    /// Otherwise, the data is copied with vkCmdUpdateBuffer between two
+    /// barriers, so this may not be called within a renderpass. It may be
+    /// called several times for a single frame as long as no renderpass is active.
     /// @param cmd The command buffer
     /// @param descriptorSet The descriptor set to use
     /// @param slot The slot number in the descriptor set
     void update(VkCommandBuffer cmd, DescriptorSet* descriptorSet, int slot);
 
+    /// Copy the uniform data into the fixed buffer (see fixedBuffer()).
+    /// Unlike update(), this overwrites the same buffer every frame, so
+    /// descriptor sets and command buffers that were recorded in earlier
+    /// frames see the new values. The copy waits for earlier frames to
+    /// finish reading the old values. This may not be called within a renderpass.
+    /// @param cmd The command buffer
+    void updateFixed(VkCommandBuffer cmd);
+
+    /// Get the buffer that updateFixed() writes to. It stays the
+    /// same for the life of this object.
+    /// @return The buffer
+    VkBuffer fixedBuffer();
+
+    /// Get the amount of uniform data that has been sent to the GPU.
+    /// Setting a uniform to the value it already has doesn't count as
+    /// a change, so update() and updateFixed() only copy
+    /// uniforms that changed (update() copies all of them if any did).
+    /// @return The counts
+    UniformUploadStats uploadStats() const;
+
     /// Get the value of the symbol #define'd in the uniform specification.
     /// If the symbol does not exist, an exception is thrown.
     /// Only integer values are permitted.
@@ -130,23 +208,78 @@ class Uniforms{
     std::vector<char> shadowBuffer;
     std::map<std::string,parseMembers::Item> items;
 
-    //keeps track of uniforms that haven't been set yet
-    std::set<std::string> uninitialized;
+    //keeps track of uniforms that haven't been set yet:
+    //isSet[offset/4] is nonzero once the uniform at offset has been set
+    std::vector<char> isSet;
+    std::size_t numUnset=0;
+    void markSet(int offset){
+        char& s = this->isSet[offset/4];
+        if( !s ){
+            s=1;
+            this->numUnset--;
+        }
+    }
+
+    //true if anything changed since the last update()
+    bool changed=true;
+
+    //byte ranges [first,second) of shadowBuffer that changed since
+    //the last updateFixed(); unsorted and may overlap
+    std::vector<std::pair<std::uint32_t,std::uint32_t>> fixedDirty;
+
+    //copy size bytes to the shadow buffer at offset, and
+    //note which bytes changed
+    void write(int offset, const void* data, std::size_t size){
+        char* p = this->shadowBuffer.data()+offset;
+        if( std::memcmp(p,data,size) != 0 ){
+            std::memcpy(p,data,size);
+            this->changed=true;
+            this->markDirty(offset,size);
+        }
+        this->markSet(offset);
+    }
+    void markDirty(int offset, std::size_t size);
+
+    template<typename T>
+    void setByName(const std::string& name, const T& value);
+
+    UniformUploadStats stats{};
 
     //size of all uniforms
     VkDeviceSize byteSize;
 
     std::vector<DeviceLocalBuffer*> availableBuffers;
 
-    //frame identifier & active buffers
-    std::map<unsigned,std::vector<DeviceLocalBuffer*> > activeBuffers;
+    //buffers used by frames the GPU hasn't finished yet
+    RetireQueue<DeviceLocalBuffer*> activeBuffers;
 
+    //the buffer with the data from the last update(),
+    //when uniformRing is off. It's reused if nothing has changed.
     DeviceLocalBuffer* currentBuffer = nullptr;
 
+    //for updateFixed(); created when first needed
+    DeviceLocalBuffer* fixed = nullptr;
+
+    //for update() when uniformRing is on: host visible, and mapped for
+    //as long as it exists. Frame slot i uses bytes
+    //[i*ringFrameSize, (i+1)*ringFrameSize). Created when first needed.
+    bool useRing;
+    Buffer* ring = nullptr;
+    char* ringMapped = nullptr;
+    VkDeviceSize ringFrameSize;
+    VkDeviceSize ringStride;            //shadowBuffer.size(), aligned for dynamic offsets
+    VkDeviceSize ringCursor = 0;        //next free byte
+    VkDeviceSize ringFrameEnd = 0;      //end of the current frame's part; 0 = none yet
+    unsigned ringFrame = 0;             //frame identifier that the cursor belongs to
+    VkDeviceSize ringLast = 0;          //block with the data from the last update()
+    VkDeviceSize ringSkip = 0;          //block in this frame's part that's still in use; ringFrameEnd = none
+    void createRing();
+    void updateRing(DescriptorSet* descriptorSet, int slot);
+
     //memories. We allocate several buffers from each memory
     std::vector<VkDeviceMemory> memories;
     std::uint32_t memoryTypeBits;
-    void ensureCurrentIsValid();
+    DeviceLocalBuffer* freeBuffer();
 
     void init(VulkanContext* ctx,
             std::tuple<int,std::map<std::string,parseMembers::Item>,std::map<std::string,int> > info,
@@ -0,0 +1,469 @@
+#include "Uploader.h"
+#include "Buffers.h"
+#include "Images.h"
+#include "CleanupManager.h"
+#include "utils.h"
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+//staging memory is allocated in chunks of this size
+//(or larger, for big single uploads)
+static const VkDeviceSize STAGING_CHUNK_SIZE = 16*1024*1024;
+
+//offsets into staging memory are aligned to this; it satisfies
+//the texel size and 4-byte requirements of vkCmdCopyBufferToImage
+static const VkDeviceSize STAGING_ALIGNMENT = 16;
+
+static VulkanContext* ctx;
+static VkCommandPool transferPool;
+static VkCommandPool graphicsPool;
+
+//true if uploads run on a different queue family than graphics
+static bool separateTransferQueue;
+
+struct StagingChunk{
+    StagingBuffer* buffer;
+    char* mapped;
+    VkDeviceSize used;
+};
+
+struct Batch{
+    unsigned id;
+    VkCommandBuffer transferCmd = VK_NULL_HANDLE;   //same as graphicsCmd if !separateTransferQueue
+    VkCommandBuffer graphicsCmd = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    VkSemaphore semaphore = VK_NULL_HANDLE;         //transfer -> graphics; only if separateTransferQueue
+    std::vector<StagingChunk> staging;
+    bool empty = true;
+};
+
+//batch being recorded (or null)
+static Batch* currentBatch = nullptr;
+
+//submitted, in order of submission
+static std::deque<Batch*> pendingBatches;
+
+static unsigned nextBatchId = 1;
+static unsigned lastSubmittedBatchId = 0;
+
+static std::vector<VkFence> availableFences;
+static std::vector<VkSemaphore> availableSemaphores;
+
+static VkCommandBuffer allocateCommandBuffer(VkCommandPool pool)
+{
+    VkCommandBuffer cmd;
+    check(vkAllocateCommandBuffers(
+        ctx->dev,
+        VkCommandBufferAllocateInfo{
+            .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .pNext=nullptr,
+            .commandPool=pool,
+            .level=VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount=1
+        },
+        &(cmd)
+    ));
+    check(vkBeginCommandBuffer(
+        cmd,
+        VkCommandBufferBeginInfo{
+            .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .pNext=nullptr,
+            .flags=VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+            .pInheritanceInfo=nullptr
+        }
+    ));
+    return cmd;
+}
+
+static Batch* getBatch()
+{
+    if( !ctx )
+        throw std::runtime_error("Uploader has not been initialized");
+
+    if( currentBatch )
+        return currentBatch;
+
+    currentBatch = new Batch();
+    currentBatch->id = nextBatchId++;
+    currentBatch->graphicsCmd = allocateCommandBuffer(graphicsPool);
+    if( separateTransferQueue ){
+        currentBatch->transferCmd = allocateCommandBuffer(transferPool);
+    } else {
+        currentBatch->transferCmd = currentBatch->graphicsCmd;
+    }
+    ctx->beginCmdRegion(currentBatch->graphicsCmd, "Upload batch "+std::to_string(currentBatch->id));
+    return currentBatch;
+}
+
+//get space for size bytes of staging data in the current batch
+static std::pair<StagingBuffer*,VkDeviceSize> stagingAlloc(Batch* b, const void* data, VkDeviceSize size)
+{
+    if( b->staging.empty() || b->staging.back().used + size > b->staging.back().buffer->byteSize ){
+        VkDeviceSize chunkSize = std::max(STAGING_CHUNK_SIZE, size);
+        StagingChunk c;
+        c.buffer = new StagingBuffer(ctx, nullptr, chunkSize, "Uploader staging");
+        //memory is host coherent, and vkQueueSubmit makes host writes
+        //visible to the device, so the mapping is kept until the batch retires
+        check(vkMapMemory(ctx->dev, c.buffer->memory, 0, chunkSize, 0, (void**)&(c.mapped)));
+        c.used = 0;
+        b->staging.push_back(c);
+    }
+    StagingChunk& c = b->staging.back();
+    VkDeviceSize offset = c.used;
+    std::memcpy(c.mapped + offset, data, size);
+    c.used += size;
+    c.used += utils::computePadding(c.used, STAGING_ALIGNMENT);
+    return std::make_pair(c.buffer, offset);
+}
+
+static void retire(Batch* b)
+{
+    check(vkResetFences(ctx->dev, 1, &(b->fence)));
+    availableFences.push_back(b->fence);
+    if( b->semaphore )
+        availableSemaphores.push_back(b->semaphore);
+    vkFreeCommandBuffers(ctx->dev, graphicsPool, 1, &(b->graphicsCmd));
+    if( separateTransferQueue )
+        vkFreeCommandBuffers(ctx->dev, transferPool, 1, &(b->transferCmd));
+    for(auto& c : b->staging){
+        vkUnmapMemory(ctx->dev, c.buffer->memory);
+        c.buffer->cleanup();
+        delete c.buffer;
+    }
+    delete b;
+}
+
+//release resources of completed batches
+static void retireCompleted()
+{
+    while( !pendingBatches.empty() ){
+        Batch* b = pendingBatches.front();
+        auto fstat = vkGetFenceStatus(ctx->dev, b->fence);
+        if( fstat == VK_NOT_READY )
+            return;
+        if( fstat == VK_ERROR_DEVICE_LOST )
+            throw std::runtime_error("Device was lost");
+        pendingBatches.pop_front();
+        retire(b);
+    }
+}
+
+namespace Uploader{
+
+bool initialized()
+{
+    return ctx != nullptr;
+}
+
+void initialize(VulkanContext* ctx_)
+{
+    if(initialized())
+        return;
+
+    ctx=ctx_;
+    separateTransferQueue = (ctx->transferQueueIndex != ctx->graphicsQueueIndex);
+
+    check(vkCreateCommandPool(
+        ctx->dev,
+        VkCommandPoolCreateInfo{
+            .sType=VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .pNext=nullptr,
+            .flags=VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = ctx->graphicsQueueIndex
+        },
+        nullptr,
+        &(graphicsPool)
+    ));
+    if( separateTransferQueue ){
+        check(vkCreateCommandPool(
+            ctx->dev,
+            VkCommandPoolCreateInfo{
+                .sType=VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .pNext=nullptr,
+                .flags=VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                .queueFamilyIndex = ctx->transferQueueIndex
+            },
+            nullptr,
+            &(transferPool)
+        ));
+    }
+
+    CleanupManager::registerCleanupFunction([](){
+        Uploader::wait();
+        if( currentBatch ){
+            //opened but never had anything recorded
+            vkFreeCommandBuffers(ctx->dev, graphicsPool, 1, &(currentBatch->graphicsCmd));
+            if( separateTransferQueue )
+                vkFreeCommandBuffers(ctx->dev, transferPool, 1, &(currentBatch->transferCmd));
+            delete currentBatch;
+            currentBatch=nullptr;
+        }
+        for(VkFence f : availableFences )
+            vkDestroyFence(ctx->dev, f, nullptr);
+        for(VkSemaphore s : availableSemaphores )
+            vkDestroySemaphore(ctx->dev, s, nullptr);
+        vkDestroyCommandPool(ctx->dev, graphicsPool, nullptr);
+        if( separateTransferQueue )
+            vkDestroyCommandPool(ctx->dev, transferPool, nullptr);
+    });
+}
+
+void uploadBuffer(Buffer* dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset)
+{
+    assert(size > 0);
+    Batch* b = getBatch();
+    b->empty=false;
+    auto [staging,offset] = stagingAlloc(b, data, size);
+
+    vkCmdCopyBuffer(
+        b->transferCmd,
+        staging->buffer,
+        dst->buffer,
+        1,
+        VkBufferCopy{
+            .srcOffset=offset,
+            .dstOffset=dstOffset,
+            .size=size
+        }
+    );
+
+    if( separateTransferQueue ){
+        //hand the buffer over to the graphics queue family:
+        //a release on the transfer queue and a matching acquire on the graphics queue
+        VkBufferMemoryBarrier B{
+            .sType=VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .pNext=nullptr,
+            .srcAccessMask=VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask=0,
+            .srcQueueFamilyIndex=ctx->transferQueueIndex,
+            .dstQueueFamilyIndex=ctx->graphicsQueueIndex,
+            .buffer=dst->buffer,
+            .offset=dstOffset,
+            .size=size
+        };
+        vkCmdPipelineBarrier(b->transferCmd,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0, 0, nullptr, 1, &B, 0, nullptr);
+        B.srcAccessMask=0;
+        B.dstAccessMask=VK_ACCESS_MEMORY_READ_BIT|VK_ACCESS_MEMORY_WRITE_BIT;
+        vkCmdPipelineBarrier(b->graphicsCmd,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            0, 0, nullptr, 1, &B, 0, nullptr);
+    } else {
+        Buffers::memoryBarrier(b->graphicsCmd, dst->buffer);
+    }
+}
+
+void uploadImage(Image* img)
+{
+    Batch* b = getBatch();
+    b->empty=false;
+
+    if( img->layers[0].mips[0].pixels.empty() ){
+        //no initial data, so nothing to copy
+        img->layoutTransition(img->finalLayout, b->graphicsCmd);
+        return;
+    }
+
+    if( img->aspect & VK_IMAGE_ASPECT_DEPTH_BIT ){
+        throw std::runtime_error("Unimplemented: Depth texture with initial data...");
+    }
+
+    img->layoutTransition(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, b->transferCmd);
+
+    std::vector<VkBufferImageCopy> regions;
+    StagingBuffer* regionSource = nullptr;
+
+    auto copyRegions = [&](){
+        if( regions.empty() )
+            return;
+        vkCmdCopyBufferToImage(
+            b->transferCmd,
+            regionSource->buffer,
+            img->image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            (unsigned)regions.size(),
+            regions.data()
+        );
+        regions.clear();
+    };
+
+    for(int layernumber=0;layernumber<(int)img->layers.size();++layernumber){
+        Images::Layer& layerdata = img->layers[layernumber];
+        for(int miplevel=0;miplevel<(int)layerdata.mips.size();++miplevel){
+            Images::Mip& mipdata = layerdata.mips[miplevel];
+            auto [staging,offset] = stagingAlloc(b, mipdata.pixels.data(),
+                mipdata.pixels.size() * sizeof(mipdata.pixels[0]) );
+
+            //one copy command for all the regions that share a staging chunk
+            if( staging != regionSource ){
+                copyRegions();
+                regionSource = staging;
+            }
+            regions.push_back(VkBufferImageCopy{
+                .bufferOffset = offset,
+                .bufferRowLength = 0,      //0=no padding
+                .bufferImageHeight = 0,    //0=no padding
+                .imageSubresource = VkImageSubresourceLayers{
+                    .aspectMask = img->aspect,
+                    .mipLevel = (unsigned)miplevel,
+                    .baseArrayLayer = (unsigned)layernumber,
+                    .layerCount = 1
+                },
+                .imageOffset = VkOffset3D{
+                    .x = 0,
+                    .y = 0,
+                    .z = 0,
+                },
+                .imageExtent = VkExtent3D{
+                    .width = (unsigned)mipdata.width,
+                    .height = (unsigned)mipdata.height,
+                    .depth = 1
+                }
+            });
+        }
+    }
+    copyRegions();
+
+    if( separateTransferQueue ){
+        img->queueFamilyTransfer(img->finalLayout,
+            ctx->transferQueueIndex, ctx->graphicsQueueIndex,
+            b->transferCmd, b->graphicsCmd);
+    } else {
+        img->layoutTransition(img->finalLayout, b->graphicsCmd);
+    }
+}
+
+VkCommandBuffer graphicsCommands()
+{
+    Batch* b = getBatch();
+    b->empty=false;
+    return b->graphicsCmd;
+}
+
+unsigned flush()
+{
+    if( !ctx )
+        return lastSubmittedBatchId;
+
+    retireCompleted();
+
+    Batch* b = currentBatch;
+    if( !b || b->empty )
+        return lastSubmittedBatchId;
+
+    currentBatch = nullptr;
+
+    ctx->endCmdRegion(b->graphicsCmd);
+
+    if( availableFences.empty() ){
+        VkFence f;
+        check(vkCreateFence(
+            ctx->dev,
+            VkFenceCreateInfo{
+                .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0
+            },
+            nullptr,
+            &f
+        ));
+        availableFences.push_back(f);
+    }
+    b->fence = availableFences.back();
+    availableFences.pop_back();
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+    if( separateTransferQueue ){
+        if( availableSemaphores.empty() ){
+            VkSemaphore s;
+            check(vkCreateSemaphore(
+                ctx->dev,
+                VkSemaphoreCreateInfo{
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                    .pNext = nullptr,
+                    .flags = 0
+                },
+                nullptr,
+                &s
+            ));
+            availableSemaphores.push_back(s);
+        }
+        b->semaphore = availableSemaphores.back();
+        availableSemaphores.pop_back();
+
+        check(vkEndCommandBuffer(b->transferCmd));
+        check(vkQueueSubmit(
+            ctx->transferQueue,
+            1,
+            VkSubmitInfo{
+                .sType=VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .pNext=nullptr,
+                .waitSemaphoreCount=0,
+                .pWaitSemaphores=nullptr,
+                .pWaitDstStageMask=nullptr,
+                .commandBufferCount=1,
+                .pCommandBuffers=&(b->transferCmd),
+                .signalSemaphoreCount=1,
+                .pSignalSemaphores=&(b->semaphore)
+            },
+            nullptr
+        ));
+    }
+
+    check(vkEndCommandBuffer(b->graphicsCmd));
+    check(vkQueueSubmit(
+        ctx->graphicsQueue,
+        1,
+        VkSubmitInfo{
+            .sType=VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext=nullptr,
+            .waitSemaphoreCount=(separateTransferQueue ? 1u : 0u),
+            .pWaitSemaphores=(separateTransferQueue ? &(b->semaphore) : nullptr),
+            .pWaitDstStageMask=(separateTransferQueue ? &waitStage : nullptr),
+            .commandBufferCount=1,
+            .pCommandBuffers=&(b->graphicsCmd),
+            .signalSemaphoreCount=0,
+            .pSignalSemaphores=nullptr
+        },
+        b->fence
+    ));
+
+    pendingBatches.push_back(b);
+    lastSubmittedBatchId = b->id;
+    return b->id;
+}
+
+void wait(unsigned batch)
+{
+    //batches complete in order, so wait for everything up to and including batch
+    while( !pendingBatches.empty() && pendingBatches.front()->id <= batch ){
+        Batch* b = pendingBatches.front();
+        check(vkWaitForFences(ctx->dev, 1, &(b->fence), VK_TRUE, 0xffffffffffffffff));
+        pendingBatches.pop_front();
+        retire(b);
+    }
+}
+
+void wait()
+{
+    if( !ctx )
+        return;
+    wait(flush());
+}
+
+bool isComplete(unsigned batch)
+{
+    if( !ctx )
+        return true;
+    retireCompleted();
+    if( currentBatch && currentBatch->id <= batch )
+        return false;
+    return pendingBatches.empty() || pendingBatches.front()->id > batch;
+}
+
+};  //namespace
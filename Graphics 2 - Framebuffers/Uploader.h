@@ -0,0 +1,69 @@
+#pragma once
+#include "vkhelpers.h"
+
+class Buffer;
+class Image;
+
+/// Batched, asynchronous transfers of data to the GPU.
+/// Uploads are recorded into a batch that is submitted by flush().
+/// If the device has a dedicated transfer queue, the copies run there
+/// and ownership of the destination is then handed to the graphics
+/// queue; otherwise everything runs on the graphics queue.
+/// Each batch signals a fence when it completes; its staging memory
+/// is released at that point.
+/// Work submitted to the graphics queue after flush() will see the
+/// results of the batch, so beginFrame() and beginImmediateCommands()
+/// flush automatically.
+namespace Uploader{
+
+/// Initialize the subsystem.
+/// @param ctx The context
+void initialize(VulkanContext* ctx);
+
+/// Return true if subsystem was initialized
+/// @return True if initialized; false if not
+bool initialized();
+
+/// Copy data to a (device local) buffer. The data is copied to
+/// staging memory immediately, so the caller may free it as soon
+/// as this returns.
+/// @param dst The destination buffer. It must have VK_BUFFER_USAGE_TRANSFER_DST_BIT.
+/// @param data The data to copy
+/// @param size Number of bytes to copy
+/// @param dstOffset Destination offset within dst
+void uploadBuffer(Buffer* dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset=0);
+
+/// Copy all of an image's pixel data (every layer and mip) to the GPU
+/// and transition it to its final layout. The image must already
+/// have memory bound to it. Images with no pixel data are only
+/// transitioned to their final layout.
+/// @param img The image
+void uploadImage(Image* img);
+
+/// Get a command buffer on the graphics queue that belongs
+/// to the current batch. Use this for small setup operations
+/// (ex: layout transitions) that should be batched with the uploads
+/// rather than submitted on their own. The commands run
+/// after the batch's copies have completed.
+/// @return The command buffer; it's valid until the next flush()
+VkCommandBuffer graphicsCommands();
+
+/// Submit the current batch. If nothing has been recorded,
+/// this does nothing. This also releases the resources of any
+/// batches that have completed.
+/// @return Identifier of the most recently submitted batch (for wait())
+unsigned flush();
+
+/// Wait until the given batch (and all earlier ones) have completed.
+/// @param batch Batch identifier returned by flush()
+void wait(unsigned batch);
+
+/// Flush and wait for all uploads to complete.
+void wait();
+
+/// Check if a batch has completed, without waiting.
+/// @param batch Batch identifier returned by flush()
+/// @return True if the batch is done
+bool isComplete(unsigned batch);
+
+};  //namespace
@@ -1,5 +1,6 @@
 #include "VertexManager.h"
 #include "Buffers.h"
+#include "Uploader.h"
 #include <cassert>
 #include "utils.h"
 #include "mischelpers.h"
@@ -137,6 +138,9 @@ void VertexManager::pushToGPU()
         this->indexData,
         VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
         "indices");
+
+    //submit all the attribute and index copies as one batch
+    Uploader::flush();
 }
 
 void VertexManager::bindBuffers(VkCommandBuffer cmd)
@@ -0,0 +1,347 @@
+#include "Globals.h"
+#include "FrameState.h"
+#include "Uniforms.h"
+#include "utils.h"
+#include "timeutil.h"
+#include "CPUProfiler.h"
+#include "consoleoutput.h"
+#include "Descriptors.h"
+#include "ImageManager.h"
+#include "Images.h"
+#include "Samplers.h"
+#include "importantConstants.h"
+#include "ShadowAtlas.h"
+#include "DeferredShading.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+
+void draw(Globals& globs, const FrameState& state);
+
+using namespace math2801;
+
+//frames at the start that are not included in the statistics
+//(pipeline creation, first use of each image, etc.)
+static const int WARMUP_FRAMES = 30;
+
+//radius of the circle that the eye moves along, in world units
+static const float PATH_RADIUS = 0.5f;
+
+//Put the camera at position t (0...1) along the benchmark path.
+//The path depends only on t, so every run renders the same images:
+//the eye moves around a circle that begins at the starting eye
+//position while the view direction turns a full 360 degrees.
+static void setCameraOnPath(Camera& camera, vec3 startEye, vec3 startLook, float t)
+{
+    float angle = 2.0f * 3.14159265358979f * t;
+    float c = std::cos(angle);
+    float s = std::sin(angle);
+    vec3 eye = startEye + vec3(
+        PATH_RADIUS * s,
+        0.1f * s,
+        PATH_RADIUS * (1.0f-c)
+    );
+    vec3 look(
+        c*startLook.x + s*startLook.z,
+        startLook.y,
+        -s*startLook.x + c*startLook.z
+    );
+    camera.lookAt(eye, eye+look, vec3(0,1,0));
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    std::size_t i = (std::size_t)std::ceil(p*sorted.size());
+    if( i > 0 )
+        i--;
+    return sorted[std::min(i,sorted.size()-1)];
+}
+
+void benchmark(Globals& globs, int numFrames)
+{
+    vec3 startEye = globs.camera.eye;
+    vec3 startLook = globs.camera.look;
+
+    info("Benchmark:",numFrames,"frames at",globs.width,"x",globs.height,
+        (globs.ctx->headless ? "(headless)" : "(windowed)"),
+        (DeferredShading::active() ? "with deferred shading" : "with forward shading"));
+
+    int skip = std::min(WARMUP_FRAMES, numFrames/10);
+
+    FrameState state(globs);
+    std::vector<double> frameTimes;
+    frameTimes.reserve(numFrames);
+    DescriptorCacheStats warmupStats = DescriptorSet::cacheStats();
+    UniformUploadStats warmupUploads = globs.uniforms->uploadStats();
+    unsigned long long warmupPushes = PushConstants::pushCount();
+    LightCullStats warmupCull = globs.allLights->cullStats();
+    ShadowAtlasStats warmupShadows = ShadowAtlas::stats();
+    double start = timeutil::time_sec();
+    double last = start;
+    for(int i=0;i<numFrames;++i){
+        if( i == skip ){
+            warmupStats = DescriptorSet::cacheStats();
+            warmupUploads = globs.uniforms->uploadStats();
+            warmupPushes = PushConstants::pushCount();
+            warmupCull = globs.allLights->cullStats();
+            warmupShadows = ShadowAtlas::stats();
+        }
+        CPUProfiler::frameBoundary();
+        CPU_ZONE("benchmark");
+        setCameraOnPath(globs.camera, startEye, startLook, float(i)/float(numFrames));
+        state.capture(globs);
+        draw(globs,state);
+        double now = timeutil::time_sec();
+        frameTimes.push_back(now-last);
+        last = now;
+    }
+    //include the GPU work for the last frames
+    utils::waitForAllFrames(globs.ctx);
+    double total = timeutil::time_sec() - start;
+
+    globs.camera.lookAt(startEye, startEye+startLook, vec3(0,1,0));
+
+    DescriptorCacheStats endStats = DescriptorSet::cacheStats();
+    UniformUploadStats endUploads = globs.uniforms->uploadStats();
+    unsigned long long endPushes = PushConstants::pushCount();
+    LightCullStats endCull = globs.allLights->cullStats();
+    ShadowAtlasStats endShadows = ShadowAtlas::stats();
+    std::vector<double> S(frameTimes.begin()+skip, frameTimes.end());
+    if( S.empty() ){
+        warn("Benchmark: Not enough frames for statistics");
+        return;
+    }
+    std::sort(S.begin(),S.end());
+    double sum=0.0;
+    for(double d : S)
+        sum += d;
+    double mean = sum/S.size();
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(3)
+        << "Benchmark: " << numFrames << " frames in " << total << " sec"
+        << " (first " << skip << " not included in statistics)\n"
+        << "    frame time (msec): "
+        << " mean=" << mean*1000.0
+        << " min=" << S.front()*1000.0
+        << " p50=" << percentile(S,0.50)*1000.0
+        << " p95=" << percentile(S,0.95)*1000.0
+        << " p99=" << percentile(S,0.99)*1000.0
+        << " max=" << S.back()*1000.0 << "\n"
+        << "    fps: " << std::setprecision(1) << 1.0/mean << "\n"
+        << "    descriptor cache per frame: "
+        << " hits=" << double(endStats.hits-warmupStats.hits)/S.size()
+        << " misses=" << double(endStats.misses-warmupStats.misses)/S.size()
+        << " descriptor writes=" << double(endStats.writes-warmupStats.writes)/S.size() << "\n"
+        << "    uniform uploads per frame: "
+        << " bytes=" << double(endUploads.bytes-warmupUploads.bytes)/S.size()
+        << " uploads=" << double(endUploads.uploads-warmupUploads.uploads)/S.size()
+        << " skipped=" << double(endUploads.skipped-warmupUploads.skipped)/S.size() << "\n"
+        << "    vkCmdPushConstants calls per frame: " << double(endPushes-warmupPushes)/S.size() << "\n"
+        << "    lights per frame: "
+        << " active=" << double(endCull.active-warmupCull.active)/S.size()
+        << " culled=" << double(endCull.culled-warmupCull.culled)/S.size();
+    if( ShadowAtlas::enabled() ){
+        double shadowFrames = double(endShadows.frames-warmupShadows.frames);
+        oss << "\n    shadow atlas per frame: "
+            << " lights=" << double(endShadows.shadowedLights-warmupShadows.shadowedLights)/shadowFrames
+            << " tiles drawn=" << double(endShadows.tilesRendered-warmupShadows.tilesRendered)/shadowFrames
+            << " cached=" << double(endShadows.tilesCached-warmupShadows.tilesCached)/shadowFrames
+            << " deferred=" << double(endShadows.tilesDeferred-warmupShadows.tilesDeferred)/shadowFrames
+            << " occupancy=" << 100.0*(endShadows.occupancy-warmupShadows.occupancy)/shadowFrames << "%";
+    }
+    print(oss.str());
+    DescriptorSetFactory::report();
+}
+
+//sets written per pass of the descriptor benchmark
+static const unsigned BENCHMARK_SETS = 256;
+
+//passes over the sets for each way of writing them
+static const unsigned BENCHMARK_PASSES = 200;
+
+//Write BENCHMARK_SETS sets BENCHMARK_PASSES times with f(set,n), where
+//n varies from call to call so the written data changes, and print the rate.
+template<typename F>
+static void timeDescriptorWrites(const char* name, const std::vector<VkDescriptorSet>& sets,
+    unsigned writesPerSet, F f)
+{
+    //once untimed, so the driver has seen every set
+    for(unsigned i=0;i<sets.size();++i)
+        f(sets[i],i);
+    double start = timeutil::time_sec();
+    for(unsigned pass=0;pass<BENCHMARK_PASSES;++pass){
+        for(unsigned i=0;i<sets.size();++i)
+            f(sets[i],i+pass);
+    }
+    double elapsed = timeutil::time_sec() - start;
+    double numSets = double(sets.size())*BENCHMARK_PASSES;
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(0)
+        << "    " << name << ": " << numSets/elapsed << " sets/sec, "
+        << numSets*writesPerSet/elapsed << " descriptor writes/sec";
+    print(oss.str());
+}
+
+void descriptorBenchmark(Globals& globs)
+{
+    VulkanContext* ctx = globs.ctx;
+
+    //the material layout from before the sets were split by frequency
+    //(see descriptorSets.h): a sampler and four textures.
+    //CleanupManager destroys it.
+    DescriptorSetLayout& layout = *new DescriptorSetLayout(ctx, {
+        { VK_DESCRIPTOR_TYPE_SAMPLER, BASE_TEXTURE_SAMPLER_SLOT },
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, BASE_TEXTURE_SLOT },
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, EMISSIVE_TEXTURE_SLOT },
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, NORMAL_TEXTURE_SLOT },
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, METALLICROUGHNESS_TEXTURE_SLOT }
+    });
+    unsigned numSlots = (unsigned)layout.types.size();
+
+    //views of the scene's textures; the callbacks run right away
+    //for images that are on the GPU already
+    std::vector<VkImageView> views;
+    for(Image* img : ImageManager::allImages()){
+        if( img->viewType == VK_IMAGE_VIEW_TYPE_2D_ARRAY && img->aspect == VK_IMAGE_ASPECT_COLOR_BIT )
+            img->addCallback([&views](Image* im){ views.push_back(im->view()); });
+    }
+    if( views.empty() ){
+        warn("Descriptor benchmark: No textures to write");
+        return;
+    }
+
+    VkDescriptorPool pool;
+    VkDescriptorPoolSize poolSizes[] = {
+        { .type=VK_DESCRIPTOR_TYPE_SAMPLER, .descriptorCount=BENCHMARK_SETS },
+        { .type=VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, .descriptorCount=4*BENCHMARK_SETS }
+    };
+    check(vkCreateDescriptorPool(
+        ctx->dev,
+        VkDescriptorPoolCreateInfo{
+            .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .pNext=nullptr,
+            .flags=0,
+            .maxSets=BENCHMARK_SETS,
+            .poolSizeCount=2,
+            .pPoolSizes=poolSizes
+        },
+        nullptr,
+        &pool
+    ));
+
+    std::vector<VkDescriptorSetLayout> layouts(BENCHMARK_SETS, layout.layout);
+    std::vector<VkDescriptorSet> sets(BENCHMARK_SETS);
+    check(vkAllocateDescriptorSets(
+        ctx->dev,
+        VkDescriptorSetAllocateInfo{
+            .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .pNext=nullptr,
+            .descriptorPool=pool,
+            .descriptorSetCount=BENCHMARK_SETS,
+            .pSetLayouts=layouts.data()
+        },
+        sets.data()
+    ));
+
+    //the contents for write number n; this changes from
+    //one write to the next, like it would for real materials
+    std::vector<DescriptorData> data(numSlots);
+    std::uint64_t mask=0;
+    auto fill = [&](unsigned n){
+        for(const DescriptorSetEntry& e : layout.entries){
+            DescriptorData& d = data[e.slot];
+            d.image.sampler = Samplers::mipSampler;
+            d.image.imageView = (e.type == VK_DESCRIPTOR_TYPE_SAMPLER ? VK_NULL_HANDLE :
+                                    views[(n+e.slot) % views.size()]);
+            d.image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
+    };
+    for(const DescriptorSetEntry& e : layout.entries)
+        mask |= std::uint64_t(1) << e.slot;
+
+    info("Descriptor benchmark:",BENCHMARK_SETS,"sets,",BENCHMARK_PASSES,"passes,",
+        layout.entries.size(),"descriptors per set");
+
+    std::vector<VkWriteDescriptorSet> writes;
+    timeDescriptorWrites("vkUpdateDescriptorSets", sets, (unsigned)layout.entries.size(),
+        [&](VkDescriptorSet set, unsigned n){
+            fill(n);
+            writes.clear();
+            for(const DescriptorSetEntry& e : layout.entries){
+                writes.push_back(VkWriteDescriptorSet{
+                    .sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .pNext=nullptr,
+                    .dstSet=set,
+                    .dstBinding=(unsigned)e.slot,
+                    .dstArrayElement=0,
+                    .descriptorCount=1,
+                    .descriptorType=e.type,
+                    .pImageInfo=&data[e.slot].image,
+                    .pBufferInfo=nullptr,
+                    .pTexelBufferView=nullptr
+                });
+            }
+            vkUpdateDescriptorSets(ctx->dev, (unsigned)writes.size(), writes.data(), 0, nullptr);
+        }
+    );
+
+    VkDescriptorUpdateTemplate tmpl = layout.updateTemplate(mask);
+    if( tmpl == VK_NULL_HANDLE ){
+        print("    vkUpdateDescriptorSetWithTemplateKHR: not available");
+    } else {
+        timeDescriptorWrites("vkUpdateDescriptorSetWithTemplateKHR", sets, (unsigned)layout.entries.size(),
+            [&](VkDescriptorSet set, unsigned n){
+                fill(n);
+                vkUpdateDescriptorSetWithTemplateKHR(ctx->dev, set, tmpl, data.data());
+            }
+        );
+    }
+
+    vkDestroyDescriptorPool(ctx->dev,pool,nullptr);
+}
+
+//times each way of setting the uniforms is repeated
+static const unsigned UNIFORM_BENCHMARK_ITERATIONS = 100000;
+
+void uniformBenchmark(Globals& globs)
+{
+    FrameState state(globs);
+    Uniforms* uniforms = globs.uniforms;
+    const Camera& cam = state.camera;
+    const LightCollection& lights = state.lights;
+
+    info("Uniform benchmark:",UNIFORM_BENCHMARK_ITERATIONS,"frames of camera and light uniforms");
+
+    //what Camera::setUniforms and LightCollection::setUniforms
+    //did before they used handles
+    double start = timeutil::time_sec();
+    for(unsigned i=0;i<UNIFORM_BENCHMARK_ITERATIONS;++i){
+        uniforms->set("viewMatrix",cam.viewMatrix);
+        uniforms->set("viewProjMatrix",cam.viewProjMatrix);
+        uniforms->set("projMatrix",cam.projMatrix);
+        uniforms->set("eyePos",cam.eye);
+        uniforms->set("lightPositionAndDirectionalFlag",lights.lightPositionAndDirectionalFlag);
+        uniforms->set("lightColorAndIntensity", lights.lightColorAndIntensity);
+        uniforms->set("cosSpotAngles", lights.cosSpotAngles);
+        uniforms->set("spotDirection", lights.spotDirection);
+        uniforms->set("attenuation", vec3(150,0.0,0.15));
+    }
+    double byName = (timeutil::time_sec() - start)/UNIFORM_BENCHMARK_ITERATIONS;
+
+    start = timeutil::time_sec();
+    for(unsigned i=0;i<UNIFORM_BENCHMARK_ITERATIONS;++i){
+        state.setUniforms(uniforms);
+    }
+    double byHandle = (timeutil::time_sec() - start)/UNIFORM_BENCHMARK_ITERATIONS;
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(3)
+        << "    by name: " << byName*1.0e6 << " usec/frame\n"
+        << "    by handle: " << byHandle*1.0e6 << " usec/frame"
+        << " (" << std::setprecision(1) << byName/byHandle << "x faster)";
+    print(oss.str());
+}
@@ -0,0 +1,51 @@
+//Every descriptor the shaders use, grouped by how often it changes.
+//This is the only place that says which set each descriptor is in:
+//setup.cpp makes the DescriptorSetLayouts from this list and the shaders
+//get their declarations from it through shaders/descriptors.txt.
+//
+//There's no include guard: the includer defines these three macros
+//first and #undef's them afterwards.
+//    PER_FRAME(slot,type,declaration,sampler)      set PER_FRAME_SET
+//    PER_MATERIAL(slot,type,declaration,sampler)   set PER_MATERIAL_SET
+//    PER_DRAW(slot,type,declaration,sampler)       set PER_DRAW_SET
+//slot is from importantConstants.h; type is the VkDescriptorType
+//without VK_DESCRIPTOR_TYPE_; declaration is the GLSL declaration,
+//without layout() or the semicolon. sampler is the immutable sampler
+//for a SAMPLER slot (see DescriptorSetEntry::immutableSampler), or
+//VK_NULL_HANDLE if the slot is written with DescriptorSet::setSlot().
+//The shaders ignore it.
+
+//bound once per frame
+PER_FRAME(BASE_TEXTURE_SAMPLER_SLOT,        SAMPLER,        uniform sampler texSampler,                 Samplers::mipSampler)
+PER_FRAME(ENVMAP_TEXTURE_SLOT,              SAMPLED_IMAGE,  uniform textureCube environmentMap,         VK_NULL_HANDLE)
+#ifdef __cplusplus
+//the shaders declare this in uniforms.txt, since Uniforms parses it from there
+PER_FRAME(UNIFORM_BUFFER_SLOT,              UNIFORM_BUFFER_DYNAMIC, uniform UBO,                        VK_NULL_HANDLE)
+#endif
+//only written if ClusteredLights is enabled
+PER_FRAME(LIGHT_BUFFER_SLOT,                STORAGE_BUFFER, readonly buffer LightBuffer{ vec4 lightData[]; }, VK_NULL_HANDLE)
+PER_FRAME(CLUSTER_BUFFER_SLOT,              STORAGE_BUFFER, readonly buffer ClusterBuffer{ uint clusterData[]; }, VK_NULL_HANDLE)
+//only written if ShadowAtlas is enabled
+PER_FRAME(SHADOW_ATLAS_SLOT,                SAMPLED_IMAGE,  uniform texture2DArray shadowAtlas,         VK_NULL_HANDLE)
+PER_FRAME(SHADOW_BUFFER_SLOT,               STORAGE_BUFFER, readonly buffer ShadowBuffer{ vec4 shadowData[]; }, VK_NULL_HANDLE)
+//only written if Lightmaps is enabled
+PER_FRAME(LIGHTMAP_TEXTURE_SLOT,            SAMPLED_IMAGE,  uniform texture2DArray lightmap,            VK_NULL_HANDLE)
+PER_FRAME(LIGHTMAP_BUFFER_SLOT,             STORAGE_BUFFER, readonly buffer LightmapBuffer{ vec4 lightmapTiles[]; }, VK_NULL_HANDLE)
+
+//written once when the meshes are loaded; bound once per primitive.
+//Each texture's sampler comes from its GLTF sampler (see Samplers::get()).
+PER_MATERIAL(BASE_SAMPLER_SLOT,             SAMPLER,        uniform sampler baseColorSampler,           VK_NULL_HANDLE)
+PER_MATERIAL(BASE_TEXTURE_SLOT,             SAMPLED_IMAGE,  uniform texture2DArray baseColorTexture,    VK_NULL_HANDLE)
+PER_MATERIAL(EMISSIVE_SAMPLER_SLOT,         SAMPLER,        uniform sampler emissiveSampler,            VK_NULL_HANDLE)
+PER_MATERIAL(EMISSIVE_TEXTURE_SLOT,         SAMPLED_IMAGE,  uniform texture2DArray emissiveTexture,     VK_NULL_HANDLE)
+PER_MATERIAL(NORMAL_SAMPLER_SLOT,           SAMPLER,        uniform sampler normalSampler,              VK_NULL_HANDLE)
+PER_MATERIAL(NORMAL_TEXTURE_SLOT,           SAMPLED_IMAGE,  uniform texture2DArray normalTexture,       VK_NULL_HANDLE)
+PER_MATERIAL(METALLICROUGHNESS_SAMPLER_SLOT, SAMPLER,       uniform sampler metallicRoughnessSampler,   VK_NULL_HANDLE)
+PER_MATERIAL(METALLICROUGHNESS_TEXTURE_SLOT, SAMPLED_IMAGE, uniform texture2DArray metallicRoughnessTexture, VK_NULL_HANDLE)
+
+//changes from one draw to the next
+PER_DRAW(BLIT_SAMPLER_SLOT,                 SAMPLER,        uniform sampler blitSampler,                Samplers::clampingMipSampler)
+PER_DRAW(BLIT_TEXTURE_SLOT,                 SAMPLED_IMAGE,  uniform texture2DArray blitTexture,         VK_NULL_HANDLE)
+//only written for the lighting pass of DeferredShading
+PER_DRAW(GBUFFER_TEXTURE_SLOT,              SAMPLED_IMAGE,  uniform texture2DArray gbuffer,             VK_NULL_HANDLE)
+PER_DRAW(GBUFFER_DEPTH_SLOT,                SAMPLED_IMAGE,  uniform texture2DArray gbufferDepth,        VK_NULL_HANDLE)
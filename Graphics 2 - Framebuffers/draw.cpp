@@ -3,13 +3,62 @@
 #include "Globals.h"
 #include "Uniforms.h"
 #include "importantConstants.h"
+#include "CPUProfiler.h"
+#include "FrameState.h"
+#include "GPUProfiler.h"
+#include "ParallelRecorder.h"
+#include "StaticCommandCache.h"
+#include "BindlessTextures.h"
+#include "ClusteredLights.h"
+#include "ShadowAtlas.h"
+#include "Lightmaps.h"
+#include "DeferredShading.h"
+#include "consoleoutput.h"
 #include "utils.h"
 
-void draw(Globals& globs)
+//where the meshes are drawn: the offscreen framebuffer, lit as they
+//are drawn (forward shading), or the G-buffer (see DeferredShading)
+struct MeshPass{
+    Framebuffer* target;
+    GraphicsPipeline* pipeline;
+    bool forward;
+};
+
+//the color where nothing is drawn
+static const float CLEAR_R=0.2f, CLEAR_G=0.4f, CLEAR_B=0.8f, CLEAR_A=1.0f;
+
+static void drawMeshesCached(Globals& globs, const FrameState& state, VkCommandBuffer cmd, const MeshPass& pass);
+static void drawMeshesParallel(Globals& globs, const FrameState& state, VkCommandBuffer cmd, const MeshPass& pass);
+static void drawMeshesSerial(Globals& globs, const FrameState& state, VkCommandBuffer cmd, const MeshPass& pass);
+
+void draw(Globals& globs, const FrameState& state)
 {
+    CPU_ZONE("draw");
+
+    //switch between forward and deferred shading (F3)
+    if( globs.renderPathToggleRequested.exchange(false) ){
+        if( DeferredShading::enabled() ){
+            DeferredShading::setActive(!DeferredShading::active());
+            print("Render path:", (DeferredShading::active() ? "deferred" : "forward"));
+        } else {
+            print("Deferred shading is turned off in config.ini");
+        }
+    }
+
+    MeshPass pass;
+    if( DeferredShading::active() ){
+        pass = MeshPass{ DeferredShading::gbuffer(), DeferredShading::geometryPipeline(), false };
+    } else {
+        pass = MeshPass{ globs.offscreen, globs.pipeline, true };
+    }
+
     //begin rendering the frame
     VkCommandBuffer cmd = utils::beginFrame(globs.ctx);
 
+    //the per-frame descriptor set: the primitives
+    //only bind their per-material sets. Its sampler
+    //is immutable (see descriptorSets.h).
+
     //set skybox environmap
     globs.descriptorSet->setSlot(
         ENVMAP_TEXTURE_SLOT,
@@ -19,22 +68,163 @@ void draw(Globals& globs)
     //set uniforms
     globs.uniforms->set("reflectionMatrix", globs.reflectionMatrix);
     globs.uniforms->set("reflectionPlane", globs.reflectionPlane);
-    globs.camera.setUniforms(globs.uniforms);
-    globs.allLights->setUniforms(globs.uniforms);
+    state.setUniforms(globs.uniforms);
     globs.uniforms->update(cmd,globs.descriptorSet,UNIFORM_BUFFER_SLOT);
+    if( ClusteredLights::enabled() )
+        ClusteredLights::update(cmd,globs.descriptorSet,state.camera,state.lights);
+    if( ShadowAtlas::enabled() ){
+        ShadowAtlas::update(cmd,globs.descriptorSet,state.camera,state.lights,
+            globs.allMeshes,state.worldMatrices);
+    }
+    if( Lightmaps::enabled() )
+        Lightmaps::setSlots(globs.descriptorSet);
 
-    //bind descriptor set
+    //bind per-frame descriptor set
     globs.descriptorSet->bind(cmd);
+    if( BindlessTextures::enabled() )
+        BindlessTextures::bind(cmd, globs.pipelineLayout);
+
+    if( StaticCommandCache::enabled() ){
+        drawMeshesCached(globs,state,cmd,pass);
+    } else if( ParallelRecorder::enabled() ){
+        drawMeshesParallel(globs,state,cmd,pass);
+    } else {
+        drawMeshesSerial(globs,state,cmd,pass);
+    }
+
+    //light the G-buffer into the offscreen framebuffer
+    if( !pass.forward )
+        DeferredShading::light(cmd, CLEAR_R, CLEAR_G, CLEAR_B, CLEAR_A);
+   
+    globs.framebuffer->beginRenderPassClearContents(
+        cmd, 1.0f, 0.0f, 0.0f, 1.0f
+    );
+    globs.blitPipe->use(cmd);
+    
+    globs.blitSquare->draw(cmd, globs.drawDescriptorSet,
+        globs.offscreen->currentImage());
+
+
+    globs.framebuffer->endRenderPass(cmd);
+
+    utils::endFrame(globs.ctx);
+
+    //these use the queue, so they must happen on the render thread
+    if(globs.screenshotRequested.exchange(false)){
+        globs.ctx->screenshot(0,"screenshot.png");
+        print("Wrote screenshot.png");
+    }
+    if(globs.gpuTraceRequested.exchange(false)){
+        GPUProfiler::dumpChromeTrace("gputrace.json");
+    }
+}
 
+//begin the renderpass that the meshes are drawn in
+static void beginMeshPass(const MeshPass& pass, VkCommandBuffer cmd, VkSubpassContents contents)
+{
+    if( pass.forward ){
+        pass.target->beginRenderPassClearContents(
+            cmd,
+            CLEAR_R, CLEAR_G, CLEAR_B, CLEAR_A,
+            contents
+        );
+    } else {
+        //an empty G-buffer; the lighting pass skips
+        //pixels where the depth is still 1
+        pass.target->beginRenderPassClearContents(
+            cmd,
+            0.0f, 0.0f, 0.0f, 0.0f,
+            contents
+        );
+    }
+}
+
+static void endMeshPass(const MeshPass& pass, VkCommandBuffer cmd)
+{
+    //the lighting pass reads only the G-buffer's top level
+    if( pass.forward )
+        pass.target->endRenderPass(cmd);
+    else
+        pass.target->endRenderPassNoMipmaps(cmd);
+}
+
+//replay the mesh commands from an earlier frame (see StaticCommandCache)
+static void drawMeshesCached(Globals& globs, const FrameState& state, VkCommandBuffer cmd, const MeshPass& pass)
+{
+    //the cached commands read the uniforms from the fixed buffer,
+    //so it must be updated before the renderpass begins
+    globs.uniforms->updateFixed(cmd);
+    pass.pipeline->use(cmd);
+
+    beginMeshPass(pass, cmd, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    //the world matrices are push constants, so the
+    //commands must be recorded again if any of them moved.
+    //Each target has its own cached commands.
+    StaticCommandCache::execute(cmd, pass.target, globs.staticDescriptorSet,
+        state.worldMatrices.data(),
+        state.worldMatrices.size() * sizeof(state.worldMatrices[0]),
+        [&globs,&state,&pass](VkCommandBuffer sec){
+            DescriptorSet* ds = globs.staticDescriptorSet;
+            ds->copyContents(globs.descriptorSet);
+            ds->setSlot(UNIFORM_BUFFER_SLOT, globs.uniforms->fixedBuffer());
+            pass.pipeline->use(sec);
+            globs.vertexManager->bindBuffers(sec);
+            ds->bind(sec);
+            if( BindlessTextures::enabled() )
+                BindlessTextures::bind(sec, globs.pipelineLayout);
+            PushConstantBlock pushConstants(globs.pushConstants);
+            for(std::size_t i=0;i<globs.allMeshes.size();++i){
+                globs.allMeshes[i]->draw(sec,pushConstants,
+                    globs.meshPushConstantHandles,state.worldMatrices[i]);
+            }
+        }
+    );
+
+    endMeshPass(pass, cmd);
+}
+
+//record the meshes on several threads (see ParallelRecorder)
+static void drawMeshesParallel(Globals& globs, const FrameState& state, VkCommandBuffer cmd, const MeshPass& pass)
+{
+    //binding the pipeline here finishes creating it before
+    //the workers use it
+    pass.pipeline->use(cmd);
+
+    beginMeshPass(pass, cmd, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    ParallelRecorder::record(cmd, pass.target, globs.allMeshes.size(),
+        [&globs,&state,&pass](VkCommandBuffer sec, unsigned worker, std::size_t begin, std::size_t end){
+            DescriptorSet* ds = globs.workerDescriptorSets[worker];
+            ds->copyContents(globs.descriptorSet);
+            pass.pipeline->use(sec);
+            globs.vertexManager->bindBuffers(sec);
+            //secondary command buffers don't inherit bindings
+            ds->bind(sec);
+            if( BindlessTextures::enabled() )
+                BindlessTextures::bind(sec, globs.pipelineLayout);
+            //each worker has its own copy of the push constants
+            PushConstantBlock pushConstants(globs.pushConstants);
+            for(std::size_t i=begin;i<end;++i){
+                globs.allMeshes[i]->draw(sec,pushConstants,
+                    globs.meshPushConstantHandles,state.worldMatrices[i]);
+            }
+        }
+    );
+
+    //the sky isn't drawn, and this renderpass can only
+    //contain vkCmdExecuteCommands, so there's nothing else to record here
+    endMeshPass(pass, cmd);
+}
+
+static void drawMeshesSerial(Globals& globs, const FrameState& state, VkCommandBuffer cmd, const MeshPass& pass)
+{
     //begin rendering to the screen
     //globs.framebuffer->beginRenderPassClearContents(cmd, 0.2f, 0.4f, 0.8f, 1.0f);
-    globs.offscreen->beginRenderPassClearContents(
-        cmd,
-        0.2f, 0.4f, 0.8f, 1.0f
-    );
+    beginMeshPass(pass, cmd, VK_SUBPASS_CONTENTS_INLINE);
 
     //activate the pipeline
-    globs.pipeline->use(cmd);
+    pass.pipeline->use(cmd);
 
     //set source for vertex data
     globs.vertexManager->bindBuffers(cmd);
@@ -71,35 +261,26 @@ void draw(Globals& globs)
     //}
 
     //draw the meshes
-    for(auto& m : globs.allMeshes){
-      m->draw(cmd,globs.descriptorSet,globs.pushConstants);
+    PushConstantBlock pushConstants(globs.pushConstants);
+    for(std::size_t i=0;i<globs.allMeshes.size();++i){
+      globs.allMeshes[i]->draw(cmd,pushConstants,
+        globs.meshPushConstantHandles,state.worldMatrices[i]);
     }
 
   
 
-    //draw the sky
-    globs.skymappipeline->use(cmd);
-    globs.descriptorSet->setSlot(
-        ENVMAP_TEXTURE_SLOT, globs.skyBoxImage->view());
-    globs.descriptorSet->bind(cmd);
-    //globs.skyboxMesh->draw(cmd,
-        //globs.descriptorSet, globs.pushConstants);
+    //draw the sky. Its pipeline is for the offscreen framebuffer,
+    //and the lighting pass needs the environment map in ENVMAP_TEXTURE_SLOT
+    if( pass.forward ){
+        globs.skymappipeline->use(cmd);
+        globs.descriptorSet->setSlot(
+            ENVMAP_TEXTURE_SLOT, globs.skyBoxImage->view());
+        globs.descriptorSet->bind(cmd);
+        //globs.skyboxMesh->draw(cmd,
+            //globs.descriptorSet, globs.pushConstants);
+    }
 
     //done rendering
     //globs.framebuffer->endRenderPass(cmd);
-    globs.offscreen->endRenderPass(cmd);
-   
-    globs.framebuffer->beginRenderPassClearContents(
-        cmd, 1.0f, 0.0f, 0.0f, 1.0f
-    );
-    globs.blitPipe->use(cmd);
-    
-    globs.blitSquare->draw(cmd, globs.descriptorSet,
-        globs.offscreen->currentImage());
-
-
-    globs.framebuffer->endRenderPass(cmd);
-
-    utils::endFrame(globs.ctx);
-
+    endMeshPass(pass, cmd);
 }
\ No newline at end of file
@@ -18,6 +18,15 @@ namespace gltf {
     /// Texture sampling mode: Linear, no mipmaps
     static const int LINEAR = 9729;
 
+    /// Texture sampling mode: Nearest, nearest mipmap
+    static const int NEAREST_MIPMAP_NEAREST = 9984;
+
+    /// Texture sampling mode: Linear, nearest mipmap
+    static const int LINEAR_MIPMAP_NEAREST = 9985;
+
+    /// Texture sampling mode: Nearest, blend between mipmaps
+    static const int NEAREST_MIPMAP_LINEAR = 9986;
+
     /// Texture sampling mode: Linear + mipmaps
     static const int LINEAR_MIPMAP_LINEAR = 9987;
 
@@ -3,17 +3,83 @@
 
 //important constants that are used in several places
 
-#define DESCRIPTOR_SET_BINDING_POINT 0
+//descriptor sets, by how often their contents change.
+//descriptorSets.h says what goes in each one.
+#define PER_FRAME_SET       0
+#define PER_MATERIAL_SET    1
+#define PER_DRAW_SET        2
 
-//things in per-mesh descriptor set
+//the texture array for bindless textures (see BindlessTextures);
+//it takes the place of the per-material set
+#define BINDLESS_TEXTURE_SET_BINDING_POINT PER_MATERIAL_SET
+
+//size of the sampler array next to the bindless texture array.
+//With the other samplers in a pipeline, this stays under the 16
+//per stage that every GPU allows.
+#define BINDLESS_SAMPLER_COUNT          8
+
+//things in per-frame descriptor set
 #define BASE_TEXTURE_SAMPLER_SLOT		0
+#define UNIFORM_BUFFER_SLOT				3
+#define ENVMAP_TEXTURE_SLOT               6
+#define SKYBOX_TEXTURE_SLOT               6
+#define LIGHT_BUFFER_SLOT               7
+#define CLUSTER_BUFFER_SLOT             8
+#define SHADOW_ATLAS_SLOT               9
+#define SHADOW_BUFFER_SLOT              10
+#define LIGHTMAP_TEXTURE_SLOT           11
+#define LIGHTMAP_BUFFER_SLOT            12
+
+//clustered lighting (see ClusteredLights): the view frustum is cut
+//into this many tiles across, down, and (logarithmically) in depth
+#define CLUSTER_GRID_X                  16
+#define CLUSTER_GRID_Y                  9
+#define CLUSTER_GRID_Z                  24
+#define CLUSTER_COUNT                   (CLUSTER_GRID_X*CLUSTER_GRID_Y*CLUSTER_GRID_Z)
+//layout of the cluster buffer, in uints: a header, then an
+//(offset,count) pair per cluster plus one for lights that are
+//in every cluster, then the light indices the offsets refer to
+#define CLUSTER_HEADER_SIZE             4
+#define CLUSTER_INDEX_START             (CLUSTER_HEADER_SIZE+2*(CLUSTER_COUNT+1))
+
+//layout of the shadow buffer (see ShadowAtlas), in vec4's: a header
+//(x=number of lights), then (first view, number of views) for each
+//light, then the views: the columns of the light's viewProjMatrix and
+//the tile (x, y, size in texels, atlas layer). A point light has
+//six views, in the order +x,-x,+y,-y,+z,-z.
+#define SHADOW_HEADER_SIZE              1
+#define SHADOW_VIEW_SIZE                5
+
+//the lightmap tile buffer (see Lightmaps) has a vec4 per primitive,
+//indexed by the lightmapIndex push constant: the scale (xy) and offset (zw)
+//from the second texture coordinates to the atlas, or all zero if
+//the primitive has no lightmap. Entry 0 is always all zero.
+//The atlas is RGBM: the light is rgb * a * LIGHTMAP_RGBM_RANGE.
+#define LIGHTMAP_RGBM_RANGE             16.0
+
+//things in per-material descriptor set
+#define BASE_SAMPLER_SLOT               0
 #define BASE_TEXTURE_SLOT				1
 #define EMISSIVE_TEXTURE_SLOT			2
-#define UNIFORM_BUFFER_SLOT				3
+#define EMISSIVE_SAMPLER_SLOT           3
 #define NORMAL_TEXTURE_SLOT				4
 #define METALLICROUGHNESS_TEXTURE_SLOT  5
-#define ENVMAP_TEXTURE_SLOT               6
-#define SKYBOX_TEXTURE_SLOT               6
+#define NORMAL_SAMPLER_SLOT             6
+#define METALLICROUGHNESS_SAMPLER_SLOT  7
+
+//things in per-draw descriptor set
+#define BLIT_SAMPLER_SLOT               0
+#define BLIT_TEXTURE_SLOT               1
+#define GBUFFER_TEXTURE_SLOT            2
+#define GBUFFER_DEPTH_SLOT              3
+
+//layers of the G-buffer (see DeferredShading)
+#define GBUFFER_ALBEDO_LAYER            0   //base color, alpha
+#define GBUFFER_NORMAL_LAYER            1   //world space normal
+#define GBUFFER_MATERIAL_LAYER          2   //x=metallicity, y=roughness
+#define GBUFFER_EMISSIVE_LAYER          3   //emitted color
+#define GBUFFER_LIGHTMAP_LAYER          4   //baked light; a=1 if there is any
+#define GBUFFER_LAYERS                  5
 
 #define POSITION_SLOT               0
 #define TEXCOORD_SLOT               1
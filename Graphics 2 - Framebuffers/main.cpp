@@ -1,5 +1,15 @@
 #include "vkhelpers.h"
 #include "CommandBuffer.h"
+#include "Uploader.h"
+#include "GPUProfiler.h"
+#include "CPUProfiler.h"
+#include "ParallelRecorder.h"
+#include "StaticCommandCache.h"
+#include "BindlessTextures.h"
+#include "ClusteredLights.h"
+#include "ShadowAtlas.h"
+#include "DeferredShading.h"
+#include "Lightmaps.h"
 #include "Pipeline.h"
 #include "utils.h"
 #include "timeutil.h"
@@ -25,67 +35,202 @@
 #include "imagedecode.h"
 #include <set>
 #include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <exception>
 #include <SDL.h>
 
 #include "Globals.h"
+#include "FrameState.h"
 void setup(Globals& g);
-void draw(Globals& g);
+void draw(Globals& g, const FrameState& state);
 void update(Globals& globs, float elapsed);
 void handleEvents(Globals& globs);
 void mainloop(Globals& globs);
+void benchmark(Globals& globs, int numFrames);
+void descriptorBenchmark(Globals& globs);
+void uniformBenchmark(Globals& globs);
 
 using namespace math2801;
 
 
-int main(int , char** )
+static void usage()
+{
+    std::cout << "Usage: etgg2802 [--benchmark frames] [--descriptor-benchmark] [--uniform-benchmark] [--headless] [--size pixels] [--scene file.glb]\n";
+    std::cout << "    --benchmark  Render a fixed number of frames along a camera path and print frame time statistics\n";
+    std::cout << "    --descriptor-benchmark  Time the ways of writing descriptor sets and exit\n";
+    std::cout << "    --uniform-benchmark  Time setting the camera and light uniforms by name and by handle, and exit\n";
+    std::cout << "    --headless   Do not open a window (implies --benchmark 600 if no frame count is given)\n";
+    std::cout << "    --size       Width and height of the headless framebuffer (default: 720)\n";
+    std::cout << "    --scene      Scene to load (default: assets/room.glb; assets/room3.glb for benchmarks)\n";
+}
+
+int main(int argc, char** argv)
 {
     Globals globs{};
 
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_Rect r;
-    SDL_GetDisplayBounds( 0 , &(r) );
-    globs.height = int(r.h/2.0);
-    globs.width = globs.height;
-    SDL_Window* win = SDL_CreateWindow("ETGG",
-        10,10, globs.width, globs.height,
-        SDL_WINDOW_VULKAN );
-
-    if( !win ){
-        std::cout << "Could not create window\n";
+    bool headless=false;
+    int benchmarkFrames=0;
+    bool descriptorBench=false;
+    bool uniformBench=false;
+    int headlessSize=720;
+    std::string scene;
+    try{
+        for(int i=1;i<argc;++i){
+            std::string a = argv[i];
+            if( a == "--headless" )
+                headless=true;
+            else if( a == "--benchmark" && i+1 < argc )
+                benchmarkFrames = std::stoi(argv[++i]);
+            else if( a == "--descriptor-benchmark" )
+                descriptorBench=true;
+            else if( a == "--uniform-benchmark" )
+                uniformBench=true;
+            else if( a == "--size" && i+1 < argc )
+                headlessSize = std::stoi(argv[++i]);
+            else if( a == "--scene" && i+1 < argc )
+                scene = argv[++i];
+            else
+                throw std::invalid_argument(a);
+        }
+    } catch(std::logic_error&){
+        usage();
         return 1;
     }
+    if( headless && benchmarkFrames <= 0 )
+        benchmarkFrames = 600;      //there's no way to interact with it otherwise
+    if( !scene.empty() )
+        globs.sceneFile = scene;
+    else if( benchmarkFrames > 0 )
+        globs.sceneFile = "assets/room3.glb";
 
     VkPhysicalDeviceFeatures featuresToEnable{};
     featuresToEnable.samplerAnisotropy=VK_TRUE;
     featuresToEnable.fillModeNonSolid=VK_TRUE;
-    globs.ctx = new VulkanContext(win=win,featuresToEnable,1);
+
+    if( headless ){
+        globs.width = globs.height = headlessSize;
+        globs.ctx = new VulkanContext(globs.width,globs.height,featuresToEnable,1);
+    } else {
+        SDL_Init(SDL_INIT_VIDEO);
+        SDL_Rect r;
+        SDL_GetDisplayBounds( 0 , &(r) );
+        globs.height = int(r.h/2.0);
+        globs.width = globs.height;
+        SDL_Window* win = SDL_CreateWindow("ETGG",
+            10,10, globs.width, globs.height,
+            SDL_WINDOW_VULKAN );
+
+        if( !win ){
+            std::cout << "Could not create window\n";
+            return 1;
+        }
+
+        globs.ctx = new VulkanContext(win=win,featuresToEnable,1);
+    }
 
     CommandBuffer::initialize(globs.ctx);
+    ParallelRecorder::initialize(globs.ctx);
+    StaticCommandCache::initialize(globs.ctx);
+    Uploader::initialize(globs.ctx);
+    GPUProfiler::initialize(globs.ctx);
+    CPUProfiler::initialize(globs.ctx);
     ImageManager::initialize(globs.ctx);
     ShaderManager::initialize(globs.ctx);
     Framebuffer::initialize(globs.ctx);
     Images::initialize(globs.ctx);
     Samplers::initialize(globs.ctx);
+    BindlessTextures::initialize(globs.ctx);
+    ClusteredLights::initialize(globs.ctx);
+    ShadowAtlas::initialize(globs.ctx);
+    DeferredShading::initialize(globs.ctx);
+    Lightmaps::initialize(globs.ctx);
 
     setup(globs);
 
-    mainloop(globs);
+    if( descriptorBench )
+        descriptorBenchmark(globs);
+    else if( uniformBench )
+        uniformBenchmark(globs);
+    else if( benchmarkFrames > 0 )
+        benchmark(globs,benchmarkFrames);
+    else
+        mainloop(globs);
 
+    utils::waitForAllFrames(globs.ctx);
     CleanupManager::cleanupEverything();
     globs.ctx->cleanup();
 
-    SDL_Quit();
+    if( !headless )
+        SDL_Quit();
     return 0;
 }
 
+//Runs on the render thread: Draw the newest FrameState that
+//the simulation has published, until the program exits.
+static void renderLoop(Globals& globs, TripleBuffer<FrameState>& states)
+{
+    while(globs.keepLooping){
+        //wake up now and then to check keepLooping
+        if( !states.waitForNew(0.1) )
+            continue;
+        CPUProfiler::frameBoundary();
+        CPU_ZONE("render");
+        draw(globs,states.read());
+    }
+}
+
 void mainloop(Globals& globs)
 {
-    float DESIRED_FRAMES_PER_SEC = 60;
-    float DESIRED_SEC_PER_FRAME = 1/DESIRED_FRAMES_PER_SEC;
     float QUANTUM = 0.005f;     //5 msec
     float accumulated = 0.0f;
     double last=timeutil::time_sec();
+
+    if( globs.ctx->config.get("renderThread","yes") == "no" ){
+        //simulate and draw on one thread
+        float DESIRED_FRAMES_PER_SEC = 60;
+        float DESIRED_SEC_PER_FRAME = 1/DESIRED_FRAMES_PER_SEC;
+        FrameState state(globs);
+        while(globs.keepLooping){
+            CPUProfiler::frameBoundary();
+            CPU_ZONE("mainloop");
+            double now = timeutil::time_sec();
+            float elapsed = float(now-last);
+            last=now;
+            accumulated += elapsed;
+            handleEvents(globs);
+            while(accumulated >= QUANTUM){
+                update(globs,QUANTUM);
+                accumulated -= QUANTUM;
+            }
+            state.capture(globs);
+            draw(globs,state);
+            double end = timeutil::time_sec();
+            float frameTime = float(end-now);
+            float leftover = DESIRED_SEC_PER_FRAME - frameTime;
+            if(leftover > 0)
+                timeutil::sleep(leftover);
+        }
+        return;
+    }
+
+    //This thread (which must be the one that created the window, for
+    //SDL's sake) handles events and runs the simulation; after each
+    //tick it publishes a FrameState for the render thread. Neither
+    //waits for the other.
+    TripleBuffer<FrameState> states{ FrameState(globs) };
+    std::exception_ptr renderError;
+    std::thread renderThread( [&](){
+        try{
+            renderLoop(globs,states);
+        } catch(...){
+            renderError = std::current_exception();
+            globs.keepLooping=false;
+        }
+    });
+
     while(globs.keepLooping){
+        CPU_ZONE("simulation");
         double now = timeutil::time_sec();
         float elapsed = float(now-last);
         last=now;
@@ -95,12 +240,16 @@ void mainloop(Globals& globs)
             update(globs,QUANTUM);
             accumulated -= QUANTUM;
         }
-        draw(globs);
-        double end = timeutil::time_sec();
-        float frameTime = float(end-now);
-        float leftover = DESIRED_SEC_PER_FRAME - frameTime;
+        states.writeSlot().capture(globs);
+        states.publish();
+
+        //sleep until the next tick is due
+        float leftover = QUANTUM - accumulated - float(timeutil::time_sec()-now);
         if(leftover > 0)
             timeutil::sleep(leftover);
     }
-}
 
+    renderThread.join();
+    if(renderError)
+        std::rethrow_exception(renderError);
+}
@@ -7,14 +7,42 @@
 #include "ImageManager.h"
 #include "gltf.h"
 #include "GraphicsPipeline.h"
+#include "ParallelRecorder.h"
+#include "StaticCommandCache.h"
+#include "BindlessTextures.h"
+#include "ClusteredLights.h"
+#include "ShadowAtlas.h"
+#include "DeferredShading.h"
+#include "Lightmaps.h"
+#include "Samplers.h"
 #include <SDL.h>
 
 using namespace math2801;
+
+//the entries for one of the descriptor sets, from descriptorSets.h
+static std::vector<DescriptorSetEntry> tierEntries(int set)
+{
+    std::vector<DescriptorSetEntry> entries;
+    #define PER_FRAME(s,t,d,smp)    if( set == PER_FRAME_SET )    entries.push_back({ .type=VK_DESCRIPTOR_TYPE_##t, .slot=s, .immutableSampler=smp });
+    #define PER_MATERIAL(s,t,d,smp) if( set == PER_MATERIAL_SET ) entries.push_back({ .type=VK_DESCRIPTOR_TYPE_##t, .slot=s, .immutableSampler=smp });
+    #define PER_DRAW(s,t,d,smp)     if( set == PER_DRAW_SET )     entries.push_back({ .type=VK_DESCRIPTOR_TYPE_##t, .slot=s, .immutableSampler=smp });
+    #include "descriptorSets.h"
+    #undef PER_FRAME
+    #undef PER_MATERIAL
+    #undef PER_DRAW
+    return entries;
+}
   
 void setup(Globals& globs)
 {
     globs.keepLooping = true;
-    globs.framebuffer = new Framebuffer();
+    if( globs.ctx->headless ){
+        //stands in for the window; same format as a screenshot
+        globs.framebuffer = new Framebuffer(
+            globs.width, globs.height, 1, VK_FORMAT_R8G8B8A8_UNORM, "headless window");
+    } else {
+        globs.framebuffer = new Framebuffer();
+    }
     globs.offscreen = new Framebuffer(
         globs.width, globs.height, 1, VK_FORMAT_R8G8B8A8_UNORM, "fbo");
 
@@ -30,33 +58,48 @@ void setup(Globals& globs)
     );
     
     globs.pushConstants = new PushConstants("shaders/pushconstants.txt");
+    globs.meshPushConstantHandles = MeshPushConstantHandles(globs.pushConstants);
     
-    globs.descriptorSetLayout = new DescriptorSetLayout(
-        globs.ctx,
-        {
-            { .type=VK_DESCRIPTOR_TYPE_SAMPLER,           .slot=BASE_TEXTURE_SAMPLER_SLOT },
-            { .type=VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,     .slot=BASE_TEXTURE_SLOT         },
-            { .type=VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,     .slot=EMISSIVE_TEXTURE_SLOT     },
-            { .type=VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,    .slot=UNIFORM_BUFFER_SLOT       },
-            {.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,    .slot = NORMAL_TEXTURE_SLOT     },
-            {.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,    .slot = METALLICROUGHNESS_TEXTURE_SLOT    },
-             {.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,   .slot = ENVMAP_TEXTURE_SLOT  },
-
-        }
-    );
+    for(int i=0;i<(int)globs.descriptorSetLayouts.size();++i){
+        if( i == PER_MATERIAL_SET && BindlessTextures::enabled() )
+            globs.descriptorSetLayouts[i] = BindlessTextures::layout();
+        else
+            globs.descriptorSetLayouts[i] = new DescriptorSetLayout(globs.ctx, tierEntries(i));
+    }
     
     globs.blitSquare = new BlitSquare(globs.vertexManager);
 
     globs.pipelineLayout = new PipelineLayout(
         globs.ctx,
         globs.pushConstants,
-        {
-            globs.descriptorSetLayout,
-            nullptr,
-            nullptr
-        },
+        globs.descriptorSetLayouts,
         "globs.pipelineLayout"
     );
+
+    globs.descriptorSetFactory = new DescriptorSetFactory(
+        globs.ctx,
+        "per frame dsf",
+        PER_FRAME_SET,
+        globs.pipelineLayout
+    );
+
+    if( BindlessTextures::enabled() ){
+        globs.materialDescriptorSetFactory = nullptr;
+    } else {
+        globs.materialDescriptorSetFactory = new DescriptorSetFactory(
+            globs.ctx,
+            "per material dsf",
+            PER_MATERIAL_SET,
+            globs.pipelineLayout
+        );
+    }
+
+    globs.drawDescriptorSetFactory = new DescriptorSetFactory(
+        globs.ctx,
+        "per draw dsf",
+        PER_DRAW_SET,
+        globs.pipelineLayout
+    );
     
     globs.blitPipe = (new GraphicsPipeline(
         globs.ctx, globs.pipelineLayout,
@@ -83,7 +126,8 @@ void setup(Globals& globs)
 
     globs.skyboxMesh = Meshes::getFromGLTF(
         globs.vertexManager,
-        gltf::parse("assets/skybox.glb")
+        gltf::parse("assets/skybox.glb"),
+        globs.materialDescriptorSetFactory
     )[0];
 
     globs.floorPipeline1 = globs.pipeline->clone("floor pipeline 1")
@@ -101,14 +145,15 @@ void setup(Globals& globs)
             VK_STENCIL_OP_KEEP, VK_STENCIL_OP_KEEP, VK_STENCIL_OP_KEEP);
 
 
-    globs.descriptorSetFactory = new DescriptorSetFactory(
-        globs.ctx,
-        "per mesh dsf",
-        DESCRIPTOR_SET_BINDING_POINT,
-        globs.pipelineLayout
-    );
-    
     globs.descriptorSet = globs.descriptorSetFactory->make();
+    globs.drawDescriptorSet = globs.drawDescriptorSetFactory->make();
+
+    //one for each recording thread (see ParallelRecorder)
+    for(unsigned i=0;i<ParallelRecorder::numWorkers();++i){
+        globs.workerDescriptorSets.push_back(globs.descriptorSetFactory->make());
+    }
+
+    globs.staticDescriptorSet = globs.descriptorSetFactory->make();
     
     globs.uniforms = new Uniforms(globs.ctx, "shaders/uniforms.txt");
     
@@ -131,9 +176,27 @@ void setup(Globals& globs)
         "assets/nebula1_5.jpg"
         });
 
-    gltf::GLTFScene scene = gltf::parse("assets/room.glb");
-    globs.allLights = new LightCollection(scene,globs.uniforms->getDefine("MAX_LIGHTS"));
-    globs.allMeshes = Meshes::getFromGLTF(globs.vertexManager, scene );
+    gltf::GLTFScene scene = gltf::parse(globs.sceneFile);
+    int arraySize = globs.uniforms->getDefine("MAX_LIGHTS");
+    globs.allLights = new LightCollection(scene,
+        ClusteredLights::enabled() ? ClusteredLights::maxLights() : arraySize,
+        arraySize);
+    globs.allMeshes = Meshes::getFromGLTF(globs.vertexManager, scene,
+        globs.materialDescriptorSetFactory );
+    if( Lightmaps::enabled() )
+        Lightmaps::createResources(scene, globs.allMeshes);
+    if( ShadowAtlas::enabled() ){
+        ShadowAtlas::createResources(globs.pipelineLayout, globs.vertexManager,
+            globs.pushConstants, globs.allLights->numLights);
+    }
+    if( DeferredShading::enabled() ){
+        DeferredShading::createResources(globs.width, globs.height,
+            globs.pipelineLayout, globs.vertexManager, globs.offscreen,
+            globs.drawDescriptorSetFactory, globs.blitSquare);
+    }
+
+    //any cached mesh commands refer to the old meshes
+    StaticCommandCache::invalidate();
      
     vec3 p(0.0f, -2.1188f, 0.0f);
     float A = 0.0f;
@@ -156,7 +219,8 @@ void setup(Globals& globs)
     #ifdef START_UNLOCKED
         globs.mouseLook=false;
     #else
-        SDL_SetRelativeMouseMode(SDL_TRUE);
-        globs.mouseLook=true;
+        globs.mouseLook = !globs.ctx->headless;
+        if(globs.mouseLook)
+            SDL_SetRelativeMouseMode(SDL_TRUE);
     #endif
 }
@@ -2,11 +2,10 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "../importantConstants.h"
+#include "descriptors.txt"
 
 layout(location=0) in vec2 texcoord;
 layout(location=0) out vec4 color;
-layout(set=0,binding=BASE_TEXTURE_SAMPLER_SLOT) uniform sampler texSampler;
-layout(set=0,binding=BASE_TEXTURE_SLOT) uniform texture2DArray baseColorTexture;
 
 vec3 rgb2hsv(vec3 color)
 {
@@ -70,7 +69,7 @@ vec3 hsv2rgb(vec3 hsv)
 void main(){
     ivec2 coord = ivec2(gl_FragCoord.xy);
     vec4 texcolor = texelFetch(
-        sampler2DArray(baseColorTexture,texSampler),
+        sampler2DArray(blitTexture,blitSampler),
         ivec3(coord,0),
         0
     );
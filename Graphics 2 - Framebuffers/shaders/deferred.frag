@@ -0,0 +1,50 @@
+#version 450 core
+
+#extension GL_GOOGLE_include_directive : enable
+
+#include "../importantConstants.h"
+#include "uniforms.txt"
+#include "descriptors.txt"
+
+//the lighting pass of deferred shading: light each pixel
+//once, with what gbuffer.frag wrote for it
+
+layout(location=0) noperspective in vec4 nearPoint;
+layout(location=1) flat in vec4 depthStep;
+
+layout(location=0) out vec4 color;
+
+//lighting.txt's inputs; they come from the G-buffer
+vec3 worldPos;
+float MF;
+float RF;
+
+#include "lighting.txt"
+
+vec4 gbufferLayer(ivec2 coord, int layer)
+{
+    return texelFetch( sampler2DArray(gbuffer,blitSampler), ivec3(coord,layer), 0 );
+}
+
+void main(){
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch( sampler2DArray(gbufferDepth,blitSampler), ivec3(coord,0), 0 ).r;
+    if( depth == 1.0 ){
+        //nothing was drawn here; keep the clear color
+        discard;
+        return;
+    }
+    vec4 p = nearPoint + depth * depthStep;
+    worldPos = p.xyz / p.w;
+
+    vec4 c = gbufferLayer(coord,GBUFFER_ALBEDO_LAYER);
+    vec3 N = normalize( gbufferLayer(coord,GBUFFER_NORMAL_LAYER).xyz );
+    vec2 m = gbufferLayer(coord,GBUFFER_MATERIAL_LAYER).xy;
+    vec3 e = gbufferLayer(coord,GBUFFER_EMISSIVE_LAYER).rgb;
+    vec4 baked = gbufferLayer(coord,GBUFFER_LIGHTMAP_LAYER);
+    MF = m.x;
+    RF = m.y;
+
+    vec3 V = normalize(eyePos-worldPos);
+    color = vec4( shade(c.rgb, N, V, e, baked), 1.0 );
+}
@@ -0,0 +1,25 @@
+#version 450 core
+
+#extension GL_GOOGLE_include_directive : enable
+
+#include "../importantConstants.h"
+#include "pushconstants.txt"
+#include "uniforms.txt"
+
+//the lighting pass of deferred shading: a square that covers the screen
+
+layout(location=POSITION_SLOT) in vec3 position;
+
+//the world space point (before dividing by w) at depth 0 under this
+//corner, and what each unit of depth adds to it. Both are linear in
+//screen space, so deferred.frag gets its point's position from the
+//depth buffer without inverting the matrix for every pixel.
+layout(location=0) noperspective out vec4 v_nearPoint;
+layout(location=1) flat out vec4 v_depthStep;
+
+void main(){
+    mat4 inverseViewProj = inverse(viewProjMatrix);
+    gl_Position = vec4(position.xy,0.0,1.0);
+    v_nearPoint = vec4(position.xy,0.0,1.0) * inverseViewProj;
+    v_depthStep = vec4(0.0,0.0,1.0,0.0) * inverseViewProj;
+}
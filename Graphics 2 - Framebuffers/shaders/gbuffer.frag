@@ -0,0 +1,60 @@
+#version 450 core
+
+#extension GL_GOOGLE_include_directive : enable
+#ifdef BINDLESS_TEXTURES
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+#include "../importantConstants.h"
+#include "pushconstants.txt"
+#include "uniforms.txt"
+#include "descriptors.txt"
+
+//the geometry pass of deferred shading: write the surface
+//to the G-buffer and leave the lighting to deferred.frag
+
+layout(location=0) in vec2 texcoord;
+layout(location=1) in vec3 normal;
+layout(location=2) in vec3 worldPos;
+layout(location=3) in vec4 tangent;
+layout(location=4) in vec2 texcoord2;
+
+layout(location=GBUFFER_ALBEDO_LAYER) out vec4 albedo;
+layout(location=GBUFFER_NORMAL_LAYER) out vec4 surfaceNormal;
+layout(location=GBUFFER_MATERIAL_LAYER) out vec4 material;
+layout(location=GBUFFER_EMISSIVE_LAYER) out vec4 emissive;
+layout(location=GBUFFER_LIGHTMAP_LAYER) out vec4 baked;
+
+#include "material.txt"
+
+void main(){
+     
+    vec4 c = texture( sampler2DArray(baseColorTexture,baseColorSampler),
+                      vec3(texcoord,animationFrame) );
+    c = c * baseColorFactor;
+    
+    vec3 b = texture( sampler2DArray(normalTexture, normalSampler),
+                    vec3(texcoord2,animationFrame) ).xyz;
+
+    if( doingReflections == 1 ){
+        if( dot(vec4(worldPos,1.0),reflectionPlane) < 0 ){
+            discard;
+            return;
+        }
+    }
+
+    vec3 N = normal;
+    N = doBumpMapping(b.xyz, N);
+
+    N = (vec4(N,0.0) * worldMatrix).xyz;
+    N = normalize(N);
+
+    vec4 e = texture( sampler2DArray(emissiveTexture,emissiveSampler),
+                      vec3(texcoord,0.0) );
+
+    albedo = c;
+    surfaceNormal = vec4(N,0.0);
+    material = vec4(MF,RF,0.0,0.0);
+    emissive = vec4(e.rgb * emissiveFactor.rgb, 0.0);
+    baked = bakedLight();
+}
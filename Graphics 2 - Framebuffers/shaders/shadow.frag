@@ -0,0 +1,9 @@
+#version 450 core
+
+//distance along the light's view direction: w of the
+//clip space position, which is 1/gl_FragCoord.w
+layout(location=0) out vec4 lightDistance;
+
+void main(){
+    lightDistance = vec4(1.0/gl_FragCoord.w);
+}
@@ -0,0 +1,15 @@
+#version 450 core
+
+#extension GL_GOOGLE_include_directive : enable
+
+#include "../importantConstants.h"
+#include "pushconstants.txt"
+
+//draws one view of a light into the shadow atlas (see ShadowAtlas).
+//worldMatrix is the mesh's world matrix times the light's viewProjMatrix.
+
+layout(location=POSITION_SLOT) in vec3 position;
+
+void main(){
+    gl_Position = vec4(position,1.0) * worldMatrix;
+}
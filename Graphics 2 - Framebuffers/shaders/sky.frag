@@ -5,6 +5,7 @@
 #include "../importantConstants.h"
 #include "pushconstants.txt"
 #include "uniforms.txt"
+#include "descriptors.txt"
 
 layout(location=0) in vec2 texcoord;
 layout(location=1) in vec3 normal;
@@ -15,15 +16,9 @@ layout(location=5) in vec3 objPos;
 
 layout(location=0) out vec4 color;
 
-layout(set=0,binding=BASE_TEXTURE_SAMPLER_SLOT) uniform sampler texSampler;
-layout(set=0,binding=BASE_TEXTURE_SLOT) uniform texture2DArray baseColorTexture;
-layout(set=0,binding=EMISSIVE_TEXTURE_SLOT) uniform texture2DArray emissiveTexture;
-layout(set=0,binding=NORMAL_TEXTURE_SLOT) uniform texture2DArray normalTexture;
-layout(set=0,binding=METALLICROUGHNESS_TEXTURE_SLOT) uniform texture2DArray metallicRoughnessTexture;
-layout(set=0,binding=SKYBOX_TEXTURE_SLOT) uniform textureCube skybox;
-
 
 void main(){
-    vec4 c = texture( samplerCube(skybox,texSampler), objPos);
+    //the sky image is in the environment map's slot (SKYBOX_TEXTURE_SLOT)
+    vec4 c = texture( samplerCube(environmentMap,texSampler), objPos);
     color = c;
 }
@@ -2,11 +2,14 @@
 #include <SDL.h>
 #include "Globals.h"
 #include "consoleoutput.h"
+#include "CPUProfiler.h"
 
 using namespace math2801;
    
 void update(Globals& globs, float elapsed)
 {
+    CPU_ZONE("update");
+    globs.tick++;
     float speed=1.0;
     if( globs.keys.contains(SDLK_LSHIFT)) speed *= 4.0f;
     if( globs.keys.contains(SDLK_w) )     globs.camera.strafeNoUpDown(0,0,speed*elapsed);
@@ -21,6 +24,7 @@ void update(Globals& globs, float elapsed)
 
 void handleEvents(Globals& globs)
 {
+    CPU_ZONE("handleEvents");
     SDL_Event ev;
     while(true){
         bool eventOccurred = SDL_PollEvent(&(ev));
@@ -45,8 +49,13 @@ void handleEvents(Globals& globs)
                      SDL_SetRelativeMouseMode(SDL_FALSE);
             }
             if(ev.key.keysym.sym == SDLK_F1){
-                globs.ctx->screenshot(0,"screenshot.png");
-                print("Wrote screenshot.png");
+                globs.screenshotRequested=true;
+            }
+            if(ev.key.keysym.sym == SDLK_F2){
+                globs.gpuTraceRequested=true;
+            }
+            if(ev.key.keysym.sym == SDLK_F3){
+                globs.renderPathToggleRequested=true;
             }
         }
         if(ev.type == SDL_KEYUP){
@@ -1,13 +1,17 @@
 #include "utils.h"
 #include <tuple>
 #include "CommandBuffer.h"
+#include "Uploader.h"
 #include "GraphicsPipeline.h"
 #include <chrono>
 #include <fstream>
 #include <iostream>
 #include "CleanupManager.h"
+#include "timeutil.h"
+#include "consoleoutput.h"
+#include "CPUProfiler.h"
+#include <atomic>
 
-static std::vector<std::function<void(unsigned)> > frameCompleteCallbacks;
 static std::vector<std::function<void(int,VkCommandBuffer)> > frameBeginCallbacks;
 static std::vector<std::function<void(int,VkCommandBuffer)> > frameEndCallbacks;
 
@@ -18,61 +22,247 @@ static std::vector<std::function<void(int,VkCommandBuffer)> > frameEndCallbacks;
 //is associated with frame 0
 static unsigned currentFrameIdentifier=0;
 
-static std::vector<VkFence> availableFences;
-
-//first=frame number, second=fence
-static std::vector< std::pair<unsigned,VkFence> > activeFences;
+//Number of frames the GPU is known to have finished (modulo 2^32).
+//Frame identifier f is complete if f comes before this value.
+//Written by the render thread once per frame; read by anything
+//that reclaims resources (see RetireQueue).
+static std::atomic<unsigned> completedFrames{0};
+
+//With timeline semaphores, every submit signals frameTimeline with
+//the next value of timelineValue, so one read of the counter tells how
+//far the GPU has gotten. Values are 64 bits, so they never wrap.
+static VkSemaphore frameTimeline = VK_NULL_HANDLE;
+static std::uint64_t timelineValue = 0;
+
+//Bookkeeping for one of the ctx->framesInFlight frame slots.
+//A slot is reused every framesInFlight frames; before
+//that can happen, the GPU must have finished with the slot's
+//previous frame (signaled by the timeline semaphore reaching
+//timelineValue, or by the fence if there are no timeline semaphores).
+struct FrameSlot{
+    VkFence fence = VK_NULL_HANDLE;         //only used without timeline semaphores
+    std::uint64_t timelineValue = 0;        //only used with timeline semaphores
+    unsigned frameNumber = 0;
+    bool pending = false;                   //true if submitted but not yet retired
+};
+
+static std::vector<FrameSlot> frameSlots;
+
+//slot being recorded now (or next, if we are not in a frame)
+static int currentSlot=0;
 
 static bool inFrame=false;
 
 static int currentSwapchainIndex=-1;
 static VkCommandBuffer currentCommandBuffer=VK_NULL_HANDLE;
 
-namespace utils{
+//timing information for printFrameStats
+static bool printFrameStats=false;
+static const int FRAME_STATS_INTERVAL=120;
+static int statsFrames=0;
+static double statsWaitTime=0.0;        //time blocked waiting for the GPU
+static double statsRecordTime=0.0;      //time between beginFrame() and submit
+static double statsFirstFrameTime=0.0;
+static double frameStartTime=0.0;
+static double frameWaitTime=0.0;
+
+static void makeFrameSlots(VulkanContext* ctx)
+{
+    printFrameStats = (ctx->config.get("printFrameStats","no") != "no");
+    frameSlots.resize(ctx->framesInFlight);
+    if( ctx->haveTimelineSemaphores ){
+        VkSemaphoreTypeCreateInfoKHR typeInfo{
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+            .pNext = nullptr,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+            .initialValue = 0
+        };
+        check(vkCreateSemaphore(
+            ctx->dev,
+            VkSemaphoreCreateInfo{
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                .pNext = &typeInfo,
+                .flags = 0
+            },
+            nullptr,
+            &frameTimeline
+        ));
+        ctx->setObjectName(frameTimeline,"frame timeline");
+        CleanupManager::registerCleanupFunction( [ctx](){
+            vkDestroySemaphore(ctx->dev,frameTimeline,nullptr);
+            frameTimeline = VK_NULL_HANDLE;
+            frameSlots.clear();
+        });
+        return;
+    }
+    for(int i=0;i<ctx->framesInFlight;++i){
+        VkFence f;
+        check(vkCreateFence(
+            ctx->dev,
+            VkFenceCreateInfo{
+                .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0          //create as unsignaled
+            },
+            nullptr,
+            &f
+        ));
+        ctx->setObjectName(f,"frame fence["+std::to_string(i)+"]");
+        frameSlots[i].fence = f;
+    }
+    CleanupManager::registerCleanupFunction( [ctx](){
+        for(auto& fs : frameSlots ){
+            vkDestroyFence(ctx->dev,fs.fence,nullptr);
+        }
+        frameSlots.clear();
+    });
+}
 
+//the GPU has finished with this slot's frame; anything
+//queued for it (see RetireQueue) can now be reclaimed
+static void retireFrameSlot(VulkanContext* ctx, FrameSlot& fs)
+{
+    if( !frameTimeline )
+        check(vkResetFences(ctx->dev,1,&fs.fence));
+    fs.pending=false;
+    completedFrames.store(fs.frameNumber+1);
+}
 
-VkCommandBuffer beginFrame(VulkanContext* ctx)
+//find out how far the GPU has gotten
+static void pollCompletedFrames(VulkanContext* ctx, int currentSlot)
 {
+    if( frameTimeline ){
+        //one counter read covers every outstanding frame
+        std::uint64_t value;
+        check(vkGetSemaphoreCounterValueKHR(ctx->dev, frameTimeline, &value));
+        completedFrames.store( (unsigned) value );
+        for(FrameSlot& fs : frameSlots){
+            if( fs.pending && fs.timelineValue <= value )
+                fs.pending=false;
+        }
+        return;
+    }
 
-    //deal with any signaled fences from past frames
-    for( auto it = activeFences.begin(); it != activeFences.end() ; ){
-        auto fstat = vkGetFenceStatus(ctx->dev, it->second);
+    //No timeline: check the fences. The queue
+    //completes work in order, so we look at the oldest frame first
+    //and stop at the first one that's still running.
+    int numSlots = (int)frameSlots.size();
+    for(int i=0;i<numSlots;++i){
+        FrameSlot& fs = frameSlots[(currentSlot+i)%numSlots];
+        if( !fs.pending )
+            continue;
+        auto fstat = vkGetFenceStatus(ctx->dev, fs.fence);
         if( fstat == VK_SUCCESS ){
-            //this frame is done; notify components that they can
-            //reclaim resources
-            availableFences.push_back(it->second);
-            vkResetFences(ctx->dev,1,&it->second);
-            for(auto& f : frameCompleteCallbacks ){
-                f(it->first);       //tell them the frame number
-            }
-            it = activeFences.erase(it);
+            retireFrameSlot(ctx,fs);
         } else if( fstat == VK_NOT_READY ){
-            //frame not yet done; look at next fence
-            it++;
+            //frame not yet done; newer ones won't be either
+            break;
         } else if( fstat == VK_ERROR_DEVICE_LOST ){
             throw std::runtime_error("Device was lost");
         }
     }
+}
+
+//block until the GPU has finished the slot's previous frame
+static void waitForFrameSlot(VulkanContext* ctx, FrameSlot& fs)
+{
+    if( frameTimeline ){
+        check(vkWaitSemaphoresKHR(
+            ctx->dev,
+            VkSemaphoreWaitInfoKHR{
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+                .pNext = nullptr,
+                .flags = 0,
+                .semaphoreCount = 1,
+                .pSemaphores = &frameTimeline,
+                .pValues = &fs.timelineValue
+            },
+            0xffffffffffffffff
+        ));
+    } else {
+        check(vkWaitForFences(ctx->dev,1,&fs.fence,VK_TRUE,0xffffffffffffffff));
+    }
+    retireFrameSlot(ctx,fs);
+}
+
+static void updateFrameStats(VulkanContext* ctx, double waitTime, double recordTime)
+{
+    if(!printFrameStats)
+        return;
+    double now = timeutil::time_sec();
+    if(statsFrames == 0)
+        statsFirstFrameTime = now;
+    statsWaitTime += waitTime;
+    statsRecordTime += recordTime;
+    statsFrames++;
+    if(statsFrames == FRAME_STATS_INTERVAL){
+        double total = now-statsFirstFrameTime;
+        double perFrame = total / (statsFrames-1);
+        print("framesInFlight=",ctx->framesInFlight,
+            " frame:",perFrame*1000.0,"ms",
+            " record:",statsRecordTime/statsFrames*1000.0,"ms",
+            " gpu wait:",statsWaitTime/statsFrames*1000.0,"ms",
+            " fps:",1.0/perFrame,
+            " cmd buffer allocations:",CommandBuffer::FrameAllocator::numAllocations()
+        );
+        statsFrames=0;
+        statsWaitTime=0.0;
+        statsRecordTime=0.0;
+    }
+}
+
+namespace utils{
+
+
+VkCommandBuffer beginFrame(VulkanContext* ctx)
+{
+    CPU_ZONE("utils::beginFrame");
+    if( frameSlots.empty() )
+        makeFrameSlots(ctx);
+
+    //anything uploaded since the last frame must be submitted
+    //before this frame's commands
+    Uploader::flush();
 
+    //see which past frames are done, so their resources can be reclaimed
+    pollCompletedFrames(ctx,currentSlot);
 
     if(inFrame ){
         throw std::runtime_error("beginFrame() called twice with no intervening endFrame()");
     }
     inFrame=true;
 
+    //if we are more than framesInFlight frames ahead of the GPU,
+    //we must wait for it to catch up before reusing this slot
+    FrameSlot& slot = frameSlots[currentSlot];
+    double waitStart = timeutil::time_sec();
+    if( slot.pending ){
+        waitForFrameSlot(ctx,slot);
+    }
+
     std::uint32_t imageindex;
-    vkAcquireNextImageKHR(
-        ctx->dev,
-        ctx->swapchain,
-        0xffffffffffffffff,
-        ctx->imageAcquiredSemaphore,
-        nullptr,
-        &(imageindex)
-    );
+    if( ctx->headless ){
+        //nothing to acquire: offscreen framebuffers have
+        //one image per frame slot
+        imageindex = (std::uint32_t)currentSlot;
+    } else {
+        vkAcquireNextImageKHR(
+            ctx->dev,
+            ctx->swapchain,
+            0xffffffffffffffff,
+            ctx->imageAcquiredSemaphores[currentSlot],
+            nullptr,
+            &(imageindex)
+        );
+    }
+    frameStartTime = timeutil::time_sec();
+    frameWaitTime = frameStartTime-waitStart;
 
     currentSwapchainIndex = (int)imageindex;
 
-    auto cmd = CommandBuffer::allocate();
+    //the slot's previous frame is done, so its command pool can be recycled
+    CommandBuffer::FrameAllocator::beginSlot(currentSlot);
+    auto cmd = CommandBuffer::FrameAllocator::allocate();
     currentCommandBuffer = cmd;
 
     check(vkBeginCommandBuffer(
@@ -80,7 +270,7 @@ VkCommandBuffer beginFrame(VulkanContext* ctx)
         VkCommandBufferBeginInfo{
             .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
             .pNext=nullptr,
-            .flags=0,
+            .flags=VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
             .pInheritanceInfo=nullptr
         }
     ));
@@ -95,6 +285,7 @@ VkCommandBuffer beginFrame(VulkanContext* ctx)
 
 void endFrame(VulkanContext* ctx)
 {
+    CPU_ZONE("utils::endFrame");
     if(!inFrame){
         throw std::runtime_error("endFrame called without matching beginFrame");
     }
@@ -106,66 +297,79 @@ void endFrame(VulkanContext* ctx)
 
     check(vkEndCommandBuffer(currentCommandBuffer));
 
+    FrameSlot& slot = frameSlots[currentSlot];
+    slot.frameNumber = currentFrameIdentifier;
+    slot.pending = true;
 
-   if( availableFences.empty() ){
-        VkFenceCreateInfo ci{
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-            .pNext = nullptr,
-            .flags = 0          //create as unsignaled
-        };
-        VkFence f;
-        check(vkCreateFence(ctx->dev, &ci, nullptr, &f ));
-        activeFences.push_back( std::make_pair(currentFrameIdentifier, f ) );
-        CleanupManager::registerCleanupFunction( [f,ctx](){
-            vkDestroyFence(ctx->dev,f,nullptr);
-        });
-    } else {
-        VkFence f = availableFences.back();
-        availableFences.pop_back();
-        activeFences.push_back( std::make_pair(currentFrameIdentifier, f ) );
-    }
+    //headless: no acquire to wait for and no present to signal
+    unsigned numSemaphores = (ctx->headless ? 0 : 1);
+    VkPipelineStageFlags waitDestStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
 
+    std::vector<VkSemaphore> signalSemaphores;
+    std::vector<std::uint64_t> signalValues;     //ignored for binary semaphores
+    if( !ctx->headless ){
+        signalSemaphores.push_back(ctx->renderCompleteSemaphores[currentSlot]);
+        signalValues.push_back(0);
+    }
+    VkTimelineSemaphoreSubmitInfoKHR timelineInfo{
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+        .pNext = nullptr,
+        .waitSemaphoreValueCount = 0,
+        .pWaitSemaphoreValues = nullptr,
+        .signalSemaphoreValueCount = 0,
+        .pSignalSemaphoreValues = nullptr
+    };
+    if( frameTimeline ){
+        slot.timelineValue = ++timelineValue;
+        signalSemaphores.push_back(frameTimeline);
+        signalValues.push_back(slot.timelineValue);
+        timelineInfo.signalSemaphoreValueCount = (unsigned)signalValues.size();
+        timelineInfo.pSignalSemaphoreValues = signalValues.data();
+    }
 
-    VkPipelineStageFlags waitDestStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
     check(vkQueueSubmit(
         ctx->graphicsQueue,
         1,
         VkSubmitInfo{
             .sType=VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .pNext=nullptr,
-            .waitSemaphoreCount=1,
-            .pWaitSemaphores=&ctx->imageAcquiredSemaphore,
+            .pNext=(frameTimeline ? &timelineInfo : nullptr),
+            .waitSemaphoreCount=numSemaphores,
+            .pWaitSemaphores=&ctx->imageAcquiredSemaphores[currentSlot],
             .pWaitDstStageMask = &waitDestStageMask,
             .commandBufferCount=1,
             .pCommandBuffers = &currentCommandBuffer,
-            .signalSemaphoreCount=1,
-            .pSignalSemaphores=&ctx->renderCompleteSemaphore
+            .signalSemaphoreCount=(unsigned)signalSemaphores.size(),
+            .pSignalSemaphores=(signalSemaphores.empty() ? nullptr : signalSemaphores.data())
         },
-        activeFences.back().second         //always the last one in the list
+        slot.fence          //VK_NULL_HANDLE with timeline semaphores
     ));
 
-    std::uint32_t ii = (std::uint32_t)currentSwapchainIndex;
-    check(vkQueuePresentKHR(
-        ctx->presentQueue,
-        VkPresentInfoKHR{
-            .sType=VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-            .pNext=nullptr,
-            .waitSemaphoreCount=1,
-            .pWaitSemaphores = &ctx->renderCompleteSemaphore,
-            .swapchainCount=1,
-            .pSwapchains = &ctx->swapchain,
-            .pImageIndices=&ii,
-            .pResults=nullptr
-        }
-    ));
+    double recordTime = timeutil::time_sec() - frameStartTime;
+
+    if( !ctx->headless ){
+        std::uint32_t ii = (std::uint32_t)currentSwapchainIndex;
+        check(vkQueuePresentKHR(
+            ctx->presentQueue,
+            VkPresentInfoKHR{
+                .sType=VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+                .pNext=nullptr,
+                .waitSemaphoreCount=1,
+                .pWaitSemaphores = &ctx->renderCompleteSemaphores[currentSlot],
+                .swapchainCount=1,
+                .pSwapchains = &ctx->swapchain,
+                .pImageIndices=&ii,
+                .pResults=nullptr
+            }
+        ));
+    }
 
-    //FIXME: Remove this wait and then dispose of command buffer
-    //when frame is complete. Also make several renderCompleteSemaphore's above.
-    check(vkQueueWaitIdle(ctx->presentQueue));
+    //no wait here: the command buffer is recycled by
+    //beginFrame() once the slot's frame has finished
 
-    CommandBuffer::dispose(currentCommandBuffer);
+    updateFrameStats(ctx,frameWaitTime,recordTime);
 
     ++currentFrameIdentifier;
+    currentSlot = (currentSlot+1) % (int)frameSlots.size();
 
     inFrame=false;
     currentSwapchainIndex=-1;
@@ -173,6 +377,20 @@ void endFrame(VulkanContext* ctx)
 
 }
 
+void waitForAllFrames(VulkanContext* ctx)
+{
+    if(inFrame){
+        throw std::runtime_error("Cannot call waitForAllFrames() inside a frame");
+    }
+    check(vkDeviceWaitIdle(ctx->dev));
+    int numSlots = (int)frameSlots.size();
+    for(int i=0;i<numSlots;++i){
+        FrameSlot& fs = frameSlots[(currentSlot+i)%numSlots];
+        if( fs.pending )
+            retireFrameSlot(ctx,fs);
+    }
+}
+
 
 int computePadding(VkDeviceSize offset, VkDeviceSize alignment )
 {
@@ -198,8 +416,10 @@ std::vector<char> readFile(std::string filename)
     return d;
 }
 
-void registerFrameCompleteCallback( std::function<void(unsigned)> f){
-    frameCompleteCallbacks.push_back(f);
+bool isFrameComplete(unsigned frameIdentifier)
+{
+    //wraparound-safe version of frameIdentifier < completedFrames
+    return int(completedFrames.load() - frameIdentifier) > 0;
 }
 
 
@@ -226,5 +446,12 @@ int getSwapchainImageIndex()
     return currentSwapchainIndex;
 }
 
+int getFrameSlot()
+{
+    if(!inFrame)
+        throw std::runtime_error("Cannot call getFrameSlot() outside of a render operation");
+    return currentSlot;
+}
+
 };  //end namespace
 
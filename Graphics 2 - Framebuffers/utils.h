@@ -5,21 +5,41 @@
 
 namespace utils{
 
-/// Call this at the start of the draw function. It calls any
-/// pending frame complete callbacks that have been registered
-/// (see registerFrameCompleteCallback()).
+/// Call this at the start of the draw function. It checks how
+/// many frames the GPU has finished (one read of a timeline semaphore,
+/// or the slots' fences if timeline semaphores aren't available;
+/// see isFrameComplete()) and waits if the frame slot is still busy.
 /// @param ctx The context
 /// @return A command buffer that can be used for rendering
 VkCommandBuffer beginFrame(VulkanContext* ctx);
 
-/// Call this at the end of the draw function
+/// Call this at the end of the draw function. This submits the
+/// frame's commands and presents the image (unless the context is
+/// headless), but it does not wait for
+/// the GPU to finish: Up to ctx->framesInFlight frames may be
+/// executing while the CPU works on the next one.
 /// @param ctx The context
 void endFrame(VulkanContext* ctx);
 
-/// Get the current swapchain image index
+/// Wait until the GPU has finished all submitted frames and
+/// mark them as complete. Call this before cleanup.
+/// This may not be called between beginFrame() and endFrame().
+/// @param ctx The context
+void waitForAllFrames(VulkanContext* ctx);
+
+/// Get the current swapchain image index. If the context is
+/// headless, this is the same as getFrameSlot().
 /// @return The image index
 int getSwapchainImageIndex();
 
+/// Get the frame slot of the current frame. Slots are reused
+/// every ctx->framesInFlight frames, and a slot is never reused until
+/// the GPU has finished the previous frame that used it, so
+/// per-slot resources can be recycled safely.
+/// This function may only be called between beginFrame() and endFrame().
+/// @return The slot, in the range [0...ctx->framesInFlight)
+int getFrameSlot();
+
 /// Compute padding for uniforms or push constants
 /// @param offset Current offset within file
 /// @param alignment Desired alignment of next item to add
@@ -33,19 +53,18 @@ int computePadding( VkDeviceSize offset, VkDeviceSize alignment );
 /// @return The file's data
 std::vector<char> readFile(std::string filename);
 
-/// Register a callback to be notified when a particular
-/// frame has completely finished rendering.
-/// The check for frame completeness is performed at the very start of beginFrame()
-/// so that we have the best chance of finding any previous frames that
-/// have progressed entirely thorough the GPU pipeline.
-/// The callback is passed the identifier of the frame that
-/// has been completed (see getCurrentFrameIdentifier()).
-/// @param f The callback
-void registerFrameCompleteCallback( std::function<void(unsigned)> f);
+/// Return true if a frame has completely finished on the GPU, so
+/// resources it used can be reused. This reflects the GPU's progress
+/// as of the last beginFrame() (or waitForAllFrames()); it does not
+/// ask the GPU again. Resources are normally retired with a RetireQueue,
+/// which calls this.
+/// @param frameIdentifier The frame (see getCurrentFrameIdentifier())
+/// @return True if the frame is complete
+bool isFrameComplete(unsigned frameIdentifier);
 
 /// Get a unique identifier for the current frame. This eventually
 /// wraps after approximately 4.2 billion frames have been rendered.
-/// This identifier is used in the registerFrameCallback() callback.
+/// This identifier is used by isFrameComplete().
 /// This function may only be called between beginFrame() and endFrame().
 /// @return The frame identifier.
 unsigned getCurrentFrameIdentifier();
@@ -72,6 +72,18 @@ VkResult vkGetFenceStatus(VkDevice device, VkFence fence ){
   if(!_impl_vkGetFenceStatus) _needLoad(); 
   return _impl_vkGetFenceStatus(device,fence);
 }
+static PFN_vkGetSemaphoreCounterValueKHR _impl_vkGetSemaphoreCounterValueKHR;
+VkResult vkGetSemaphoreCounterValueKHR(VkDevice device, VkSemaphore semaphore, uint64_t* 
+        pValue ){
+  if(!_impl_vkGetSemaphoreCounterValueKHR) _needLoad(); 
+  return _impl_vkGetSemaphoreCounterValueKHR(device,semaphore,pValue);
+}
+static PFN_vkWaitSemaphoresKHR _impl_vkWaitSemaphoresKHR;
+VkResult vkWaitSemaphoresKHR(VkDevice device, const VkSemaphoreWaitInfo* pWaitInfo, 
+        uint64_t timeout ){
+  if(!_impl_vkWaitSemaphoresKHR) _needLoad(); 
+  return _impl_vkWaitSemaphoresKHR(device,pWaitInfo,timeout);
+}
 static PFN_vkCreateCommandPool _impl_vkCreateCommandPool;
 VkResult vkCreateCommandPool(VkDevice device, const VkCommandPoolCreateInfo* pCreateInfo, 
         const VkAllocationCallbacks* pAllocator, VkCommandPool* pCommandPool ){
@@ -230,6 +242,12 @@ void vkGetPhysicalDeviceFormatProperties(VkPhysicalDevice physicalDevice, VkForm
   if(!_impl_vkGetPhysicalDeviceFormatProperties) _needLoad(); 
   _impl_vkGetPhysicalDeviceFormatProperties(physicalDevice,format,pFormatProperties);
 }
+static PFN_vkGetPhysicalDeviceFeatures2KHR _impl_vkGetPhysicalDeviceFeatures2KHR;
+void vkGetPhysicalDeviceFeatures2KHR(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures2* 
+        pFeatures ){
+  if(!_impl_vkGetPhysicalDeviceFeatures2KHR) _needLoad(); 
+  _impl_vkGetPhysicalDeviceFeatures2KHR(physicalDevice,pFeatures);
+}
 static PFN_vkGetPhysicalDeviceFeatures _impl_vkGetPhysicalDeviceFeatures;
 void vkGetPhysicalDeviceFeatures(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures* 
         pFeatures ){
@@ -476,6 +494,25 @@ void vkDestroyDescriptorPool(VkDevice device, VkDescriptorPool descriptorPool, c
   if(!_impl_vkDestroyDescriptorPool) _needLoad(); 
   _impl_vkDestroyDescriptorPool(device,descriptorPool,pAllocator);
 }
+static PFN_vkCreateDescriptorUpdateTemplateKHR _impl_vkCreateDescriptorUpdateTemplateKHR;
+VkResult vkCreateDescriptorUpdateTemplateKHR(VkDevice device, const 
+        VkDescriptorUpdateTemplateCreateInfo* pCreateInfo, const VkAllocationCallbacks* 
+        pAllocator, VkDescriptorUpdateTemplate* pDescriptorUpdateTemplate ){
+  if(!_impl_vkCreateDescriptorUpdateTemplateKHR) _needLoad(); 
+  return _impl_vkCreateDescriptorUpdateTemplateKHR(device,pCreateInfo,pAllocator,pDescriptorUpdateTemplate);
+}
+static PFN_vkDestroyDescriptorUpdateTemplateKHR _impl_vkDestroyDescriptorUpdateTemplateKHR;
+void vkDestroyDescriptorUpdateTemplateKHR(VkDevice device, VkDescriptorUpdateTemplate 
+        descriptorUpdateTemplate, const VkAllocationCallbacks* pAllocator ){
+  if(!_impl_vkDestroyDescriptorUpdateTemplateKHR) _needLoad(); 
+  _impl_vkDestroyDescriptorUpdateTemplateKHR(device,descriptorUpdateTemplate,pAllocator);
+}
+static PFN_vkUpdateDescriptorSetWithTemplateKHR _impl_vkUpdateDescriptorSetWithTemplateKHR;
+void vkUpdateDescriptorSetWithTemplateKHR(VkDevice device, VkDescriptorSet descriptorSet, 
+        VkDescriptorUpdateTemplate descriptorUpdateTemplate, const void* pData ){
+  if(!_impl_vkUpdateDescriptorSetWithTemplateKHR) _needLoad(); 
+  _impl_vkUpdateDescriptorSetWithTemplateKHR(device,descriptorSet,descriptorUpdateTemplate,pData);
+}
 static PFN_vkCreateFramebuffer _impl_vkCreateFramebuffer;
 VkResult vkCreateFramebuffer(VkDevice device, const VkFramebufferCreateInfo* pCreateInfo, 
         const VkAllocationCallbacks* pAllocator, VkFramebuffer* pFramebuffer ){
@@ -1266,6 +1303,13 @@ VkResult vkCreateDescriptorPool(VkDevice device, const VkDescriptorPoolCreateInf
     pCreateInfo_copy.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     return vkCreateDescriptorPool(device,&pCreateInfo_copy,pAllocator,pDescriptorPool);
 }
+VkResult vkCreateDescriptorUpdateTemplateKHR(VkDevice device, const 
+        VkDescriptorUpdateTemplateCreateInfo& pCreateInfo, const VkAllocationCallbacks* 
+        pAllocator, VkDescriptorUpdateTemplate* pDescriptorUpdateTemplate ){
+    auto pCreateInfo_copy = pCreateInfo;
+    pCreateInfo_copy.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+    return vkCreateDescriptorUpdateTemplateKHR(device,&pCreateInfo_copy,pAllocator,pDescriptorUpdateTemplate);
+}
 VkResult vkQueueBindSparse(VkQueue queue, uint32_t bindInfoCount, const VkBindSparseInfo& 
         pBindInfo, VkFence fence ){
     auto pBindInfo_copy = pBindInfo;
@@ -2205,6 +2249,10 @@ void loadAllVulkanFunctions(VkInstance instance)
     _impl_vkCmdDraw = (PFN_vkCmdDraw) loadVulkanFunction(instance, "vkCmdDraw");
     _impl_vkGetFenceStatus = (PFN_vkGetFenceStatus) loadVulkanFunction(instance, 
         "vkGetFenceStatus");
+    _impl_vkGetSemaphoreCounterValueKHR = (PFN_vkGetSemaphoreCounterValueKHR) loadVulkanFunction(instance, 
+        "vkGetSemaphoreCounterValueKHR");
+    _impl_vkWaitSemaphoresKHR = (PFN_vkWaitSemaphoresKHR) loadVulkanFunction(instance, 
+        "vkWaitSemaphoresKHR");
     _impl_vkCreateCommandPool = (PFN_vkCreateCommandPool) loadVulkanFunction(instance, 
         "vkCreateCommandPool");
     _impl_vkGetImageMemoryRequirements = (PFN_vkGetImageMemoryRequirements) loadVulkanFunction(instance, 
@@ -2251,6 +2299,14 @@ void loadAllVulkanFunctions(VkInstance instance)
         "vkCmdCopyQueryPoolResults");
     _impl_vkGetPhysicalDeviceFormatProperties = (PFN_vkGetPhysicalDeviceFormatProperties) 
         loadVulkanFunction(instance, "vkGetPhysicalDeviceFormatProperties");
+    _impl_vkGetPhysicalDeviceFeatures2KHR = (PFN_vkGetPhysicalDeviceFeatures2KHR) loadVulkanFunction(instance, 
+        "vkGetPhysicalDeviceFeatures2KHR");
+    _impl_vkCreateDescriptorUpdateTemplateKHR = (PFN_vkCreateDescriptorUpdateTemplateKHR) 
+        loadVulkanFunction(instance, "vkCreateDescriptorUpdateTemplateKHR");
+    _impl_vkDestroyDescriptorUpdateTemplateKHR = (PFN_vkDestroyDescriptorUpdateTemplateKHR) 
+        loadVulkanFunction(instance, "vkDestroyDescriptorUpdateTemplateKHR");
+    _impl_vkUpdateDescriptorSetWithTemplateKHR = (PFN_vkUpdateDescriptorSetWithTemplateKHR) 
+        loadVulkanFunction(instance, "vkUpdateDescriptorSetWithTemplateKHR");
     _impl_vkGetPhysicalDeviceFeatures = (PFN_vkGetPhysicalDeviceFeatures) loadVulkanFunction(instance, 
         "vkGetPhysicalDeviceFeatures");
     _impl_vkQueueSubmit = (PFN_vkQueueSubmit) loadVulkanFunction(instance, "vkQueueSubmit");
@@ -26,6 +26,10 @@ void vkSubmitDebugUtilsMessageEXT(VkInstance instance, VkDebugUtilsMessageSeveri
 void vkCmdDraw(VkCommandBuffer commandBuffer, uint32_t vertexCount, uint32_t instanceCount, 
         uint32_t firstVertex, uint32_t firstInstance );
 VkResult vkGetFenceStatus(VkDevice device, VkFence fence );
+VkResult vkGetSemaphoreCounterValueKHR(VkDevice device, VkSemaphore semaphore, uint64_t* 
+        pValue );
+VkResult vkWaitSemaphoresKHR(VkDevice device, const VkSemaphoreWaitInfo* pWaitInfo, 
+        uint64_t timeout );
 VkResult vkCreateCommandPool(VkDevice device, const VkCommandPoolCreateInfo* pCreateInfo, 
         const VkAllocationCallbacks* pAllocator, VkCommandPool* pCommandPool );
 void vkGetImageMemoryRequirements(VkDevice device, VkImage image, VkMemoryRequirements* 
@@ -80,6 +84,8 @@ void vkCmdCopyQueryPoolResults(VkCommandBuffer commandBuffer, VkQueryPool queryP
         dstOffset, VkDeviceSize stride, VkQueryResultFlags flags );
 void vkGetPhysicalDeviceFormatProperties(VkPhysicalDevice physicalDevice, VkFormat 
         format, VkFormatProperties* pFormatProperties );
+void vkGetPhysicalDeviceFeatures2KHR(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures2* 
+        pFeatures );
 void vkGetPhysicalDeviceFeatures(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures* 
         pFeatures );
 VkResult vkQueueSubmit(VkQueue queue, uint32_t submitCount, const VkSubmitInfo* pSubmits, 
@@ -166,6 +172,13 @@ VkResult vkCreateShaderModule(VkDevice device, const VkShaderModuleCreateInfo* p
         const VkAllocationCallbacks* pAllocator, VkShaderModule* pShaderModule );
 void vkDestroyDescriptorPool(VkDevice device, VkDescriptorPool descriptorPool, const 
         VkAllocationCallbacks* pAllocator );
+VkResult vkCreateDescriptorUpdateTemplateKHR(VkDevice device, const 
+        VkDescriptorUpdateTemplateCreateInfo* pCreateInfo, const VkAllocationCallbacks* 
+        pAllocator, VkDescriptorUpdateTemplate* pDescriptorUpdateTemplate );
+void vkDestroyDescriptorUpdateTemplateKHR(VkDevice device, VkDescriptorUpdateTemplate 
+        descriptorUpdateTemplate, const VkAllocationCallbacks* pAllocator );
+void vkUpdateDescriptorSetWithTemplateKHR(VkDevice device, VkDescriptorSet descriptorSet, 
+        VkDescriptorUpdateTemplate descriptorUpdateTemplate, const void* pData );
 VkResult vkCreateFramebuffer(VkDevice device, const VkFramebufferCreateInfo* pCreateInfo, 
         const VkAllocationCallbacks* pAllocator, VkFramebuffer* pFramebuffer );
 void vkQueueInsertDebugUtilsLabelEXT(VkQueue queue, const VkDebugUtilsLabelEXT* pLabelInfo 
@@ -447,6 +460,9 @@ void vkCmdBlitImage(VkCommandBuffer commandBuffer, VkImage srcImage, VkImageLayo
 VkResult vkCreateDescriptorPool(VkDevice device, const VkDescriptorPoolCreateInfo& 
         pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDescriptorPool* pDescriptorPool 
         );
+VkResult vkCreateDescriptorUpdateTemplateKHR(VkDevice device, const 
+        VkDescriptorUpdateTemplateCreateInfo& pCreateInfo, const VkAllocationCallbacks* 
+        pAllocator, VkDescriptorUpdateTemplate* pDescriptorUpdateTemplate );
 VkResult vkQueueBindSparse(VkQueue queue, uint32_t bindInfoCount, const VkBindSparseInfo& 
         pBindInfo, VkFence fence );
 VkResult vkFlushMappedMemoryRanges(VkDevice device, uint32_t memoryRangeCount, const 
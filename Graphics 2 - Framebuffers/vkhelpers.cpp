@@ -3,6 +3,7 @@
 #include "platform.h"
 #include "imageencode.h"
 #include "consoleoutput.h"
+#include "GPUProfiler.h"
 #include <SDL.h>
 #include <SDL_vulkan.h>
 #include <sstream>
@@ -62,6 +63,10 @@ static std::tuple<
 //~ static bool _printPerformance=true;
 static bool _printLoader=false;
 
+//true if the instance has VK_KHR_get_physical_device_properties2,
+//which is needed to ask about extension features
+static bool _haveProperties2=false;
+
 
 template<typename ...T>
 void _shader(T... args)
@@ -209,6 +214,23 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL _debugCallback(
 VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresToEnable,
         int numSubpasses): config("config.ini")
 {
+    int clientWidth;
+    int clientHeight;
+    SDL_GetWindowSize(win,&clientWidth,&clientHeight);
+    this->initialize(win,clientWidth,clientHeight,featuresToEnable,numSubpasses);
+}
+
+VulkanContext::VulkanContext(int width_, int height_, VkPhysicalDeviceFeatures featuresToEnable,
+        int numSubpasses): config("config.ini")
+{
+    this->initialize(nullptr,width_,height_,featuresToEnable,numSubpasses);
+}
+
+void VulkanContext::initialize(SDL_Window* win, int clientWidth, int clientHeight,
+        VkPhysicalDeviceFeatures featuresToEnable, int numSubpasses)
+{
+    this->headless = (win == nullptr);
+
     bool withShaderPrintf=(this->config.get("shaderPrintf","yes") != "no");
     bool withDebugPrint=(this->config.get("debugPrint","yes") != "no");
     bool withGPUValidation=(this->config.get("gpuValidation","no") != "no");
@@ -228,6 +250,10 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
     bool useValidation = (this->config.get("useValidation","yes") != "no");
     bool useDebugUtils = (this->config.get("useDebugUtils","yes") != "no");
 
+    this->framesInFlight = std::stoi(this->config.get("framesInFlight","2"));
+    if( this->framesInFlight < 1 || this->framesInFlight > 8 )
+        throw std::runtime_error("config file: framesInFlight must be between 1 and 8");
+
     auto pmode = this->config.get("presentMode","VK_PRESENT_MODE_FIFO_KHR");
     std::map<std::string, VkPresentModeKHR> presentModes={ 
         { "VK_PRESENT_MODE_IMMEDIATE_KHR"   , VK_PRESENT_MODE_IMMEDIATE_KHR     },
@@ -243,9 +269,6 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
         
     auto compiler = this->config.get("shadercompiler","glslangValidator");
     
-    int clientWidth;
-    int clientHeight;
-    SDL_GetWindowSize(win,&clientWidth,&clientHeight);
     this->width=clientWidth;
     this->height=clientHeight;
     
@@ -289,7 +312,8 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
         this->messenger = nullptr;
     }
         
-    if(!SDL_Vulkan_CreateSurface(win,this->instance,&(this->surface))){
+    this->surface = VK_NULL_HANDLE;
+    if(!this->headless && !SDL_Vulkan_CreateSurface(win,this->instance,&(this->surface))){
         throw std::runtime_error("Cannot create SDL VK surface");
     }
      
@@ -323,7 +347,8 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
     vkEnumerateDeviceExtensionProperties(this->physdev,nullptr,&(ecount),eprops.data());
     
     std::vector<const char*> extensionNames;
-    extensionNames.push_back( VK_KHR_SWAPCHAIN_EXTENSION_NAME );
+    if(!this->headless)
+        extensionNames.push_back( VK_KHR_SWAPCHAIN_EXTENSION_NAME );
     
             
     //ref: https://stackoverflow.com/questions/68575596/using-debugprintfext-in-vulkan
@@ -333,6 +358,81 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
             extensionNames.push_back(VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME);
         }
     }
+
+    //frames are retired with a timeline semaphore if we have one;
+    //otherwise utils falls back to one fence per frame slot
+    this->haveTimelineSemaphores = false;
+    if( this->config.get("timelineSemaphore","yes") != "no" ){
+        for(unsigned i=0;i<ecount;++i){
+            if(eprops[i].extensionName == std::string(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)){
+                extensionNames.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+                this->haveTimelineSemaphores = true;
+            }
+        }
+    }
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+        .pNext = nullptr,
+        .timelineSemaphore = VK_TRUE
+    };
+    void* featureChain = nullptr;
+    if( this->haveTimelineSemaphores ){
+        featureChain = &timelineFeatures;
+    }
+
+    //DescriptorSet writes descriptors with update templates if it can
+    this->haveDescriptorUpdateTemplates = false;
+    if( this->config.get("descriptorUpdateTemplates","yes") != "no" ){
+        for(unsigned i=0;i<ecount;++i){
+            if(eprops[i].extensionName == std::string(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME)){
+                extensionNames.push_back(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+                this->haveDescriptorUpdateTemplates = true;
+            }
+        }
+    }
+
+    //bindless textures need a runtime sized, partially bound array
+    //of images that is indexed with nonuniformEXT
+    this->haveDescriptorIndexing = false;
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    if( _haveProperties2 && this->config.get("bindlessTextures","yes") != "no" ){
+        bool haveIndexing=false, haveMaintenance3=false;
+        for(unsigned i=0;i<ecount;++i){
+            if(eprops[i].extensionName == std::string(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+                haveIndexing=true;
+            if(eprops[i].extensionName == std::string(VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+                haveMaintenance3=true;
+        }
+        if( haveIndexing && haveMaintenance3 ){
+            VkPhysicalDeviceFeatures2 f2{
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR,
+                .pNext = &indexingFeatures,
+                .features = {}
+            };
+            vkGetPhysicalDeviceFeatures2KHR(this->physdev, &f2);
+            if( indexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+                    indexingFeatures.runtimeDescriptorArray &&
+                    indexingFeatures.descriptorBindingPartiallyBound ){
+                this->haveDescriptorIndexing = true;
+            }
+        }
+        if( !this->haveDescriptorIndexing ){
+            info("Descriptor indexing is not available; not using bindless textures");
+        }
+    }
+    if( this->haveDescriptorIndexing ){
+        extensionNames.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        extensionNames.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        //enable only what we use
+        indexingFeatures = VkPhysicalDeviceDescriptorIndexingFeaturesEXT{};
+        indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        indexingFeatures.pNext = featureChain;
+        indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+        indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        featureChain = &indexingFeatures;
+    }
             
     std::vector<const char*> extensionNameArray(extensionNames.size());
     for(std::size_t i=0;i<extensionNames.size();++i){
@@ -340,6 +440,26 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
     }
     unsigned extensionCount = unsigned(extensionNames.size());
     
+    //uploads go to a transfer-only queue family if the device has one
+    //(typically a DMA engine on discrete GPUs); otherwise they
+    //share the graphics queue
+    this->transferQueueIndex = this->graphicsQueueIndex;
+    if( this->config.get("useTransferQueue","yes") != "no" ){
+        std::uint32_t qcount;
+        vkGetPhysicalDeviceQueueFamilyProperties(this->physdev,&(qcount),nullptr);
+        std::vector<VkQueueFamilyProperties> qfamilies(qcount);
+        vkGetPhysicalDeviceQueueFamilyProperties(this->physdev,&(qcount),qfamilies.data());
+        for(unsigned i=0;i<qcount;++i){
+            auto flags = qfamilies[i].queueFlags;
+            if( qfamilies[i].queueCount != 0 && (flags & VK_QUEUE_TRANSFER_BIT) &&
+                    0 == (flags & (VK_QUEUE_GRAPHICS_BIT|VK_QUEUE_COMPUTE_BIT)) ){
+                this->transferQueueIndex = i;
+                verbose("Using dedicated transfer queue family",i);
+                break;
+            }
+        }
+    }
+
     float priorities[1] = {1.0};
     std::vector<VkDeviceQueueCreateInfo> pQueueCreateInfos{
         {
@@ -349,23 +469,40 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
             .queueFamilyIndex=this->graphicsQueueIndex,
             .queueCount = 1,
             .pQueuePriorities = priorities
-        },
-        {
-            .sType=VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .pNext=nullptr,
-            .flags=0,
-            .queueFamilyIndex=this->presentQueueIndex,
-            .queueCount = 1,
-            .pQueuePriorities = priorities
         }
     };
+    if( this->presentQueueIndex != this->graphicsQueueIndex ){
+        pQueueCreateInfos.push_back(
+            VkDeviceQueueCreateInfo{
+                .sType=VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .pNext=nullptr,
+                .flags=0,
+                .queueFamilyIndex=this->presentQueueIndex,
+                .queueCount = 1,
+                .pQueuePriorities = priorities
+            }
+        );
+    }
+    if( this->transferQueueIndex != this->graphicsQueueIndex &&
+            this->transferQueueIndex != this->presentQueueIndex ){
+        pQueueCreateInfos.push_back(
+            VkDeviceQueueCreateInfo{
+                .sType=VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .pNext=nullptr,
+                .flags=0,
+                .queueFamilyIndex=this->transferQueueIndex,
+                .queueCount = 1,
+                .pQueuePriorities = priorities
+            }
+        );
+    }
        
        
     VkDeviceCreateInfo dci = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .pNext = nullptr,
+        .pNext = featureChain,
         .flags = 0,
-        .queueCreateInfoCount = (unsigned)( (this->graphicsQueueIndex == this->presentQueueIndex) ? 1 : 2 ),
+        .queueCreateInfoCount = (unsigned)pQueueCreateInfos.size(),
         .pQueueCreateInfos = pQueueCreateInfos.data(),
         .enabledLayerCount = 0,
         .ppEnabledLayerNames = nullptr,
@@ -385,75 +522,85 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
     
     this->presentQueue = VkQueue();
     vkGetDeviceQueue( this->dev, this->presentQueueIndex, 0, &(this->presentQueue));
+
+    this->transferQueue = VkQueue();
+    vkGetDeviceQueue( this->dev, this->transferQueueIndex, 0, &(this->transferQueue));
     
-    VkSurfaceCapabilitiesKHR surfCaps;
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(this->physdev,
-        this->surface,&(surfCaps));
-    
-    //the device wants us to create at least minImageCount images...
-    auto imageCount = surfCaps.minImageCount;
-    
-    //...but if we create an extra buffer, we get better performance
-    //We check to make sure the implementation would allow that.
-    if(surfCaps.maxImageCount == 0 or surfCaps.maxImageCount > surfCaps.minImageCount){
-        imageCount += 1;
+    this->swapchain = VK_NULL_HANDLE;
+    if(this->headless){
+        //no swapchain: offscreen Framebuffers get one image
+        //per frame slot instead of one per swapchain image
+        this->numSwapchainImages = this->framesInFlight;
+    } else {
+        VkSurfaceCapabilitiesKHR surfCaps;
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(this->physdev,
+            this->surface,&(surfCaps));
+
+        //the device wants us to create at least minImageCount images...
+        auto imageCount = surfCaps.minImageCount;
+
+        //...but if we create an extra buffer, we get better performance
+        //We check to make sure the implementation would allow that.
+        if(surfCaps.maxImageCount == 0 or surfCaps.maxImageCount > surfCaps.minImageCount){
+            imageCount += 1;
+        }
+
+        VkSwapchainCreateInfoKHR swapchainCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+            .pNext=nullptr,
+            .flags=0,
+            .surface = this->surface,
+            .minImageCount = imageCount,
+            .imageFormat = this->surfaceFormat.format,
+            .imageColorSpace = this->surfaceFormat.colorSpace,
+            .imageExtent = VkExtent2D{
+                .width=unsigned(clientWidth),
+                .height=unsigned(clientHeight)
+            },
+            .imageArrayLayers = 1,
+            .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT|VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            .imageSharingMode=(
+                (this->graphicsQueueIndex == this->presentQueueIndex) ? 
+                    VK_SHARING_MODE_EXCLUSIVE  :
+                    VK_SHARING_MODE_CONCURRENT
+            ),
+            .queueFamilyIndexCount=(
+                (this->graphicsQueueIndex == this->presentQueueIndex) ?
+                    std::uint32_t(0) : std::uint32_t(2)
+            ),
+            .pQueueFamilyIndices=(
+                (this->graphicsQueueIndex == this->presentQueueIndex) ?
+                nullptr : &presentQueueIndex
+            ),
+            .preTransform = surfCaps.currentTransform,
+            .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+            .presentMode = presentMode,
+            .clipped = VK_TRUE,
+            .oldSwapchain = VK_NULL_HANDLE
+        };
+
+        check(vkCreateSwapchainKHR(this->dev, &swapchainCreateInfo, 
+            nullptr, &this->swapchain)
+        );
+
+
+        //get number of images
+        std::uint32_t swapchainImageCount;
+        vkGetSwapchainImagesKHR(this->dev,this->swapchain,
+            &(swapchainImageCount),nullptr);
+
+        //and then allocate the images themselves
+        this->swapchainImages.resize(swapchainImageCount);
+        this->numSwapchainImages = int(this->swapchainImages.size());
+        check(vkGetSwapchainImagesKHR(
+            this->dev,
+            this->swapchain,
+            &(swapchainImageCount),
+            this->swapchainImages.data()
+        ));
+
+        this->numSwapchainImages = swapchainImageCount;
     }
-    
-    VkSwapchainCreateInfoKHR swapchainCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-        .pNext=nullptr,
-        .flags=0,
-        .surface = this->surface,
-        .minImageCount = imageCount,
-        .imageFormat = this->surfaceFormat.format,
-        .imageColorSpace = this->surfaceFormat.colorSpace,
-        .imageExtent = VkExtent2D{
-            .width=unsigned(clientWidth),
-            .height=unsigned(clientHeight)
-        },
-        .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT|VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-        .imageSharingMode=(
-            (this->graphicsQueueIndex == this->presentQueueIndex) ? 
-                VK_SHARING_MODE_EXCLUSIVE  :
-                VK_SHARING_MODE_CONCURRENT
-        ),
-        .queueFamilyIndexCount=(
-            (this->graphicsQueueIndex == this->presentQueueIndex) ?
-                std::uint32_t(0) : std::uint32_t(2)
-        ),
-        .pQueueFamilyIndices=(
-            (this->graphicsQueueIndex == this->presentQueueIndex) ?
-            nullptr : &presentQueueIndex
-        ),
-        .preTransform = surfCaps.currentTransform,
-        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-        .presentMode = presentMode,
-        .clipped = VK_TRUE,
-        .oldSwapchain = VK_NULL_HANDLE
-    };
-        
-    check(vkCreateSwapchainKHR(this->dev, &swapchainCreateInfo, 
-        nullptr, &this->swapchain)
-    );
-     
-    
-    //get number of images
-    std::uint32_t swapchainImageCount;
-    vkGetSwapchainImagesKHR(this->dev,this->swapchain,
-        &(swapchainImageCount),nullptr);
-    
-    //and then allocate the images themselves
-    this->swapchainImages.resize(swapchainImageCount);
-    this->numSwapchainImages = int(this->swapchainImages.size());
-    check(vkGetSwapchainImagesKHR(
-        this->dev,
-        this->swapchain,
-        &(swapchainImageCount),
-        this->swapchainImages.data()
-    ));
-    
-    this->numSwapchainImages = swapchainImageCount;
 
     //vk spec says that implementation must support at least one of
     //VK_FORMAT_D24_UNORM_S8_UINT or VK_FORMAT_D32_SFLOAT_S8_UINT
@@ -533,8 +680,14 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
         .pNext = nullptr,
         .flags=0
     };
-    check(vkCreateSemaphore(this->dev,&(seminfo),nullptr,&(this->imageAcquiredSemaphore)));
-    check(vkCreateSemaphore(this->dev,&(seminfo),nullptr,&(this->renderCompleteSemaphore)));
+    this->imageAcquiredSemaphores.resize(this->framesInFlight);
+    this->renderCompleteSemaphores.resize(this->framesInFlight);
+    for(int i=0;i<this->framesInFlight;++i){
+        check(vkCreateSemaphore(this->dev,&(seminfo),nullptr,&(this->imageAcquiredSemaphores[i])));
+        check(vkCreateSemaphore(this->dev,&(seminfo),nullptr,&(this->renderCompleteSemaphores[i])));
+        this->setObjectName(this->imageAcquiredSemaphores[i],"imageAcquiredSemaphore["+std::to_string(i)+"]");
+        this->setObjectName(this->renderCompleteSemaphores[i],"renderCompleteSemaphore["+std::to_string(i)+"]");
+    }
     
     check(vkAllocateCommandBuffers(
         this->dev, 
@@ -608,7 +761,8 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
             .stencilLoadOp=VK_ATTACHMENT_LOAD_OP_LOAD,
             .stencilStoreOp=VK_ATTACHMENT_STORE_OP_STORE,
             .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            //PRESENT_SRC requires the swapchain extension
+            .finalLayout = (this->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR),
         },
         {
             .flags=0,
@@ -676,6 +830,8 @@ VulkanContext::VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresT
     
 std::tuple<int,int,std::string,std::vector<char> >  VulkanContext::screenshot(int imageIndex)
 {
+    if(this->headless)
+        throw std::runtime_error("Cannot take a screenshot of the window: There is no window in headless mode");
     auto simg = this->swapchainImages[imageIndex];
     return this->screenshot(simg);
 }
@@ -1045,6 +1201,7 @@ void VulkanContext::insertQueueLabel(std::string text, VkQueue queue)
 
 void VulkanContext::beginCmdRegion(VkCommandBuffer cmd, std::string text)
 {
+    GPUProfiler::beginRegion(cmd,text);
     if(! this->haveDebugUtils ){
         return;
     }
@@ -1061,6 +1218,7 @@ void VulkanContext::beginCmdRegion(VkCommandBuffer cmd, std::string text)
 
 void VulkanContext::endCmdRegion(VkCommandBuffer cmd)
 {
+    GPUProfiler::endRegion(cmd);
     if(!this->haveDebugUtils)
         return;
     vkCmdEndDebugUtilsLabelEXT(cmd);
@@ -1095,7 +1253,10 @@ std::array<int,2> getGraphicsAndPresentQueues(VkPhysicalDevice physdev, VkSurfac
         if(graphicsQueueIndex == -1 && qfamilies[i].queueCount != 0 && 0 != (VK_QUEUE_GRAPHICS_BIT & qfamilies[i].queueFlags) && 0 != (VK_QUEUE_COMPUTE_BIT & qfamilies[i].queueFlags)){
             graphicsQueueIndex = i;
         }
-        if(presentQueueIndex == -1){
+        if(presentQueueIndex == -1 && surf == VK_NULL_HANDLE){
+            //headless: nothing is presented; use the graphics queue
+            presentQueueIndex = graphicsQueueIndex;
+        } else if(presentQueueIndex == -1){
             VkBool32 presentIsSupported;
             check(vkGetPhysicalDeviceSurfaceSupportKHR(physdev,i,surf,&(presentIsSupported)));
             if(presentIsSupported){
@@ -1176,45 +1337,53 @@ static std::tuple<
             }
         }
 
-            
-        if(!hasSwapchain){
-            continue;
-        }
-         
-        VkSurfaceCapabilitiesKHR surfCaps;
-        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physdev,surf,&(surfCaps));
-        
-        std::uint32_t surffmtcount; 
-        vkGetPhysicalDeviceSurfaceFormatsKHR(physdev,surf,&(surffmtcount),nullptr);
+        //headless: there is no surface to check; use the
+        //format that offscreen rendering and screenshots use
+        VkSurfaceFormatKHR surfFormat{
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR
+        };
 
-        if(surffmtcount == 0){
-            continue;        //not suitable
-        }
-        std::vector<VkSurfaceFormatKHR> surffmts(surffmtcount);
-        vkGetPhysicalDeviceSurfaceFormatsKHR(physdev,surf,&(surffmtcount),surffmts.data());
+        if( surf != VK_NULL_HANDLE ){
+            if(!hasSwapchain){
+                continue;
+            }
 
+            VkSurfaceCapabilitiesKHR surfCaps;
+            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physdev,surf,&(surfCaps));
 
-        //use first format; usually sufficient for our purposes
-        auto surfFormat = surffmts[0];
-       
-        std::uint32_t surfpresentcount;
-        vkGetPhysicalDeviceSurfacePresentModesKHR(physdev,surf,&(surfpresentcount),nullptr);
+            std::uint32_t surffmtcount; 
+            vkGetPhysicalDeviceSurfaceFormatsKHR(physdev,surf,&(surffmtcount),nullptr);
+
+            if(surffmtcount == 0){
+                continue;        //not suitable
+            }
+            std::vector<VkSurfaceFormatKHR> surffmts(surffmtcount);
+            vkGetPhysicalDeviceSurfaceFormatsKHR(physdev,surf,&(surffmtcount),surffmts.data());
 
 
-        if(surfpresentcount == 0){
-            continue;        //not suitable
-        }
-        
-        std::vector<VkPresentModeKHR> surfpresents(surfpresentcount);
-        vkGetPhysicalDeviceSurfacePresentModesKHR(physdev,surf,
-            &(surfpresentcount), surfpresents.data());
-            
-            
-        //VK_PRESENT_MODE_FIFO_KHR is guaranteed to always be supported; syncs to vblank
-        //use VK_PRESENT_MODE_MAILBOX_KHR to do triple buffering
-        //or VK_PRESENT_MODE_IMMEDIATE_KHR to go as fast as possible
-        if( std::find( surfpresents.begin(),surfpresents.end(), VK_PRESENT_MODE_FIFO_KHR) == surfpresents.end() ){
-            throw std::runtime_error("This implementation doesn't support a required present mode");
+            //use first format; usually sufficient for our purposes
+            surfFormat = surffmts[0];
+
+            std::uint32_t surfpresentcount;
+            vkGetPhysicalDeviceSurfacePresentModesKHR(physdev,surf,&(surfpresentcount),nullptr);
+
+
+            if(surfpresentcount == 0){
+                continue;        //not suitable
+            }
+
+            std::vector<VkPresentModeKHR> surfpresents(surfpresentcount);
+            vkGetPhysicalDeviceSurfacePresentModesKHR(physdev,surf,
+                &(surfpresentcount), surfpresents.data());
+
+
+            //VK_PRESENT_MODE_FIFO_KHR is guaranteed to always be supported; syncs to vblank
+            //use VK_PRESENT_MODE_MAILBOX_KHR to do triple buffering
+            //or VK_PRESENT_MODE_IMMEDIATE_KHR to go as fast as possible
+            if( std::find( surfpresents.begin(),surfpresents.end(), VK_PRESENT_MODE_FIFO_KHR) == surfpresents.end() ){
+                throw std::runtime_error("This implementation doesn't support a required present mode");
+            }
         }
 
         std::uint32_t count;
@@ -1335,15 +1504,21 @@ void VulkanContext::cleanup(){
     for( auto&  view : this->depthbufferViews){
         vkDestroyImageView(this->dev,view,nullptr);
     }
-    vkDestroySemaphore(this->dev,this->renderCompleteSemaphore,nullptr);
-    vkDestroySemaphore(this->dev,this->imageAcquiredSemaphore,nullptr);
+    for( auto& sem : this->renderCompleteSemaphores){
+        vkDestroySemaphore(this->dev,sem,nullptr);
+    }
+    for( auto& sem : this->imageAcquiredSemaphores){
+        vkDestroySemaphore(this->dev,sem,nullptr);
+    }
     vkDestroyCommandPool(this->dev,this->commandPool,nullptr);
     for( auto&  view : this->swapchainImageViews){
         vkDestroyImageView(this->dev,view,nullptr);
     }
-    vkDestroySwapchainKHR(this->dev,this->swapchain,nullptr);
+    if(this->swapchain != VK_NULL_HANDLE)
+        vkDestroySwapchainKHR(this->dev,this->swapchain,nullptr);
     vkDestroyDevice(this->dev,nullptr);
-    vkDestroySurfaceKHR(this->instance,this->surface,nullptr);
+    if(this->surface != VK_NULL_HANDLE)
+        vkDestroySurfaceKHR(this->instance,this->surface,nullptr);
     if(this->messenger != nullptr){
         vkDestroyDebugUtilsMessengerEXT(this->instance,this->messenger,nullptr);
     }
@@ -1454,16 +1629,20 @@ static std::tuple<VkInstance,bool>  _makeInstance(SDL_Window* win,
     loadSpecialVulkanFunctions();
  
     std::uint32_t count;
-    if( SDL_TRUE != SDL_Vulkan_GetInstanceExtensions(win,&(count),nullptr)){
-        throw std::runtime_error("Cannot get Vulkan instance extensions");
-    }
-    auto requiredExtensionCount = count;
-    std::vector<const char*> requiredExtensions(requiredExtensionCount);
-    SDL_Vulkan_GetInstanceExtensions(win,&(count),requiredExtensions.data());
-
     std::vector<std::string> extensionNames;
-    for(unsigned i=0;i<requiredExtensionCount;++i){
-        extensionNames.push_back(requiredExtensions[i]);
+
+    //headless: no surface extensions are needed
+    if( win ){
+        if( SDL_TRUE != SDL_Vulkan_GetInstanceExtensions(win,&(count),nullptr)){
+            throw std::runtime_error("Cannot get Vulkan instance extensions");
+        }
+        auto requiredExtensionCount = count;
+        std::vector<const char*> requiredExtensions(requiredExtensionCount);
+        SDL_Vulkan_GetInstanceExtensions(win,&(count),requiredExtensions.data());
+
+        for(unsigned i=0;i<requiredExtensionCount;++i){
+            extensionNames.push_back(requiredExtensions[i]);
+        }
     }
 
     
@@ -1505,6 +1684,14 @@ static std::tuple<VkInstance,bool>  _makeInstance(SDL_Window* win,
     std::vector<VkExtensionProperties> extensionInfo(numExtensions);
     check(vkEnumerateInstanceExtensionProperties(nullptr, &(count), extensionInfo.data()));
 
+    _haveProperties2=false;
+    for(unsigned i=0;i<numExtensions;++i){
+        if(extensionInfo[i].extensionName == std::string(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)){
+            extensionNames.push_back(extensionInfo[i].extensionName);
+            _haveProperties2=true;
+        }
+    }
+
     bool haveDebugUtils=false;
     if(useDebugUtils){
         std::string VEDU = "VK_EXT_debug_utils";
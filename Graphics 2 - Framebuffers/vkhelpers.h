@@ -21,7 +21,7 @@ class VulkanContext{
     VkFormat                    depthFormat;                /// Format of depth buffer
     VkInstance                  instance;                   /// The Vulkan instance
     bool                        haveDebugUtils;             /// True if debug utils are available
-    VkSurfaceKHR                surface;                    /// The window's surface
+    VkSurfaceKHR                surface;                    /// The window's surface (VK_NULL_HANDLE if headless)
     VkPhysicalDevice            physdev ;                   /// The Vulkan physical device
     VkPhysicalDeviceProperties  physdevProperties ;         /// properties of physical device
     VkPhysicalDeviceFeatures    physdevFeatures ;           /// features of physical device
@@ -30,20 +30,27 @@ class VulkanContext{
     VkQueue                     presentQueue;               /// The present queue
     std::uint32_t               graphicsQueueIndex;         /// Index of the graphics queue
     std::uint32_t               presentQueueIndex;          /// Index of the present queue
+    VkQueue                     transferQueue;              /// Queue for uploads: a dedicated transfer queue if there is one, else the graphics queue
+    std::uint32_t               transferQueueIndex;         /// Index of the transfer queue (equals graphicsQueueIndex if there is no dedicated one)
     VkDevice                    dev;                        /// The Vulkan logical device
-    VkSwapchainKHR              swapchain;                  /// The swapchain
+    VkSwapchainKHR              swapchain;                  /// The swapchain (VK_NULL_HANDLE if headless)
     std::vector<VkImage>        swapchainImages;            /// The swapchain's images
-    int                         numSwapchainImages;         /// length of swapchainImages (convenience variable)
+    int                         numSwapchainImages;         /// length of swapchainImages (convenience variable); framesInFlight if headless
     std::vector<VkImageView>    swapchainImageViews;        /// The swapchain image views
     std::vector<VkImage>        depthbufferImages;          /// The depth buffers, one per swapchain image
     std::vector<VkDeviceMemory> depthbufferMemories;        /// Memory for depth buffer images
     std::vector<VkImageView>    depthbufferViews;           /// The depth buffers, one per swapchain image
     std::vector<VkFramebuffer>  framebuffers;               /// List of framebuffers, one per swapchain image
     VkCommandPool               commandPool;                /// A command pool suitable for creating one-time command buffers
-    VkSemaphore                 imageAcquiredSemaphore;     /// Semaphore for signaling when the frame's image has been acquired
-    VkSemaphore                 renderCompleteSemaphore;    /// Semaphore for signaling when the frame's image has been rendered
+    int                         framesInFlight;             /// Maximum number of frames the CPU may run ahead of the GPU (config.ini: framesInFlight)
+    std::vector<VkSemaphore>    imageAcquiredSemaphores;    /// Per frame slot: signaled when the frame's image has been acquired
+    std::vector<VkSemaphore>    renderCompleteSemaphores;   /// Per frame slot: signaled when the frame's image has been rendered
     VkRenderPass                renderPass;                 /// Generic renderpass
     VkDebugUtilsMessengerEXT    messenger;
+    bool                        headless;                   /// True if there is no window: no surface or swapchain is created and frames are never presented
+    bool                        haveTimelineSemaphores;     /// True if VK_KHR_timeline_semaphore is enabled (config.ini: timelineSemaphore)
+    bool                        haveDescriptorIndexing;     /// True if VK_EXT_descriptor_indexing is enabled with the features that bindless textures need (config.ini: bindlessTextures)
+    bool                        haveDescriptorUpdateTemplates;  /// True if VK_KHR_descriptor_update_template is enabled (config.ini: descriptorUpdateTemplates)
 
 
 
@@ -53,6 +60,17 @@ class VulkanContext{
     /// @param numSubpasses The number of subpasses for rendering. Usually set to 1.
     VulkanContext(SDL_Window* win, VkPhysicalDeviceFeatures featuresToEnable,int numSubpasses);
 
+    /// Constructor for a headless VulkanContext: There is no window,
+    /// surface, or swapchain. numSwapchainImages is set to framesInFlight
+    /// so offscreen Framebuffers work as usual, but there are no
+    /// swapchainImages or default framebuffers; render to an
+    /// offscreen Framebuffer instead.
+    /// @param width The width of the (virtual) window
+    /// @param height The height of the (virtual) window
+    /// @param featuresToEnable Optional features to enable
+    /// @param numSubpasses The number of subpasses for rendering. Usually set to 1.
+    VulkanContext(int width, int height, VkPhysicalDeviceFeatures featuresToEnable,int numSubpasses);
+
     /// Generate a screenshot
     /// @param imageIndex The current swapchain image that is being displayed
     /// @return A tuple: width, height, format ("RGBA"), and the pixel data.
@@ -237,6 +255,7 @@ class VulkanContext{
 
 
     /// Add a region (ex: for RenderDoc debugging) to the command buffer.
+    /// If the GPUProfiler is enabled, the region is also timed.
     /// You must call endCmdRegion to close the region.
     /// @param cmd The command queue
     /// @param text The label to insert
@@ -266,6 +285,7 @@ class VulkanContext{
     std::vector<char> loadShaderFromString(std::string data, std::string stage);
 
   private:
+    void initialize(SDL_Window* win, int width, int height, VkPhysicalDeviceFeatures featuresToEnable, int numSubpasses);
     std::vector<char> loadShaderHelper(std::string filename, bool fromFile, std::string stage);
     VkCommandBuffer             _privateCmdBuffer;          //command buffer for private use
 };